@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Call Graph Store
+ * ================
+ *
+ * Records of calls from each source to each destination, along with a shadow of the
+ * target's call stack, for orbprofile and orbstat. Neither the calls nor the stack
+ * allocate anything once they've grown to cover what the target does.
+ *
+ */
+
+#ifndef _CALL_GRAPH_H_
+#define _CALL_GRAPH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct execEntryHash;
+
+/* Signature for a source/dest calling pair */
+struct subcallSig
+{
+    uint32_t src;                       /* Where the call is from */
+    uint32_t dst;                       /* Where the call is to */
+};
+
+/* Processed subcalls from routine to routine */
+struct subcall
+{
+    struct subcallSig sig;              /* Calling and called side record, forming an index entry */
+
+    struct execEntryHash *srch;         /* Calling side */
+    struct execEntryHash *dsth;         /* Called side */
+
+    /* Housekeeping */
+    uint64_t myCost;                    /* Inclusive cost of this call */
+    uint64_t count;                     /* Number of executions of this call */
+    uint64_t inTicks;
+    uint64_t snapCost;                  /* Cost at the last snapshot */
+    uint64_t snapCount;                 /* Executions at the last snapshot */
+};
+
+/* Entry on the shadow call stack */
+struct subcallAccount
+{
+    struct subcall *s;                  /* The call that was made */
+    uint64_t inTicks;                   /* When it was made */
+    bool tailChained;
+};
+
+struct callGraph
+{
+    struct subcall **slot;              /* Open addressed index of the calls, NULL if empty */
+    uint32_t slots;                     /* ...number of slots, a power of 2 */
+    struct subcall **block;             /* The calls, in blocks so they never move once made */
+    uint32_t blocks;                    /* ...how many blocks there are */
+    uint32_t count;                     /* ...and how many calls are in them */
+};
+
+struct callStack
+{
+    struct subcallAccount *e;           /* The entries, grown as needed but never shrunk */
+    uint32_t depth;                     /* Current depth of the stack */
+    uint32_t alloc;                     /* ...and how deep it can get before it's grown */
+};
+
+#define CALL_GRAPH_BLOCK_LEN (1024)     /* Calls per block of the call graph */
+
+// ====================================================================================================
+struct subcall *CallGraphFind( struct callGraph *g, uint32_t src, uint32_t dst );
+struct subcall *CallGraphFindOrCreate( struct callGraph *g, uint32_t src, uint32_t dst, bool *created );
+void CallGraphDelete( struct callGraph *g );
+
+struct subcallAccount *CallStackGrow( struct callStack *s );
+void CallStackDelete( struct callStack *s );
+// ====================================================================================================
+static inline uint32_t CallGraphCount( struct callGraph *g )
+
+{
+    return g->count;
+}
+// ====================================================================================================
+static inline struct subcall *CallGraphGet( struct callGraph *g, uint32_t i )
+
+/* Get the i'th call recorded, in the order they were first seen */
+
+{
+    return &g->block[i / CALL_GRAPH_BLOCK_LEN][i % CALL_GRAPH_BLOCK_LEN];
+}
+// ====================================================================================================
+static inline struct subcallAccount *CallStackPush( struct callStack *s )
+
+/* Make a new entry on top of the stack, for the caller to fill in */
+
+{
+    return ( s->depth < s->alloc ) ? &s->e[s->depth++] : CallStackGrow( s );
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Capture File Format
+ * ===================
+ *
+ * An indexed capture file is a file header followed by a sequence of chunks, each with a
+ * small header of its own. Data chunks carry a run of the raw received stream along with the
+ * host time it arrived, its offset in the stream and whether the TPIU decoder was synced at
+ * its start. Every so often an index chunk lists the data chunks since the one before it, and
+ * each index chunk points back to its predecessor. A file that was closed cleanly ends with a
+ * trailer pointing at the last index chunk, so readers can find any time or offset without
+ * replaying what comes before. Files that weren't closed cleanly can still be read, and are
+ * searched by hopping from chunk header to chunk header instead.
+ *
+ * All values are in host byte order.
+ *
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_MAGIC          "ORBCAP\r\n"  /* Start of every capture file */
+#define CAPTURE_MAGIC_LEN      (8)
+#define CAPTURE_VERSION        (1)
+
+#define CAPTURE_CHUNK_MAGIC    (0x4b48434f)  /* 'OCHK', start of every chunk */
+#define CAPTURE_TRAILER_MAGIC  (0x4c52544f)  /* 'OTRL', start of the trailer */
+
+#define CAPTURE_CHUNK_LEN      (64*1024)     /* Most data held in any one chunk */
+#define CAPTURE_CHUNK_US       (100000)      /* Longest time covered by any one chunk */
+#define CAPTURE_INDEX_CHUNKS   (64)          /* Data chunks between each index chunk */
+
+enum captureChunkType { CAPTURE_CHUNK_DATA = 1, CAPTURE_CHUNK_INDEX = 2 };
+
+#define CAPTURE_FLAG_TPIU_SYNCED  (1<<0)     /* TPIU decoder in sync at the start of this chunk */
+
+enum captureCompression { CAPTURE_COMPRESS_NONE = 0 };
+
+struct captureFileHeader
+{
+    char magic[CAPTURE_MAGIC_LEN];      /* CAPTURE_MAGIC */
+    uint32_t version;                   /* CAPTURE_VERSION */
+    uint32_t flags;                     /* None defined yet */
+    uint64_t created;                   /* Host time the capture started, uS since the epoch */
+    uint64_t reserved;
+};
+
+struct captureChunk
+{
+    uint32_t magic;                     /* CAPTURE_CHUNK_MAGIC */
+    uint8_t type;                       /* enum captureChunkType */
+    uint8_t flags;                      /* CAPTURE_FLAG_xxx */
+    uint8_t compression;                /* enum captureCompression, for the payload */
+    uint8_t reserved;
+    uint32_t len;                       /* Length of the payload following this header */
+    uint32_t reserved2;
+    uint64_t tstamp;                    /* Data: Host time of first byte. Index: time it was written */
+    uint64_t offset;                    /* Data: Stream offset of first byte. Index: position of previous index, or 0 */
+};
+
+/* Payload of an index chunk is an array of these, one per data chunk it covers */
+struct captureIndexEntry
+{
+    uint64_t tstamp;                    /* Host time of the first byte of the chunk */
+    uint64_t offset;                    /* Stream offset of the first byte of the chunk */
+    uint64_t pos;                       /* Position of the chunk header in the file */
+};
+
+struct captureTrailer
+{
+    uint32_t magic;                     /* CAPTURE_TRAILER_MAGIC */
+    uint32_t reserved;
+    uint64_t lastIndex;                 /* Position of the last index chunk, or 0 if there isn't one */
+};
+
+struct captureWriter
+{
+    int fd;                             /* File being written */
+    uint64_t pos;                       /* Current position in it */
+    uint64_t offset;                    /* Stream bytes written so far */
+    uint64_t lastIndex;                 /* Position of the last index chunk written */
+
+    uint8_t *buffer;                    /* Chunk being assembled, header first */
+    uint32_t fill;                      /* ...payload bytes in it */
+    uint64_t chunkTstamp;               /* ...time of its first byte */
+    bool chunkSynced;                   /* ...and TPIU state at that point */
+
+    struct captureIndexEntry index[CAPTURE_INDEX_CHUNKS]; /* Chunks written since the last index */
+    uint32_t indexCount;
+};
+
+// ====================================================================================================
+bool CaptureWriterOpen( struct captureWriter *w, const char *filename );
+bool CaptureWrite( struct captureWriter *w, const uint8_t *buffer, size_t len, bool tpiuSynced );
+bool CaptureWriterClose( struct captureWriter *w );
+
+bool CaptureIsCapture( const uint8_t *buffer, size_t len );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
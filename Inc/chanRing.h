@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel Ring
+ * ============
+ *
+ * A channel published as a ring of bytes in a shared memory mapped file. There is one writer,
+ * which never waits for anyone, and any number of readers, each of which keeps its own place in
+ * the ring and reads straight out of the mapping. A reader that falls more than a ring's worth
+ * behind has lost data, and finds that out when it next reads; nothing the writer does depends on
+ * its readers at all.
+ *
+ * The writer says how far it's about to write before it writes it (head), and how far it has
+ * written once it's done (wp). Data between wp - size and wp is valid until head moves past it,
+ * so a reader checks head after it's used the data to know that it wasn't overwritten meanwhile.
+ *
+ * On Linux readers sleep on a futex in the header when there's nothing for them, and are woken
+ * by the writer. Elsewhere they poll.
+ *
+ */
+
+#ifndef _CHAN_RING_H_
+#define _CHAN_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHANRING_MAGIC        (0x474e5243)  /* 'CRNG', start of every ring file */
+#define CHANRING_VERSION      (1)
+#define CHANRING_HEADER_LEN   (4096)        /* Data starts this far into the file */
+
+/* The start of the ring file, shared between the writer and all of its readers */
+struct chanRingHeader
+{
+    uint32_t magic;                     /* CHANRING_MAGIC */
+    uint32_t version;                   /* CHANRING_VERSION */
+    uint32_t size;                      /* Length of the data area, a power of 2 */
+    uint32_t reserved;
+
+    uint64_t head __attribute__( ( aligned( 64 ) ) ); /* Bytes ever written, or about to be */
+    uint64_t wp;                        /* Bytes ever written */
+    uint32_t seq;                       /* Bumped each time data is added, readers wait on it */
+    uint32_t waiters;                   /* Readers waiting on seq */
+};
+
+struct chanRingWriter
+{
+    int fd;
+    struct chanRingHeader *h;           /* Mapping of the ring file */
+    uint8_t *data;                      /* ...and the data area in it */
+    size_t mapLen;
+};
+
+struct chanRingReader
+{
+    int fd;
+    struct chanRingHeader *h;           /* Mapping of the ring file */
+    const uint8_t *data;                /* ...and the data area in it */
+    size_t mapLen;
+    uint64_t rp;                        /* Next byte to be read */
+    uint64_t lost;                      /* Bytes lost through falling behind the writer */
+};
+
+// ====================================================================================================
+/* Writer side */
+bool ChanRingCreate( struct chanRingWriter *w, const char *path, uint32_t size );
+void ChanRingWrite( struct chanRingWriter *w, const void *buffer, uint32_t len );
+void ChanRingDestroy( struct chanRingWriter *w );
+
+/* Reader side */
+bool ChanRingOpen( struct chanRingReader *r, const char *path );
+ssize_t ChanRingRead( struct chanRingReader *r, void *buffer, size_t len, int timeoutMs );
+const uint8_t *ChanRingPeek( struct chanRingReader *r, uint32_t *len, int timeoutMs );
+bool ChanRingConsume( struct chanRingReader *r, uint32_t len );
+void ChanRingClose( struct chanRingReader *r );
+
+/* ...and for a channel published as a UNIX socket, which delivers whole messages per read */
+int ChanSocketOpen( const char *path );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Native ELF symbol and DWARF line table reader
+ * =============================================
+ *
+ * Reads function symbols from .symtab and the line number program from .debug_line directly,
+ * for when we only need to map addresses to functions and lines and don't need objdump.
+ *
+ */
+
+#ifndef _ELF_DWARF_H_
+#define _ELF_DWARF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Called for each function symbol in the elf */
+typedef void ( *ElfDwarfFunctionCB )( void *ctx, const char *name, uint32_t addr, uint32_t size, bool isGlobal );
+
+/* Called for each row of the line table, in order. endSequence marks the first address after a run of rows. */
+/* May be NULL if only the functions are wanted, in which case no debug information is needed */
+typedef void ( *ElfDwarfLineCB )( void *ctx, const char *file, uint32_t line, uint32_t addr, bool endSequence );
+
+// ====================================================================================================
+bool ElfDwarfLoad( const char *filename, ElfDwarfFunctionCB fnCB, ElfDwarfLineCB lineCB, void *ctx );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+
+#endif
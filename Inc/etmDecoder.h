@@ -11,6 +11,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include "generics.h"
 
 #ifdef __cplusplus
@@ -133,6 +134,7 @@ struct ETMDecoder
     uint8_t contextBytes;                /* How many context bytes we're using */
     bool cycleAccurate;                  /* Using cycle accurate mode */
     bool dataOnlyMode;                   /* If we're only tracing data, not instructions */
+    bool batchAtoms;                     /* Report runs of atoms with a single callback */
 
     /* Purely internal matters.... */
     /* --------------------------- */
@@ -170,8 +172,10 @@ ALWAYS_INLINE bool ETMStateChanged( struct ETMDecoder *i, enum ETMchanges c )
 struct ETMDecoderStats *ETMDecoderGetStats( struct ETMDecoder *i );
 
 void ETMDecodeUsingAltAddrEncode( struct ETMDecoder *i, bool usingAltAddrEncodeSet );
+void ETMDecoderBatchAtoms( struct ETMDecoder *i, bool batchAtomsSet );
 
-void ETMDecoderPump( struct ETMDecoder *i, uint8_t *buf, int len, etmDecodeCB cb, genericsReportCB report, void *d );
+void ETMDecoderPump( struct ETMDecoder *i, const uint8_t *buf, int len, etmDecodeCB cb, genericsReportCB report, void *d );
+size_t ETMDecoderFindSync( const uint8_t *buf, size_t len, size_t from );
 
 void ETMDecoderInit( struct ETMDecoder *i, bool usingAltAddrEncodeSet );
 // ====================================================================================================
@@ -15,6 +15,7 @@
 
 #include "uthash.h"
 #include "symbols.h"
+#include "callGraph.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,8 @@ struct execEntryHash
     /* Counter at assembly and source line levels */
     uint64_t count;                      /* Instruction level count */
     uint64_t scount;                     /* Source level count (applied to first instruction of a new source line) */
+    uint64_t snapCount;                  /* Instruction level count at the last snapshot */
+    uint64_t snapScount;                 /* Source level count at the last snapshot */
 
     /* Details about this instruction */
     bool     isJump;                     /* Flag if this is a jump instruction */
@@ -50,42 +53,10 @@ struct execEntryHash
 };
 
 
-/* Signature for a source/dest calling pair */
-struct subcallSig
-{
-    uint32_t src;                       /* Where the call is from */
-    uint32_t dst;                       /* Where the call is to */
-};
-
-struct subcallAccount
-{
-    struct subcallSig sig;
-    uint64_t inTicks;
-    bool tailChained;
-};
-
-/* Processed subcalls from routine to routine */
-struct subcall
-{
-    struct subcallSig sig;              /* Calling and called side record, forming an index entry */
-
-    struct execEntryHash *srch;         /* Calling side */
-    struct execEntryHash *dsth;         /* Called side */
-
-    /* Housekeeping */
-    uint64_t myCost;                   /* Inclusive cost of this call */
-    uint64_t count;                    /* Number of executions of this call */
-    uint64_t inTicks;
-
-    /* Hash handle to make construct hashable */
-    UT_hash_handle hh;
-};
-
-
 // ====================================================================================================
-bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss );
+bool ext_ff_outputDot( char *dotfile, struct callGraph *calls, struct SymbolSet *ss );
 bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
-                           struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss );
+                           struct execEntryHash *insthead, struct callGraph *calls, struct SymbolSet *ss );
 // ====================================================================================================
 
 #ifdef __cplusplus
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * File Source
+ * ===========
+ *
+ * Input from a capture file for the offline tools. Regular files are mapped into memory
+ * and handed out in whole spans, so the decoders can run straight over them without any
+ * copying. Anything that can't be mapped (pipes, fifos, character devices) is read into
+ * an internal buffer instead, with the same interface.
+ *
+ * Indexed capture files (see capture.h) are recognised by their header, and only the data
+ * they carry is handed out. They can also be started from a given time as well as from a
+ * given offset in the stream.
+ *
+ */
+
+#ifndef _FILE_SOURCE_H_
+#define _FILE_SOURCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fileSource
+{
+    int fd;                             /* The file itself */
+    bool mapped;                        /* If it's been mapped, rather than being read */
+    const uint8_t *map;                 /* Where it's mapped to */
+    size_t len;                         /* Length of the mapping */
+    size_t pos;                         /* Position of the next byte to be handed out */
+    uint8_t *buffer;                    /* Buffer for when the file can't be mapped */
+    uint32_t pending;                   /* ...bytes in it read while finding what the file is, from pos */
+
+    bool detected;                      /* If it's known yet whether this is a capture file */
+    bool capture;                       /* It's an indexed capture file */
+    uint64_t created;                   /* ...when the capture was started */
+    uint64_t remain;                    /* ...data left in the current chunk */
+    uint64_t offset;                    /* Stream offset of the next byte to be handed out */
+    uint64_t tstamp;                    /* ...and host time the chunk it's in arrived, uS since the epoch */
+};
+
+// ====================================================================================================
+bool FileSourceOpen( struct fileSource *f, const char *filename );
+ssize_t FileSourceGet( struct fileSource *f, const uint8_t **data, size_t maxLen );
+const uint8_t *FileSourceMap( struct fileSource *f, size_t *len );
+void FileSourceRewind( struct fileSource *f );
+bool FileSourceSeekOffset( struct fileSource *f, uint64_t offset );
+bool FileSourceSeekTime( struct fileSource *f, uint64_t tstamp );
+bool FileSourceSeek( struct fileSource *f, const char *where );
+void FileSourceClose( struct fileSource *f );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
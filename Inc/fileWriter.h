@@ -16,8 +16,17 @@
 #include "fileWriterProtocol.h"
 #include "msgDecoder.h"
 
+/* When written files are forced out to storage */
+enum fwSync
+{
+    FW_SYNC_NONE,                       /* Whenever the OS gets round to it */
+    FW_SYNC_CLOSE,                      /* When the target closes the file */
+    FW_SYNC_ALWAYS                      /* Every time written data are flushed to the file */
+};
+
 // ====================================================================================================
 bool filewriterProcess( struct swMsg *m );
-bool filewriterInit( char *basedir );
+bool filewriterInit( char *basedir, enum fwSync sync );
+void filewriterShutdown( void );
 // ====================================================================================================
 #endif
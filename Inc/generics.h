@@ -76,6 +76,24 @@ const char *genericsBasenameN( const char *n, int c );
 void genericsReport( enum verbLevel l, const char *fmt, ... );
 void genericsExit( int status, const char *fmt, ... );
 // ====================================================================================================
+/* Trace logging, for high volume diagnostics out of decode paths. It's off unless a level is set */
+/* and then all it costs is the level check in GTRACE, so nothing is formatted or indented.       */
+enum traceLevel {T_OFF, T_FLOW, T_CALLS, T_DETAIL, T_MAX_TRACELEVEL};
+
+extern enum traceLevel genericsTraceLevel;
+
+bool genericsTraceSetup( enum traceLevel l, const char *filename );
+void genericsTrace( uint32_t indent, const char *fmt, ... );
+void genericsTraceFlush( void );
+
+static inline bool genericsTraceOn( enum traceLevel l )
+
+{
+    return ( l <= genericsTraceLevel );
+}
+
+#define GTRACE(l, indent, ...) do { if ( genericsTraceOn( l ) ) genericsTrace( indent, __VA_ARGS__ ); } while ( 0 )
+// ====================================================================================================
 #ifdef __cplusplus
 }
 #endif
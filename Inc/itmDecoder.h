@@ -14,6 +14,7 @@
 
 #define ITM_MAX_PACKET  (14) // This length can only happen for a timestamp or some SYNC packets
 #define ITM_DATA_PACKET (4)  // This is the maximum length of everything else
+#define ITM_DECODE_BATCH (64) // Suggested number of messages to collect per call to ITMDecodeBuffer
 
 #ifdef __cplusplus
 extern "C" {
@@ -96,7 +97,9 @@ struct ITMPacket
 };
 
 /* Time conditions of a TS message */
-enum timeDelay {TIME_CURRENT, TIME_DELAYED, EVENT_DELAYED, EVENT_AND_TIME_DELAYED};
+enum timeDelay {TIME_CURRENT, TIME_DELAYED, EVENT_DELAYED, EVENT_AND_TIME_DELAYED,
+                TIME_UNKNOWN   /* Not from the target; no timestamp has covered the event yet */
+               };
 
 /* ITM Decoder statistics */
 struct ITMDecoderStats
@@ -140,6 +143,7 @@ bool ITMGetPacket( struct ITMDecoder *i, struct ITMPacket *p );
 bool ITMGetDecodedPacket( struct ITMDecoder *i, struct msg *decoded );
 
 enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c );
+uint32_t ITMDecodeBuffer( struct ITMDecoder *i, const uint8_t *buffer, uint32_t len, struct msg *m, uint32_t maxMsgs, uint32_t *consumed );
 
 void ITMDecoderInit( struct ITMDecoder *i, bool startSynced );
 // ====================================================================================================
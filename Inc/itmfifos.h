@@ -11,6 +11,7 @@
 
 #include "tpiuDecoder.h"
 #include "itmDecoder.h"
+#include "fileWriter.h"
 
 #include "generics.h"
 
@@ -26,9 +27,18 @@ extern "C" {
 struct Channel;
 struct itmfifosHandle;
 
+/* What the channels are published as */
+enum itmfifoOutput
+{
+    ITMFIFO_OUTPUT_FIFO,                     /* Named fifos, which wait for a reader */
+    ITMFIFO_OUTPUT_PERMAFILE,                /* Permanent files */
+    ITMFIFO_OUTPUT_SHM,                      /* Shared memory rings, see chanRing.h */
+    ITMFIFO_OUTPUT_SOCKET                    /* UNIX sequenced packet sockets, for any number of readers */
+};
+
 /* Fifos running */
 void itmfifoForceSync( struct itmfifosHandle *f, bool synced );                  /* Force sync status */
-void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t c );                 /* Send undecoded data to the fifo */
+void itmfifoProtocolPump( struct itmfifosHandle *f, const uint8_t *c, uint32_t len ); /* Send undecoded data to the fifo */
 
 /* Getters and setters */
 void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s );
@@ -45,9 +55,11 @@ struct ITMDecoderStats *itmfifoGetITMDecoderStats( struct itmfifosHandle *f );
 bool itmfifoGetForceITMSync( struct itmfifosHandle *f );
 int itmfifoGettpiuITMChannel( struct itmfifosHandle *f );
 void itmfifoUsePermafiles( struct itmfifosHandle *f, bool usePermafilesSet );
+void itmfifoSetOutput( struct itmfifosHandle *f, enum itmfifoOutput o );
+enum itmfifoOutput itmfifoGetOutput( struct itmfifosHandle *f );
 
 /* Filewriting */
-void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath );
+void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath, enum fwSync sync );
 
 /* Fifos management */
 bool itmfifoCreate( struct itmfifosHandle *f );                                  /* Create the fifo set */
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Mirror Ring
+ * ===========
+ *
+ * A ring of bytes that's mapped twice, one copy straight after the other, so that anything of up
+ * to the full length of the ring starting anywhere in it can be read or written as one contiguous
+ * span, with no wraparound to deal with. The length is a power of 2, so positions are just counts
+ * of bytes ever written that are masked down.
+ *
+ * The ring lives in a file (anonymous unless one is given) with a header holding the positions.
+ * When a file is given it's left behind, so whatever was in the ring when the process went away,
+ * however that happened, can be picked up again by opening the same file.
+ *
+ */
+
+#ifndef _MIRROR_RING_H_
+#define _MIRROR_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MIRRORRING_MAGIC      (0x524d524f)  /* 'ORMR', start of every ring file */
+#define MIRRORRING_VERSION    (1)
+#define MIRRORRING_HEADER_LEN (65536)       /* Data starts this far into the file, enough for any page size */
+
+/* The start of the ring file */
+struct mirrorRingHeader
+{
+    uint32_t magic;                     /* MIRRORRING_MAGIC */
+    uint32_t version;                   /* MIRRORRING_VERSION */
+    uint64_t size;                      /* Length of the data area, a power of 2 */
+    uint64_t wp;                        /* Bytes ever written */
+    uint64_t rp;                        /* ...and the first of them still held */
+};
+
+struct mirrorRing
+{
+    int fd;
+    struct mirrorRingHeader *h;         /* Mapping of the header */
+    uint8_t *data;                      /* ...and of the data, twice over */
+    uint64_t size;                      /* Length of the data */
+};
+
+// ====================================================================================================
+bool MirrorRingCreate( struct mirrorRing *m, uint64_t size, const char *file, bool *reopened );
+uint64_t MirrorRingPut( struct mirrorRing *m, const uint8_t *buffer, uint64_t len, bool keepOldest );
+void MirrorRingDestroy( struct mirrorRing *m );
+
+// ====================================================================================================
+static inline uint64_t MirrorRingLevel( const struct mirrorRing *m )
+
+/* Number of bytes held */
+
+{
+    return m->h->wp - m->h->rp;
+}
+// ====================================================================================================
+static inline const uint8_t *MirrorRingSpan( const struct mirrorRing *m, uint64_t ofs )
+
+/* The held data from ofs bytes past the oldest, contiguous for as many bytes as are held after it */
+
+{
+    return &m->data[( m->h->rp + ofs ) & ( m->size - 1 )];
+}
+// ====================================================================================================
+static inline uint64_t MirrorRingWritten( const struct mirrorRing *m )
+
+/* Number of bytes ever put in */
+
+{
+    return m->h->wp;
+}
+// ====================================================================================================
+static inline void MirrorRingDrop( struct mirrorRing *m, uint64_t len )
+
+/* Forget the oldest len bytes held */
+
+{
+    m->h->rp += ( len < MirrorRingLevel( m ) ) ? len : MirrorRingLevel( m );
+}
+// ====================================================================================================
+static inline void MirrorRingEmpty( struct mirrorRing *m )
+
+/* Forget everything held */
+
+{
+    m->h->rp = m->h->wp;
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
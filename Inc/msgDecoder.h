@@ -133,6 +133,11 @@ struct msg
         struct excMsg excMsg;
         struct pcSampleMsg pcSampleMsg;
     };
+
+    /* ...and when it happened, filled in by the sequencer for messages that go through one */
+    uint64_t targetTime;                /* Target time in timestamp ticks, extended to 64 bits */
+    uint64_t hostTime;                  /* ...the host time (uS) that corresponds to, 0 if not correlated */
+    uint8_t timeStatus;                 /* ...and how good targetTime is (enum timeDelay) */
 };
 
 struct ITMPacket;
@@ -7,6 +7,15 @@
  * Sequencer for re-ordering messages from the ITM according to prioritize
  * timestamp information in the flow.
  *
+ * A local timestamp follows the messages it applies to, so messages are held until one turns up
+ * and then released behind it. As they're released each is given the target time it happened at,
+ * which is the running total of the local timestamps extended to 64 bits, so anything downstream
+ * can merge, window or sort them without keeping its own time. Optionally that's correlated with
+ * host time too, either from a known timestamp clock rate or from one estimated as the trace runs.
+ *
+ * When no timestamp turns up before the buffer fills it can be flushed (the messages come out with
+ * a timeStatus of TIME_UNKNOWN and the last known time), grown, or have the oldest messages dropped.
+ *
  * Spec at https://static.docs.arm.com/ddi0403/e/DDI0403E_B_armv7m_arm.pdf
  */
 
@@ -24,6 +33,14 @@
 extern "C" {
 #endif
 
+/* What to do when the buffer fills before a timestamp arrives */
+enum MSGSeqOverflow
+{
+    MSGSEQ_OVF_FLUSH,        /* Release everything, without a time */
+    MSGSEQ_OVF_GROW,         /* Grow the buffer up to a limit, then flush */
+    MSGSEQ_OVF_DROP          /* Drop the oldest message */
+};
+
 struct MSGSeq
 
 {
@@ -35,14 +52,35 @@ struct MSGSeq
     bool releaseTimeMsg;     /* Indicator to release msg at head of queue */
 
     struct msg *pbuffer;     /* The buffer */
+
+    enum MSGSeqOverflow overflow; /* What to do when the buffer fills */
+    uint32_t maxEntries;     /* Largest the buffer can grow to */
+    uint64_t flushed;        /* Times the buffer has been emptied without a timestamp */
+    uint64_t dropped;        /* Messages thrown away to make room */
+
+    uint64_t time;           /* Target time, the total of all timestamps so far */
+    uint8_t timeStatus;      /* ...how good it is */
+    bool stamped;            /* Messages being released are covered by a timestamp */
+
+    bool correlate;          /* Work out host times for messages */
+    uint64_t tickHz;         /* Timestamp clock rate, 0 to estimate it */
+    double ticksPerUs;       /* ...the rate in use, 0 until it's known */
+    bool anchored;           /* The first timestamp has been seen */
+    uint64_t anchorTime;     /* ...its target time */
+    uint64_t anchorHost;     /* ...and the host time it arrived */
+    uint64_t lastHost;       /* Host time the latest timestamp arrived */
 };
 
 // ====================================================================================================
 
 void MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries );
+void MSGSeqSetOverflow( struct MSGSeq *d, enum MSGSeqOverflow overflow, uint32_t maxEntries );
+void MSGSeqSetCorrelation( struct MSGSeq *d, bool correlate, uint64_t tickHz );
+void MSGSeqDestroy( struct MSGSeq *d );
 struct msg *MSGSeqGetPacket( struct MSGSeq *d );
 
 bool MSGSeqPump( struct MSGSeq *d, uint8_t c );
+bool MSGSeqPumpBuffer( struct MSGSeq *d, const uint8_t *buffer, uint32_t len, uint32_t *consumed );
 
 // ====================================================================================================
 #ifdef __cplusplus
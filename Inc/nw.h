@@ -20,6 +20,77 @@ extern "C" {
 #define NWCLIENT_SERVER_PORT (3443)           /* Server port definition */
 #define TRANSFER_SIZE (256000)
 
+/* A client carrying ITM can ask the server, at any time after it connects, to only send it some of */
+/* it. Until it does, and for servers that don't understand, it gets everything. The subscription is */
+/* NW_SUBSCRIBE_LEN bytes, all values little endian;                                                 */
+/*                                                                                                    */
+/*   u32 NW_SUBSCRIBE_MAGIC, u8 NW_SUBSCRIBE_VERSION, u8[3] reserved (0)                              */
+/*   u32 stimulus ports wanted for software messages (bit per port)                                   */
+/*   u32 message types wanted (bit per enum MSGType), or 0 to go back to getting everything           */
+
+#define NW_SUBSCRIBE_MAGIC   (0x4255534f)     /* 'OSUB' */
+#define NW_SUBSCRIBE_VERSION (1)
+#define NW_SUBSCRIBE_LEN     (16)
+
+// ====================================================================================================
+static inline uint32_t nwSubscribeBuild( uint8_t *b, uint32_t channels, uint32_t msgTypes )
+
+/* Fill in a subscription, returning its length */
+
+{
+    const uint32_t v[3] = { NW_SUBSCRIBE_MAGIC, NW_SUBSCRIBE_VERSION, channels };
+
+    for ( uint32_t i = 0; i < NW_SUBSCRIBE_LEN; i++ )
+    {
+        b[i] = ( ( ( i < 12 ) ? v[i / 4] : msgTypes ) >> ( 8 * ( i % 4 ) ) ) & 0xff;
+    }
+
+    return NW_SUBSCRIBE_LEN;
+}
+// ====================================================================================================
+
+/* A client can also ask, at any time, for what it's sent to be compressed. The request is             */
+/* NW_COMPRESS_LEN bytes, all values little endian;                                                    */
+/*                                                                                                      */
+/*   u32 NW_COMPRESS_MAGIC, u8 NW_COMPRESS_VERSION, u8 codec (enum nwCodec), u8[2] reserved (0)         */
+/*   u64 nonce, anything the client likes, so that the reply can't be mistaken for trace               */
+/*                                                                                                      */
+/* At the next block boundary the server sends the same thing back, with the codec it's going to use  */
+/* (NW_CODEC_NONE if it can't). Straight after that everything comes in frames of NW_FRAME_HDR_LEN    */
+/* header followed by the payload;                                                                     */
+/*                                                                                                      */
+/*   u32 payload length, u32 length once decompressed                                                  */
+/*                                                                                                      */
+/* A payload that's the same length as it decompresses to is sent as it is. A server that doesn't      */
+/* understand never replies, and carries on sending everything as before.                              */
+
+#define NW_COMPRESS_MAGIC     (0x504d434f)    /* 'OCMP' */
+#define NW_COMPRESS_VERSION   (1)
+#define NW_COMPRESS_LEN       (16)
+#define NW_COMPRESS_CODEC_OFS (5)             /* Where the codec is, in the request and reply */
+#define NW_FRAME_HDR_LEN      (8)
+
+enum nwCodec
+{
+    NW_CODEC_NONE,                            /* Sent as it is */
+    NW_CODEC_DEFLATE                          /* Raw deflate (RFC1951), each frame on its own */
+};
+
+// ====================================================================================================
+static inline uint32_t nwCompressBuild( uint8_t *b, enum nwCodec codec, uint64_t nonce )
+
+/* Fill in a request for compression, returning its length */
+
+{
+    for ( uint32_t i = 0; i < NW_COMPRESS_LEN; i++ )
+    {
+        b[i] = ( i < 4 ) ? ( NW_COMPRESS_MAGIC >> ( 8 * i ) ) & 0xff : ( i >= 8 ) ? ( nonce >> ( 8 * ( i - 8 ) ) ) & 0xff : 0;
+    }
+
+    b[4] = NW_COMPRESS_VERSION;
+    b[NW_COMPRESS_CODEC_OFS] = codec;
+    return NW_COMPRESS_LEN;
+}
 // ====================================================================================================
 
 #ifdef __cplusplus
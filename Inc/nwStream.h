@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Network Stream
+ * ==============
+ *
+ * The client end of a connection to a server, for reading what it sends. This is just the socket
+ * unless compression has been asked for (see nw.h), in which case everything up to the server's
+ * reply is passed on as it came and everything after it is taken out of its frames.
+ *
+ * Data can be held here that has already been taken from the socket, so anything waiting on the
+ * socket before reading should check NWStreamPending first.
+ *
+ */
+
+#ifndef _NW_STREAM_H_
+#define _NW_STREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "nw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NWSTREAM_READ_LEN (TRANSFER_SIZE)     /* Most to take from the socket at once */
+
+struct nwStream
+{
+    int fd;                             /* The socket */
+    bool awaiting;                      /* Compression was asked for, and the reply hasn't come */
+    bool framed;                        /* Everything is arriving in frames */
+    uint8_t req[NW_COMPRESS_LEN];       /* What was asked for, to spot the reply by */
+
+    uint8_t *in;                        /* Data taken from the socket */
+    uint32_t inSize;                    /* ...its allocated size */
+    uint32_t inOfs;                     /* ...where the unused part starts */
+    uint32_t inLen;                     /* ...and ends */
+
+    uint8_t *out;                       /* Data ready to be read */
+    uint32_t outSize;                   /* ...its allocated size */
+    uint32_t outOfs;                    /* ...how much of it has been */
+    uint32_t outLen;                    /* ...and how much there is */
+
+    z_stream z;                         /* Decompressor */
+    bool zReady;                        /* ...and it's been set up */
+};
+
+// ====================================================================================================
+bool NWStreamInit( struct nwStream *s, int fd, bool compress );
+ssize_t NWStreamRead( struct nwStream *s, uint8_t *buffer, size_t len );
+bool NWStreamPending( const struct nwStream *s );
+void NWStreamClose( struct nwStream *s );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -16,18 +16,52 @@ extern "C" {
 #endif
 
 #include <semaphore.h>
+#include <netinet/in.h>
 #include "nw.h"
+#include "stageStats.h"
 // ====================================================================================================
 
 struct nwclientsHandle;
 
+/* What to do with a client that falls too far behind the data flow */
+enum nwclientOverrunPolicy
+{
+    NWCLIENT_OVERRUN_DROP,                 /* Skip the client forward, losing data for it */
+    NWCLIENT_OVERRUN_DISCONNECT            /* Close the connection to the client */
+};
+
+/* State of a server, as a whole */
+struct nwclientStats
+{
+    uint32_t clients;                      /* Number of clients connected */
+    uint64_t sent;                         /* Blocks offered to clients */
+    uint64_t dropped;                      /* Blocks dropped, across all clients connected or not */
+    uint64_t disconnects;                  /* Clients disconnected for being too slow */
+    uint32_t maxDepth;                     /* Most blocks queued for any client */
+    struct stageStat lockHold;             /* Time the producer holds the ring lock for, per send */
+};
+
+/* ...and of each of its clients */
+struct nwclientClientStats
+{
+    char addr[INET_ADDRSTRLEN];            /* Where it's connected from */
+    uint32_t depth;                        /* Blocks queued for it */
+    uint64_t dropped;                      /* Blocks it's had dropped */
+    bool subscribed;                       /* It's only getting what it subscribed to */
+    uint64_t filteredBytes;                /* ...and the bytes it hasn't been sent because of that */
+    bool compressed;                       /* It's being sent compressed */
+    uint64_t rawBytes;                     /* ...the bytes that have been compressed for it */
+    uint64_t wireBytes;                    /* ...and what they came to */
+};
+
 // ====================================================================================================
 
-void nwclientSend( struct nwclientsHandle *h, uint32_t len, uint8_t *buffer );
+void nwclientSend( struct nwclientsHandle *h, uint32_t len, const uint8_t *buffer );
+uint32_t nwclientGetStats( struct nwclientsHandle *h, struct nwclientStats *s, struct nwclientClientStats *c, uint32_t maxClients );
 
 void nwclientShutdown( struct nwclientsHandle *h );
 bool nwclientShutdownComplete( struct nwclientsHandle *h );
-struct nwclientsHandle *nwclientStart( int port );
+struct nwclientsHandle *nwclientStart( int port, enum nwclientOverrunPolicy policy );
 
 // ====================================================================================================
 #ifdef __cplusplus
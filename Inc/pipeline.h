@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Decode Pipeline
+ * ===============
+ *
+ * Takes the stream as it arrives from a probe or a server and runs it through whatever decoders
+ * are needed to turn it into messages, so a tool only has to say what it's interested in. The
+ * stream can go through a TPIU decoder first, with ITM taken from one of its channels and ETM
+ * from another. Without TPIU the whole stream is ITM, unless there's an ETM handler, in which
+ * case it's all ETM. ITM messages can be put back into time order by a sequencer on the way.
+ *
+ * Data are pumped in as whole buffers and go through each stage a block at a time, so the block
+ * level paths through each decoder get used by everything built on this. Handlers are registered
+ * for each message type wanted, and get the decoded message along with the context given to
+ * PipelineInit. Anything there isn't a handler for is decoded and dropped.
+ *
+ * Loss of sync and overflows are reported through genericsReport as they're seen.
+ *
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "itmDecoder.h"
+#include "tpiuDecoder.h"
+#include "etmDecoder.h"
+#include "msgDecoder.h"
+#include "msgSeq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELINE_CHUNK_LEN (65536)          /* Most TPIU input taken through the decoder at once */
+#define PIPELINE_NO_CHANNEL (0)             /* TPIU channel for a stage that isn't wanted */
+
+typedef void ( *pipelineMsgCB )( void *m, void *d );
+typedef void ( *pipelineBatchCB )( void *d );
+
+struct pipeline
+{
+    void *d;                            /* Context handed to every handler */
+
+    bool useTPIU;                       /* Input is TPIU framed */
+    uint32_t itmChannel;                /* ...the TPIU channel carrying ITM */
+    uint32_t etmChannel;                /* ...and the one carrying ETM */
+    struct TPIUDecoder t;
+    struct TPIUSpan itmSpan;            /* Output from the TPIU decoder for ITM */
+    struct TPIUSpan etmSpan;            /* ...and for ETM */
+    struct TPIUSpan *stream[TPIU_NUM_STREAMS];
+
+    struct ITMDecoder i;
+    bool sequenced;                     /* ITM messages go through the sequencer */
+    struct MSGSeq seq;
+    pipelineMsgCB msgCB[MSG_NUM_MSGS];  /* Handlers for each ITM message type */
+    pipelineBatchCB batchCB;            /* Called after each batch of ITM messages is handled */
+
+    bool etmReady;                      /* There's an ETM stage */
+    struct ETMDecoder e;
+    etmDecodeCB etmCB;                  /* ...and its handler */
+};
+
+// ====================================================================================================
+void PipelineInit( struct pipeline *p, bool forceITMSync, void *d );
+bool PipelineUseTPIU( struct pipeline *p, uint32_t itmChannel, uint32_t etmChannel );
+void PipelineSequence( struct pipeline *p, uint32_t entries, enum MSGSeqOverflow overflow, uint32_t maxEntries );
+void PipelineOnMsg( struct pipeline *p, enum MSGType type, pipelineMsgCB cb );
+void PipelineOnAllMsgs( struct pipeline *p, pipelineMsgCB cb );
+void PipelineOnBatch( struct pipeline *p, pipelineBatchCB cb );
+void PipelineOnETM( struct pipeline *p, bool usingAltAddrEncode, etmDecodeCB cb );
+void PipelinePump( struct pipeline *p, const uint8_t *buffer, uint32_t len );
+void PipelineForceSync( struct pipeline *p, bool synced );
+void PipelineDestroy( struct pipeline *p );
+
+// ====================================================================================================
+static inline struct ITMDecoder *PipelineITM( struct pipeline *p )
+
+/* The ITM decoder, for its state and stats */
+
+{
+    return &p->i;
+}
+// ====================================================================================================
+static inline struct TPIUDecoder *PipelineTPIU( struct pipeline *p )
+
+/* ...and the TPIU one */
+
+{
+    return &p->t;
+}
+// ====================================================================================================
+static inline struct ETMDecoder *PipelineETM( struct pipeline *p )
+
+/* ...and the ETM one */
+
+{
+    return &p->e;
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
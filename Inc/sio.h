@@ -24,7 +24,7 @@ extern "C" {
 struct SIOInstance;
 
 /* Events that can be returned by the handler */
-enum SIOEvent { SIO_EV_NONE, SIO_EV_HOLD, SIO_EV_QUIT, SIO_EV_SAVE, SIO_EV_CONSUMED, SIO_EV_SURFACE, SIO_EV_DIVE, SIO_EV_FOPEN };
+enum SIOEvent { SIO_EV_NONE, SIO_EV_HOLD, SIO_EV_QUIT, SIO_EV_SAVE, SIO_EV_CONSUMED, SIO_EV_SURFACE, SIO_EV_DIVE, SIO_EV_FOPEN, SIO_EV_EXTEND };
 
 /* Types of line (each with their own display mechanism & colours */
 enum LineType { LT_SOURCE, LT_ASSEMBLY, LT_NASSEMBLY, LT_MU_SOURCE, LT_EVENT, LT_LABEL, LT_FILE, LT_DEBUG  };
@@ -42,6 +42,9 @@ struct line
 const char *SIOgetSaveFilename( struct SIOInstance *sio );
 int32_t SIOgetCurrentLineno( struct SIOInstance *sio );
 void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t currentLine, struct line **opTextSet, bool amDiving );
+void SIOsetMoreAbove( struct SIOInstance *sio, bool moreAbove );
+void SIOprependedOutput( struct SIOInstance *sio, int32_t numLines, int32_t added );
+void SIOsetProgress( struct SIOInstance *sio, const char *what, int32_t percent );
 void SIOalert( struct SIOInstance *sio, const char *msg );
 void SIOrequestRefresh( struct SIOInstance *sio );
 void SIOheld( struct SIOInstance *sio, bool isHeld );
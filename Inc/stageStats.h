@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Stage Statistics
+ * ================
+ *
+ * Cheap timing of the stages that data passes through, kept as a count, total and maximum along
+ * with a histogram of log2 nanosecond buckets. Each stage is only ever updated from one thread and
+ * its counts only ever go up, so another thread can get a good enough view of it without locking
+ * by taking the difference between two looks at it.
+ *
+ */
+
+#ifndef _STAGE_STATS_H_
+#define _STAGE_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STAGE_BUCKETS (32)              /* Bucket n covers 2^n..2^(n+1)-1 ns, so up to about 4s */
+
+struct stageStat
+{
+    uint64_t count;                     /* Number of times through the stage */
+    uint64_t totalNs;                   /* ...total time taken */
+    uint64_t maxNs;                     /* ...longest time taken */
+    uint64_t units;                     /* ...and work done, in whatever units suit the stage (e.g. bytes) */
+    uint64_t bucket[STAGE_BUCKETS];     /* Histogram of times taken */
+};
+
+// ====================================================================================================
+static inline uint64_t StageNow( void )
+
+/* Time to measure stages from, in ns */
+
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+// ====================================================================================================
+static inline void StageRecord( struct stageStat *s, uint64_t start, uint64_t units )
+
+/* Account for a trip through a stage that started at the given time */
+
+{
+    uint64_t ns = StageNow() - start;
+    uint32_t b = ns ? 63 - __builtin_clzll( ns ) : 0;
+
+    s->count++;
+    s->totalNs += ns;
+    s->units += units;
+    s->bucket[( b < STAGE_BUCKETS ) ? b : STAGE_BUCKETS - 1]++;
+
+    if ( ns > s->maxNs )
+    {
+        s->maxNs = ns;
+    }
+}
+// ====================================================================================================
+static inline void StageDelta( struct stageStat *d, const struct stageStat *now, const struct stageStat *then )
+
+/* What happened in a stage between two looks at it. The maximum can't be split, so is the overall one */
+
+{
+    d->count = now->count - then->count;
+    d->totalNs = now->totalNs - then->totalNs;
+    d->units = now->units - then->units;
+    d->maxNs = now->maxNs;
+
+    for ( uint32_t i = 0; i < STAGE_BUCKETS; i++ )
+    {
+        d->bucket[i] = now->bucket[i] - then->bucket[i];
+    }
+}
+// ====================================================================================================
+static inline void StageAdd( struct stageStat *d, const struct stageStat *s )
+
+/* Combine the trips through one stage into those through another */
+
+{
+    d->count += s->count;
+    d->totalNs += s->totalNs;
+    d->units += s->units;
+
+    if ( s->maxNs > d->maxNs )
+    {
+        d->maxNs = s->maxNs;
+    }
+
+    for ( uint32_t i = 0; i < STAGE_BUCKETS; i++ )
+    {
+        d->bucket[i] += s->bucket[i];
+    }
+}
+// ====================================================================================================
+static inline uint64_t StagePercentile( const struct stageStat *s, uint32_t pct )
+
+/* Upper bound of the bucket that the given percentage of trips through the stage fall within, in ns */
+
+{
+    uint64_t want = ( s->count * pct + 99 ) / 100;
+    uint64_t seen = 0;
+
+    for ( uint32_t i = 0; i < STAGE_BUCKETS; i++ )
+    {
+        if ( ( seen += s->bucket[i] ) >= want )
+        {
+            return ( 2ULL << i ) - 1;
+        }
+    }
+
+    return s->maxNs;
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
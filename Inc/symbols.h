@@ -9,6 +9,7 @@
 #ifndef _SYMBOLS_H_
 #define _SYMBOLS_H_
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -101,8 +102,33 @@ struct SymbolSet
     uint32_t functionCount;                /* Number of functions we have loaded */
     struct functionEntry *functions;       /* Table of functions */
     struct sourceLineEntry *sources;       /* Table of sources */
+
+    struct nameBlock *names;               /* Arena holding the file and function names */
+    struct nameHash *fileHash;             /* Index of files by name */
+    struct nameHash *functionHash;         /* Index of functions by name */
+
+    uint32_t *lineKey;                     /* Line start addresses in search order, for SymbolLookup */
+    uint32_t *lineEntry;                   /* ...and the corresponding index into sources */
+
+    FILE *spool;                           /* While loading, where source and assembly text is being written */
+    uint64_t spoolLen;
+    void *textMap;                         /* Mapping of the text, once loaded */
+    size_t textLen;
+
+    void *cacheMap;                        /* If loaded from the symbol cache, the mapping holding the tables */
+    size_t cacheLen;                       /* ...and its length */
+
+    /* When the set comes from a SymbolReload... */
+    uint32_t generation;                   /* Sets loaded so far, including this one */
+    uint32_t layout;                       /* Changes each time the file and function tables do */
 };
 
+/* A symbol set kept up to date with its elf file by a background thread. Readers each have a slot, */
+/* and the set they get from SymbolReloadEnter stays valid until they call SymbolReloadExit.        */
+struct SymbolReload;
+
+#define SYMBOL_RELOAD_READERS (4)          /* Number of reader slots */
+
 /* An entry in the names table ... what we return to our caller */
 struct nameEntry
 {
@@ -125,5 +151,12 @@ bool SymbolSetValid( struct SymbolSet **s, char *filename );
 const char *SymbolFilename( struct SymbolSet *s, uint32_t index );
 const char *SymbolFunction( struct SymbolSet *s, uint32_t index );
 bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n );
+
+struct SymbolReload *SymbolReloadStart( const char *filename, const char *deleteMaterial, bool demanglecpp, bool recordSource, bool recordAssy );
+struct SymbolSet *SymbolReloadEnter( struct SymbolReload *r, uint32_t reader );
+void SymbolReloadExit( struct SymbolReload *r, uint32_t reader );
+uint32_t SymbolReloadGeneration( struct SymbolReload *r );
+bool SymbolReloadWait( struct SymbolReload *r, int timeoutMs );
+void SymbolReloadStop( struct SymbolReload **r );
 // ====================================================================================================
 #endif
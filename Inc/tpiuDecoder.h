@@ -37,6 +37,7 @@ enum TPIUPumpState
 };
 
 #define TPIU_PACKET_LEN (16)
+#define TPIU_NUM_STREAMS (0x80)
 
 struct TPIUCommsStats
 
@@ -54,6 +55,7 @@ struct TPIUDecoderStats
     uint32_t halfSyncCount;                /* Number of times a half sync event has been received */
     uint32_t packets;                      /* Number of packets received */
     uint32_t error;                        /* Number of times an error has been received */
+    uint32_t spanOverflow;                 /* Number of bytes lost because an output span was full */
 };
 
 struct TPIUDecoder
@@ -80,7 +82,16 @@ struct TPIUPacket
     } packet[TPIU_PACKET_LEN];
 };
 
+/* Output area for one stream when decoding a whole block at a time */
+struct TPIUSpan
+{
+    uint8_t *buffer;                       /* Where to put the data for this stream */
+    uint32_t len;                          /* Size of buffer */
+    uint32_t fill;                         /* ...and how much of it has been used */
+};
+
 // ====================================================================================================
+uint32_t TPIUDecodeBlock( struct TPIUDecoder *t, const uint8_t *buffer, uint32_t len, struct TPIUSpan *stream[TPIU_NUM_STREAMS] );
 void TPIUDecoderForceSync( struct TPIUDecoder *t, uint8_t offset );
 bool TPIUGetPacket( struct TPIUDecoder *t, struct TPIUPacket *p );
 void TPIUDecoderZeroStats( struct TPIUDecoder *t );
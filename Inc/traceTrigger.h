@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Trace Trigger
+ * =============
+ *
+ * Watches a trace stream as it arrives for something of interest, without doing a full decode of
+ * it. The ETM stream is run through a decoder of its own that only gets as far as packets, so
+ * that exceptions, explicit branch addresses and the ETM's own trigger packets can be spotted
+ * without following the program flow or looking anything up. ITM software messages can be
+ * watched for too, for a target that marks the moment of interest itself.
+ *
+ * Trigger conditions are given as text;
+ *
+ *   trigger              An ETM trigger packet, from the ETM's own trigger event logic
+ *   ex:<n>[-<m>]         Entry to exception n, or any of n to m
+ *   addr:<lo>[-<hi>]     A branch to lo, or to anywhere from lo to hi
+ *   itm:<chan>[=<val>]   An ITM software message on channel chan, or only with value val
+ *
+ * Any of the conditions being met fires the trigger, and it stays fired until it's re-armed.
+ *
+ */
+
+#ifndef _TRACE_TRIGGER_H_
+#define _TRACE_TRIGGER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "etmDecoder.h"
+#include "itmDecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACETRIGGER_MAX_CONDS (8)          /* How many conditions can be set */
+
+enum traceTriggerType { TT_ETM_TRIGGER, TT_EXCEPTION, TT_ADDRESS, TT_ITM };
+
+struct traceTriggerCond
+{
+    enum traceTriggerType type;
+    uint32_t lo;                        /* Exception number, start of address range, or ITM channel */
+    uint32_t hi;                        /* End of exception or address range, or ITM value */
+    bool anyValue;                      /* For ITM, any value on the channel will do */
+};
+
+struct traceTrigger
+{
+    struct traceTriggerCond cond[TRACETRIGGER_MAX_CONDS];
+    uint32_t numConds;                  /* Number of conditions set */
+    bool wantsETM;                      /* Some condition needs the ETM stream watching */
+    bool wantsITM;                      /* ...or the ITM stream */
+
+    struct ETMDecoder e;                /* Decoder for watching the ETM stream */
+    struct ITMDecoder i;                /* ...and the ITM stream */
+
+    bool fired;                         /* One of the conditions has been met */
+    uint32_t firedCond;                 /* ...which one it was */
+    uint32_t firedValue;                /* ...and the exception, address or ITM value that met it */
+};
+
+// ====================================================================================================
+void TraceTriggerInit( struct traceTrigger *t, bool usingAltAddrEncode );
+bool TraceTriggerAdd( struct traceTrigger *t, const char *spec );
+void TraceTriggerArm( struct traceTrigger *t );
+int64_t TraceTriggerETM( struct traceTrigger *t, const uint8_t *buffer, uint32_t len );
+bool TraceTriggerITM( struct traceTrigger *t, const uint8_t *buffer, uint32_t len );
+const char *TraceTriggerDescribe( struct traceTrigger *t, char *buffer, size_t len );
+
+// ====================================================================================================
+static inline bool TraceTriggerSet( const struct traceTrigger *t )
+
+/* Is there any condition to watch for? */
+
+{
+    return t->numConds != 0;
+}
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
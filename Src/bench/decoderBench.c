@@ -0,0 +1,840 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Decoder stack benchmark
+ * =======================
+ *
+ * Times each stage of the decode over synthetic trace from traceGen, both in isolation and end to
+ * end; TPIU demux, ITM packet and message decode, message sequencing, ETM decode, symbol lookup of
+ * PC samples (given an elf) and network fan-out to local clients, and how quickly each decoder gets
+ * through noise while hunting for sync. Reports MB/s and events/s, so
+ * it's useful both for catching regressions and for sizing hardware for a given trace rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "generics.h"
+#include "tpiuDecoder.h"
+#include "itmDecoder.h"
+#include "msgDecoder.h"
+#include "msgSeq.h"
+#include "etmDecoder.h"
+#include "symbols.h"
+#include "nwclient.h"
+#include "traceGen.h"
+
+#define BLOCK_LEN       (65536)             /* Size of blocks presented to each stage */
+#define SEQ_LEN         (100)               /* Depth of the message sequencer */
+#define ITM_STREAM      (1)                 /* TPIU streams carrying each sort of trace */
+#define ETM_STREAM      (2)
+#define MAX_CLIENTS     (64)
+#define FANOUT_TIMEOUT  (10.0)              /* Longest to wait for network clients to catch up, in seconds */
+#define FANOUT_DEPTH    (16)                /* Client queue depth that holds back the sender */
+#define DEFAULT_PC_LO   (0x08000000)        /* PC sample range when there's no elf to take it from */
+#define DEFAULT_PC_HI   (0x0800ffff)
+
+/* Record for options, either defaults or from command line */
+struct
+{
+    uint32_t size;                          /* MB of trace to generate for each of ITM and ETM */
+    uint32_t etmPercent;                    /* ...how much of it is ETM */
+    struct traceMix mix;                    /* Make up of the ITM */
+    uint32_t repeats;                       /* Number of times to run each stage, taking the best */
+    uint32_t clients;                       /* Number of network clients for the fan-out */
+    int port;                               /* ...and the port they connect to */
+    char *elffile;                          /* Elf to look PC samples up in, if any */
+    char *outfile;                          /* File to write the generated trace to, instead of benchmarking */
+} _options =
+{
+    .size = 16,
+    .etmPercent = 50,
+    .mix = { .sw = 60, .pc = 20, .dwt = 5, .exc = 10, .ts = 5 },
+    .repeats = 4,
+    .clients = 4,
+    .port = NWCLIENT_SERVER_PORT + 100
+};
+
+/* The generated trace */
+static struct
+{
+    uint8_t *itm;                           /* ITM stream */
+    uint32_t itmLen;
+    uint64_t itmEvents;                     /* ...and number of packets in it */
+    uint8_t *etm;                           /* ETM stream */
+    uint32_t etmLen;
+    uint64_t etmEvents;
+    uint8_t *tpiu;                          /* Both of them framed together */
+    uint32_t tpiuLen;
+    uint8_t *noise;                         /* Random bytes, as seen while out of sync */
+    uint32_t noiseLen;
+
+    struct SymbolSet *s;                    /* Symbols to look up PC samples in */
+    uint32_t *pc;                           /* The PC samples in the ITM */
+    uint32_t pcCount;
+} _g;
+
+/* A network client for the fan-out */
+struct benchClient
+{
+    int fd;
+    pthread_t thread;
+    uint64_t rxed;                          /* Bytes received so far */
+};
+
+static uint8_t _out[TPIU_NUM_STREAMS][BLOCK_LEN];
+static struct msg _msgs[ITM_DECODE_BATCH];
+static uint64_t _etmEvents;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static void _report( const char *title, uint64_t bytes, uint64_t events, double secs )
+
+{
+    if ( bytes )
+    {
+        printf( "  %-24s %10.1f MB/s %10.2f Mevents/s" EOL, title, bytes / secs / 1e6, events / secs / 1e6 );
+    }
+    else
+    {
+        printf( "  %-24s %10s      %10.2f Mevents/s" EOL, title, "-", events / secs / 1e6 );
+    }
+}
+// ====================================================================================================
+static void _run( const char *title, uint64_t bytes, uint64_t ( *fn )( void ) )
+
+/* Run a stage the configured number of times, reporting the best */
+
+{
+    double best = 0;
+    double t0;
+    uint64_t events = 0;
+
+    for ( uint32_t r = 0; r < _options.repeats; r++ )
+    {
+        t0 = _now();
+        events = fn();
+        t0 = _now() - t0;
+        best = ( ( !best ) || ( t0 < best ) ) ? t0 : best;
+    }
+
+    _report( title, bytes, events, best );
+}
+// ====================================================================================================
+static void _etmCB( void *d )
+
+{
+    _etmEvents++;
+}
+// ====================================================================================================
+static void _streamTable( struct TPIUSpan span[TPIU_NUM_STREAMS], struct TPIUSpan *stream[TPIU_NUM_STREAMS] )
+
+{
+    for ( uint32_t s = 0; s < TPIU_NUM_STREAMS; s++ )
+    {
+        span[s].buffer = _out[s];
+        span[s].len = BLOCK_LEN;
+        span[s].fill = 0;
+        stream[s] = &span[s];
+    }
+}
+// ====================================================================================================
+// Stages in isolation
+// ====================================================================================================
+static uint64_t _tpiuPump( void )
+
+/* Byte at a time TPIU decode, a frame at a time out */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUPacket p;
+    uint64_t frames = 0;
+
+    TPIUDecoderInit( &t );
+
+    for ( uint32_t i = 0; i < _g.tpiuLen; i++ )
+    {
+        if ( TPIU_EV_RXEDPACKET == TPIUPump( &t, _g.tpiu[i] ) )
+        {
+            TPIUGetPacket( &t, &p );
+            frames++;
+        }
+    }
+
+    return frames;
+}
+// ====================================================================================================
+static uint64_t _tpiuBlock( void )
+
+/* Block TPIU decode, straight into spans for each stream */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUSpan span[TPIU_NUM_STREAMS];
+    struct TPIUSpan *stream[TPIU_NUM_STREAMS];
+
+    TPIUDecoderInit( &t );
+    _streamTable( span, stream );
+
+    for ( uint32_t b = 0; b < _g.tpiuLen; b += BLOCK_LEN )
+    {
+        TPIUDecodeBlock( &t, &_g.tpiu[b], ( _g.tpiuLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.tpiuLen - b, stream );
+
+        for ( uint32_t s = 0; s < TPIU_NUM_STREAMS; s++ )
+        {
+            span[s].fill = 0;
+        }
+    }
+
+    return _g.tpiuLen / TPIU_PACKET_LEN;
+}
+// ====================================================================================================
+static uint64_t _itmPump( void )
+
+/* Byte at a time ITM decode, a packet at a time out */
+
+{
+    struct ITMDecoder i;
+    uint64_t packets = 0;
+
+    ITMDecoderInit( &i, false );
+
+    for ( uint32_t n = 0; n < _g.itmLen; n++ )
+    {
+        packets += ( ITM_EV_PACKET_RXED == ITMPump( &i, _g.itm[n] ) );
+    }
+
+    return packets;
+}
+// ====================================================================================================
+static uint64_t _itmDecode( void )
+
+/* Block ITM decode, into batches of messages */
+
+{
+    struct ITMDecoder i;
+    uint64_t msgs = 0;
+    uint32_t used;
+
+    ITMDecoderInit( &i, false );
+
+    for ( uint32_t n = 0; n < _g.itmLen; n += used )
+    {
+        msgs += ITMDecodeBuffer( &i, &_g.itm[n], _g.itmLen - n, _msgs, ITM_DECODE_BATCH, &used );
+    }
+
+    return msgs;
+}
+// ====================================================================================================
+static uint64_t _msgSeq( void )
+
+/* ITM decode through the sequencer, which orders messages against the timestamps */
+
+{
+    struct ITMDecoder i;
+    struct MSGSeq s;
+    uint64_t msgs = 0;
+    uint32_t used;
+
+    ITMDecoderInit( &i, false );
+    MSGSeqInit( &s, &i, SEQ_LEN );
+
+    for ( uint32_t n = 0; n < _g.itmLen; n += used )
+    {
+        MSGSeqPumpBuffer( &s, &_g.itm[n], _g.itmLen - n, &used );
+
+        while ( MSGSeqGetPacket( &s ) )
+        {
+            msgs++;
+        }
+    }
+
+    MSGSeqDestroy( &s );
+    return msgs;
+}
+// ====================================================================================================
+static uint64_t _etm( void )
+
+/* ETM decode, a callback for each change in state */
+
+{
+    struct ETMDecoder e;
+
+    _etmEvents = 0;
+    ETMDecoderInit( &e, true );
+
+    for ( uint32_t b = 0; b < _g.etmLen; b += BLOCK_LEN )
+    {
+        ETMDecoderPump( &e, &_g.etm[b], ( _g.etmLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.etmLen - b, _etmCB, NULL, NULL );
+    }
+
+    return _etmEvents;
+}
+// ====================================================================================================
+static uint64_t _tpiuHunt( void )
+
+/* Block TPIU decode of noise, so hunting for sync throughout */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUSpan span[TPIU_NUM_STREAMS];
+    struct TPIUSpan *stream[TPIU_NUM_STREAMS];
+    uint64_t frames = 0;
+
+    TPIUDecoderInit( &t );
+    _streamTable( span, stream );
+
+    for ( uint32_t b = 0; b < _g.noiseLen; b += BLOCK_LEN )
+    {
+        frames += TPIUDecodeBlock( &t, &_g.noise[b], ( _g.noiseLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.noiseLen - b, stream );
+
+        for ( uint32_t s = 0; s < TPIU_NUM_STREAMS; s++ )
+        {
+            span[s].fill = 0;
+        }
+    }
+
+    return frames;
+}
+// ====================================================================================================
+static uint64_t _itmHunt( void )
+
+/* Block ITM decode of noise, so hunting for sync throughout */
+
+{
+    struct ITMDecoder i;
+    uint64_t msgs = 0;
+    uint32_t used;
+
+    ITMDecoderInit( &i, false );
+
+    for ( uint32_t n = 0; n < _g.noiseLen; n += used )
+    {
+        msgs += ITMDecodeBuffer( &i, &_g.noise[n], _g.noiseLen - n, _msgs, ITM_DECODE_BATCH, &used );
+    }
+
+    return msgs;
+}
+// ====================================================================================================
+static uint64_t _etmHunt( void )
+
+/* ETM decode of noise, hunting for sync throughout */
+
+{
+    struct ETMDecoder e;
+
+    _etmEvents = 0;
+    ETMDecoderInit( &e, true );
+
+    for ( uint32_t b = 0; b < _g.noiseLen; b += BLOCK_LEN )
+    {
+        ETMDecoderPump( &e, &_g.noise[b], ( _g.noiseLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.noiseLen - b, _etmCB, NULL, NULL );
+    }
+
+    return _etmEvents;
+}
+// ====================================================================================================
+static uint64_t _symbols( void )
+
+/* Lookup of each PC sample in the ITM */
+
+{
+    struct nameEntry n;
+    uint64_t hits = 0;
+
+    for ( uint32_t i = 0; i < _g.pcCount; i++ )
+    {
+        hits += SymbolLookup( _g.s, _g.pc[i], &n );
+    }
+
+    return _g.pcCount + ( hits & 0 );
+}
+// ====================================================================================================
+// Network fan-out
+// ====================================================================================================
+static void *_clientTask( void *arg )
+
+/* Swallow everything that's sent to this client, counting it */
+
+{
+    struct benchClient *c = ( struct benchClient * )arg;
+    uint8_t buffer[BLOCK_LEN];
+    ssize_t r;
+
+    while ( ( r = recv( c->fd, buffer, BLOCK_LEN, 0 ) ) > 0 )
+    {
+        __atomic_add_fetch( &c->rxed, r, __ATOMIC_RELAXED );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _clientsDone( struct benchClient *c, uint32_t count, uint64_t len )
+
+{
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        if ( __atomic_load_n( &c[i].rxed, __ATOMIC_RELAXED ) < len )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _fanout( void )
+
+/* Send the framed trace to a set of local clients, holding back when they fall behind so that */
+/* none of it is dropped. The time is until the last client has received all of it.           */
+
+{
+    struct benchClient c[MAX_CLIENTS];
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons( _options.port ) };
+    struct nwclientStats s;
+    struct nwclientsHandle *h;
+    uint32_t count = ( _options.clients > MAX_CLIENTS ) ? MAX_CLIENTS : _options.clients;
+    uint64_t blocks = 0;
+    double t0;
+
+    if ( !count )
+    {
+        return;
+    }
+
+    if ( !( h = nwclientStart( _options.port, NWCLIENT_OVERRUN_DROP ) ) )
+    {
+        fprintf( stderr, "Could not start network server on port %d" EOL, _options.port );
+        return;
+    }
+
+    inet_pton( AF_INET, "127.0.0.1", &addr.sin_addr );
+    memset( c, 0, sizeof( c ) );
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        int r = -1;
+
+        /* The server might not be listening quite yet */
+        for ( uint32_t tries = 0; ( r < 0 ) && ( tries < 100 ); tries++ )
+        {
+            if ( ( c[i].fd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+            {
+                break;
+            }
+
+            if ( ( r = connect( c[i].fd, ( struct sockaddr * )&addr, sizeof( addr ) ) ) < 0 )
+            {
+                close( c[i].fd );
+                usleep( 10000 );
+            }
+        }
+
+        if ( r < 0 )
+        {
+            fprintf( stderr, "Could not connect client (%s)" EOL, strerror( errno ) );
+            count = i;
+            break;
+        }
+
+        pthread_create( &c[i].thread, NULL, _clientTask, &c[i] );
+    }
+
+    if ( !count )
+    {
+        nwclientShutdown( h );
+        return;
+    }
+
+    /* Wait for the server to have seen all of them */
+    while ( ( nwclientGetStats( h, &s, NULL, 0 ), s.clients < count ) )
+    {
+        usleep( 1000 );
+    }
+
+    t0 = _now();
+
+    for ( uint32_t b = 0; b < _g.tpiuLen; b += BLOCK_LEN, blocks++ )
+    {
+        while ( ( nwclientGetStats( h, &s, NULL, 0 ), s.maxDepth >= FANOUT_DEPTH ) )
+        {
+            sched_yield();
+        }
+
+        nwclientSend( h, ( _g.tpiuLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.tpiuLen - b, &_g.tpiu[b] );
+    }
+
+    while ( ( !_clientsDone( c, count, _g.tpiuLen ) ) && ( _now() - t0 < FANOUT_TIMEOUT ) )
+    {
+        usleep( 100 );
+    }
+
+    t0 = _now() - t0;
+    nwclientGetStats( h, &s, NULL, 0 );
+
+    char title[32];
+    snprintf( title, sizeof( title ), "nwclient x%u", count );
+    _report( title, _g.tpiuLen * ( uint64_t )count, blocks * count, t0 );
+
+    if ( ( s.dropped ) || ( !_clientsDone( c, count, _g.tpiuLen ) ) )
+    {
+        printf( "    (%" PRIu64 " blocks dropped, clients did not all receive everything)" EOL, s.dropped );
+    }
+
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        shutdown( c[i].fd, SHUT_RDWR );
+        close( c[i].fd );
+        pthread_join( c[i].thread, NULL );
+    }
+
+    nwclientShutdown( h );
+
+    while ( !nwclientShutdownComplete( h ) )
+    {
+        usleep( 1000 );
+    }
+}
+// ====================================================================================================
+// End to end
+// ====================================================================================================
+static uint64_t _endToEnd( void )
+
+/* TPIU demux feeding the ITM sequencer (with symbol lookup of PC samples) and the ETM decoder */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUSpan span[TPIU_NUM_STREAMS];
+    struct TPIUSpan *stream[TPIU_NUM_STREAMS];
+    struct ITMDecoder i;
+    struct MSGSeq s;
+    struct ETMDecoder e;
+    struct nameEntry n;
+    struct msg *m;
+    uint64_t events = 0;
+    uint32_t used;
+
+    TPIUDecoderInit( &t );
+    ITMDecoderInit( &i, false );
+    MSGSeqInit( &s, &i, SEQ_LEN );
+    ETMDecoderInit( &e, true );
+    _streamTable( span, stream );
+    _etmEvents = 0;
+
+    for ( uint32_t b = 0; b < _g.tpiuLen; b += BLOCK_LEN )
+    {
+        TPIUDecodeBlock( &t, &_g.tpiu[b], ( _g.tpiuLen - b > BLOCK_LEN ) ? BLOCK_LEN : _g.tpiuLen - b, stream );
+
+        for ( uint32_t c = 0; c < span[ITM_STREAM].fill; c += used )
+        {
+            MSGSeqPumpBuffer( &s, &span[ITM_STREAM].buffer[c], span[ITM_STREAM].fill - c, &used );
+
+            while ( ( m = MSGSeqGetPacket( &s ) ) )
+            {
+                events++;
+
+                if ( ( _g.s ) && ( m->genericMsg.msgtype == MSG_PC_SAMPLE ) && ( !m->pcSampleMsg.sleep ) )
+                {
+                    SymbolLookup( _g.s, m->pcSampleMsg.pc, &n );
+                }
+            }
+        }
+
+        ETMDecoderPump( &e, span[ETM_STREAM].buffer, span[ETM_STREAM].fill, _etmCB, NULL, NULL );
+
+        for ( uint32_t c = 0; c < TPIU_NUM_STREAMS; c++ )
+        {
+            span[c].fill = 0;
+        }
+    }
+
+    MSGSeqDestroy( &s );
+    return events + _etmEvents;
+}
+// ====================================================================================================
+// Setup
+// ====================================================================================================
+static void _collectPCs( void )
+
+/* Find the PC samples in the ITM, for the symbol lookup */
+
+{
+    struct ITMDecoder i;
+    uint32_t used;
+    uint32_t n;
+
+    _g.pc = ( uint32_t * )malloc( sizeof( uint32_t ) * _g.itmEvents );
+    ITMDecoderInit( &i, false );
+
+    for ( uint32_t b = 0; b < _g.itmLen; b += used )
+    {
+        n = ITMDecodeBuffer( &i, &_g.itm[b], _g.itmLen - b, _msgs, ITM_DECODE_BATCH, &used );
+
+        for ( uint32_t k = 0; k < n; k++ )
+        {
+            if ( ( _msgs[k].genericMsg.msgtype == MSG_PC_SAMPLE ) && ( !_msgs[k].pcSampleMsg.sleep ) )
+            {
+                _g.pc[_g.pcCount++] = _msgs[k].pcSampleMsg.pc;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static bool _generate( void )
+
+/* Make the trace to be used by all of the stages */
+
+{
+    uint32_t pcLo = DEFAULT_PC_LO;
+    uint32_t pcHi = DEFAULT_PC_HI;
+    uint32_t total = _options.size * 1024 * 1024;
+    uint32_t etmLen = ( uint64_t )total * _options.etmPercent / 100;
+    struct traceItem *it;
+    const uint8_t *streams[2];
+    uint32_t lens[2];
+    uint32_t nitems;
+
+    if ( _options.elffile )
+    {
+        if ( !( _g.s = SymbolSetCreate( _options.elffile, NULL, false, false, false ) ) )
+        {
+            fprintf( stderr, "Could not load symbols from %s" EOL, _options.elffile );
+            return false;
+        }
+
+        /* PC samples are spread over the code that's in the elf */
+        pcLo = 0xffffffff;
+        pcHi = 0;
+
+        for ( uint32_t i = 0; i < _g.s->sourceCount; i++ )
+        {
+            pcLo = ( _g.s->sources[i].startAddr < pcLo ) ? _g.s->sources[i].startAddr : pcLo;
+            pcHi = ( _g.s->sources[i].endAddr > pcHi ) ? _g.s->sources[i].endAddr : pcHi;
+        }
+
+        if ( pcLo > pcHi )
+        {
+            fprintf( stderr, "No code found in %s" EOL, _options.elffile );
+            return false;
+        }
+    }
+
+    _g.itm = ( uint8_t * )malloc( total - etmLen + 1 );
+    _g.etm = ( uint8_t * )malloc( etmLen + 1 );
+    _g.tpiu = ( uint8_t * )malloc( total * 2 );
+    _g.noise = ( uint8_t * )malloc( total );
+    it = ( struct traceItem * )malloc( sizeof( struct traceItem ) * ( total + 1 ) );
+
+    if ( ( !_g.itm ) || ( !_g.etm ) || ( !_g.tpiu ) || ( !_g.noise ) || ( !it ) )
+    {
+        fprintf( stderr, "Out of memory" EOL );
+        return false;
+    }
+
+    srand( 1 );
+    _g.itmLen = TraceGenITM( _g.itm, total - etmLen, &_options.mix, pcLo, pcHi, &_g.itmEvents );
+    _g.etmLen = TraceGenETM( _g.etm, etmLen, pcLo, &_g.etmEvents );
+
+    streams[ITM_STREAM - 1] = _g.itm;
+    lens[ITM_STREAM - 1] = _g.itmLen;
+    streams[ETM_STREAM - 1] = _g.etm;
+    lens[ETM_STREAM - 1] = _g.etmLen;
+
+    nitems = TraceGenInterleave( it, total, streams, lens, 2 );
+    _g.tpiuLen = TraceGenFrame( it, nitems, _g.tpiu, total * 2 );
+    free( it );
+
+    for ( _g.noiseLen = 0; _g.noiseLen < total; _g.noiseLen++ )
+    {
+        _g.noise[_g.noiseLen] = rand();
+    }
+
+    _collectPCs();
+
+    printf( "Generated %.1fMB ITM (%" PRIu64 " packets), %.1fMB ETM, %.1fMB TPIU framed" EOL,
+            _g.itmLen / 1e6, _g.itmEvents, _g.etmLen / 1e6, _g.tpiuLen / 1e6 );
+    return true;
+}
+// ====================================================================================================
+static void _printHelp( const char *progName )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, progName );
+    genericsPrintf( "       -c: <count> Number of network clients for the fan-out (default %u, 0 to skip it)" EOL, _options.clients );
+    genericsPrintf( "       -e: <ElfFile> to look up PC samples in" EOL );
+    genericsPrintf( "       -E: <percent> Proportion of the trace that's ETM (default %u)" EOL, _options.etmPercent );
+    genericsPrintf( "       -h: This help" EOL );
+    genericsPrintf( "       -l: <port> Port to use for the fan-out (default %d)" EOL, _options.port );
+    genericsPrintf( "       -m: <sw,pc,dwt,exc,ts> Relative weights of ITM packet types (default %u,%u,%u,%u,%u)" EOL,
+                    _options.mix.sw, _options.mix.pc, _options.mix.dwt, _options.mix.exc, _options.mix.ts );
+    genericsPrintf( "       -n: <MB> Amount of trace to generate (default %u)" EOL, _options.size );
+    genericsPrintf( "       -r: <count> Number of runs of each stage, of which the best is reported (default %u)" EOL, _options.repeats );
+    genericsPrintf( "       -w: <filename> Write the generated TPIU framed trace to file, and don't benchmark" EOL );
+}
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[] )
+
+{
+    int c;
+
+    while ( ( c = getopt ( argc, argv, "c:e:E:hl:m:n:r:w:" ) ) != -1 )
+        switch ( c )
+        {
+            // ------------------------------------
+            case 'c':
+                _options.clients = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'e':
+                _options.elffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'E':
+                _options.etmPercent = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'h':
+                _printHelp( argv[0] );
+                return false;
+
+            // ------------------------------------
+            case 'l':
+                _options.port = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'm':
+                if ( 5 != sscanf( optarg, "%u,%u,%u,%u,%u", &_options.mix.sw, &_options.mix.pc, &_options.mix.dwt, &_options.mix.exc, &_options.mix.ts ) )
+                {
+                    genericsReport( V_ERROR, "Mix needs five weights" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+            case 'n':
+                _options.size = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'r':
+                _options.repeats = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'w':
+                _options.outfile = optarg;
+                break;
+
+            // ------------------------------------
+            default:
+                genericsReport( V_ERROR, "Unrecognised option '%c'" EOL, c );
+                return false;
+                // ------------------------------------
+        }
+
+    if ( ( !_options.size ) || ( _options.size > 1024 ) || ( _options.etmPercent > 100 ) || ( !_options.repeats ) )
+    {
+        genericsReport( V_ERROR, "Illegal size, proportion or repeat count" EOL );
+        return false;
+    }
+
+    if ( ( _options.etmPercent < 100 ) &&
+            ( !( _options.mix.sw + _options.mix.pc + _options.mix.dwt + _options.mix.exc + _options.mix.ts ) ) )
+    {
+        genericsReport( V_ERROR, "Mix can't be all zero" EOL );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    if ( !_processOptions( argc, argv ) )
+    {
+        return -1;
+    }
+
+    /* Keep the decoders quiet about what they find */
+    genericsSetReportLevel( V_ERROR );
+
+    if ( !_generate() )
+    {
+        return -1;
+    }
+
+    if ( _options.outfile )
+    {
+        FILE *f = fopen( _options.outfile, "wb" );
+
+        if ( ( !f ) || ( fwrite( _g.tpiu, 1, _g.tpiuLen, f ) != _g.tpiuLen ) )
+        {
+            fprintf( stderr, "Could not write %s" EOL, _options.outfile );
+            return -1;
+        }
+
+        fclose( f );
+        return 0;
+    }
+
+    printf( "Stages in isolation:" EOL );
+    _run( "TPIUPump", _g.tpiuLen, _tpiuPump );
+    _run( "TPIUDecodeBlock", _g.tpiuLen, _tpiuBlock );
+    _run( "ITMPump", _g.itmLen, _itmPump );
+    _run( "ITMDecodeBuffer", _g.itmLen, _itmDecode );
+    _run( "MSGSeqPumpBuffer", _g.itmLen, _msgSeq );
+    _run( "ETMDecoderPump", _g.etmLen, _etm );
+
+    if ( _g.s )
+    {
+        _run( "SymbolLookup", 0, _symbols );
+    }
+
+    printf( "Hunting for sync in noise:" EOL );
+    _run( "TPIUDecodeBlock", _g.noiseLen, _tpiuHunt );
+    _run( "ITMDecodeBuffer", _g.noiseLen, _itmHunt );
+    _run( "ETMDecoderPump", _g.noiseLen, _etmHunt );
+
+    _fanout();
+
+    printf( "End to end:" EOL );
+    _run( "TPIU+ITM+ETM", _g.tpiuLen, _endToEnd );
+
+    return 0;
+}
+// ====================================================================================================
@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Symbol lookup micro-benchmark
+ * =============================
+ *
+ * Measures SymbolLookup() rate against a real elf, comparing the indexed search with the original
+ * bsearch over the source line table followed by a linear scan of the assembly, and checks that
+ * both give identical answers for every address looked up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "generics.h"
+#include "symbols.h"
+
+#define LOOKUPS         (8 * 1024 * 1024)   /* Number of addresses to look up per pass */
+#define HOT_SET         (4096)              /* Size of the set of frequently hit addresses */
+#define REPEATS         (4)
+
+// ====================================================================================================
+static int _compareLines( const void *a, const void *b )
+
+/* The original comparison used for the bsearch */
+
+{
+    const struct sourceLineEntry *sa = ( const struct sourceLineEntry * )a;
+    const struct sourceLineEntry *sb = ( const struct sourceLineEntry * )b;
+
+    if ( sa->startAddr < sb->startAddr )
+    {
+        return -1;
+    }
+
+    if ( sa->startAddr > sb->endAddr )
+    {
+        return 1;
+    }
+
+    return 0;
+}
+// ====================================================================================================
+static bool _oldLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
+
+/* The lookup as it was, for comparison */
+
+{
+    struct sourceLineEntry needle = { .startAddr = addr, .endAddr = addr };
+    struct sourceLineEntry *found = bsearch( &needle, s->sources, s->sourceCount, sizeof( struct sourceLineEntry ), _compareLines );
+
+    memset( n, 0, sizeof( struct nameEntry ) );
+
+    if ( !found )
+    {
+        return false;
+    }
+
+    n->fileindex     = found->fileIdx;
+    n->functionindex = found->functionIdx;
+    n->line          = found->lineNo;
+    n->assy          = found->assy;
+
+    for ( n->assyLine = 0; n->assyLine < found->assyLines; n->assyLine++ )
+    {
+        if ( found->assy[n->assyLine].addr == addr )
+        {
+            break;
+        }
+    }
+
+    if ( n->assyLine == found->assyLines )
+    {
+        n->assyLine = ASSY_NOT_FOUND;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static double _secs( struct timespec *a, struct timespec *b )
+
+{
+    return ( b->tv_sec - a->tv_sec ) + ( b->tv_nsec - a->tv_nsec ) / 1e9;
+}
+// ====================================================================================================
+static void _run( const char *title, struct SymbolSet *s, uint32_t *addr, bool ( *fn )( struct SymbolSet *, uint32_t, struct nameEntry * ) )
+
+{
+    struct timespec start, end;
+    struct nameEntry n;
+    uint32_t hits = 0;
+    double best = 0;
+
+    for ( uint32_t r = 0; r < REPEATS; r++ )
+    {
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        for ( uint32_t i = 0; i < LOOKUPS; i++ )
+        {
+            hits += fn( s, addr[i], &n );
+        }
+
+        clock_gettime( CLOCK_MONOTONIC, &end );
+
+        double rate = LOOKUPS / _secs( &start, &end );
+        best = ( rate > best ) ? rate : best;
+    }
+
+    printf( "  %-20s %8.2f M lookups/s (%u hits)\n", title, best / 1e6, hits / REPEATS );
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    struct SymbolSet *s;
+    struct timespec start, end;
+    uint32_t lo = 0xffffffff, hi = 0;
+    uint32_t *uniform, *hot;
+    bool withAssy = ( argc > 2 ) && ( !strcmp( argv[2], "-a" ) );
+
+    if ( argc < 2 )
+    {
+        fprintf( stderr, "Usage: %s <elf file> [-a]" EOL "  -a: Also load source and assembly (needs objdump)" EOL, argv[0] );
+        return -1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    if ( !( s = SymbolSetCreate( argv[1], NULL, false, withAssy, withAssy ) ) )
+    {
+        fprintf( stderr, "Could not load symbols from %s" EOL, argv[1] );
+        return -1;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        lo = ( s->sources[i].startAddr < lo ) ? s->sources[i].startAddr : lo;
+        hi = ( s->sources[i].endAddr > hi ) ? s->sources[i].endAddr : hi;
+    }
+
+    printf( "%s: %u lines, %u functions, loaded in %.1fms, addresses %08x-%08x" EOL,
+            argv[1], s->sourceCount, s->functionCount, _secs( &start, &end ) * 1000, lo, hi );
+
+    if ( lo > hi )
+    {
+        return 0;
+    }
+
+    /* Uniform spread of halfword aligned addresses, and a stream concentrated on a small hot set like a real PC trace */
+    uniform = ( uint32_t * )malloc( LOOKUPS * sizeof( uint32_t ) );
+    hot     = ( uint32_t * )malloc( LOOKUPS * sizeof( uint32_t ) );
+    srand( 1 );
+
+    for ( uint32_t i = 0; i < LOOKUPS; i++ )
+    {
+        uniform[i] = ( lo + ( ( ( uint64_t )rand() << 16 ^ rand() ) % ( hi - lo + 1 ) ) ) & ~1;
+        hot[i] = ( i < HOT_SET ) ? uniform[i] : hot[rand() % HOT_SET];
+    }
+
+    /* Make sure we're comparing like for like */
+    for ( uint32_t i = 0; i < LOOKUPS; i++ )
+    {
+        struct nameEntry a, b;
+        bool ra = SymbolLookup( s, uniform[i], &a );
+        bool rb = _oldLookup( s, uniform[i], &b );
+
+        if ( ( ra != rb ) || ( ( ra ) && ( ( a.fileindex != b.fileindex ) || ( a.functionindex != b.functionindex ) ||
+                                           ( a.line != b.line ) || ( a.assyLine != b.assyLine ) ) ) )
+        {
+            fprintf( stderr, "Mismatch at %08x" EOL, uniform[i] );
+            return -1;
+        }
+    }
+
+    printf( "Uniform addresses:" EOL );
+    _run( "bsearch", s, uniform, _oldLookup );
+    _run( "SymbolLookup", s, uniform, SymbolLookup );
+    printf( "Hot set of %u addresses:" EOL, HOT_SET );
+    _run( "bsearch", s, hot, _oldLookup );
+    _run( "SymbolLookup", s, hot, SymbolLookup );
+
+    free( uniform );
+    free( hot );
+    SymbolSetDelete( &s );
+    return 0;
+}
+// ====================================================================================================
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * TPIU demux micro-benchmark
+ * ==========================
+ *
+ * Measures TPIU demux throughput for different numbers of configured channels, comparing the original
+ * byte-at-a-time route (TPIUPump/TPIUGetPacket with a search for the handler) against TPIUDecodeBlock
+ * with a direct mapped stream table, as used by orbuculum.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tpiuDecoder.h"
+#include "traceGen.h"
+
+#define INPUT_LEN       (16 * 1024 * 1024)  /* Amount of framed data to generate */
+#define BLOCK_LEN       (65536)             /* Size of blocks presented to the decoder */
+#define MAX_RUN         (32)                /* Longest run of bytes for one stream */
+#define MAX_CHANNELS    (8)
+#define REPEATS         (4)
+
+static uint8_t _out[MAX_CHANNELS][BLOCK_LEN];
+
+// ====================================================================================================
+static uint32_t _makeItems( struct traceItem *it, uint32_t count, uint32_t channels )
+
+/* Create runs of data for randomly chosen streams */
+
+{
+    uint32_t n = 0;
+
+    while ( n < count )
+    {
+        uint8_t s = 1 + ( rand() % channels );
+        uint32_t run = 1 + ( rand() % MAX_RUN );
+
+        while ( ( run-- ) && ( n < count ) )
+        {
+            it[n].s = s;
+            it[n++].d = rand();
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static double _now( void )
+
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+// ====================================================================================================
+static uint64_t _legacy( const uint8_t *ip, uint32_t len, uint32_t channels )
+
+/* Per-byte pump, with a cached channel and linear search on change, as the original _stripTPIU */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUPacket p;
+    uint32_t fill[MAX_CHANNELS] = { 0 };
+    uint64_t total = 0;
+    int cachedChannel = -1;
+    uint32_t chIndex = 0;
+
+    TPIUDecoderInit( &t );
+
+    for ( uint32_t b = 0; b < len; b += BLOCK_LEN )
+    {
+        uint32_t l = ( len - b > BLOCK_LEN ) ? BLOCK_LEN : len - b;
+
+        for ( uint32_t i = 0; i < l; i++ )
+        {
+            if ( TPIU_EV_RXEDPACKET == TPIUPump( &t, ip[b + i] ) )
+            {
+                TPIUGetPacket( &t, &p );
+
+                for ( uint32_t g = 0; g < p.len; g++ )
+                {
+                    if ( cachedChannel != p.packet[g].s )
+                    {
+                        cachedChannel = p.packet[g].s;
+
+                        for ( chIndex = 0; ( chIndex < channels ) && ( chIndex + 1 != p.packet[g].s ); chIndex++ );
+                    }
+
+                    if ( chIndex != channels )
+                    {
+                        _out[chIndex][fill[chIndex]++] = p.packet[g].d;
+                    }
+                }
+            }
+        }
+
+        for ( uint32_t c = 0; c < channels; c++ )
+        {
+            total += fill[c];
+            fill[c] = 0;
+        }
+    }
+
+    return total;
+}
+// ====================================================================================================
+static uint64_t _block( const uint8_t *ip, uint32_t len, uint32_t channels )
+
+/* Block decode into a direct mapped table of spans */
+
+{
+    struct TPIUDecoder t;
+    struct TPIUSpan span[MAX_CHANNELS];
+    struct TPIUSpan *stream[TPIU_NUM_STREAMS] = { NULL };
+    uint64_t total = 0;
+
+    TPIUDecoderInit( &t );
+
+    for ( uint32_t c = 0; c < channels; c++ )
+    {
+        span[c].buffer = _out[c];
+        span[c].len = BLOCK_LEN;
+        span[c].fill = 0;
+        stream[c + 1] = &span[c];
+    }
+
+    for ( uint32_t b = 0; b < len; b += BLOCK_LEN )
+    {
+        uint32_t l = ( len - b > BLOCK_LEN ) ? BLOCK_LEN : len - b;
+
+        TPIUDecodeBlock( &t, &ip[b], l, stream );
+
+        for ( uint32_t c = 0; c < channels; c++ )
+        {
+            total += span[c].fill;
+            span[c].fill = 0;
+        }
+    }
+
+    return total;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    const uint32_t channelSets[] = { 1, 2, 8 };
+    struct traceItem *it = ( struct traceItem * )malloc( INPUT_LEN * sizeof( struct traceItem ) );
+    uint8_t *ip = ( uint8_t * )malloc( INPUT_LEN );
+    double t0;
+    double tl;
+    double tb;
+    uint64_t nl;
+    uint64_t nb;
+
+    if ( ( !it ) || ( !ip ) )
+    {
+        fprintf( stderr, "Out of memory\n" );
+        return -1;
+    }
+
+    printf( "Channels     Legacy MB/s     Block MB/s\n" );
+
+    for ( uint32_t s = 0; s < sizeof( channelSets ) / sizeof( channelSets[0] ); s++ )
+    {
+        srand( 1 );
+        uint32_t nitems = _makeItems( it, INPUT_LEN * 7 / 8, channelSets[s] );
+        uint32_t len = TraceGenFrame( it, nitems, ip, INPUT_LEN );
+
+        tl = tb = 0;
+        nl = nb = 0;
+
+        for ( uint32_t r = 0; r < REPEATS; r++ )
+        {
+            t0 = _now();
+            nl = _legacy( ip, len, channelSets[s] );
+            tl += _now() - t0;
+
+            t0 = _now();
+            nb = _block( ip, len, channelSets[s] );
+            tb += _now() - t0;
+        }
+
+        if ( nl != nb )
+        {
+            fprintf( stderr, "Output mismatch (%lu vs %lu bytes)\n", ( unsigned long )nl, ( unsigned long )nb );
+            return -1;
+        }
+
+        printf( "%8u %15.1f %14.1f\n", channelSets[s], ( len * ( double )REPEATS ) / tl / 1e6, ( len * ( double )REPEATS ) / tb / 1e6 );
+    }
+
+    free( it );
+    free( ip );
+    return 0;
+}
+// ====================================================================================================
@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Synthetic trace generator for the benchmarks
+ * ============================================
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tpiuDecoder.h"
+#include "traceGen.h"
+
+#define MAX_RUN         (32)            /* Longest run of bytes for one stream in the TPIU */
+#define MAX_PACKET      (12)            /* Longest packet that's generated, including syncs */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint32_t _sync( uint8_t *op )
+
+/* The sync used by both ITM and ETM (where it's called A-Sync); five zeros then 0x80 */
+
+{
+    memset( op, 0, 5 );
+    op[5] = 0x80;
+    return 6;
+}
+// ====================================================================================================
+static uint32_t _random32( void )
+
+{
+    return ( ( uint32_t )rand() << 16 ) ^ rand();
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+uint32_t TraceGenITM( uint8_t *op, uint32_t len, const struct traceMix *m, uint32_t pcLo, uint32_t pcHi, uint64_t *events )
+
+/* Fill a buffer with ITM packets of the mix given, returning the length used. PC samples are */
+/* halfword aligned addresses between pcLo and pcHi, with a few sleeping samples among them.  */
+
+{
+    uint32_t total = m->sw + m->pc + m->dwt + m->exc + m->ts;
+    uint32_t o = _sync( op );
+    uint32_t nextSync = TRACE_SYNC_INTERVAL;
+    uint32_t r;
+
+    *events = 0;
+
+    while ( ( total ) && ( o + MAX_PACKET <= len ) )
+    {
+        if ( o >= nextSync )
+        {
+            o += _sync( &op[o] );
+            nextSync = o + TRACE_SYNC_INTERVAL;
+            continue;
+        }
+
+        r = rand() % total;
+        ( *events )++;
+
+        if ( r < m->sw )
+        {
+            /* Software packet on one of the lower channels, as printf over ITM is */
+            uint8_t sizeCode = 1 + ( rand() % 3 );
+            uint8_t size = ( sizeCode == 3 ) ? 4 : sizeCode;
+
+            op[o++] = ( ( rand() % 8 ) << 3 ) | sizeCode;
+
+            while ( size-- )
+            {
+                op[o++] = ' ' + ( rand() % 95 );
+            }
+        }
+        else if ( ( r -= m->sw ) < m->pc )
+        {
+            /* PC sample is hardware source 2, four bytes long. One in sixteen of them is a sleep */
+            if ( !( rand() % 16 ) )
+            {
+                op[o++] = 0x15;
+                op[o++] = 0;
+            }
+            else
+            {
+                uint32_t pc = ( pcLo + ( _random32() % ( pcHi - pcLo + 1 ) ) ) & ~1;
+
+                op[o++] = 0x17;
+                op[o++] = pc;
+                op[o++] = pc >> 8;
+                op[o++] = pc >> 16;
+                op[o++] = pc >> 24;
+            }
+        }
+        else if ( ( r -= m->pc ) < m->dwt )
+        {
+            /* Event counter wrap is hardware source 0, one byte of which counters wrapped */
+            op[o++] = 0x05;
+            op[o++] = 1 + ( rand() % 0x3f );
+        }
+        else if ( ( r -= m->dwt ) < m->exc )
+        {
+            /* Exception trace is hardware source 1, two bytes of exception number and what happened */
+            uint16_t exc = rand() % 64;
+
+            op[o++] = 0x0e;
+            op[o++] = exc;
+            op[o++] = ( ( 1 + ( rand() % 3 ) ) << 4 ) | ( exc >> 8 );
+        }
+        else
+        {
+            /* Local timestamps, mostly the single byte form */
+            if ( rand() % 4 )
+            {
+                op[o++] = ( 1 + ( rand() % 6 ) ) << 4;
+            }
+            else
+            {
+                op[o++] = 0xc0 | ( ( rand() % 4 ) << 4 );
+                op[o++] = 0x80 | ( rand() & 0x7f );
+                op[o++] = rand() & 0x7f;
+            }
+        }
+    }
+
+    return o;
+}
+// ====================================================================================================
+uint32_t TraceGenETM( uint8_t *op, uint32_t len, uint32_t base, uint64_t *events )
+
+/* Fill a buffer with an ETMv3.5 stream (using the alternative address encoding) of the sort a loop */
+/* heavy program produces; mostly atoms, with branches and the occasional re-sync. Returns length.  */
+
+{
+    uint32_t o = 0;
+    uint32_t nextSync = 0;
+    uint32_t r;
+
+    *events = 0;
+
+    while ( o + MAX_PACKET <= len )
+    {
+        ( *events )++;
+
+        if ( o >= nextSync )
+        {
+            /* A-Sync followed by I-Sync, with no context ID and a thumb address */
+            o += _sync( &op[o] );
+            op[o++] = 0x08;
+            op[o++] = 0x00;
+            op[o++] = base | 1;
+            op[o++] = base >> 8;
+            op[o++] = base >> 16;
+            op[o++] = base >> 24;
+            nextSync = o + TRACE_SYNC_INTERVAL;
+            continue;
+        }
+
+        r = rand() % 100;
+
+        if ( r < 80 )
+        {
+            /* P-Header, either format 1 (runs of E atoms then an N) or format 2 (a pair of atoms) */
+            if ( rand() % 2 )
+            {
+                op[o++] = 0x80 | ( ( rand() % 16 ) << 2 ) | ( ( rand() % 2 ) << 6 );
+            }
+            else
+            {
+                op[o++] = 0x82 | ( ( rand() % 4 ) << 2 );
+            }
+        }
+        else if ( r < 95 )
+        {
+            /* Branch address, short form */
+            op[o++] = ( rand() & 0x7e ) | 1;
+        }
+        else
+        {
+            /* Branch address, two bytes */
+            op[o++] = 0x81 | ( rand() & 0x7e );
+            op[o++] = rand() & 0x7f;
+        }
+    }
+
+    return o;
+}
+// ====================================================================================================
+uint32_t TraceGenInterleave( struct traceItem *it, uint32_t count, const uint8_t *stream[], const uint32_t len[], uint32_t numStreams )
+
+/* Interleave runs of data from each of the streams (numbered from 1) as a TPIU would carry them, */
+/* until they're all used up or there's no more room. Returns the number of items made.          */
+
+{
+    uint32_t pos[TPIU_NUM_STREAMS] = { 0 };
+    uint32_t remaining = 0;
+    uint32_t n = 0;
+
+    for ( uint32_t s = 0; s < numStreams; s++ )
+    {
+        remaining += len[s];
+    }
+
+    while ( ( remaining ) && ( n < count ) )
+    {
+        uint32_t s = rand() % numStreams;
+        uint32_t run = 1 + ( rand() % MAX_RUN );
+
+        while ( ( run-- ) && ( pos[s] < len[s] ) && ( n < count ) )
+        {
+            it[n].s = s + 1;
+            it[n++].d = stream[s][pos[s]++];
+            remaining--;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+uint32_t TraceGenFrame( const struct traceItem *it, uint32_t nitems, uint8_t *op, uint32_t oplen )
+
+/* Encode items into TPIU frames, returning the length of the output used */
+
+{
+    uint32_t i = 0;
+    uint32_t o = 0;
+    uint8_t cur = 0xff;
+    const uint8_t sync[] = { 0xff, 0xff, 0xff, 0x7f };
+
+    memcpy( &op[o], sync, sizeof( sync ) );
+    o += sizeof( sync );
+
+    while ( ( i + 2 * TPIU_PACKET_LEN < nitems ) && ( o + TPIU_PACKET_LEN <= oplen ) )
+    {
+        uint8_t *f = &op[o];
+        uint8_t aux = 0;
+
+        for ( uint32_t p = 0; p < TPIU_PACKET_LEN / 2; p++ )
+        {
+            if ( it[i].s != cur )
+            {
+                /* Immediate stream change */
+                cur = it[i].s;
+                f[p * 2] = ( cur << 1 ) | 1;
+            }
+            else if ( ( p < 7 ) && ( it[i + 1].s != cur ) )
+            {
+                /* Delayed stream change, taking effect after the data byte that follows */
+                f[p * 2] = ( it[i + 1].s << 1 ) | 1;
+                aux |= ( 1 << p );
+                f[p * 2 + 1] = it[i++].d;
+                cur = it[i].s;
+                continue;
+            }
+            else
+            {
+                f[p * 2] = it[i].d & 0xfe;
+                aux |= ( it[i++].d & 1 ) << p;
+            }
+
+            if ( p < 7 )
+            {
+                f[p * 2 + 1] = it[i++].d;
+            }
+        }
+
+        f[TPIU_PACKET_LEN - 1] = aux;
+        o += TPIU_PACKET_LEN;
+    }
+
+    return o;
+}
+// ====================================================================================================
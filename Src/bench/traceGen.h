@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Synthetic trace generator for the benchmarks
+ * ============================================
+ *
+ * Makes plausible ITM and ETMv3.5 streams, with a chosen mix of packet types, and frames any
+ * number of them into a TPIU stream as a probe would present it. Everything is driven from
+ * rand() so runs are repeatable for a given seed.
+ */
+
+#ifndef _TRACE_GEN_H_
+#define _TRACE_GEN_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Relative weights of the kinds of ITM packet to generate */
+struct traceMix
+{
+    uint32_t sw;                        /* Software (printf style) writes of 1, 2 or 4 bytes */
+    uint32_t pc;                        /* PC samples */
+    uint32_t dwt;                       /* DWT event counter wraps */
+    uint32_t exc;                       /* Exception entry, exit and return */
+    uint32_t ts;                        /* Local timestamps */
+};
+
+/* One byte of data for one TPIU stream */
+struct traceItem
+{
+    uint8_t s;                          /* Stream it's for */
+    uint8_t d;                          /* ...and the data */
+};
+
+#define TRACE_SYNC_INTERVAL (4096)      /* Bytes of generated stream between each sync */
+
+// ====================================================================================================
+uint32_t TraceGenITM( uint8_t *op, uint32_t len, const struct traceMix *m, uint32_t pcLo, uint32_t pcHi, uint64_t *events );
+uint32_t TraceGenETM( uint8_t *op, uint32_t len, uint32_t base, uint64_t *events );
+
+uint32_t TraceGenInterleave( struct traceItem *it, uint32_t count, const uint8_t *stream[], const uint32_t len[], uint32_t numStreams );
+uint32_t TraceGenFrame( const struct traceItem *it, uint32_t nitems, uint8_t *op, uint32_t oplen );
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
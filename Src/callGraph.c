@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Call Graph Store
+ * ================
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "callGraph.h"
+
+#define CALL_GRAPH_INITIAL  (1024)      /* Initial slots in the index, must be a power of 2 */
+#define CALL_STACK_INITIAL  (64)        /* Initial depth of the stack */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _sigHash( uint32_t src, uint32_t dst, uint32_t slots )
+
+/* Slot to start looking for a call in. Addresses are halfword aligned, so the bottom bits are no use */
+
+{
+    uint32_t h = ( ( src >> 1 ) * 2654435761U ) ^ ( ( dst >> 1 ) * 0x85ebca6bU );
+
+    return ( h ^ ( h >> 15 ) ) & ( slots - 1 );
+}
+// ====================================================================================================
+static void _grow( struct callGraph *g )
+
+/* Double the size of the index, re-placing everything already in it */
+
+{
+    uint32_t slots = g->slots ? g->slots * 2 : CALL_GRAPH_INITIAL;
+    struct subcall **slot = ( struct subcall ** )calloc( slots, sizeof( struct subcall * ) );
+
+    for ( uint32_t i = 0; i < g->slots; i++ )
+    {
+        if ( g->slot[i] )
+        {
+            uint32_t h = _sigHash( g->slot[i]->sig.src, g->slot[i]->sig.dst, slots );
+
+            while ( slot[h] )
+            {
+                h = ( h + 1 ) & ( slots - 1 );
+            }
+
+            slot[h] = g->slot[i];
+        }
+    }
+
+    free( g->slot );
+    g->slot = slot;
+    g->slots = slots;
+}
+// ====================================================================================================
+static uint32_t _findSlot( struct callGraph *g, uint32_t src, uint32_t dst )
+
+/* Find the slot with this call in it, or the empty one where it would go */
+
+{
+    uint32_t h = _sigHash( src, dst, g->slots );
+
+    while ( ( g->slot[h] ) && ( ( g->slot[h]->sig.src != src ) || ( g->slot[h]->sig.dst != dst ) ) )
+    {
+        h = ( h + 1 ) & ( g->slots - 1 );
+    }
+
+    return h;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+struct subcall *CallGraphFind( struct callGraph *g, uint32_t src, uint32_t dst )
+
+/* Find the record of calls from src to dst, if there is one */
+
+{
+    return ( g->slots ) ? g->slot[_findSlot( g, src, dst )] : NULL;
+}
+// ====================================================================================================
+struct subcall *CallGraphFindOrCreate( struct callGraph *g, uint32_t src, uint32_t dst, bool *created )
+
+/* Find the record of calls from src to dst, making a new empty one if they've not been seen before */
+
+{
+    struct subcall *s;
+    uint32_t h;
+
+    if ( !g->slots )
+    {
+        _grow( g );
+    }
+
+    h = _findSlot( g, src, dst );
+
+    if ( created )
+    {
+        *created = ( !g->slot[h] );
+    }
+
+    if ( g->slot[h] )
+    {
+        return g->slot[h];
+    }
+
+    /* First time for this pair, so take the next record from the pool */
+    if ( g->count == g->blocks * CALL_GRAPH_BLOCK_LEN )
+    {
+        g->block = ( struct subcall ** )realloc( g->block, sizeof( struct subcall * ) * ( g->blocks + 1 ) );
+        g->block[g->blocks++] = ( struct subcall * )malloc( sizeof( struct subcall ) * CALL_GRAPH_BLOCK_LEN );
+    }
+
+    s = CallGraphGet( g, g->count++ );
+    memset( s, 0, sizeof( struct subcall ) );
+    s->sig.src = src;
+    s->sig.dst = dst;
+    g->slot[h] = s;
+
+    /* Keep at least half of the index empty so runs stay short */
+    if ( g->count * 2 > g->slots )
+    {
+        _grow( g );
+    }
+
+    return s;
+}
+// ====================================================================================================
+void CallGraphDelete( struct callGraph *g )
+
+{
+    for ( uint32_t i = 0; i < g->blocks; i++ )
+    {
+        free( g->block[i] );
+    }
+
+    free( g->block );
+    free( g->slot );
+    memset( g, 0, sizeof( struct callGraph ) );
+}
+// ====================================================================================================
+struct subcallAccount *CallStackGrow( struct callStack *s )
+
+/* Make room for the stack to get deeper, then push a new entry. The depth grows geometrically */
+
+{
+    s->alloc = s->alloc ? s->alloc * 2 : CALL_STACK_INITIAL;
+    s->e = ( struct subcallAccount * )realloc( s->e, sizeof( struct subcallAccount ) * s->alloc );
+    return &s->e[s->depth++];
+}
+// ====================================================================================================
+void CallStackDelete( struct callStack *s )
+
+{
+    free( s->e );
+    memset( s, 0, sizeof( struct callStack ) );
+}
+// ====================================================================================================
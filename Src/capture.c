@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Capture File Format
+ * ===================
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint64_t _now( void )
+
+{
+    struct timeval te;
+
+    gettimeofday( &te, NULL );
+    return ( te.tv_sec * 1000000LL + te.tv_usec );
+}
+// ====================================================================================================
+static bool _writeAll( int fd, struct iovec *iov, int iovcnt )
+
+/* Write all of the vectors, however many goes that takes */
+
+{
+    ssize_t t;
+
+    while ( iovcnt )
+    {
+        if ( ( t = writev( fd, iov, iovcnt ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        /* Step over whatever made it out */
+        while ( ( iovcnt ) && ( ( size_t )t >= iov->iov_len ) )
+        {
+            t -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if ( iovcnt )
+        {
+            iov->iov_base = ( uint8_t * )iov->iov_base + t;
+            iov->iov_len -= t;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _writeIndex( struct captureWriter *w )
+
+/* Write an index chunk covering the data chunks since the last one */
+
+{
+    struct captureChunk c =
+    {
+        .magic  = CAPTURE_CHUNK_MAGIC,
+        .type   = CAPTURE_CHUNK_INDEX,
+        .len    = w->indexCount * sizeof( struct captureIndexEntry ),
+        .tstamp = _now(),
+        .offset = w->lastIndex
+    };
+
+    struct iovec iov[2] =
+    {
+        { .iov_base = &c, .iov_len = sizeof( c ) },
+        { .iov_base = w->index, .iov_len = c.len }
+    };
+
+    if ( !_writeAll( w->fd, iov, 2 ) )
+    {
+        return false;
+    }
+
+    w->lastIndex = w->pos;
+    w->pos += sizeof( c ) + c.len;
+    w->indexCount = 0;
+    return true;
+}
+// ====================================================================================================
+static bool _flushChunk( struct captureWriter *w )
+
+/* Write out the chunk that's been assembled, if there is one */
+
+{
+    struct captureChunk *c = ( struct captureChunk * )w->buffer;
+    struct iovec iov;
+
+    if ( !w->fill )
+    {
+        return true;
+    }
+
+    memset( c, 0, sizeof( struct captureChunk ) );
+    c->magic       = CAPTURE_CHUNK_MAGIC;
+    c->type        = CAPTURE_CHUNK_DATA;
+    c->flags       = w->chunkSynced ? CAPTURE_FLAG_TPIU_SYNCED : 0;
+    c->compression = CAPTURE_COMPRESS_NONE;
+    c->len         = w->fill;
+    c->tstamp      = w->chunkTstamp;
+    c->offset      = w->offset;
+
+    iov.iov_base = w->buffer;
+    iov.iov_len  = sizeof( struct captureChunk ) + w->fill;
+
+    if ( !_writeAll( w->fd, &iov, 1 ) )
+    {
+        return false;
+    }
+
+    w->index[w->indexCount].tstamp = c->tstamp;
+    w->index[w->indexCount].offset = c->offset;
+    w->index[w->indexCount].pos    = w->pos;
+    w->indexCount++;
+
+    w->pos    += iov.iov_len;
+    w->offset += w->fill;
+    w->fill    = 0;
+
+    return ( w->indexCount < CAPTURE_INDEX_CHUNKS ) || _writeIndex( w );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool CaptureWriterOpen( struct captureWriter *w, const char *filename )
+
+/* Create a capture file and write its header */
+
+{
+    struct captureFileHeader h = { .version = CAPTURE_VERSION };
+    struct iovec iov = { .iov_base = &h, .iov_len = sizeof( h ) };
+
+    memset( w, 0, sizeof( struct captureWriter ) );
+
+    if ( ( w->fd = open( filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH ) ) < 0 )
+    {
+        return false;
+    }
+
+    memcpy( h.magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN );
+    h.created = _now();
+
+    if ( !_writeAll( w->fd, &iov, 1 ) )
+    {
+        close( w->fd );
+        return false;
+    }
+
+    w->pos = sizeof( h );
+    w->buffer = ( uint8_t * )malloc( sizeof( struct captureChunk ) + CAPTURE_CHUNK_LEN );
+    return true;
+}
+// ====================================================================================================
+bool CaptureWrite( struct captureWriter *w, const uint8_t *buffer, size_t len, bool tpiuSynced )
+
+/* Add received data to the capture. It's collected into chunks which are written once they're */
+/* full, or once they've covered enough time that the next data wants a new timestamp.         */
+
+{
+    uint64_t now = _now();
+    size_t n;
+
+    while ( len )
+    {
+        if ( ( w->fill ) && ( now - w->chunkTstamp > CAPTURE_CHUNK_US ) && ( !_flushChunk( w ) ) )
+        {
+            return false;
+        }
+
+        if ( !w->fill )
+        {
+            w->chunkTstamp = now;
+            w->chunkSynced = tpiuSynced;
+        }
+
+        n = ( len > CAPTURE_CHUNK_LEN - w->fill ) ? CAPTURE_CHUNK_LEN - w->fill : len;
+        memcpy( &w->buffer[sizeof( struct captureChunk ) + w->fill], buffer, n );
+        w->fill += n;
+        buffer += n;
+        len -= n;
+
+        if ( ( w->fill == CAPTURE_CHUNK_LEN ) && ( !_flushChunk( w ) ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+bool CaptureWriterClose( struct captureWriter *w )
+
+/* Write out anything still pending, then the last index and the trailer that points at it */
+
+{
+    struct captureTrailer t = { .magic = CAPTURE_TRAILER_MAGIC };
+    struct iovec iov = { .iov_base = &t, .iov_len = sizeof( t ) };
+    bool ok;
+
+    ok = _flushChunk( w ) && ( ( !w->indexCount ) || _writeIndex( w ) );
+
+    if ( ok )
+    {
+        t.lastIndex = w->lastIndex;
+        ok = _writeAll( w->fd, &iov, 1 );
+    }
+
+    close( w->fd );
+    free( w->buffer );
+    memset( w, 0, sizeof( struct captureWriter ) );
+    w->fd = -1;
+    return ok;
+}
+// ====================================================================================================
+bool CaptureIsCapture( const uint8_t *buffer, size_t len )
+
+/* Check if this is the start of a capture file */
+
+{
+    const struct captureFileHeader *h = ( const struct captureFileHeader * )buffer;
+
+    return ( len >= sizeof( struct captureFileHeader ) ) && ( !memcmp( h->magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN ) ) &&
+           ( h->version == CAPTURE_VERSION );
+}
+// ====================================================================================================
@@ -0,0 +1,357 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel Ring
+ * ============
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef LINUX
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+#endif
+
+#include "chanRing.h"
+
+#define CHANRING_POLL_US (1000)             /* Interval readers poll at, where there's no futex */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int64_t _nowMs( void )
+
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+// ====================================================================================================
+static bool _waitData( struct chanRingReader *r, int timeoutMs )
+
+/* Wait for something to read; forever if timeoutMs is negative, or not at all if it's zero */
+
+{
+    int64_t until = _nowMs() + timeoutMs;
+    int64_t remain = timeoutMs;
+
+    while ( __atomic_load_n( &r->h->wp, __ATOMIC_ACQUIRE ) == r->rp )
+    {
+        if ( !remain )
+        {
+            return false;
+        }
+
+#ifdef LINUX
+        struct timespec ts = { .tv_sec = remain / 1000, .tv_nsec = ( remain % 1000 ) * 1000000 };
+
+        /* The writer only wakes anyone if it can see there's someone waiting, so say so first */
+        __atomic_add_fetch( &r->h->waiters, 1, __ATOMIC_SEQ_CST );
+        uint32_t s = __atomic_load_n( &r->h->seq, __ATOMIC_SEQ_CST );
+
+        if ( __atomic_load_n( &r->h->wp, __ATOMIC_SEQ_CST ) == r->rp )
+        {
+            syscall( SYS_futex, &r->h->seq, FUTEX_WAIT, s, ( remain < 0 ) ? NULL : &ts, NULL, 0 );
+        }
+
+        __atomic_sub_fetch( &r->h->waiters, 1, __ATOMIC_SEQ_CST );
+#else
+        usleep( CHANRING_POLL_US );
+#endif
+
+        if ( timeoutMs > 0 )
+        {
+            remain = ( until > _nowMs() ) ? until - _nowMs() : 0;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _catchUp( struct chanRingReader *r, uint64_t wp )
+
+/* If the writer has lapped us then whatever it's overwritten is lost */
+
+{
+    if ( wp - r->rp > r->h->size )
+    {
+        r->lost += wp - r->h->size - r->rp;
+        r->rp = wp - r->h->size;
+    }
+}
+// ====================================================================================================
+static bool _stillValid( struct chanRingReader *r )
+
+/* Check the data from rp onwards weren't overwritten while we were using them */
+
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    return __atomic_load_n( &r->h->head, __ATOMIC_RELAXED ) - r->rp <= r->h->size;
+}
+// ====================================================================================================
+static void *_map( int fd, size_t *mapLen, int prot )
+
+/* Map a ring file, once its header says how big it is */
+
+{
+    struct chanRingHeader h;
+    void *m;
+
+    if ( ( pread( fd, &h, sizeof( h ), 0 ) != sizeof( h ) ) || ( h.magic != CHANRING_MAGIC ) ||
+            ( h.version != CHANRING_VERSION ) || ( !h.size ) || ( h.size & ( h.size - 1 ) ) )
+    {
+        return NULL;
+    }
+
+    *mapLen = CHANRING_HEADER_LEN + h.size;
+    m = mmap( NULL, *mapLen, prot, MAP_SHARED, fd, 0 );
+    return ( m == MAP_FAILED ) ? NULL : m;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool ChanRingCreate( struct chanRingWriter *w, const char *path, uint32_t size )
+
+/* Create a ring file of size bytes of data (a power of 2), replacing anything already there */
+
+{
+    struct chanRingHeader h = { .magic = CHANRING_MAGIC, .version = CHANRING_VERSION, .size = size };
+
+    memset( w, 0, sizeof( struct chanRingWriter ) );
+
+    if ( ( !size ) || ( size & ( size - 1 ) ) )
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    unlink( path );
+
+    if ( ( w->fd = open( path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH ) ) < 0 )
+    {
+        return false;
+    }
+
+    if ( ( ftruncate( w->fd, CHANRING_HEADER_LEN + size ) < 0 ) || ( pwrite( w->fd, &h, sizeof( h ), 0 ) != sizeof( h ) ) ||
+            ( !( w->h = ( struct chanRingHeader * )_map( w->fd, &w->mapLen, PROT_READ | PROT_WRITE ) ) ) )
+    {
+        close( w->fd );
+        return false;
+    }
+
+    w->data = ( uint8_t * )w->h + CHANRING_HEADER_LEN;
+    return true;
+}
+// ====================================================================================================
+void ChanRingWrite( struct chanRingWriter *w, const void *buffer, uint32_t len )
+
+/* Add data to the ring. This never waits, whatever state the readers are in */
+
+{
+    const uint8_t *b = ( const uint8_t * )buffer;
+    uint32_t mask = w->h->size - 1;
+    uint64_t wp = w->h->wp;
+    uint32_t first;
+
+    if ( len > w->h->size )
+    {
+        /* Only the end of this would survive anyway */
+        wp += len - w->h->size;
+        b += len - w->h->size;
+        len = w->h->size;
+    }
+
+    /* Say what's about to be overwritten, before overwriting it */
+    __atomic_store_n( &w->h->head, wp + len, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+    first = ( len < w->h->size - ( wp & mask ) ) ? len : w->h->size - ( wp & mask );
+    memcpy( &w->data[wp & mask], b, first );
+    memcpy( w->data, b + first, len - first );
+
+    __atomic_store_n( &w->h->wp, wp + len, __ATOMIC_RELEASE );
+    __atomic_add_fetch( &w->h->seq, 1, __ATOMIC_SEQ_CST );
+
+#ifdef LINUX
+
+    if ( __atomic_load_n( &w->h->waiters, __ATOMIC_SEQ_CST ) )
+    {
+        syscall( SYS_futex, &w->h->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+    }
+
+#endif
+}
+// ====================================================================================================
+void ChanRingDestroy( struct chanRingWriter *w )
+
+/* Stop writing to the ring. The file is left for the caller to remove */
+
+{
+    if ( w->h )
+    {
+        munmap( w->h, w->mapLen );
+        close( w->fd );
+    }
+
+    memset( w, 0, sizeof( struct chanRingWriter ) );
+}
+// ====================================================================================================
+bool ChanRingOpen( struct chanRingReader *r, const char *path )
+
+/* Start reading a ring file, from whatever is written to it next */
+
+{
+    memset( r, 0, sizeof( struct chanRingReader ) );
+
+    /* It's mapped writable so that readers can say they're waiting */
+    if ( ( r->fd = open( path, O_RDWR ) ) < 0 )
+    {
+        return false;
+    }
+
+    if ( !( r->h = ( struct chanRingHeader * )_map( r->fd, &r->mapLen, PROT_READ | PROT_WRITE ) ) )
+    {
+        close( r->fd );
+        errno = EINVAL;
+        return false;
+    }
+
+    r->data = ( const uint8_t * )r->h + CHANRING_HEADER_LEN;
+    r->rp = __atomic_load_n( &r->h->wp, __ATOMIC_ACQUIRE );
+    return true;
+}
+// ====================================================================================================
+ssize_t ChanRingRead( struct chanRingReader *r, void *buffer, size_t len, int timeoutMs )
+
+/* Copy up to len bytes out of the ring, waiting up to timeoutMs for there to be some (-1 for */
+/* ever). Returns the number of bytes read, which is 0 if there weren't any.                 */
+
+{
+    uint8_t *b = ( uint8_t * )buffer;
+    uint32_t mask = r->h->size - 1;
+    uint64_t wp;
+    uint32_t n, first;
+
+    while ( _waitData( r, timeoutMs ) )
+    {
+        wp = __atomic_load_n( &r->h->wp, __ATOMIC_ACQUIRE );
+        _catchUp( r, wp );
+
+        n = ( wp - r->rp < len ) ? wp - r->rp : len;
+        first = ( n < r->h->size - ( r->rp & mask ) ) ? n : r->h->size - ( r->rp & mask );
+        memcpy( b, &r->data[r->rp & mask], first );
+        memcpy( b + first, r->data, n - first );
+
+        if ( _stillValid( r ) )
+        {
+            r->rp += n;
+            return n;
+        }
+
+        /* The writer got to it while it was being copied, so it's gone */
+        r->lost += n;
+        r->rp += n;
+    }
+
+    return 0;
+}
+// ====================================================================================================
+const uint8_t *ChanRingPeek( struct chanRingReader *r, uint32_t *len, int timeoutMs )
+
+/* Get the next contiguous span of the ring in place, waiting as for ChanRingRead. The span has */
+/* to be handed back with ChanRingConsume, which says whether it was good all the while.        */
+
+{
+    uint32_t mask = r->h->size - 1;
+    uint64_t wp;
+
+    if ( !_waitData( r, timeoutMs ) )
+    {
+        *len = 0;
+        return NULL;
+    }
+
+    wp = __atomic_load_n( &r->h->wp, __ATOMIC_ACQUIRE );
+    _catchUp( r, wp );
+
+    *len = ( wp - r->rp < r->h->size - ( r->rp & mask ) ) ? wp - r->rp : r->h->size - ( r->rp & mask );
+    return &r->data[r->rp & mask];
+}
+// ====================================================================================================
+bool ChanRingConsume( struct chanRingReader *r, uint32_t len )
+
+/* Finish with len bytes from ChanRingPeek. If this returns false they were overwritten while in */
+/* use, and whatever was done with them should be thrown away.                                   */
+
+{
+    bool valid = _stillValid( r );
+
+    if ( !valid )
+    {
+        r->lost += len;
+    }
+
+    r->rp += len;
+    return valid;
+}
+// ====================================================================================================
+void ChanRingClose( struct chanRingReader *r )
+
+{
+    if ( r->h )
+    {
+        munmap( r->h, r->mapLen );
+        close( r->fd );
+    }
+
+    memset( r, 0, sizeof( struct chanRingReader ) );
+}
+// ====================================================================================================
+int ChanSocketOpen( const char *path )
+
+/* Connect to a channel published as a UNIX socket, returning the socket or -1 */
+
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if ( strlen( path ) >= sizeof( addr.sun_path ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy( addr.sun_path, path );
+
+    if ( ( fd = socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( connect( fd, ( struct sockaddr * )&addr, sizeof( addr ) ) < 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+// ====================================================================================================
@@ -0,0 +1,1312 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Native ELF symbol and DWARF line table reader
+ * =============================================
+ *
+ * A small self-contained reader for the two things we need from an elf to map addresses onto
+ * functions and source lines; the function symbols in .symtab and the line number program
+ * in .debug_line. Handles 32 and 64 bit elf of either endianness and DWARF versions 2 to 5.
+ * Anything it doesn't understand (compressed sections, string offset forms etc.) makes the load
+ * fail, so the caller can fall back to objdump.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "generics.h"
+#include "elfDwarf.h"
+
+#define EM_ARM            (40)
+
+#define SHT_SYMTAB        (2)
+#define SHT_NOBITS        (8)
+#define SHF_ALLOC         (0x2)
+#define SHF_EXECINSTR     (0x4)
+#define SHF_COMPRESSED    (0x800)
+
+#define STT_FUNC          (2)
+#define STB_GLOBAL        (1)
+#define SHN_UNDEF         (0)
+
+/* Line number program opcodes */
+#define DW_LNS_copy               (1)
+#define DW_LNS_advance_pc         (2)
+#define DW_LNS_advance_line       (3)
+#define DW_LNS_set_file           (4)
+#define DW_LNS_const_add_pc       (8)
+#define DW_LNS_fixed_advance_pc   (9)
+
+#define DW_LNE_end_sequence       (1)
+#define DW_LNE_set_address        (2)
+#define DW_LNE_define_file        (3)
+
+/* DWARF5 entry formats */
+#define DW_LNCT_path              (1)
+#define DW_LNCT_directory_index   (2)
+
+#define DW_FORM_block2            (0x03)
+#define DW_FORM_block4            (0x04)
+#define DW_FORM_data2             (0x05)
+#define DW_FORM_data4             (0x06)
+#define DW_FORM_data8             (0x07)
+#define DW_FORM_string            (0x08)
+#define DW_FORM_block             (0x09)
+#define DW_FORM_block1            (0x0a)
+#define DW_FORM_data1             (0x0b)
+#define DW_FORM_sdata             (0x0d)
+#define DW_FORM_strp              (0x0e)
+#define DW_FORM_udata             (0x0f)
+#define DW_FORM_data16            (0x1e)
+#define DW_FORM_line_strp         (0x1f)
+#define DW_FORM_addr              (0x01)
+#define DW_FORM_ref_addr          (0x10)
+#define DW_FORM_ref1              (0x11)
+#define DW_FORM_ref2              (0x12)
+#define DW_FORM_ref4              (0x13)
+#define DW_FORM_ref8              (0x14)
+#define DW_FORM_ref_udata         (0x15)
+#define DW_FORM_indirect          (0x16)
+#define DW_FORM_sec_offset        (0x17)
+#define DW_FORM_exprloc           (0x18)
+#define DW_FORM_flag_present      (0x19)
+#define DW_FORM_flag              (0x0c)
+#define DW_FORM_ref_sig8          (0x20)
+#define DW_FORM_implicit_const    (0x21)
+
+#define DW_AT_stmt_list           (0x10)
+#define DW_AT_comp_dir            (0x1b)
+
+#define DW_UT_skeleton            (0x04)
+#define DW_UT_split_compile       (0x05)
+
+#define MAX_PATH_LEN              (4096)
+
+/* A section, as far as we're concerned */
+struct section
+{
+    const uint8_t *d;
+    uint64_t len;
+};
+
+/* The elf we're working on */
+struct elf
+{
+    const uint8_t *base;                    /* The whole mapped file */
+    uint64_t len;
+    bool is64;                              /* 64 bit elf class */
+    bool isBE;                              /* Big endian data */
+    uint16_t machine;
+
+    uint32_t execCount;                     /* Executable address ranges, for filtering dead line sequences */
+    uint64_t *execLow;
+    uint64_t *execHigh;
+
+    struct section debugLine;
+    struct section debugStr;
+    struct section debugLineStr;
+    struct section debugInfo;
+    struct section debugAbbrev;
+
+    uint32_t compDirCount;                  /* Compilation directory for each line table, from .debug_info */
+    uint64_t *compDirLine;
+    const char **compDir;
+};
+
+/* A read cursor into a section. Any attempt to read past the end sets the error flag */
+struct cursor
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    bool isBE;
+    bool err;
+};
+
+/* The parts of a section header we need */
+struct shdr
+{
+    uint64_t name;
+    uint64_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t ofs;
+    uint64_t size;                          /* Size in memory */
+    uint64_t len;                           /* Size in the file */
+    uint64_t link;
+    uint64_t entSize;
+};
+
+/* A row of the current line sequence */
+struct row
+{
+    uint32_t addr;
+    uint32_t line;
+    uint32_t file;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint64_t _get( const uint8_t *p, int n, bool isBE )
+
+/* Get an n byte unsigned value in the given endianness */
+
+{
+    uint64_t v = 0;
+
+    for ( int i = 0; i < n; i++ )
+    {
+        v |= ( uint64_t )p[isBE ? i : n - 1 - i] << ( 8 * ( n - 1 - i ) );
+    }
+
+    return v;
+}
+// ====================================================================================================
+static uint64_t _u( struct cursor *c, int n )
+
+{
+    uint64_t v;
+
+    if ( ( c->err ) || ( c->end - c->p < n ) )
+    {
+        c->err = true;
+        return 0;
+    }
+
+    v = _get( c->p, n, c->isBE );
+    c->p += n;
+    return v;
+}
+// ====================================================================================================
+static uint64_t _uleb( struct cursor *c )
+
+{
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+
+    do
+    {
+        if ( ( c->err ) || ( c->p >= c->end ) )
+        {
+            c->err = true;
+            return 0;
+        }
+
+        b = *c->p++;
+
+        if ( shift < 64 )
+        {
+            v |= ( uint64_t )( b & 0x7f ) << shift;
+        }
+
+        shift += 7;
+    }
+    while ( b & 0x80 );
+
+    return v;
+}
+// ====================================================================================================
+static int64_t _sleb( struct cursor *c )
+
+{
+    int64_t v = 0;
+    int shift = 0;
+    uint8_t b;
+
+    do
+    {
+        if ( ( c->err ) || ( c->p >= c->end ) )
+        {
+            c->err = true;
+            return 0;
+        }
+
+        b = *c->p++;
+
+        if ( shift < 64 )
+        {
+            v |= ( int64_t )( b & 0x7f ) << shift;
+        }
+
+        shift += 7;
+    }
+    while ( b & 0x80 );
+
+    if ( ( shift < 64 ) && ( b & 0x40 ) )
+    {
+        v |= -( ( int64_t )1 << shift );
+    }
+
+    return v;
+}
+// ====================================================================================================
+static const char *_str( struct cursor *c )
+
+/* Return an inline string, or NULL if it isn't terminated inside the section */
+
+{
+    const uint8_t *e;
+
+    if ( ( c->err ) || ( !( e = memchr( c->p, 0, c->end - c->p ) ) ) )
+    {
+        c->err = true;
+        return NULL;
+    }
+
+    const char *s = ( const char * )c->p;
+    c->p = e + 1;
+    return s;
+}
+// ====================================================================================================
+static void _skip( struct cursor *c, uint64_t n )
+
+{
+    if ( ( c->err ) || ( ( uint64_t )( c->end - c->p ) < n ) )
+    {
+        c->err = true;
+        return;
+    }
+
+    c->p += n;
+}
+// ====================================================================================================
+static const char *_strAt( struct section *s, uint64_t ofs )
+
+/* Return a string from a string section, or NULL if the offset isn't valid */
+
+{
+    if ( ( !s->d ) || ( ofs >= s->len ) || ( !memchr( &s->d[ofs], 0, s->len - ofs ) ) )
+    {
+        return NULL;
+    }
+
+    return ( const char * )&s->d[ofs];
+}
+// ====================================================================================================
+static bool _inExec( struct elf *e, uint64_t addr )
+
+/* Is this address inside executable memory? */
+
+{
+    for ( uint32_t i = 0; i < e->execCount; i++ )
+    {
+        if ( ( addr >= e->execLow[i] ) && ( addr < e->execHigh[i] ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static bool _readForm( struct elf *e, struct cursor *c, uint64_t form, int ofsSize, uint64_t *val, const char **str )
+
+/* Read an attribute of a DWARF5 directory or file entry. Strings are returned via str, values via val */
+
+{
+    *str = NULL;
+    *val = 0;
+
+    switch ( form )
+    {
+        case DW_FORM_string:
+            *str = _str( c );
+            break;
+
+        case DW_FORM_line_strp:
+            *str = _strAt( &e->debugLineStr, _u( c, ofsSize ) );
+            break;
+
+        case DW_FORM_strp:
+            *str = _strAt( &e->debugStr, _u( c, ofsSize ) );
+            break;
+
+        case DW_FORM_udata:
+            *val = _uleb( c );
+            break;
+
+        case DW_FORM_sdata:
+            *val = _sleb( c );
+            break;
+
+        case DW_FORM_data1:
+            *val = _u( c, 1 );
+            break;
+
+        case DW_FORM_data2:
+            *val = _u( c, 2 );
+            break;
+
+        case DW_FORM_data4:
+            *val = _u( c, 4 );
+            break;
+
+        case DW_FORM_data8:
+            *val = _u( c, 8 );
+            break;
+
+        case DW_FORM_data16:
+            _skip( c, 16 );
+            break;
+
+        case DW_FORM_block:
+            _skip( c, _uleb( c ) );
+            break;
+
+        case DW_FORM_block1:
+            _skip( c, _u( c, 1 ) );
+            break;
+
+        case DW_FORM_block2:
+            _skip( c, _u( c, 2 ) );
+            break;
+
+        case DW_FORM_block4:
+            _skip( c, _u( c, 4 ) );
+            break;
+
+        default:
+            /* Not something we know how to deal with (e.g. string offsets into .debug_str_offsets) */
+            return false;
+    }
+
+    return !c->err;
+}
+// ====================================================================================================
+static char *_joinPath( const char *dir, const char *name )
+
+/* Put a directory and filename together, unless the filename is already absolute */
+
+{
+    char path[MAX_PATH_LEN];
+
+    if ( ( !dir ) || ( !*dir ) || ( *name == '/' ) )
+    {
+        return strdup( name );
+    }
+
+    snprintf( path, MAX_PATH_LEN, "%s/%s", dir, name );
+    return strdup( path );
+}
+// ====================================================================================================
+static bool _readEntryTable( struct elf *e, struct cursor *c, int ofsSize, const char ***names, uint32_t *count, uint64_t **dirIdx )
+
+/* Read a DWARF5 format-described table of directories or files */
+
+{
+    uint32_t formatCount = _u( c, 1 );
+    uint64_t type[formatCount ? formatCount : 1];
+    uint64_t form[formatCount ? formatCount : 1];
+    uint64_t val;
+    const char *str;
+
+    for ( uint32_t i = 0; i < formatCount; i++ )
+    {
+        type[i] = _uleb( c );
+        form[i] = _uleb( c );
+    }
+
+    *count = _uleb( c );
+
+    if ( ( c->err ) || ( *count > ( uint64_t )( c->end - c->p ) ) )
+    {
+        return false;
+    }
+
+    *names = ( const char ** )calloc( *count + 1, sizeof( char * ) );
+
+    if ( dirIdx )
+    {
+        *dirIdx = ( uint64_t * )calloc( *count + 1, sizeof( uint64_t ) );
+    }
+
+    for ( uint32_t n = 0; n < *count; n++ )
+    {
+        for ( uint32_t i = 0; i < formatCount; i++ )
+        {
+            if ( !_readForm( e, c, form[i], ofsSize, &val, &str ) )
+            {
+                return false;
+            }
+
+            if ( type[i] == DW_LNCT_path )
+            {
+                ( *names )[n] = str;
+            }
+            else if ( ( type[i] == DW_LNCT_directory_index ) && ( dirIdx ) )
+            {
+                ( *dirIdx )[n] = val;
+            }
+        }
+
+        if ( !( *names )[n] )
+        {
+            ( *names )[n] = "";
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _flushSequence( struct elf *e, struct row *rows, uint32_t rowCount, char **paths, uint32_t pathCount,
+                            ElfDwarfLineCB lineCB, void *ctx )
+
+/* Report a complete sequence, as long as it describes code that actually made it into the image */
+
+{
+    if ( ( rowCount < 2 ) || ( !_inExec( e, rows[0].addr ) ) )
+    {
+        return;
+    }
+
+    for ( uint32_t i = 0; i < rowCount; i++ )
+    {
+        const char *file = ( rows[i].file < pathCount ) ? paths[rows[i].file] : "";
+        lineCB( ctx, file ? file : "", rows[i].line, rows[i].addr, i == rowCount - 1 );
+    }
+}
+// ====================================================================================================
+static bool _skipForm( struct cursor *c, uint64_t form, int addrSize, int ofsSize, uint16_t version )
+
+/* Skip over an attribute value in a DIE */
+
+{
+    switch ( form )
+    {
+        case DW_FORM_flag_present:
+        case DW_FORM_implicit_const:
+            break;
+
+        case DW_FORM_addr:
+            _skip( c, addrSize );
+            break;
+
+        case DW_FORM_ref_addr:
+            _skip( c, ( version < 3 ) ? addrSize : ofsSize );
+            break;
+
+        case DW_FORM_data1:
+        case DW_FORM_ref1:
+        case DW_FORM_flag:
+        case 0x25:                                   /* strx1 */
+        case 0x29:                                   /* addrx1 */
+            _skip( c, 1 );
+            break;
+
+        case DW_FORM_data2:
+        case DW_FORM_ref2:
+        case 0x26:                                   /* strx2 */
+        case 0x2a:                                   /* addrx2 */
+            _skip( c, 2 );
+            break;
+
+        case 0x27:                                   /* strx3 */
+        case 0x2b:                                   /* addrx3 */
+            _skip( c, 3 );
+            break;
+
+        case DW_FORM_data4:
+        case DW_FORM_ref4:
+        case 0x1c:                                   /* ref_sup4 */
+        case 0x28:                                   /* strx4 */
+        case 0x2c:                                   /* addrx4 */
+            _skip( c, 4 );
+            break;
+
+        case DW_FORM_data8:
+        case DW_FORM_ref8:
+        case DW_FORM_ref_sig8:
+        case 0x24:                                   /* ref_sup8 */
+            _skip( c, 8 );
+            break;
+
+        case DW_FORM_data16:
+            _skip( c, 16 );
+            break;
+
+        case DW_FORM_strp:
+        case DW_FORM_line_strp:
+        case DW_FORM_sec_offset:
+        case 0x1d:                                   /* strp_sup */
+            _skip( c, ofsSize );
+            break;
+
+        case DW_FORM_sdata:
+            _sleb( c );
+            break;
+
+        case DW_FORM_udata:
+        case DW_FORM_ref_udata:
+        case 0x1a:                                   /* strx */
+        case 0x1b:                                   /* addrx */
+        case 0x22:                                   /* loclistx */
+        case 0x23:                                   /* rnglistx */
+            _uleb( c );
+            break;
+
+        case DW_FORM_string:
+            _str( c );
+            break;
+
+        case DW_FORM_exprloc:
+        case DW_FORM_block:
+            _skip( c, _uleb( c ) );
+            break;
+
+        case DW_FORM_block1:
+            _skip( c, _u( c, 1 ) );
+            break;
+
+        case DW_FORM_block2:
+            _skip( c, _u( c, 2 ) );
+            break;
+
+        case DW_FORM_block4:
+            _skip( c, _u( c, 4 ) );
+            break;
+
+        case DW_FORM_indirect:
+            return _skipForm( c, _uleb( c ), addrSize, ofsSize, version );
+
+        default:
+            return false;
+    }
+
+    return !c->err;
+}
+// ====================================================================================================
+static void _readCompDirs( struct elf *e )
+
+/* The line tables of DWARF before version 5 don't carry the compilation directory, so we need to go and */
+/* find it from the compilation unit that refers to each table. Only the first DIE of each unit is read. */
+
+{
+    struct cursor c = { .p = e->debugInfo.d, .end = e->debugInfo.d + e->debugInfo.len, .isBE = e->isBE };
+    uint64_t abbrevOfs, code, stmtList, val;
+    const char *compDir, *str;
+    uint8_t addrSize, unitType = 0;
+
+    if ( ( !e->debugInfo.d ) || ( !e->debugAbbrev.d ) )
+    {
+        return;
+    }
+
+    while ( ( !c.err ) && ( c.p < c.end ) )
+    {
+        uint64_t len = _u( &c, 4 );
+
+        if ( ( c.err ) || ( len == 0xffffffff ) || ( len > ( uint64_t )( c.end - c.p ) ) )
+        {
+            return;
+        }
+
+        struct cursor u = { .p = c.p, .end = c.p + len, .isBE = e->isBE };
+        c.p += len;
+
+        uint16_t version = _u( &u, 2 );
+
+        if ( version >= 5 )
+        {
+            unitType  = _u( &u, 1 );
+            addrSize  = _u( &u, 1 );
+            abbrevOfs = _u( &u, 4 );
+
+            if ( ( unitType == DW_UT_skeleton ) || ( unitType == DW_UT_split_compile ) )
+            {
+                _skip( &u, 8 );
+            }
+            else if ( unitType != 1 )
+            {
+                continue;
+            }
+        }
+        else
+        {
+            abbrevOfs = _u( &u, 4 );
+            addrSize  = _u( &u, 1 );
+        }
+
+        code = _uleb( &u );
+
+        if ( ( u.err ) || ( version < 2 ) || ( version > 5 ) || ( abbrevOfs >= e->debugAbbrev.len ) )
+        {
+            continue;
+        }
+
+        /* Find the abbreviation for this DIE */
+        struct cursor a = { .p = e->debugAbbrev.d + abbrevOfs, .end = e->debugAbbrev.d + e->debugAbbrev.len, .isBE = e->isBE };
+        uint64_t acode, attr, form;
+
+        while ( ( !a.err ) && ( ( acode = _uleb( &a ) ) ) && ( acode != code ) )
+        {
+            _uleb( &a );
+            _u( &a, 1 );
+
+            do
+            {
+                attr = _uleb( &a );
+                form = _uleb( &a );
+
+                if ( form == DW_FORM_implicit_const )
+                {
+                    _sleb( &a );
+                }
+            }
+            while ( ( !a.err ) && ( attr || form ) );
+        }
+
+        if ( ( a.err ) || ( acode != code ) )
+        {
+            continue;
+        }
+
+        _uleb( &a );
+        _u( &a, 1 );
+
+        /* ...and run through its attributes looking for the two we want */
+        compDir  = NULL;
+        stmtList = 0xffffffffffffffffULL;
+
+        while ( ( !a.err ) && ( !u.err ) )
+        {
+            attr = _uleb( &a );
+            form = _uleb( &a );
+
+            if ( ( !attr ) && ( !form ) )
+            {
+                break;
+            }
+
+            if ( form == DW_FORM_implicit_const )
+            {
+                _sleb( &a );
+                continue;
+            }
+
+            if ( ( attr == DW_AT_comp_dir ) && ( ( form == DW_FORM_string ) || ( form == DW_FORM_strp ) || ( form == DW_FORM_line_strp ) ) )
+            {
+                _readForm( e, &u, form, 4, &val, &str );
+                compDir = str;
+            }
+            else if ( ( attr == DW_AT_stmt_list ) && ( ( form == DW_FORM_sec_offset ) || ( form == DW_FORM_data4 ) ) )
+            {
+                stmtList = _u( &u, 4 );
+            }
+            else if ( !_skipForm( &u, form, addrSize, 4, version ) )
+            {
+                break;
+            }
+        }
+
+        if ( ( compDir ) && ( stmtList != 0xffffffffffffffffULL ) )
+        {
+            e->compDirLine = ( uint64_t * )realloc( e->compDirLine, sizeof( uint64_t ) * ( e->compDirCount + 1 ) );
+            e->compDir = ( const char ** )realloc( e->compDir, sizeof( char * ) * ( e->compDirCount + 1 ) );
+            e->compDirLine[e->compDirCount] = stmtList;
+            e->compDir[e->compDirCount] = compDir;
+            e->compDirCount++;
+        }
+    }
+}
+// ====================================================================================================
+static const char *_compDirFor( struct elf *e, uint64_t lineOfs )
+
+/* Return the compilation directory for the line table at this offset, if we know it */
+
+{
+    for ( uint32_t i = 0; i < e->compDirCount; i++ )
+    {
+        if ( e->compDirLine[i] == lineOfs )
+        {
+            return e->compDir[i];
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _readLineUnit( struct elf *e, struct cursor *u, uint64_t unitOfs, ElfDwarfLineCB lineCB, void *ctx )
+
+/* Read one line number program unit, from just after its length field to the end of the unit */
+
+{
+    const int ofsSize = 4;                           /* Only 32 bit DWARF gets this far */
+    uint16_t version = _u( u, 2 );
+    uint8_t minInstLen, lineRange, opcodeBase;
+    int8_t lineBase;
+    uint8_t stdLen[256] = { 0 };
+    struct cursor prog;
+    bool ok = false;
+
+    const char **dirs = NULL;
+    uint32_t dirCount = 0;
+    const char **files = NULL;
+    uint64_t *fileDir = NULL;
+    uint32_t fileCount = 0;
+    uint32_t fileBase;
+    char **paths = NULL;
+    uint32_t pathCount = 0;
+    char **dirPaths = NULL;
+
+    struct row *rows = NULL;
+    uint32_t rowCount = 0;
+    uint32_t rowSize = 0;
+
+    if ( ( version < 2 ) || ( version > 5 ) )
+    {
+        /* Skip units we don't understand rather than giving up on everything */
+        return true;
+    }
+
+    if ( version >= 5 )
+    {
+        _u( u, 1 );                                  /* Address size...we get this from set_address anyway */
+        _u( u, 1 );                                  /* Segment selector size */
+    }
+
+    uint64_t headerLen = _u( u, ofsSize );
+
+    if ( ( u->err ) || ( headerLen > ( uint64_t )( u->end - u->p ) ) )
+    {
+        return false;
+    }
+
+    prog.p     = u->p + headerLen;
+    prog.end   = u->end;
+    prog.isBE  = u->isBE;
+    prog.err   = false;
+
+    minInstLen = _u( u, 1 );
+
+    if ( version >= 4 )
+    {
+        _u( u, 1 );                                  /* Maximum operations per instruction, 1 for non-VLIW */
+    }
+
+    _u( u, 1 );                                      /* default_is_stmt */
+    lineBase   = ( int8_t )_u( u, 1 );
+    lineRange  = _u( u, 1 );
+    opcodeBase = _u( u, 1 );
+
+    if ( ( u->err ) || ( !lineRange ) || ( !opcodeBase ) )
+    {
+        return false;
+    }
+
+    for ( uint32_t i = 1; i < opcodeBase; i++ )
+    {
+        stdLen[i] = _u( u, 1 );
+    }
+
+    if ( version >= 5 )
+    {
+        /* Directories and files are described by format tables, and files are numbered from zero */
+        if ( ( !_readEntryTable( e, u, ofsSize, &dirs, &dirCount, NULL ) ) ||
+                ( !_readEntryTable( e, u, ofsSize, &files, &fileCount, &fileDir ) ) )
+        {
+            goto cleanup;
+        }
+
+        fileBase = 0;
+    }
+    else
+    {
+        /* Null terminated lists, with files numbered from one and directory zero being the compilation directory */
+        const char *str;
+        dirs = ( const char ** )calloc( 1, sizeof( char * ) );
+        dirs[dirCount++] = _compDirFor( e, unitOfs );
+
+        while ( ( ( str = _str( u ) ) ) && ( *str ) )
+        {
+            dirs = ( const char ** )realloc( dirs, sizeof( char * ) * ( dirCount + 1 ) );
+            dirs[dirCount++] = str;
+        }
+
+        while ( ( ( str = _str( u ) ) ) && ( *str ) )
+        {
+            files = ( const char ** )realloc( files, sizeof( char * ) * ( fileCount + 1 ) );
+            fileDir = ( uint64_t * )realloc( fileDir, sizeof( uint64_t ) * ( fileCount + 1 ) );
+            files[fileCount] = str;
+            fileDir[fileCount] = _uleb( u );
+            _uleb( u );
+            _uleb( u );
+            fileCount++;
+        }
+
+        if ( u->err )
+        {
+            goto cleanup;
+        }
+
+        fileBase = 1;
+    }
+
+    /* Directories other than the compilation directory may be relative to it */
+    dirPaths = ( char ** )calloc( dirCount + 1, sizeof( char * ) );
+
+    for ( uint32_t i = 0; i < dirCount; i++ )
+    {
+        dirPaths[i] = i ? _joinPath( dirPaths[0], dirs[i] ) : strdup( dirs[0] ? dirs[0] : "" );
+    }
+
+    /* Build the full path of each file once, so every row for a file carries the same pointer */
+    pathCount = fileCount + fileBase;
+    paths = ( char ** )calloc( pathCount + 1, sizeof( char * ) );
+
+    for ( uint32_t i = 0; i < fileCount; i++ )
+    {
+        paths[i + fileBase] = _joinPath( ( fileDir[i] < dirCount ) ? dirPaths[fileDir[i]] : NULL, files[i] );
+    }
+
+    /* ...and now run the line number state machine itself */
+    uint64_t addr = 0;
+    uint32_t file = 1;
+    int64_t line = 1;
+
+    while ( ( !prog.err ) && ( prog.p < prog.end ) )
+    {
+        uint8_t op = _u( &prog, 1 );
+        bool emit = false;
+        bool endSeq = false;
+
+        if ( op >= opcodeBase )
+        {
+            uint8_t adj = op - opcodeBase;
+            addr += ( adj / lineRange ) * minInstLen;
+            line += lineBase + ( adj % lineRange );
+            emit = true;
+        }
+        else if ( op == 0 )
+        {
+            uint64_t len = _uleb( &prog );
+            const uint8_t *next = prog.p + len;
+
+            if ( ( prog.err ) || ( len > ( uint64_t )( prog.end - prog.p ) ) || ( !len ) )
+            {
+                break;
+            }
+
+            switch ( _u( &prog, 1 ) )
+            {
+                case DW_LNE_end_sequence:
+                    emit = endSeq = true;
+                    break;
+
+                case DW_LNE_set_address:
+                    addr = _u( &prog, ( len - 1 > 8 ) ? 8 : len - 1 );
+                    break;
+
+                case DW_LNE_define_file:
+                    /* Obsolete, and not seen from any toolchain we care about */
+                    break;
+
+                default:
+                    break;
+            }
+
+            prog.p = next;
+        }
+        else
+        {
+            switch ( op )
+            {
+                case DW_LNS_copy:
+                    emit = true;
+                    break;
+
+                case DW_LNS_advance_pc:
+                    addr += _uleb( &prog ) * minInstLen;
+                    break;
+
+                case DW_LNS_advance_line:
+                    line += _sleb( &prog );
+                    break;
+
+                case DW_LNS_set_file:
+                    file = _uleb( &prog );
+                    break;
+
+                case DW_LNS_const_add_pc:
+                    addr += ( ( 255 - opcodeBase ) / lineRange ) * minInstLen;
+                    break;
+
+                case DW_LNS_fixed_advance_pc:
+                    addr += _u( &prog, 2 );
+                    break;
+
+                default:
+                    /* Anything else we just skip over the operands of */
+                    for ( uint32_t i = 0; i < stdLen[op]; i++ )
+                    {
+                        _uleb( &prog );
+                    }
+
+                    break;
+            }
+        }
+
+        if ( emit )
+        {
+            if ( rowCount == rowSize )
+            {
+                rowSize = rowSize ? rowSize * 2 : 64;
+                rows = ( struct row * )realloc( rows, sizeof( struct row ) * rowSize );
+            }
+
+            rows[rowCount].addr = addr;
+            rows[rowCount].line = line;
+            rows[rowCount].file = file;
+            rowCount++;
+        }
+
+        if ( endSeq )
+        {
+            _flushSequence( e, rows, rowCount, paths, pathCount, lineCB, ctx );
+            rowCount = 0;
+            addr = 0;
+            file = 1;
+            line = 1;
+        }
+    }
+
+    ok = !prog.err;
+
+cleanup:
+
+    if ( paths )
+    {
+        for ( uint32_t i = 0; i < pathCount; i++ )
+        {
+            free( paths[i] );
+        }
+    }
+
+    if ( dirPaths )
+    {
+        for ( uint32_t i = 0; i < dirCount; i++ )
+        {
+            free( dirPaths[i] );
+        }
+    }
+
+    free( dirPaths );
+    free( paths );
+    free( rows );
+    free( dirs );
+    free( files );
+    free( fileDir );
+    return ok;
+}
+// ====================================================================================================
+static bool _readLines( struct elf *e, ElfDwarfLineCB lineCB, void *ctx )
+
+/* Run through all of the units in .debug_line */
+
+{
+    struct cursor c = { .p = e->debugLine.d, .end = e->debugLine.d + e->debugLine.len, .isBE = e->isBE };
+
+    while ( c.p < c.end )
+    {
+        uint64_t len = _u( &c, 4 );
+        bool is64 = false;
+
+        if ( len == 0xffffffff )
+        {
+            len = _u( &c, 8 );
+            is64 = true;
+        }
+
+        if ( ( c.err ) || ( len > ( uint64_t )( c.end - c.p ) ) )
+        {
+            return false;
+        }
+
+        if ( is64 )
+        {
+            /* 64 bit DWARF isn't something a 32 bit target will generate */
+            return false;
+        }
+
+        struct cursor u = { .p = c.p, .end = c.p + len, .isBE = e->isBE };
+
+        if ( !_readLineUnit( e, &u, ( c.p - 4 ) - e->debugLine.d, lineCB, ctx ) )
+        {
+            return false;
+        }
+
+        c.p += len;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _readSymbols( struct elf *e, const uint8_t *sym, uint64_t symLen, uint64_t entSize,
+                          const uint8_t *str, uint64_t strLen, ElfDwarfFunctionCB fnCB, void *ctx )
+
+/* Report every defined function symbol from the symbol table */
+
+{
+    uint64_t name, value, size;
+    uint8_t info;
+    uint16_t shndx;
+
+    if ( entSize < ( e->is64 ? 24 : 16 ) )
+    {
+        return false;
+    }
+
+    for ( const uint8_t *s = sym + entSize; s + entSize <= sym + symLen; s += entSize )
+    {
+        name = _get( s, 4, e->isBE );
+
+        if ( e->is64 )
+        {
+            info  = s[4];
+            shndx = _get( &s[6], 2, e->isBE );
+            value = _get( &s[8], 8, e->isBE );
+            size  = _get( &s[16], 8, e->isBE );
+        }
+        else
+        {
+            value = _get( &s[4], 4, e->isBE );
+            size  = _get( &s[8], 4, e->isBE );
+            info  = s[12];
+            shndx = _get( &s[14], 2, e->isBE );
+        }
+
+        if ( ( ( info & 0xf ) != STT_FUNC ) || ( shndx == SHN_UNDEF ) || ( name >= strLen ) ||
+                ( !memchr( &str[name], 0, strLen - name ) ) || ( !str[name] ) )
+        {
+            continue;
+        }
+
+        /* Thumb functions have the bottom bit set to indicate the instruction set */
+        if ( e->machine == EM_ARM )
+        {
+            value &= ~1ULL;
+        }
+
+        fnCB( ctx, ( const char * )&str[name], value, size, ( info >> 4 ) == STB_GLOBAL );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _sectionHeader( struct elf *e, uint64_t shoff, uint32_t shentsize, uint32_t idx, struct shdr *sh )
+
+/* Pull out the fields of a section header, checking its contents lie inside the file */
+
+{
+    const uint8_t *s = &e->base[shoff + ( uint64_t )idx * shentsize];
+
+    sh->name = _get( &s[0], 4, e->isBE );
+    sh->type = _get( &s[4], 4, e->isBE );
+
+    if ( e->is64 )
+    {
+        sh->flags   = _get( &s[8], 8, e->isBE );
+        sh->addr    = _get( &s[16], 8, e->isBE );
+        sh->ofs     = _get( &s[24], 8, e->isBE );
+        sh->size    = _get( &s[32], 8, e->isBE );
+        sh->link    = _get( &s[40], 4, e->isBE );
+        sh->entSize = _get( &s[56], 8, e->isBE );
+    }
+    else
+    {
+        sh->flags   = _get( &s[8], 4, e->isBE );
+        sh->addr    = _get( &s[12], 4, e->isBE );
+        sh->ofs     = _get( &s[16], 4, e->isBE );
+        sh->size    = _get( &s[20], 4, e->isBE );
+        sh->link    = _get( &s[24], 4, e->isBE );
+        sh->entSize = _get( &s[36], 4, e->isBE );
+    }
+
+    /* Sections with no content in the file (e.g. .bss) still have a size in memory */
+    sh->len = ( sh->type == SHT_NOBITS ) ? 0 : sh->size;
+
+    if ( sh->type == SHT_NOBITS )
+    {
+        sh->ofs = 0;
+    }
+
+    return ( sh->ofs <= e->len ) && ( sh->len <= e->len - sh->ofs );
+}
+// ====================================================================================================
+static bool _readElf( struct elf *e, ElfDwarfFunctionCB fnCB, ElfDwarfLineCB lineCB, void *ctx )
+
+/* Find our way around the section headers and pull out what we need */
+
+{
+    const uint8_t *h = e->base;
+    uint64_t shoff;
+    uint32_t shentsize, shnum, shstrndx;
+    const uint8_t *sym = NULL, *symStr = NULL;
+    uint64_t symLen = 0, symStrLen = 0, symEntSize = 0;
+
+    if ( ( e->len < 0x40 ) || ( memcmp( h, "\177ELF", 4 ) ) || ( h[4] < 1 ) || ( h[4] > 2 ) || ( h[5] < 1 ) || ( h[5] > 2 ) )
+    {
+        return false;
+    }
+
+    e->is64    = ( h[4] == 2 );
+    e->isBE    = ( h[5] == 2 );
+    e->machine = _get( &h[18], 2, e->isBE );
+
+    shoff     = _get( &h[e->is64 ? 0x28 : 0x20], e->is64 ? 8 : 4, e->isBE );
+    shentsize = _get( &h[e->is64 ? 0x3a : 0x2e], 2, e->isBE );
+    shnum     = _get( &h[e->is64 ? 0x3c : 0x30], 2, e->isBE );
+    shstrndx  = _get( &h[e->is64 ? 0x3e : 0x32], 2, e->isBE );
+
+    if ( ( shentsize < ( e->is64 ? 64 : 40 ) ) || ( shoff > e->len ) || ( ( uint64_t )shnum * shentsize > e->len - shoff ) || ( shstrndx >= shnum ) )
+    {
+        return false;
+    }
+
+    struct shdr sh, link;
+
+    if ( !_sectionHeader( e, shoff, shentsize, shstrndx, &sh ) )
+    {
+        return false;
+    }
+
+    struct section shstr = { .d = &e->base[sh.ofs], .len = sh.len };
+
+    e->execLow  = ( uint64_t * )calloc( shnum, sizeof( uint64_t ) );
+    e->execHigh = ( uint64_t * )calloc( shnum, sizeof( uint64_t ) );
+
+    for ( uint32_t i = 0; i < shnum; i++ )
+    {
+        if ( !_sectionHeader( e, shoff, shentsize, i, &sh ) )
+        {
+            return false;
+        }
+
+        const char *name = _strAt( &shstr, sh.name );
+        struct section *target = NULL;
+
+        if ( ( sh.flags & ( SHF_ALLOC | SHF_EXECINSTR ) ) == ( SHF_ALLOC | SHF_EXECINSTR ) )
+        {
+            e->execLow[e->execCount]  = sh.addr;
+            e->execHigh[e->execCount] = sh.addr + sh.size;
+            e->execCount++;
+        }
+
+        if ( ( sh.type == SHT_SYMTAB ) && ( sh.link < shnum ) && ( _sectionHeader( e, shoff, shentsize, sh.link, &link ) ) )
+        {
+            sym        = &e->base[sh.ofs];
+            symLen     = sh.len;
+            symEntSize = sh.entSize;
+            symStr     = &e->base[link.ofs];
+            symStrLen  = link.len;
+        }
+
+        if ( !name )
+        {
+            continue;
+        }
+
+        if ( !strcmp( name, ".debug_line" ) )
+        {
+            target = &e->debugLine;
+        }
+        else if ( !strcmp( name, ".debug_str" ) )
+        {
+            target = &e->debugStr;
+        }
+        else if ( !strcmp( name, ".debug_line_str" ) )
+        {
+            target = &e->debugLineStr;
+        }
+        else if ( !strcmp( name, ".debug_info" ) )
+        {
+            target = &e->debugInfo;
+        }
+        else if ( !strcmp( name, ".debug_abbrev" ) )
+        {
+            target = &e->debugAbbrev;
+        }
+
+        if ( target )
+        {
+            if ( sh.flags & SHF_COMPRESSED )
+            {
+                genericsReport( V_DEBUG, "Compressed debug section %s not supported" EOL, name );
+                return false;
+            }
+
+            target->d   = &e->base[sh.ofs];
+            target->len = sh.len;
+        }
+    }
+
+    /* Without both of these there's nothing useful we can do, unless we've only been asked for functions */
+    if ( ( !sym ) || ( ( lineCB ) && ( !e->debugLine.d ) ) )
+    {
+        return false;
+    }
+
+    if ( !lineCB )
+    {
+        return _readSymbols( e, sym, symLen, symEntSize, symStr, symStrLen, fnCB, ctx );
+    }
+
+    _readCompDirs( e );
+    return _readSymbols( e, sym, symLen, symEntSize, symStr, symStrLen, fnCB, ctx ) && _readLines( e, lineCB, ctx );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool ElfDwarfLoad( const char *filename, ElfDwarfFunctionCB fnCB, ElfDwarfLineCB lineCB, void *ctx )
+
+/* Read the functions and line table from the named elf, calling back for each entry found */
+
+{
+    struct elf e = { 0 };
+    struct stat st;
+    bool ok;
+    int fd;
+
+    if ( ( fd = open( filename, O_RDONLY ) ) < 0 )
+    {
+        return false;
+    }
+
+    if ( ( fstat( fd, &st ) != 0 ) || ( !st.st_size ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    e.len  = st.st_size;
+    e.base = mmap( NULL, e.len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( e.base == MAP_FAILED )
+    {
+        return false;
+    }
+
+    ok = _readElf( &e, fnCB, lineCB, ctx );
+
+    munmap( ( void * )e.base, e.len );
+    free( e.execLow );
+    free( e.execHigh );
+    free( e.compDirLine );
+    free( e.compDir );
+    return ok;
+}
+// ====================================================================================================
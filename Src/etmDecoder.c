@@ -34,12 +34,146 @@ enum ETMDecoderPumpEvent
 
 static char *_protoNames[] = {ETM_PROTO_NAME_LIST};
 
+/* Most atoms that can be reported in one go (limited by the width of disposition) */
+#define MAX_BATCHED_ATOMS (32)
+
 // ====================================================================================================
 static void _stateChange( struct ETMDecoder *i, enum ETMchanges c )
 {
     i->cpu.changeRecord |= ( 1 << c );
 }
 // ====================================================================================================
+static inline bool _decodeAtoms( uint8_t c, uint8_t *eatoms, uint8_t *natoms, uint32_t *disposition )
+
+/* Decode a non-cycle-accurate P-header, returning false if this isn't one */
+
+{
+    if ( ( c & 0b10000011 ) == 0b10000000 )
+    {
+        /* Format-1 P-header */
+        *eatoms = ( c & 0x3C ) >> 2;
+        *natoms = ( c & ( 1 << 6 ) ) ? 1 : 0;
+
+        /* Put a 1 in each element of disposition if was executed */
+        *disposition = ( 1 << *eatoms ) - 1;
+        return true;
+    }
+
+    if ( ( c & 0b11110011 ) == 0b10000010 )
+    {
+        /* Format-2 P-header */
+        *eatoms = ( ( c & ( 1 << 2 ) ) == 0 ) + ( ( c & ( 1 << 3 ) ) == 0 );
+        *natoms = 2 - *eatoms;
+
+        *disposition = ( ( c & ( 1 << 3 ) ) == 0 ) |
+                       ( ( ( c & ( 1 << 2 ) ) == 0 ) << 1 );
+        return true;
+    }
+
+    return false;
+}
+// ====================================================================================================
+static const uint8_t *_huntSync( struct ETMDecoder *i, const uint8_t *buf, const uint8_t *end )
+
+/* While unsynced only the 0x80 at the end of an A-Sync can change anything, so skip to the next one, */
+/* leaving the count of zeros as if every byte on the way had been pumped.                            */
+
+{
+    const uint8_t *c = ( const uint8_t * )memchr( buf, 0x80, end - buf );
+    const uint8_t *z;
+
+    c = c ? c : end;
+
+    for ( z = c; ( z > buf ) && ( !z[-1] ); z-- );
+
+    i->asyncCount = ( z == buf ) ? i->asyncCount + ( c - buf ) : c - z;
+    return c;
+}
+// ====================================================================================================
+static const uint8_t *_pumpAtomRun( struct ETMDecoder *i, const uint8_t *buf, const uint8_t *end, etmDecodeCB cb, genericsReportCB report, void *d )
+
+/* Fast path for consecutive P-headers while idle. Consumes atoms until a byte that isn't one is found, */
+/* leaving that for the general state machine. If batching is enabled then the atoms for a whole run   */
+/* are reported with a single callback, otherwise there is one callback per P-header as normal.        */
+
+{
+    struct ETMCPUState *cpu = &i->cpu;
+    const uint8_t *start = buf;
+    uint8_t eatoms, natoms;
+    uint32_t disposition;
+
+    /* Accumulated state for a batch */
+    uint8_t be = 0, bn = 0;
+    uint32_t bdisp = 0;
+
+    while ( ( buf < end ) && ( _decodeAtoms( *buf, &eatoms, &natoms, &disposition ) ) )
+    {
+        buf++;
+        cpu->instCount += eatoms + natoms;
+
+        if ( !i->batchAtoms )
+        {
+            cpu->eatoms = eatoms;
+            cpu->natoms = natoms;
+            cpu->disposition = disposition;
+            _stateChange( i, EV_CH_ENATOMS );
+
+            if ( report )
+            {
+                report( V_DEBUG, "PHdr (%02x E=%d, N=%d)" EOL, *( buf - 1 ), eatoms, natoms );
+            }
+
+            cb( d );
+            continue;
+        }
+
+        if ( !( eatoms + natoms ) )
+        {
+            continue;
+        }
+
+        if ( be + bn + eatoms + natoms > MAX_BATCHED_ATOMS )
+        {
+            /* No more room in this batch, so send it and start another */
+            cpu->eatoms = be;
+            cpu->natoms = bn;
+            cpu->disposition = bdisp;
+            _stateChange( i, EV_CH_ENATOMS );
+            cb( d );
+            be = bn = 0;
+            bdisp = 0;
+        }
+
+        /* Dispositions are consumed lsb first, so later atoms go above the ones already here */
+        bdisp |= disposition << ( be + bn );
+        be += eatoms;
+        bn += natoms;
+    }
+
+    if ( be + bn )
+    {
+        cpu->eatoms = be;
+        cpu->natoms = bn;
+        cpu->disposition = bdisp;
+        _stateChange( i, EV_CH_ENATOMS );
+
+        if ( report )
+        {
+            report( V_DEBUG, "PHdr run (E=%d, N=%d)" EOL, be, bn );
+        }
+
+        cb( d );
+    }
+
+    /* None of the bytes in a run are zero, so any A-Sync accumulation is broken */
+    if ( buf != start )
+    {
+        i->asyncCount = 0;
+    }
+
+    return buf;
+}
+// ====================================================================================================
 static void _ETMDecoderPumpAction( struct ETMDecoder *i, uint8_t c, etmDecodeCB cb, genericsReportCB report, void *d )
 
 /* Pump next byte into the protocol decoder */
@@ -295,42 +429,16 @@ static void _ETMDecoderPumpAction( struct ETMDecoder *i, uint8_t c, etmDecodeCB
                 {
                     if ( !i->cycleAccurate )
                     {
-                        if ( ( c & 0b10000011 ) == 0b10000000 )
+                        if ( _decodeAtoms( c, &cpu->eatoms, &cpu->natoms, &cpu->disposition ) )
                         {
-                            /* Format-1 P-header */
-                            cpu->eatoms = ( c & 0x3C ) >> 2;
-                            cpu->natoms = ( c & ( 1 << 6 ) ) ? 1 : 0;
+                            /* Format-1 or Format-2 P-header */
                             cpu->instCount += cpu->eatoms + cpu->natoms;
-
-                            /* Put a 1 in each element of disposition if was executed */
-                            cpu->disposition = ( 1 << cpu->eatoms ) - 1;
                             _stateChange( i, EV_CH_ENATOMS );
                             retVal = ETM_EV_MSG_RXED;
 
                             if ( report )
                             {
-                                report( V_DEBUG, "PHdr FMT1 (%02x E=%d, N=%d)" EOL, c, cpu->eatoms, cpu->natoms );
-                            }
-
-                            break;
-                        }
-
-                        if ( ( c & 0b11110011 ) == 0b10000010 )
-                        {
-                            /* Format-2 P-header */
-                            cpu->eatoms = ( ( c & ( 1 << 2 ) ) == 0 ) + ( ( c & ( 1 << 3 ) ) == 0 );
-                            cpu->natoms = 2 - cpu->eatoms;
-
-                            cpu->disposition = ( ( c & ( 1 << 3 ) ) == 0 ) |
-                                               ( ( ( c & ( 1 << 2 ) ) == 0 ) << 1 );
-
-                            _stateChange( i, EV_CH_ENATOMS );
-                            cpu->instCount += cpu->eatoms + cpu->natoms;
-                            retVal = ETM_EV_MSG_RXED;
-
-                            if ( report )
-                            {
-                                report( V_DEBUG, "PHdr FMT2 (E=%d, N=%d)" EOL, cpu->eatoms, cpu->natoms );
+                                report( V_DEBUG, "PHdr (%02x E=%d, N=%d)" EOL, c, cpu->eatoms, cpu->natoms );
                             }
 
                             break;
@@ -940,6 +1048,14 @@ void ETMDecodeUsingAltAddrEncode( struct ETMDecoder *i, bool usingAltAddrEncodeS
     i->usingAltAddrEncode = usingAltAddrEncodeSet;
 }
 // ====================================================================================================
+void ETMDecoderBatchAtoms( struct ETMDecoder *i, bool batchAtomsSet )
+
+/* Report runs of consecutive atoms (up to 32 of them) with a single callback */
+
+{
+    i->batchAtoms = batchAtomsSet;
+}
+// ====================================================================================================
 
 void ETMDecoderZeroStats( struct ETMDecoder *i )
 
@@ -983,12 +1099,58 @@ void ETMDecoderForceSync( struct ETMDecoder *i, bool isSynced )
     }
 }
 // ====================================================================================================
-void ETMDecoderPump( struct ETMDecoder *i, uint8_t *buf, int len, etmDecodeCB cb, genericsReportCB report, void *d )
+void ETMDecoderPump( struct ETMDecoder *i, const uint8_t *buf, int len, etmDecodeCB cb, genericsReportCB report, void *d )
 
 {
-    while ( len-- )
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+
+    while ( p < end )
     {
-        _ETMDecoderPumpAction( i, *( buf++ ), cb, report, d );
+        /* Atoms are the bulk of the flow, so bypass the state machine for runs of them when we can. */
+        /* An A-Sync can end with what looks like a P-header, so leave that case to the slow path.   */
+        if ( ( i->p == ETM_IDLE ) && ( i->rxedISYNC ) && ( !i->cycleAccurate ) && ( i->asyncCount < 5 ) )
+        {
+            if ( ( p = _pumpAtomRun( i, p, end, cb, report, d ) ) == end )
+            {
+                break;
+            }
+        }
+
+        if ( ( i->p == ETM_UNSYNCED ) && ( ( p = _huntSync( i, p, end ) ) == end ) )
+        {
+            break;
+        }
+
+        _ETMDecoderPumpAction( i, *p++, cb, report, d );
     }
 }
 // ====================================================================================================
+size_t ETMDecoderFindSync( const uint8_t *buf, size_t len, size_t from )
+
+/* Find the first A-Sync at or after from that's followed straight away by an I-Sync, so a decoder */
+/* started there from nothing is in step with one which has decoded everything before it.        */
+/* Returns the offset of the start of the A-Sync, or len if there isn't one.                      */
+
+{
+    size_t zeros = 0;
+
+    for ( size_t p = from; p + 1 < len; p++ )
+    {
+        if ( !buf[p] )
+        {
+            zeros++;
+            continue;
+        }
+
+        if ( ( zeros >= 5 ) && ( buf[p] == 0x80 ) && ( ( buf[p + 1] == 0b00001000 ) || ( buf[p + 1] == 0b01110000 ) ) )
+        {
+            return p - 5;
+        }
+
+        zeros = 0;
+    }
+
+    return len;
+}
+// ====================================================================================================
@@ -7,9 +7,34 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "ext_fileformats.h"
 
-#define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
+#define SORT_MIN_RUN        (32768)                 /* Fewest entries worth sorting in a thread of their own */
+#define SORT_MAX_THREADS    (8)                     /* Most threads to sort with */
+#define WRITE_BUFFER_LEN    (1024*1024)             /* Output is written in blocks this big */
+
+/* A part of a list to be sorted */
+struct sortRun
+{
+    void **base;                                    /* Start of run */
+    uint32_t n;                                     /* ...number of entries in it */
+    int ( *cmp )( const void *, const void * );     /* How to order them */
+    pthread_t thread;                               /* Thread sorting it */
+    bool threaded;                                  /* ...if it's got one */
+};
+
+/* Compressed ids (from 1) given to file or function indices as they're first written */
+struct nameIds
+{
+    uint32_t *id;                                   /* Id for each index, zero if it's not been written yet */
+    uint32_t count;                                 /* ...number of indices covered */
+    uint32_t special[~SPECIALS_MASK + 1];           /* Ids for special indices */
+    uint32_t next;                                  /* Last id given out */
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -20,104 +45,278 @@
 // ====================================================================================================
 static int _inst_sort_fn( const void *a, const void *b )
 
-/* Sort instructions by address */
+/* Sort instructions by file, then function, then address */
 
 {
-    return ( int )( ( ( struct execEntryHash * )a )->addr ) - ( int )( ( ( struct execEntryHash * )b )->addr );
+    const struct execEntryHash *ia = *( const struct execEntryHash * const * )a;
+    const struct execEntryHash *ib = *( const struct execEntryHash * const * )b;
+
+    if ( ia->fileindex != ib->fileindex )
+    {
+        return ( ia->fileindex < ib->fileindex ) ? -1 : 1;
+    }
+
+    if ( ia->functionindex != ib->functionindex )
+    {
+        return ( ia->functionindex < ib->functionindex ) ? -1 : 1;
+    }
+
+    return ( ia->addr < ib->addr ) ? -1 : ( ia->addr > ib->addr );
 }
 // ====================================================================================================
 static int _calls_src_sort_fn( const void *a, const void *b )
 
-/* Sort instructions by called from address */
+/* Sort calls by calling file and function, then called function, then calling address */
 
 {
-    int i;
+    const struct subcall *sa = *( const struct subcall * const * )a;
+    const struct subcall *sb = *( const struct subcall * const * )b;
+
+    if ( sa->srch->fileindex != sb->srch->fileindex )
+    {
+        return ( sa->srch->fileindex < sb->srch->fileindex ) ? -1 : 1;
+    }
 
-    if ( ( i = ( int )( ( ( struct subcall * )a )->srch->functionindex ) - ( int )( ( ( struct subcall * )b )->srch->functionindex ) ) )
+    if ( sa->srch->functionindex != sb->srch->functionindex )
     {
-        return i;
+        return ( sa->srch->functionindex < sb->srch->functionindex ) ? -1 : 1;
     }
 
-    return ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex );
+    if ( sa->dsth->functionindex != sb->dsth->functionindex )
+    {
+        return ( sa->dsth->functionindex < sb->dsth->functionindex ) ? -1 : 1;
+    }
+
+    return ( sa->sig.src < sb->sig.src ) ? -1 : ( sa->sig.src > sb->sig.src );
 }
 // ====================================================================================================
-#if 0 // Not used for now, but left here in case its useful later...
-static int _calls_dst_sort_fn( const void *a, const void *b )
+static void *_sortRun( void *p )
 
-/* Sort instructions by called to address */
+{
+    struct sortRun *r = ( struct sortRun * )p;
+
+    qsort( r->base, r->n, sizeof( void * ), r->cmp );
+    return NULL;
+}
+// ====================================================================================================
+static void _sortPointers( void **l, uint32_t n, int ( *cmp )( const void *, const void * ) )
+
+/* Sort a list of pointers. Big lists are split into runs which are sorted in parallel, then merged */
 
 {
-    int i;
+    struct sortRun run[SORT_MAX_THREADS];
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    uint32_t runs = n / SORT_MIN_RUN;
+    void **t, **from, **to;
+
+    runs = ( runs > cpus ) ? ( ( cpus > 0 ) ? cpus : 1 ) : runs;
+    runs = ( runs > SORT_MAX_THREADS ) ? SORT_MAX_THREADS : runs;
+
+    if ( ( runs < 2 ) || ( !( t = ( void ** )malloc( sizeof( void * ) * n ) ) ) )
+    {
+        qsort( l, n, sizeof( void * ), cmp );
+        return;
+    }
+
+    for ( uint32_t i = 0; i < runs; i++ )
+    {
+        run[i].base = &l[( uint64_t )n * i / runs];
+        run[i].n    = ( uint64_t )n * ( i + 1 ) / runs - ( uint64_t )n * i / runs;
+        run[i].cmp  = cmp;
+
+        run[i].threaded = ( i ) && ( !pthread_create( &run[i].thread, NULL, _sortRun, &run[i] ) );
+    }
+
+    /* The first run, and any that couldn't get a thread, are done here */
+    for ( uint32_t i = 0; i < runs; i++ )
+    {
+        if ( !run[i].threaded )
+        {
+            _sortRun( &run[i] );
+        }
+    }
+
+    for ( uint32_t i = 1; i < runs; i++ )
+    {
+        if ( run[i].threaded )
+        {
+            pthread_join( run[i].thread, NULL );
+        }
+    }
+
+    /* Merge neighbouring runs, back and forth between the lists, until there's only one */
+    from = l;
+    to = t;
+
+    while ( runs > 1 )
+    {
+        uint32_t m = 0;
+
+        for ( uint32_t i = 0; i < runs; i += 2 )
+        {
+            void **d = &to[run[i].base - from];
+            void **a = run[i].base, **ae = a + run[i].n;
+            void **b = ( i + 1 < runs ) ? run[i + 1].base : ae;
+            void **be = ( i + 1 < runs ) ? b + run[i + 1].n : ae;
+
+            run[m].base = d;
+            run[m].n = ( ae - a ) + ( be - b );
+            m++;
+
+            while ( ( a < ae ) && ( b < be ) )
+            {
+                *d++ = ( cmp( b, a ) < 0 ) ? *b++ : *a++;
+            }
+
+            memcpy( d, a, sizeof( void * ) * ( ae - a ) );
+            memcpy( d + ( ae - a ), b, sizeof( void * ) * ( be - b ) );
+        }
+
+        runs = m;
+        to = from;
+        from = run[0].base;
+    }
 
-    if ( ( i = ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex ) ) )
+    if ( from != l )
     {
-        return i;
+        memcpy( l, from, sizeof( void * ) * n );
     }
 
-    return ( int )( ( ( struct subcall * )a )->srch->functionindex ) - ( int )( ( ( struct subcall * )b )->srch->functionindex );
+    free( t );
 }
-#endif
 // ====================================================================================================
+static struct subcall **_sortedCalls( struct callGraph *calls )
+
+/* Get a list of the calls in order of calling function, for the caller to free. It's NULL terminated */
+
+{
+    uint32_t n = CallGraphCount( calls );
+    struct subcall **l = ( struct subcall ** )malloc( sizeof( struct subcall * ) * ( n + 1 ) );
+
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        l[i] = CallGraphGet( calls, i );
+    }
+
+    _sortPointers( ( void ** )l, n, _calls_src_sort_fn );
+    l[n] = NULL;
+    return l;
+}
 // ====================================================================================================
+static struct execEntryHash **_sortedInsts( struct execEntryHash *insthead )
+
+/* Get a list of the instructions grouped by file and function, for the caller to free. It's NULL terminated */
+
+{
+    uint32_t n = HASH_COUNT( insthead ), i = 0;
+    struct execEntryHash **l = ( struct execEntryHash ** )malloc( sizeof( struct execEntryHash * ) * ( n + 1 ) );
+
+    for ( struct execEntryHash *f = insthead; f; f = f->hh.next )
+    {
+        l[i++] = f;
+    }
+
+    _sortPointers( ( void ** )l, n, _inst_sort_fn );
+    l[n] = NULL;
+    return l;
+}
 // ====================================================================================================
-// Externally available routines
+static uint32_t *_nameId( struct nameIds *ids, uint32_t index )
+
+/* Where the compressed id for a file or function index is kept, zero until it's been given one */
+
+{
+    if ( ( index & SPECIALS_MASK ) == SPECIALS_MASK )
+    {
+        return &ids->special[index & ~SPECIALS_MASK];
+    }
+
+    if ( index >= ids->count )
+    {
+        uint32_t count = index + 1 + ids->count;
+        ids->id = ( uint32_t * )realloc( ids->id, sizeof( uint32_t ) * count );
+        memset( &ids->id[ids->count], 0, sizeof( uint32_t ) * ( count - ids->count ) );
+        ids->count = count;
+    }
+
+    return &ids->id[index];
+}
 // ====================================================================================================
+static void _outputName( FILE *c, const char *tag, struct nameIds *ids, uint32_t index, const char *prefix, const char *name )
+
+/* Write a callgrind name specification, with its name the first time it's used and just its id after that */
+
+{
+    uint32_t *id = _nameId( ids, index );
+
+    if ( *id )
+    {
+        fprintf( c, "%s=(%u)\n", tag, *id );
+    }
+    else
+    {
+        *id = ++ids->next;
+        fprintf( c, "%s=(%u) %s%s\n", tag, *id, prefix, name );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
 // ====================================================================================================
 // ====================================================================================================
-
 // ====================================================================================================
 // ====================================================================================================
 // Dot support
 // ====================================================================================================
 // ====================================================================================================
-bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss )
+bool ext_ff_outputDot( char *dotfile, struct callGraph *calls, struct SymbolSet *ss )
 
 /* Output call graph to dot file */
 
 {
     FILE *c;
-    uint32_t functionidx, dfunctionidx, fileidx;
+    uint32_t functionidx, dfunctionidx;
+    const char *file, *dfile;
     uint64_t cnt;
-    struct subcall *s;
+    struct subcall **sorted, **s;
 
-    if ( !dotfile )
+    if ( ( !dotfile ) || ( !( c = fopen( dotfile, "w" ) ) ) )
     {
         return false;
     }
 
-    /* Sort according to addresses visited. */
+    setvbuf( c, NULL, _IOFBF, WRITE_BUFFER_LEN );
+    fputs( "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n", c );
 
-    c = fopen( dotfile, "w" );
-    fprintf( c, "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n" );
-
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    s = subcallList;
+    /* Sort according to calling and called function, so each pair can be totalled */
+    sorted = _sortedCalls( calls );
 
     /* Now go through and label the arrows... */
+    s = sorted;
 
-    s = subcallList;
-
-    while ( s )
+    while ( *s )
     {
-        functionidx = s->srch->functionindex;
-        fileidx = s->srch->fileindex;
-
-        dfunctionidx = s->dsth->functionindex;
-        cnt = s->count;
-        s = s->hh.next;
-
-        while ( ( s ) && ( functionidx == s->srch->functionindex ) && ( dfunctionidx == s->dsth->functionindex ) )
+        functionidx  = ( *s )->srch->functionindex;
+        dfunctionidx = ( *s )->dsth->functionindex;
+        file         = SymbolFilename( ss, ( *s )->srch->fileindex );
+        dfile        = SymbolFilename( ss, ( *s )->dsth->fileindex );
+        cnt = ( *s )->count;
+        s++;
+
+        while ( ( *s ) && ( functionidx == ( *s )->srch->functionindex ) && ( dfunctionidx == ( *s )->dsth->functionindex ) )
         {
-            cnt += s->count;
-            s = s->hh.next;
+            cnt += ( *s )->count;
+            s++;
         }
 
-        fprintf( c, "    \"\n(%s)\n%s\n\n\" -- ", SymbolFilename( ss, fileidx ), SymbolFunction( ss, functionidx ) );
-        fprintf( c, "\"\n(%s)\n%s\n\n\" [label=%" PRIu64 ", weight=0.1 ];\n", SymbolFilename( ss, fileidx ), SymbolFunction( ss, dfunctionidx ), cnt );
+        fprintf( c, "    \"\n(%s)\n%s\n\n\" -- ", file, SymbolFunction( ss, functionidx ) );
+        fprintf( c, "\"\n(%s)\n%s\n\n\" [label=%" PRIu64 ", weight=0.1 ];\n", dfile, SymbolFunction( ss, dfunctionidx ), cnt );
     }
 
-    fprintf( c, "}\n" );
+    fputs( "}\n", c );
     fclose( c );
+    free( sorted );
     return true;
 }
 // ====================================================================================================
@@ -126,12 +325,14 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
 // ====================================================================================================
 // ====================================================================================================
 bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
-                           struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss )
+                           struct execEntryHash *insthead, struct callGraph *calls, struct SymbolSet *ss )
 
-/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList */
+/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in calls */
 
 {
-    struct nameEntry n;
+    struct nameIds files = { 0 };
+    struct nameIds fns = { 0 };
+    const char *prefix = deleteMaterial ? deleteMaterial : "";
     uint32_t prevfile = NO_FILE;
     uint32_t prevfn   = NO_FUNCTION;
     uint32_t prevaddr = NO_FUNCTION;
@@ -140,22 +341,21 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     char *d = deleteMaterial;
     FILE *c;
 
-    if ( !profile )
+    if ( ( !profile ) || ( !( c = fopen( profile, "w" ) ) ) )
     {
         return false;
     }
 
-
-    c = fopen( profile, "w" );
-    fprintf( c, "# callgrind format\n" );
+    setvbuf( c, NULL, _IOFBF, WRITE_BUFFER_LEN );
+    fputs( "# callgrind format\n", c );
 
     if ( includeVisits )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n" );
+        fputs( "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n", c );
     }
     else
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n" );
+        fputs( "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n", c );
     }
 
     /* Samples are in time order, so we can determine the extent of time.... */
@@ -180,45 +380,48 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     /* ...and record whatever elffilename we ended up with */
     fprintf( c, "ob=%s\n", e );
 
-    HASH_SORT( insthead, _inst_sort_fn );
-    struct execEntryHash *f = insthead;
+    /* Instructions are grouped by file and function, so each name is only given when it changes, */
+    /* and in full only the first time. Positions within a function are relative to the last one. */
+    struct execEntryHash **insts = _sortedInsts( insthead );
 
-    while ( f )
+    for ( struct execEntryHash **l = insts; *l; l++ )
     {
-        SymbolLookup( ss, f->addr, &n );
+        struct execEntryHash *f = *l;
 
-        if ( prevfile != n.fileindex )
+        if ( prevfile != f->fileindex )
         {
-            fprintf( c, "fl=(%u) %s%s\n", n.fileindex & HANDLE_MASK, deleteMaterial  ? deleteMaterial : "", SymbolFilename( ss, n.fileindex ) );
+            _outputName( c, "fl", &files, f->fileindex, prefix, SymbolFilename( ss, f->fileindex ) );
+            prevfn = NO_FUNCTION;
         }
 
-        if ( prevfn != n.functionindex )
+        if ( prevfn != f->functionindex )
         {
-            fprintf( c, "fn=(%u) %s\n", n.functionindex & HANDLE_MASK, SymbolFunction( ss, n.functionindex ) );
+            _outputName( c, "fn", &fns, f->functionindex, "", SymbolFunction( ss, f->functionindex ) );
+            prevaddr = NO_FUNCTION;
         }
 
         if ( ( prevline == NO_LINE ) || ( prevaddr == NO_FUNCTION ) )
         {
-            fprintf( c, "0x%08x %d ", f->addr, n.line );
+            fprintf( c, "0x%08x %d ", f->addr, f->line );
         }
         else
         {
             if ( prevaddr == f->addr )
             {
-                fprintf( c, "* " );
+                fputs( "* ", c );
             }
             else
             {
                 fprintf( c, "%s%d ", f->addr > prevaddr ? "+" : "", ( int )f->addr - prevaddr );
             }
 
-            if ( prevline == n.line )
+            if ( prevline == f->line )
             {
-                fprintf( c, "* " );
+                fputs( "* ", c );
             }
             else
             {
-                fprintf( c, "%s%d ", n.line > prevline ? "+" : "", ( int )n.line - prevline );
+                fprintf( c, "%s%d ", f->line > prevline ? "+" : "", ( int )f->line - prevline );
             }
         }
 
@@ -231,34 +434,37 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
             fprintf( c, "%" PRIu64 "\n", f->count );
         }
 
-
-        prevline = n.line;
+        prevline = f->line;
         prevaddr = f->addr;
-        prevfile = n.fileindex;
-        prevfn = n.functionindex;
-        f = f->hh.next;
+        prevfile = f->fileindex;
+        prevfn = f->functionindex;
     }
 
-    fprintf( c, "\n\n## ------------------- Calls Follow ------------------------\n" );
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    struct subcall *s = subcallList;
+    free( insts );
 
-    while ( s )
+    fputs( "\n\n## ------------------- Calls Follow ------------------------\n", c );
+    struct subcall **sorted = _sortedCalls( calls );
+
+    for ( struct subcall **l = sorted; *l; l++ )
     {
-        /* Now publish the call destination. By definition is is known, so can be shortformed */
+        struct subcall *s = *l;
+
+        /* Now publish the call source and destination. Both will usually be known, so can be shortformed */
         if ( prevfile != s->srch->fileindex )
         {
-            fprintf( c, "fl=(%u)\n", s->srch->fileindex & HANDLE_MASK );
+            _outputName( c, "fl", &files, s->srch->fileindex, prefix, SymbolFilename( ss, s->srch->fileindex ) );
             prevfile = s->srch->fileindex;
+            prevfn = NO_FUNCTION;
         }
 
         if ( prevfn != s->srch->functionindex )
         {
-            fprintf( c, "fn=(%u)\n", s->srch->functionindex & HANDLE_MASK );
+            _outputName( c, "fn", &fns, s->srch->functionindex, "", SymbolFunction( ss, s->srch->functionindex ) );
             prevfn = s->srch->functionindex;
         }
 
-        fprintf( c, "cfl=(%d)\ncfn=(%d)\n", s->dsth->fileindex, s->dsth->functionindex );
+        _outputName( c, "cfl", &files, s->dsth->fileindex, prefix, SymbolFilename( ss, s->dsth->fileindex ) );
+        _outputName( c, "cfn", &fns, s->dsth->functionindex, "", SymbolFunction( ss, s->dsth->functionindex ) );
         fprintf( c, "calls=%" PRIu64 " 0x%08x %d\n", s->count, s->sig.dst, s->dsth->line );
 
         if ( includeVisits )
@@ -269,10 +475,11 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
         {
             fprintf( c, "0x%08x %d %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost );
         }
-
-        s = s->hh.next;
     }
 
+    free( sorted );
+    free( files.id );
+    free( fns.id );
     fclose( c );
 
     return true;
@@ -0,0 +1,652 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * File Source
+ * ===========
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "fileSource.h"
+
+#define FILE_SOURCE_BUFFER_LEN (64*1024)   /* Size of buffer used when the file can't be mapped */
+#define FILE_SOURCE_MAX_SPAN   (1U<<30)    /* Longest span handed out at once, so it fits the decoder lengths */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _remap( struct fileSource *f )
+
+/* Pick up anything that's been added to the file since it was last mapped */
+
+{
+    struct stat s;
+    void *m;
+
+    if ( ( fstat( f->fd, &s ) < 0 ) || ( ( size_t )s.st_size <= f->len ) )
+    {
+        return;
+    }
+
+    if ( ( m = mmap( NULL, s.st_size, PROT_READ, MAP_PRIVATE, f->fd, 0 ) ) == MAP_FAILED )
+    {
+        return;
+    }
+
+    madvise( m, s.st_size, MADV_SEQUENTIAL );
+
+    if ( f->map )
+    {
+        munmap( ( void * )f->map, f->len );
+    }
+
+    f->map = ( const uint8_t * )m;
+    f->len = s.st_size;
+}
+// ====================================================================================================
+static ssize_t _readFully( struct fileSource *f, void *buffer, size_t len )
+
+/* Read until len bytes have arrived or the file ends. Returns what was read, or -1 on an error */
+
+{
+    size_t got = 0;
+    ssize_t t;
+
+    while ( got < len )
+    {
+        if ( ( t = read( f->fd, ( uint8_t * )buffer + got, len - got ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        if ( !t )
+        {
+            break;
+        }
+
+        got += t;
+    }
+
+    return got;
+}
+// ====================================================================================================
+static bool _detect( struct fileSource *f )
+
+/* Find out if this is a capture file. Returns false if there isn't enough of the file to tell yet */
+
+{
+    size_t have;
+    ssize_t t;
+
+    if ( f->mapped )
+    {
+        _remap( f );
+        have = ( f->len < CAPTURE_MAGIC_LEN ) ? f->len : CAPTURE_MAGIC_LEN;
+
+        /* Anything that starts like a capture file has to be long enough to be sure it is one */
+        if ( ( !f->len ) || ( ( f->len < sizeof( struct captureFileHeader ) ) && ( !memcmp( f->map, CAPTURE_MAGIC, have ) ) ) )
+        {
+            return false;
+        }
+
+        f->capture = CaptureIsCapture( f->map, f->len );
+    }
+    else
+    {
+        /* The start of the file has to be read to look at it, so keep hold of it in case it's data */
+        if ( ( t = _readFully( f, f->buffer, sizeof( struct captureFileHeader ) ) ) < 0 )
+        {
+            t = 0;
+        }
+
+        f->capture = CaptureIsCapture( f->buffer, t );
+        f->pending = f->capture ? 0 : t;
+    }
+
+    if ( f->capture )
+    {
+        f->created = ( ( const struct captureFileHeader * )( f->mapped ? f->map : f->buffer ) )->created;
+
+        if ( f->mapped )
+        {
+            f->pos = sizeof( struct captureFileHeader );
+        }
+    }
+
+    f->detected = true;
+    return true;
+}
+// ====================================================================================================
+static const struct captureChunk *_chunkAt( struct fileSource *f, uint64_t pos, bool whole )
+
+/* Get the chunk at pos in a mapped capture, if it's all there */
+
+{
+    const struct captureChunk *c = ( const struct captureChunk * )&f->map[pos];
+
+    if ( ( pos + sizeof( struct captureChunk ) > f->len ) || ( c->magic != CAPTURE_CHUNK_MAGIC ) ||
+            ( ( whole ) && ( pos + sizeof( struct captureChunk ) + c->len > f->len ) ) )
+    {
+        return NULL;
+    }
+
+    return c;
+}
+// ====================================================================================================
+static int _nextMappedChunk( struct fileSource *f )
+
+/* Move on to the next data chunk in a mapped capture. Returns 1 when there is one, */
+/* 0 if it's not been written yet (or the capture is over) and -1 if it's damaged   */
+
+{
+    const struct captureChunk *c;
+
+    while ( true )
+    {
+        if ( !( c = _chunkAt( f, f->pos, false ) ) )
+        {
+            _remap( f );
+
+            if ( !( c = _chunkAt( f, f->pos, false ) ) )
+            {
+                /* Either it's not arrived yet, or this is the trailer at the end */
+                return ( ( f->pos + sizeof( uint32_t ) > f->len ) ||
+                         ( *( const uint32_t * )&f->map[f->pos] == CAPTURE_CHUNK_MAGIC ) ||
+                         ( *( const uint32_t * )&f->map[f->pos] == CAPTURE_TRAILER_MAGIC ) ) ? 0 : -1;
+            }
+        }
+
+        if ( c->type == CAPTURE_CHUNK_DATA )
+        {
+            if ( c->compression != CAPTURE_COMPRESS_NONE )
+            {
+                return -1;
+            }
+
+            f->remain = c->len;
+            f->offset = c->offset;
+            f->tstamp = c->tstamp;
+            f->pos += sizeof( struct captureChunk );
+            return 1;
+        }
+
+        /* Anything else is stepped over, but only once it's all there */
+        if ( f->pos + sizeof( struct captureChunk ) + c->len > f->len )
+        {
+            _remap( f );
+
+            if ( f->pos + sizeof( struct captureChunk ) + ( ( const struct captureChunk * )&f->map[f->pos] )->len > f->len )
+            {
+                return 0;
+            }
+
+            c = ( const struct captureChunk * )&f->map[f->pos];
+        }
+
+        f->pos += sizeof( struct captureChunk ) + c->len;
+    }
+}
+// ====================================================================================================
+static int _nextReadChunk( struct fileSource *f )
+
+/* Move on to the next data chunk in a capture that's being read, with the same returns as above */
+
+{
+    struct captureChunk c;
+    ssize_t t;
+
+    while ( true )
+    {
+        if ( ( t = _readFully( f, &c, sizeof( c ) ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( ( !t ) || ( ( t >= ( ssize_t )sizeof( uint32_t ) ) && ( c.magic == CAPTURE_TRAILER_MAGIC ) ) )
+        {
+            return 0;
+        }
+
+        if ( ( t != sizeof( c ) ) || ( c.magic != CAPTURE_CHUNK_MAGIC ) )
+        {
+            return -1;
+        }
+
+        if ( c.type == CAPTURE_CHUNK_DATA )
+        {
+            if ( c.compression != CAPTURE_COMPRESS_NONE )
+            {
+                return -1;
+            }
+
+            f->remain = c.len;
+            f->offset = c.offset;
+            f->tstamp = c.tstamp;
+            return 1;
+        }
+
+        /* Step over anything else */
+        while ( c.len )
+        {
+            if ( ( t = _readFully( f, f->buffer, ( c.len < FILE_SOURCE_BUFFER_LEN ) ? c.len : FILE_SOURCE_BUFFER_LEN ) ) <= 0 )
+            {
+                return t;
+            }
+
+            c.len -= t;
+        }
+    }
+}
+// ====================================================================================================
+static uint64_t _nextData( struct fileSource *f, uint64_t pos )
+
+/* Find the first data chunk at or after pos in a mapped capture, or return 0 if there isn't one */
+
+{
+    const struct captureChunk *c;
+
+    while ( ( c = _chunkAt( f, pos, false ) ) && ( c->type != CAPTURE_CHUNK_DATA ) )
+    {
+        pos += sizeof( struct captureChunk ) + c->len;
+    }
+
+    return c ? pos : 0;
+}
+// ====================================================================================================
+static uint64_t _indexedStart( struct fileSource *f, bool byTime, uint64_t key )
+
+/* Use the index, if the capture was closed properly, to find a data chunk that starts at or before key */
+
+{
+    const struct captureTrailer *t;
+    const struct captureChunk *c;
+    const struct captureIndexEntry *e;
+    uint32_t n;
+
+    if ( f->len < sizeof( struct captureFileHeader ) + sizeof( struct captureTrailer ) )
+    {
+        return 0;
+    }
+
+    t = ( const struct captureTrailer * )&f->map[f->len - sizeof( struct captureTrailer )];
+
+    if ( t->magic != CAPTURE_TRAILER_MAGIC )
+    {
+        return 0;
+    }
+
+    /* Walk back through the indexes until one starts early enough */
+    for ( uint64_t p = t->lastIndex; ( p ) && ( c = _chunkAt( f, p, true ) ) && ( c->type == CAPTURE_CHUNK_INDEX ); p = c->offset )
+    {
+        e = ( const struct captureIndexEntry * )( c + 1 );
+        n = c->len / sizeof( struct captureIndexEntry );
+
+        if ( ( n ) && ( ( byTime ? e[0].tstamp : e[0].offset ) <= key ) )
+        {
+            while ( ( byTime ? e[n - 1].tstamp : e[n - 1].offset ) > key )
+            {
+                n--;
+            }
+
+            return e[n - 1].pos;
+        }
+    }
+
+    return 0;
+}
+// ====================================================================================================
+static bool _seekCapture( struct fileSource *f, bool byTime, uint64_t key )
+
+/* Position a mapped capture at the data chunk containing key */
+
+{
+    const struct captureChunk *c;
+    uint64_t cur, next, skip;
+
+    if ( !( cur = _indexedStart( f, byTime, key ) ) )
+    {
+        cur = sizeof( struct captureFileHeader );
+    }
+
+    if ( !( cur = _nextData( f, cur ) ) )
+    {
+        /* There's no data, so leave the file where it is */
+        return true;
+    }
+
+    /* Hop forward over any chunks which start early enough, for anything the index doesn't cover */
+    while ( true )
+    {
+        c = _chunkAt( f, cur, false );
+
+        if ( ( !( next = _nextData( f, cur + sizeof( struct captureChunk ) + c->len ) ) ) ||
+                ( ( byTime ? _chunkAt( f, next, false )->tstamp : _chunkAt( f, next, false )->offset ) > key ) )
+        {
+            break;
+        }
+
+        cur = next;
+    }
+
+    f->pos = cur;
+    f->remain = 0;
+
+    /* An offset can be hit exactly, inside the chunk that holds it */
+    if ( ( !byTime ) && ( key > c->offset ) )
+    {
+        skip = ( key - c->offset > c->len ) ? c->len : key - c->offset;
+        f->pos = cur + sizeof( struct captureChunk ) + skip;
+        f->remain = c->len - skip;
+        f->offset = c->offset + skip;
+        f->tstamp = c->tstamp;
+
+        /* The whole of this chunk may not be there yet */
+        if ( f->pos > f->len )
+        {
+            f->remain += f->pos - f->len;
+            f->pos = f->len;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool FileSourceOpen( struct fileSource *f, const char *filename )
+
+/* Open a file for input, mapping it if it's a regular file */
+
+{
+    struct stat s;
+
+    memset( f, 0, sizeof( struct fileSource ) );
+
+    if ( ( f->fd = open( filename, O_RDONLY ) ) < 0 )
+    {
+        return false;
+    }
+
+    if ( ( fstat( f->fd, &s ) == 0 ) && ( S_ISREG( s.st_mode ) ) )
+    {
+        /* An empty file can't be mapped yet, that will happen once there's something in it */
+        f->mapped = true;
+        _detect( f );
+    }
+    else
+    {
+        /* ...and what something we can't map is will be found when it's first read */
+        f->buffer = ( uint8_t * )malloc( FILE_SOURCE_BUFFER_LEN );
+    }
+
+    return true;
+}
+// ====================================================================================================
+ssize_t FileSourceGet( struct fileSource *f, const uint8_t **data, size_t maxLen )
+
+/* Get the next span of the file, of up to maxLen bytes (0 for as much as there is). The span is */
+/* valid until the next call. Returns the length of the span, 0 at the end of the file, or -1 on */
+/* an error.                                                                                    */
+
+{
+    size_t n;
+    ssize_t t;
+    int c;
+
+    if ( !maxLen )
+    {
+        maxLen = FILE_SOURCE_MAX_SPAN;
+    }
+
+    if ( ( !f->detected ) && ( !_detect( f ) ) )
+    {
+        return 0;
+    }
+
+    if ( !f->mapped )
+    {
+        *data = f->buffer;
+
+        if ( f->pending )
+        {
+            /* Hand out what was read while finding out what the file is, pos is where we are in it */
+            t = ( f->pending < maxLen ) ? f->pending : maxLen;
+            *data = &f->buffer[f->pos];
+            f->pos += t;
+            f->pending -= t;
+            return t;
+        }
+
+        if ( f->capture )
+        {
+            if ( ( !f->remain ) && ( ( c = _nextReadChunk( f ) ) <= 0 ) )
+            {
+                return c;
+            }
+
+            if ( maxLen > f->remain )
+            {
+                maxLen = f->remain;
+            }
+        }
+
+        do
+        {
+            t = read( f->fd, f->buffer, ( maxLen < FILE_SOURCE_BUFFER_LEN ) ? maxLen : FILE_SOURCE_BUFFER_LEN );
+        }
+        while ( ( t < 0 ) && ( errno == EINTR ) );
+
+        if ( ( f->capture ) && ( t > 0 ) )
+        {
+            f->remain -= t;
+            f->offset += t;
+        }
+
+        return t;
+    }
+
+    if ( f->capture )
+    {
+        if ( ( !f->remain ) && ( ( c = _nextMappedChunk( f ) ) <= 0 ) )
+        {
+            return c;
+        }
+
+        if ( maxLen > f->remain )
+        {
+            maxLen = f->remain;
+        }
+    }
+
+    if ( f->pos >= f->len )
+    {
+        /* See if the file has grown while we weren't looking */
+        _remap( f );
+
+        if ( f->pos >= f->len )
+        {
+            return 0;
+        }
+    }
+
+    n = f->len - f->pos;
+
+    if ( n > maxLen )
+    {
+        n = maxLen;
+    }
+
+    *data = &f->map[f->pos];
+    f->pos += n;
+
+    if ( f->capture )
+    {
+        f->remain -= n;
+        f->offset += n;
+    }
+
+    return n;
+}
+// ====================================================================================================
+const uint8_t *FileSourceMap( struct fileSource *f, size_t *len )
+
+/* Get the whole of the file, for random access. This is the file as it is, including the framing */
+/* of a capture file. NULL if it isn't mapped, or there's nothing in it.                          */
+
+{
+    if ( f->mapped )
+    {
+        _remap( f );
+    }
+
+    *len = f->len;
+    return f->map;
+}
+// ====================================================================================================
+void FileSourceRewind( struct fileSource *f )
+
+/* Go back to the start of the file, where that's possible */
+
+{
+    f->pos = f->capture ? sizeof( struct captureFileHeader ) : 0;
+    f->remain = 0;
+    f->offset = 0;
+
+    if ( !f->mapped )
+    {
+        if ( lseek( f->fd, 0, SEEK_SET ) == 0 )
+        {
+            f->detected = false;
+            f->pending = 0;
+        }
+    }
+}
+// ====================================================================================================
+bool FileSourceSeekOffset( struct fileSource *f, uint64_t offset )
+
+/* Move to an offset in the stream, which is the same as the offset in the file unless it's a capture */
+
+{
+    if ( ( !f->mapped ) || ( ( !f->detected ) && ( !_detect( f ) ) ) )
+    {
+        return false;
+    }
+
+    if ( f->capture )
+    {
+        return _seekCapture( f, false, offset );
+    }
+
+    _remap( f );
+    f->pos = ( offset > f->len ) ? f->len : offset;
+    return true;
+}
+// ====================================================================================================
+bool FileSourceSeekTime( struct fileSource *f, uint64_t tstamp )
+
+/* Move to the data chunk that was being received at tstamp (in uS since the epoch), for captures only */
+
+{
+    if ( ( !f->mapped ) || ( ( !f->detected ) && ( !_detect( f ) ) ) || ( !f->capture ) )
+    {
+        return false;
+    }
+
+    return _seekCapture( f, true, tstamp );
+}
+// ====================================================================================================
+bool FileSourceSeek( struct fileSource *f, const char *where )
+
+/* Move to a place given by the user, which is one of;         */
+/*   @<offset>       Byte offset in the stream                  */
+/*   +<seconds>      Time since the capture was started         */
+/*   <hh:mm:ss[.s]>  Time of day, on or after the capture start */
+
+{
+    unsigned int h, m;
+    double s;
+    char *e;
+    time_t t;
+    struct tm tm;
+    uint64_t tstamp;
+
+    if ( *where == '@' )
+    {
+        uint64_t offset = strtoull( where + 1, &e, 0 );
+        return ( where[1] ) && ( !*e ) && FileSourceSeekOffset( f, offset );
+    }
+
+    /* Everything else is a time, which needs the capture header to go from */
+    if ( ( !f->mapped ) || ( ( !f->detected ) && ( !_detect( f ) ) ) || ( !f->capture ) )
+    {
+        return false;
+    }
+
+    if ( *where == '+' )
+    {
+        s = strtod( where + 1, &e );
+        return ( where[1] ) && ( !*e ) && ( s >= 0 ) && FileSourceSeekTime( f, f->created + ( uint64_t )( s * 1000000 ) );
+    }
+
+    if ( ( sscanf( where, "%u:%u:%lf", &h, &m, &s ) != 3 ) || ( h > 23 ) || ( m > 59 ) || ( s < 0 ) || ( s >= 60 ) )
+    {
+        return false;
+    }
+
+    /* Work from local midnight on the day the capture started */
+    t = f->created / 1000000;
+    localtime_r( &t, &tm );
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    tstamp = ( uint64_t )mktime( &tm ) * 1000000 + ( ( h * 3600 + m * 60 ) * 1000000ULL ) + ( uint64_t )( s * 1000000 );
+
+    /* A time of day before the capture started must be from the day after */
+    if ( tstamp < f->created - ( f->created % 1000000 ) )
+    {
+        tstamp += 24 * 3600 * 1000000ULL;
+    }
+
+    return FileSourceSeekTime( f, tstamp );
+}
+// ====================================================================================================
+void FileSourceClose( struct fileSource *f )
+
+{
+    if ( f->map )
+    {
+        munmap( ( void * )f->map, f->len );
+    }
+
+    if ( f->fd >= 0 )
+    {
+        close( f->fd );
+    }
+
+    free( f->buffer );
+    memset( f, 0, sizeof( struct fileSource ) );
+    f->fd = -1;
+}
+// ====================================================================================================
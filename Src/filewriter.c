@@ -11,6 +11,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <libgen.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "itmDecoder.h"
 #include "generics.h"
@@ -22,18 +26,50 @@ enum fwState { FW_STATE_CLOSED, FW_STATE_GETNAMEA, FW_STATE_GETNAMEE, FW_STATE_U
 #define MAX_STRLEN 4096
 #define MAX_CONCAT_FILENAMELEN (MAX_STRLEN)
 
+#define FW_RING_LEN     (256*1024)  /* Data held for each open file on its way out, a power of 2 */
+#define FW_FLUSH_LEN    (64*1024)   /* Amount held that gets the write-behind thread going early */
+#define FW_FLUSH_MS     (100)       /* Longest data are held before being written out */
+#define FW_FULL_WAIT_US (1000)      /* Time to wait for room when a file's ring is full */
+
+/* An open file and the data on their way to it. The decode side puts data in the ring and the */
+/* write-behind thread takes them out, so neither waits for the other.                          */
+struct fwOutput
+{
+    struct fwOutput *next;          /* Next on the list of outputs being closed */
+    int              fd;
+    bool             failed;        /* A write to it failed, and that's been reported */
+    uint8_t         *ring;          /* Data waiting to be written, FW_RING_LEN long */
+    uint64_t         wp;            /* Bytes ever put in the ring, only changed by the decode side */
+    uint64_t         rp;            /* ...and written out, only changed by the write-behind thread */
+};
+
 static struct
 {
     struct
     {
-        enum fwState s;                     /* Current state of the handle */
-        FILE        *f;                     /* Handle for the handle */
-        char         name[MAX_FILENAMELEN]; /* Filename */
+        enum fwState     s;                     /* Current state of the handle */
+        struct fwOutput *o;                     /* Output for the handle, while it's open */
+        char             name[MAX_FILENAMELEN]; /* Filename */
     } file[FW_MAX_FILES];
 
     char            *basedir;     /* Where we are going to put everything */
+    char            *realBasedir; /* ...and where that really is, worked out once at the start */
+    enum fwSync      sync;        /* When written files are forced out to storage */
     bool             initialised; /* Have we been initialised? */
-} _f;
+
+    pthread_t        thread;      /* Write-behind thread */
+    pthread_mutex_t  lock;        /* Lock for the list of outputs being closed, and for wakeups */
+    pthread_cond_t   wake;        /* Gets the write-behind thread going before its time */
+    pthread_cond_t   closed;      /* Signalled once outputs being closed have been finished off */
+    struct fwOutput *closing;     /* Outputs the target has closed, waiting to be finished off */
+    uint32_t         numClosing;  /* ...and how many there are, including any being finished off now */
+    bool             ending;      /* Flag telling the write-behind thread to finish up */
+} _f =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .closed = PTHREAD_COND_INITIALIZER
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -42,14 +78,226 @@ static struct
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-void _processCompleteName( uint32_t n )
+static bool _writeAll( int fd, const uint8_t *d, size_t len )
+
+{
+    ssize_t w;
+
+    while ( len )
+    {
+        if ( ( w = write( fd, d, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        d += w;
+        len -= w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _drain( struct fwOutput *o )
+
+/* Write out whatever is in an output's ring. Only ever called from the write-behind thread */
+
+{
+    uint64_t wp = __atomic_load_n( &o->wp, __ATOMIC_ACQUIRE );
+    uint32_t mask = FW_RING_LEN - 1;
+    uint32_t first;
+
+    if ( wp == o->rp )
+    {
+        return;
+    }
+
+    /* It comes out in one go, or two if it wraps around the end of the ring */
+    first = ( wp - o->rp < FW_RING_LEN - ( o->rp & mask ) ) ? wp - o->rp : FW_RING_LEN - ( o->rp & mask );
+
+    if ( ( ( !_writeAll( o->fd, &o->ring[o->rp & mask], first ) ) || ( !_writeAll( o->fd, o->ring, wp - o->rp - first ) ) ) && ( !o->failed ) )
+    {
+        genericsReport( V_WARN, "Failed to write to filewriter file (%s)" EOL, strerror( errno ) );
+        o->failed = true;
+    }
+
+    if ( _f.sync == FW_SYNC_ALWAYS )
+    {
+        fdatasync( o->fd );
+    }
+
+    __atomic_store_n( &o->rp, wp, __ATOMIC_RELEASE );
+}
+// ====================================================================================================
+static void _finish( struct fwOutput *o )
+
+/* Write out the last of an output that's been closed, and be done with it */
+
+{
+    _drain( o );
+
+    if ( _f.sync != FW_SYNC_NONE )
+    {
+        fsync( o->fd );
+    }
+
+    close( o->fd );
+    free( o->ring );
+    free( o );
+}
+// ====================================================================================================
+static void *_writeBehind( void *arg )
+
+/* Write out what's been put in the rings of the open files, every so often or when there's a lot of it */
+
+{
+    struct fwOutput *c, *next, *o;
+    struct timespec until;
+    uint32_t finished;
+    bool ending;
+
+    ( void )arg;
+
+    do
+    {
+        pthread_mutex_lock( &_f.lock );
+
+        if ( ( !_f.closing ) && ( !_f.ending ) )
+        {
+            clock_gettime( CLOCK_REALTIME, &until );
+            until.tv_nsec += FW_FLUSH_MS * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait( &_f.wake, &_f.lock, &until );
+        }
+
+        c = _f.closing;
+        _f.closing = NULL;
+        ending = _f.ending;
+        pthread_mutex_unlock( &_f.lock );
+
+        /* Anything closed goes first. Nothing is opened while it's waiting, so it's all out before a file is reopened */
+        for ( finished = 0; c; c = next, finished++ )
+        {
+            next = c->next;
+            _finish( c );
+        }
+
+        if ( finished )
+        {
+            pthread_mutex_lock( &_f.lock );
+            _f.numClosing -= finished;
+            pthread_cond_broadcast( &_f.closed );
+            pthread_mutex_unlock( &_f.lock );
+        }
+
+        /* If one of these is closed while it's being written out, it's finished off next time round */
+        for ( uint32_t n = 0; n < FW_MAX_FILES; n++ )
+        {
+            if ( ( o = __atomic_load_n( &_f.file[n].o, __ATOMIC_ACQUIRE ) ) )
+            {
+                _drain( o );
+            }
+        }
+    }
+    while ( !ending );
+
+    return NULL;
+}
+// ====================================================================================================
+static void _put( struct fwOutput *o, const uint8_t *d, uint32_t len )
+
+/* Queue data for an open file. This only waits if the write-behind thread is a whole ring behind */
+
+{
+    uint32_t mask = FW_RING_LEN - 1;
+    uint64_t rp;
+
+    while ( o->wp + len - ( rp = __atomic_load_n( &o->rp, __ATOMIC_ACQUIRE ) ) > FW_RING_LEN )
+    {
+        pthread_cond_signal( &_f.wake );
+        usleep( FW_FULL_WAIT_US );
+    }
+
+    for ( uint32_t i = 0; i < len; i++ )
+    {
+        o->ring[( o->wp + i ) & mask] = d[i];
+    }
+
+    /* Don't wait for the next flush if there's plenty to be getting on with */
+    if ( ( o->wp - rp < FW_FLUSH_LEN ) && ( o->wp + len - rp >= FW_FLUSH_LEN ) )
+    {
+        pthread_cond_signal( &_f.wake );
+    }
+
+    __atomic_store_n( &o->wp, o->wp + len, __ATOMIC_RELEASE );
+}
+// ====================================================================================================
+static bool _open( uint32_t n, const char *name, int flags )
+
+/* Open a file for a handle, and give it somewhere to queue its data */
+
+{
+    struct fwOutput *o;
+    int fd;
+
+    if ( ( fd = open( name, flags, 0666 ) ) < 0 )
+    {
+        return false;
+    }
+
+    o = ( struct fwOutput * )calloc( 1, sizeof( struct fwOutput ) );
+    o->fd = fd;
+    o->ring = ( uint8_t * )malloc( FW_RING_LEN );
+    __atomic_store_n( &_f.file[n].o, o, __ATOMIC_RELEASE );
+    return true;
+}
+// ====================================================================================================
+static void _close( uint32_t n )
+
+/* Hand a handle's output to the write-behind thread to be finished off */
+
+{
+    struct fwOutput *o = _f.file[n].o;
+
+    __atomic_store_n( &_f.file[n].o, NULL, __ATOMIC_RELEASE );
+
+    pthread_mutex_lock( &_f.lock );
+    o->next = _f.closing;
+    _f.closing = o;
+    _f.numClosing++;
+    pthread_cond_signal( &_f.wake );
+    pthread_mutex_unlock( &_f.lock );
+}
+// ====================================================================================================
+static void _waitClosed( void )
+
+/* Wait for anything closed to be written out, so whatever happens next to the filesystem comes after it */
+
+{
+    pthread_mutex_lock( &_f.lock );
+
+    while ( _f.numClosing )
+    {
+        pthread_cond_wait( &_f.closed, &_f.lock );
+    }
+
+    pthread_mutex_unlock( &_f.lock );
+}
+// ====================================================================================================
+static void _processCompleteName( uint32_t n )
 
 /* We got the whole name from the remote end, so process it */
 
 {
     char workingName[MAX_CONCAT_FILENAMELEN] = { 0 };
+    char dirName[MAX_CONCAT_FILENAMELEN];
     char *resolvedName;
-    char *compareName;
+    size_t baseLen;
 
     /* Concat strings */
     if ( _f.basedir )
@@ -62,24 +310,17 @@ void _processCompleteName( uint32_t n )
         strncpy( workingName, _f.file[n].name, MAX_CONCAT_FILENAMELEN - 1 );
     }
 
-    /* Make sure we haven't broken out of the current directory          */
-    /* Start by getting both the real path of the requested file and the */
-    /* real path of the current directory.                               */
-    resolvedName = realpath( dirname( workingName ), NULL );
-
-    if ( _f.basedir )
-    {
-        compareName = realpath( _f.basedir, NULL );
-    }
-    else
-    {
-        compareName = realpath( dirname( "" ), NULL );
-    }
+    /* Make sure we haven't broken out of the base directory, by getting the real path of the  */
+    /* requested file to compare with that of the base directory. dirname() can change what it */
+    /* is given, so it gets a copy.                                                            */
+    strcpy( dirName, workingName );
+    resolvedName = realpath( dirname( dirName ), NULL );
 
-    /* Now check that the first part matches, up to the length of the comparison Name */
-    bool goodDirectory = ( ( compareName != NULL ) && ( 0 == strncmp( resolvedName, compareName, strlen( compareName ) ) ) );
+    /* Now check that the first part matches, up to the length of the base directory, and that it's a whole directory */
+    baseLen = _f.realBasedir ? strlen( _f.realBasedir ) : 0;
+    bool goodDirectory = ( ( resolvedName ) && ( _f.realBasedir ) && ( 0 == strncmp( resolvedName, _f.realBasedir, baseLen ) ) &&
+                           ( ( !resolvedName[baseLen] ) || ( resolvedName[baseLen] == '/' ) || ( _f.realBasedir[baseLen - 1] == '/' ) ) );
     free( resolvedName );
-    free( compareName );
 
     if ( !goodDirectory )
     {
@@ -89,14 +330,15 @@ void _processCompleteName( uint32_t n )
 
     genericsReport( V_DEBUG, "Complete name to work with is [%s]" EOL, workingName );
 
+    /* Anything closed has to be out of the way before the file can be reopened or removed */
+    _waitClosed();
+
     /* OK, now decide what to do... */
     switch ( _f.file[n].s )
     {
         // -----------------------
         case FW_STATE_GETNAMEA:     // This is a file append operation
-            _f.file[n].f = fopen( workingName, "ab+" );
-
-            if ( _f.file[n].f )
+            if ( _open( n, workingName, O_WRONLY | O_CREAT | O_APPEND ) )
             {
                 genericsReport( V_INFO, "File [%s] opened for append" EOL, workingName, n );
                 _f.file[n].s = FW_STATE_OPEN;
@@ -112,9 +354,7 @@ void _processCompleteName( uint32_t n )
 
         // -----------------------
         case FW_STATE_GETNAMEE:     // This is a file replacement operation
-            _f.file[n].f = fopen( workingName, "wb+" );
-
-            if ( _f.file[n].f )
+            if ( _open( n, workingName, O_WRONLY | O_CREAT | O_TRUNC ) )
             {
                 genericsReport( V_INFO, "File [%s] opened for write" EOL, workingName, n );
                 _f.file[n].s = FW_STATE_OPEN;
@@ -151,7 +391,7 @@ void _processCompleteName( uint32_t n )
     }
 }
 // ====================================================================================================
-void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
+static void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
 
 /* Collect the name of the file we're going to do something with */
 
@@ -194,7 +434,7 @@ bool filewriterProcess( struct swMsg *m )
 {
     /* Split 32-bit word back into its compoenent parts without punning issues */
 
-    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value > 24 ) & 0xff};
+    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value >> 24 ) & 0xff};
 
     uint8_t c = d[0]; /* Extract the control word for convinience */
 
@@ -205,14 +445,12 @@ bool filewriterProcess( struct swMsg *m )
         case FW_CMD_OPENE:     // Open file for empty write (i.e. flush and write)
             genericsReport( V_DEBUG, "Attempt to open or create file" EOL );
 
-            if ( _f.file[FW_GET_FILEID( c )].f )
+            if ( _f.file[FW_GET_FILEID( c )].o )
             {
                 /* There was a file open, close it */
                 genericsReport( V_WARN, "Attempt to write to descriptor %d while open writing %s" EOL, FW_GET_FILEID( c ),
                                 _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
-                _f.file[FW_GET_FILEID( c )].f = NULL;
+                _close( FW_GET_FILEID( c ) );
             }
 
             memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
@@ -233,7 +471,7 @@ bool filewriterProcess( struct swMsg *m )
         // -----------------------
 
         case FW_CMD_CLOSE:     // Close file
-            if ( !_f.file[FW_GET_FILEID( c )].f )
+            if ( !_f.file[FW_GET_FILEID( c )].o )
             {
                 /* There was no file open, complain */
                 genericsReport( V_DEBUG, "Attempt to close descriptor %d while not open" EOL, FW_GET_FILEID( c ) );
@@ -241,8 +479,7 @@ bool filewriterProcess( struct swMsg *m )
             else
             {
                 genericsReport( V_INFO, "Close %s" EOL,  _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
+                _close( FW_GET_FILEID( c ) );
                 memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
                 _f.file[FW_GET_FILEID( c )].s = FW_STATE_CLOSED;
             }
@@ -281,7 +518,7 @@ bool filewriterProcess( struct swMsg *m )
                 else
                 {
                     genericsReport( V_DEBUG, "Wrote %d bytes on descriptor %d" EOL, FW_GET_BYTES( c ), FW_GET_FILEID( c ) );
-                    fwrite( &d[1], 1, FW_GET_BYTES( c ), _f.file[FW_GET_FILEID( c )].f );
+                    _put( _f.file[FW_GET_FILEID( c )].o, &d[1], FW_GET_BYTES( c ) );
                 }
             }
 
@@ -297,14 +534,57 @@ bool filewriterProcess( struct swMsg *m )
     return true;
 }
 // ====================================================================================================
-bool filewriterInit( char *basedir )
+bool filewriterInit( char *basedir, enum fwSync sync )
 
 /* Initialise the filewriter */
 
 {
-    _f.initialised = true;
     _f.basedir     = basedir;
+    _f.sync        = sync;
+
+    /* Everything opened is checked against this, so it's only worked out the once */
+    if ( !( _f.realBasedir = realpath( basedir ? basedir : ".", NULL ) ) )
+    {
+        genericsReport( V_WARN, "Filewriter base directory [%s] not found" EOL, basedir ? basedir : "." );
+    }
+
+    if ( pthread_create( &_f.thread, NULL, &_writeBehind, NULL ) )
+    {
+        genericsReport( V_ERROR, "Failed to create filewriter thread" EOL );
+        return false;
+    }
+
+    _f.initialised = true;
     genericsReport( V_DEBUG, "Filewriter initialised" EOL );
     return true;
 }
 // ====================================================================================================
+void filewriterShutdown( void )
+
+/* Close anything still open, and wait for it all to be written out */
+
+{
+    if ( !_f.initialised )
+    {
+        return;
+    }
+
+    for ( uint32_t n = 0; n < FW_MAX_FILES; n++ )
+    {
+        if ( _f.file[n].o )
+        {
+            _close( n );
+        }
+    }
+
+    pthread_mutex_lock( &_f.lock );
+    _f.ending = true;
+    pthread_cond_signal( &_f.wake );
+    pthread_mutex_unlock( &_f.lock );
+
+    pthread_join( _f.thread, NULL );
+    free( _f.realBasedir );
+    _f.realBasedir = NULL;
+    _f.initialised = false;
+}
+// ====================================================================================================
@@ -16,6 +16,18 @@
 
 #define MAX_STRLEN (4096) // Maximum length of debug string
 
+#define TRACE_BUFFER_LEN (64*1024)      /* Trace output is collected into blocks this big before it's written */
+#define TRACE_MAX_INDENT (256)          /* Deepest indent a trace line will get */
+
+enum traceLevel genericsTraceLevel = T_OFF;
+
+static struct
+{
+    FILE *f;                            /* Where the trace is going */
+    uint32_t len;                       /* How much of the buffer is filled */
+    char buffer[TRACE_BUFFER_LEN];      /* Trace waiting to be written */
+} _trace;
+
 // ====================================================================================================
 char *genericsEscape( char *str )
 
@@ -264,3 +276,78 @@ void genericsExit( int status, const char *fmt, ... )
     exit( status );
 }
 // ====================================================================================================
+void genericsTraceFlush( void )
+
+/* Write out whatever trace is waiting */
+
+{
+    if ( ( _trace.f ) && ( _trace.len ) )
+    {
+        fwrite( _trace.buffer, 1, _trace.len, _trace.f );
+        fflush( _trace.f );
+    }
+
+    _trace.len = 0;
+}
+// ====================================================================================================
+bool genericsTraceSetup( enum traceLevel l, const char *filename )
+
+/* Set the level of trace to collect, and the file it goes to (stdout if there's no name) */
+
+{
+    FILE *f = stdout;
+
+    if ( ( filename ) && ( !( f = fopen( filename, "w" ) ) ) )
+    {
+        return false;
+    }
+
+    genericsTraceFlush();
+
+    if ( ( _trace.f ) && ( _trace.f != stdout ) )
+    {
+        fclose( _trace.f );
+    }
+    else if ( !_trace.f )
+    {
+        atexit( genericsTraceFlush );
+    }
+
+    _trace.f = f;
+    genericsTraceLevel = ( l < T_MAX_TRACELEVEL ) ? l : T_MAX_TRACELEVEL - 1;
+    return true;
+}
+// ====================================================================================================
+void genericsTrace( uint32_t indent, const char *fmt, ... )
+
+/* Add a line to the trace, indented by the number of spaces given. Use GTRACE so it's only called when wanted */
+
+{
+    va_list va;
+    int n;
+
+    if ( !_trace.f )
+    {
+        return;
+    }
+
+    indent = ( indent < TRACE_MAX_INDENT ) ? indent : TRACE_MAX_INDENT;
+
+    if ( TRACE_BUFFER_LEN - _trace.len < MAX_STRLEN + TRACE_MAX_INDENT )
+    {
+        genericsTraceFlush();
+    }
+
+    memset( &_trace.buffer[_trace.len], ' ', indent );
+    _trace.len += indent;
+
+    va_start( va, fmt );
+    n = vsnprintf( &_trace.buffer[_trace.len], MAX_STRLEN, fmt, va );
+    va_end( va );
+
+    if ( n > 0 )
+    {
+        _trace.len += ( n < MAX_STRLEN ) ? n : MAX_STRLEN - 1;
+    }
+}
+// ====================================================================================================
@@ -110,7 +110,7 @@ bool ITMGetDecodedPacket( struct ITMDecoder *i, struct msg *decoded )
 static char *_protoNames[] = {PROTO_NAME_LIST};
 #endif
 
-enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
+static inline enum ITMPumpEvent _pump( struct ITMDecoder *i, uint8_t c )
 
 /* Pump next byte into the protocol decoder */
 
@@ -427,3 +427,82 @@ enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
     return retVal;
 }
 // ====================================================================================================
+enum ITMPumpEvent ITMPump( struct ITMDecoder *i, uint8_t c )
+
+/* Pump next byte into the protocol decoder */
+
+{
+    return _pump( i, c );
+}
+// ====================================================================================================
+static const uint8_t *_huntSync( struct ITMDecoder *i, const uint8_t *p, const uint8_t *end )
+
+/* While unsynced only the end of a sync (0x80), or of a stray TPIU sync that gets counted (0x7f), can */
+/* matter, so skip to the next of those a word at a time. The sync monitor is left as if every byte on */
+/* the way had been pumped.                                                                            */
+
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint8_t *start = p;
+    uint64_t w, a, b;
+
+    while ( end - p >= sizeof( w ) )
+    {
+        memcpy( &w, p, sizeof( w ) );
+        a = w ^ ( ones * ( SYNCPATTERN & 0xff ) );
+        b = w ^ ( ones * ( TPIU_SYNCPATTERN & 0xff ) );
+
+        /* Standard test for a zero byte anywhere in a word */
+        if ( ( ( ( a - ones ) & ~a ) | ( ( b - ones ) & ~b ) ) & ( ones << 7 ) )
+        {
+            break;
+        }
+
+        p += sizeof( w );
+    }
+
+    while ( ( p < end ) && ( *p != ( SYNCPATTERN & 0xff ) ) && ( *p != ( TPIU_SYNCPATTERN & 0xff ) ) )
+    {
+        p++;
+    }
+
+    for ( const uint8_t *q = ( p - start > sizeof( i->syncStat ) ) ? p - sizeof( i->syncStat ) : start; q < p; q++ )
+    {
+        i->syncStat = ( i->syncStat << 8 ) | *q;
+    }
+
+    return p;
+}
+// ====================================================================================================
+uint32_t ITMDecodeBuffer( struct ITMDecoder *i, const uint8_t *buffer, uint32_t len, struct msg *m, uint32_t maxMsgs, uint32_t *consumed )
+
+/* Decode a block of input, with complete messages decoded straight into the caller's array. Stops when the input */
+/* is exhausted or maxMsgs have been decoded. Returns the number of messages, with the input used in consumed.      */
+/* While unsynced, the input is skipped through in bulk until something that could be a sync turns up.             */
+
+{
+    const uint8_t *p = buffer;
+    const uint8_t *end = buffer + len;
+    uint32_t n = 0;
+
+    while ( ( p < end ) && ( n < maxMsgs ) )
+    {
+        if ( ( i->p == ITM_UNSYNCED ) && ( ( p = _huntSync( i, p, end ) ) == end ) )
+        {
+            break;
+        }
+
+        if ( ( ITM_EV_PACKET_RXED == _pump( i, *p++ ) ) && ( msgDecoder( &i->pk, &m[n] ) ) )
+        {
+            n++;
+        }
+    }
+
+    if ( consumed )
+    {
+        *consumed = p - buffer;
+    }
+
+    return n;
+}
+// ====================================================================================================
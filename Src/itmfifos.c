@@ -17,32 +17,91 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "git_version_info.h"
 #include "generics.h"
-#include "tpiuDecoder.h"
-#include "itmDecoder.h"
+#include "pipeline.h"
 #include "fileWriter.h"
 #include "itmfifos.h"
-#include "msgDecoder.h"
+#include "chanRing.h"
+#include "nw.h"
 
 #define MAX_STRING_LENGTH (100)              /* Maximum length that will be output from a fifo for a single event */
+#define FIFO_RING_MSGS    (4096)             /* Messages that can be queued for a channel (a power of 2) */
+#define FIFO_WRITE_LEN    (8192)             /* Output collected for a channel before it's written */
+#define MAX_FORMAT_STEPS  (16)               /* Most pieces a presentation format can be split into */
+#define FIFO_DRAIN_MS     (100)              /* Time allowed at shutdown for threads to write out what's queued */
+#define FIFO_SHM_LEN      (1024*1024)        /* Size of the shared memory ring for each channel (a power of 2) */
+#define FIFO_MAX_CLIENTS  (16)               /* Most readers of a channel published as a socket */
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
 
 struct runThreadParams                       /* Structure for parameters passed to a software task thread */
 {
     int portNo;
     int listenHandle;
-    bool permafile;
+    enum itmfifoOutput output;
     struct Channel *c;
 };
 
+/* A presentation format is split up, once, into a plan of literal text and individual conversions */
+enum fmtStepType
+{
+    FMT_LITERAL,                             /* Text copied straight out */
+    FMT_CHAR,                                /* A plain %c, which is just the byte itself */
+    FMT_SPEC                                 /* Anything else, done by snprintf */
+};
+
+enum fmtMode
+{
+    FMT_MODE_INT,                            /* Conversions are given the value */
+    FMT_MODE_FLOAT,                          /* ...the value as a float, if there's a %f anywhere */
+    FMT_MODE_CHAR                            /* ...each byte in turn, if there's a %c anywhere */
+};
+
+struct fmtStep
+{
+    enum fmtStepType type;
+    char *s;                                 /* Literal text, or conversion spec for snprintf */
+    uint32_t len;                            /* ...and its length */
+};
+
+struct fmtPlan
+{
+    enum fmtMode mode;
+    uint32_t numSteps;
+    struct fmtStep step[MAX_FORMAT_STEPS];
+};
+
 struct Channel                               /* Information for an individual channel */
 {
     char *chanName;                          /* Filename to be used for the fifo */
     char *presFormat;                        /* Format of data presentation to be used */
+    struct fmtPlan plan;                     /* ...and the plan for doing it */
 
     /* Runtime state */
     int handle;                              /* Handle to the fifo */
+    struct swMsg *ring;                      /* Software messages waiting for the thread */
+    uint32_t wp;                             /* ...next one in, only moved by the decoder */
+    uint32_t rp;                             /* ...next one out, only moved by the thread */
+    uint64_t dropped;                        /* ...and those lost because it was full */
+    bool ending;                             /* Thread is to stop */
+    bool finished;                           /* ...and has done so */
+    pthread_mutex_t lock;                    /* Lock and condition for sleeping and waking the thread */
+    pthread_cond_t wake;
+
+    /* Output state, depending on what the channel is published as */
+    int opfile;                              /* Fifo or permanent file */
+    struct chanRingWriter shm;               /* Shared memory ring */
+    int listenFd;                            /* Socket readers connect to */
+    int client[FIFO_MAX_CLIENTS];            /* ...and those that have */
+    uint32_t numClients;
+    uint64_t clientDrops;                    /* Messages not taken by a socket reader */
     pthread_t thread;                        /* Thread on which it's running */
     struct runThreadParams params;           /* Parameters for running thread */
     char *fifoName;                          /* Constructed fifo name (from chanPath and name) */
@@ -51,11 +110,7 @@ struct Channel                               /* Information for an individual ch
 struct itmfifosHandle
 
 {
-    /* The decoders and the packets from them */
-    struct ITMDecoder i;
-    struct ITMPacket h;
-    struct TPIUDecoder t;
-    struct TPIUPacket p;
+    struct pipeline p;                            /* Decoders all the way to the messages */
     enum timeDelay timeStatus;                    /* Indicator of if this time is exact */
     uint64_t timeStamp;                           /* Latest received time */
 
@@ -67,8 +122,9 @@ struct itmfifosHandle
     bool useTPIU;                                 /* Is the TPIU active? */
     bool filewriter;                              /* Is the filewriter in use? */
     bool forceITMSync;                            /* Is ITM to be forced into sync? */
-    bool permafile;                               /* Use permanent files rather than fifos */
+    enum itmfifoOutput output;                    /* What the channels are published as */
     int tpiuITMChannel;                           /* TPIU channel on which ITM appears */
+    uint32_t pendingChannels;                     /* Software channels with messages queued since their last wake */
 
     struct Channel c[NUM_CHANNELS + 1];           /* Output for each channel */
 };
@@ -83,154 +139,476 @@ struct itmfifosHandle
 // ====================================================================================================
 
 // ====================================================================================================
-// Handlers for the fifos
+// Presentation of software messages
 // ====================================================================================================
-static void *_runFifo( void *arg )
+static bool _planStep( struct fmtPlan *p, enum fmtStepType type, const char *s, uint32_t len )
 
-/* This is the control loop for the channel fifos (for each software port) */
+{
+    if ( p->numSteps == MAX_FORMAT_STEPS )
+    {
+        return false;
+    }
+
+    p->step[p->numSteps].type = type;
+    p->step[p->numSteps].s = strndup( s, len );
+    p->step[p->numSteps++].len = len;
+    return true;
+}
+// ====================================================================================================
+static void _planFree( struct fmtPlan *p )
 
 {
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    struct swMsg m;
-    uint32_t w;
+    while ( p->numSteps )
+    {
+        free( p->step[--p->numSteps].s );
+    }
+}
+// ====================================================================================================
+static void _planFormat( struct fmtPlan *p, const char *fmt )
 
-    char constructString[MAX_STRING_LENGTH];
-    int opfile;
-    size_t readDataLen, writeDataLen, written = 0;
+/* Split a presentation format into the steps that make it up. Anything that's too complicated */
+/* is left as a single step for snprintf, which is how the whole of every format used to be done */
 
-    assert( &params->c->params == params );
+{
+    const char *s = fmt;
+    const char *e;
+    bool ok = true;
 
-    /* Remove the file if it exists */
-    unlink( c->fifoName );
+    _planFree( p );
+    p->mode = strstr( fmt, "%f" ) ? FMT_MODE_FLOAT : strstr( fmt, "%c" ) ? FMT_MODE_CHAR : FMT_MODE_INT;
 
-    if ( !params->permafile )
+    while ( ( ok ) && ( *s ) )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
+        if ( *s != '%' )
         {
-            pthread_exit( NULL );
+            e = s + strcspn( s, "%" );
+            ok = _planStep( p, FMT_LITERAL, s, e - s );
         }
-    }
-
-    do
-    {
-        /* Keep on opening the file (in case the fifo is opened/closed multiple times */
-        if ( !params->permafile )
+        else if ( s[1] == '%' )
         {
-            opfile = open( c->fifoName, O_WRONLY );
+            e = s + 2;
+            ok = _planStep( p, FMT_LITERAL, s, 1 );
         }
         else
         {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+            /* Flags, width, precision and length, then the conversion itself */
+            e = s + 1 + strspn( s + 1, "-+ #0'" );
+            e += strspn( e, "0123456789*" );
+
+            if ( *e == '.' )
+            {
+                e += 1 + strspn( e + 1, "0123456789*" );
+            }
+
+            e += strspn( e, "hlLqjzt" );
+
+            if ( ( !*e ) || ( *e == 's' ) || ( *e == 'n' ) )
+            {
+                /* Not something that can be given a number, so it's just text */
+                e += ( *e != 0 );
+                ok = _planStep( p, FMT_LITERAL, s, e - s );
+            }
+            else
+            {
+                e++;
+                ok = _planStep( p, ( ( p->mode == FMT_MODE_CHAR ) && ( e - s == 2 ) && ( s[1] == 'c' ) ) ? FMT_CHAR : FMT_SPEC, s, e - s );
+            }
         }
 
-        do
+        s = e;
+    }
+
+    if ( !ok )
+    {
+        _planFree( p );
+        _planStep( p, FMT_SPEC, fmt, strlen( fmt ) );
+    }
+}
+// ====================================================================================================
+static uint32_t _planRun( const struct fmtPlan *p, const struct swMsg *m, char *op )
+
+/* Present a message according to the plan for its channel, in at most MAX_STRING_LENGTH-1 chars */
+
+{
+    uint8_t b[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
+    uint32_t reps = ( ( p->mode == FMT_MODE_CHAR ) && ( m->len > 1 ) ) ? m->len : 1;
+    uint32_t n = 0;
+    uint32_t room;
+    int t;
+    float fv;
+
+    /* Type punning on same host, only unsafe on systems where u32/float have diff byte order */
+    memcpy( &fv, &m->value, sizeof( fv ) );
+
+    for ( uint32_t r = 0; r < reps; r++ )
+    {
+        for ( uint32_t i = 0; i < p->numSteps; i++ )
         {
-            /* ....get the packet */
-            readDataLen = read( params->listenHandle, &m, sizeof( struct swMsg ) );
+            const struct fmtStep *s = &p->step[i];
 
-            if ( readDataLen <= 0 )
+            if ( !( room = MAX_STRING_LENGTH - 1 - n ) )
             {
-                continue;
+                return n;
             }
 
-            if ( c->presFormat )
+            switch ( s->type )
             {
-                // formatted output....start with specials
-                if ( strstr( c->presFormat, "%f" ) )
-                {
-                    /* type punning on same host, after correctly building 32bit val
-                     * only unsafe on systems where u32/float have diff byte order */
-                    float *nastycast = ( float * )&m.value;
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, *nastycast, *nastycast, *nastycast, *nastycast );
-                }
-                else if ( strstr( c->presFormat, "%c" ) )
-                {
-                    /* Format contains %c, so execute repeatedly for all characters in sent data */
-                    writeDataLen = 0;
-                    uint8_t op[4] = {m.value & 0xff, ( m.value >> 8 ) & 0xff, ( m.value >> 16 ) & 0xff, ( m.value >> 24 ) & 0xff};
+                case FMT_LITERAL:
+                    t = ( s->len < room ) ? s->len : room;
+                    memcpy( &op[n], s->s, t );
+                    break;
+
+                case FMT_CHAR:
+                    op[n] = b[r];
+                    t = 1;
+                    break;
+
+                default:
+                    switch ( p->mode )
+                    {
+                        case FMT_MODE_FLOAT:
+                            t = snprintf( &op[n], room + 1, s->s, fv, fv, fv, fv );
+                            break;
 
-                    uint32_t l = 0;
+                        case FMT_MODE_CHAR:
+                            t = snprintf( &op[n], room + 1, s->s, b[r], b[r], b[r], b[r] );
+                            break;
 
-                    do
-                    {
-                        writeDataLen += snprintf( &constructString[writeDataLen], MAX_STRING_LENGTH - writeDataLen, c->presFormat, op[l], op[l], op[l], op[l] );
+                        default:
+                            t = snprintf( &op[n], room + 1, s->s, m->value, m->value, m->value, m->value );
+                            break;
                     }
-                    while ( ++l < m.len );
-                }
-                else
-                {
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, m.value, m.value, m.value, m.value );
-                }
 
-                written = write( opfile, constructString, ( writeDataLen < MAX_STRING_LENGTH ) ? writeDataLen : MAX_STRING_LENGTH );
-            }
-            else
-            {
-                // raw output.
-                written = write( opfile, &w, sizeof ( w ) );
+                    t = ( t < 0 ) ? 0 : ( ( ( uint32_t )t > room ) ? room : t );
+                    break;
             }
+
+            n += t;
+        }
+    }
+
+    return n;
+}
+// ====================================================================================================
+static void _queueSW( struct Channel *c, const struct swMsg *m, bool wait )
+
+/* Add a message for a channel's thread, which is only woken once the current batch is complete */
+
+{
+    while ( c->wp - __atomic_load_n( &c->rp, __ATOMIC_ACQUIRE ) >= FIFO_RING_MSGS )
+    {
+        if ( ( !wait ) || ( c->ending ) )
+        {
+            /* Just like a full non-blocking pipe, this is lost */
+            c->dropped++;
+            return;
         }
-        while ( ( readDataLen > 0 ) && ( written > 0 ) );
 
-        close( opfile );
+        /* Permanent files don't lose data, so hang on for the thread to make room */
+        pthread_mutex_lock( &c->lock );
+        pthread_cond_signal( &c->wake );
+        pthread_mutex_unlock( &c->lock );
+        usleep( 1000 );
     }
-    while ( readDataLen > 0 );
 
-    pthread_exit( NULL );
+    c->ring[c->wp & ( FIFO_RING_MSGS - 1 )] = *m;
+    __atomic_store_n( &c->wp, c->wp + 1, __ATOMIC_RELEASE );
 }
 // ====================================================================================================
-static void *_runHWFifo( void *arg )
+static void _wakeChannels( struct itmfifosHandle *f )
 
-/* This is the control loop for the hardware fifo */
+/* Wake the threads for any channels that have had messages queued for them */
 
 {
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    int opfile;
-    size_t readDataLen = 0, writeDataLen = 0;
-    uint8_t p[MAX_STRING_LENGTH];
+    uint32_t chan;
+
+    while ( f->pendingChannels )
+    {
+        chan = __builtin_ctz( f->pendingChannels );
+        f->pendingChannels &= ~( 1U << chan );
+
+        pthread_mutex_lock( &f->c[chan].lock );
+        pthread_cond_signal( &f->c[chan].wake );
+        pthread_mutex_unlock( &f->c[chan].lock );
+    }
+}
+// ====================================================================================================
+static bool _waitChannel( struct Channel *c )
+
+/* Wait for there to be messages for this thread. Returns false once it's time to stop and they're all gone */
+
+{
+    pthread_mutex_lock( &c->lock );
+
+    while ( ( __atomic_load_n( &c->wp, __ATOMIC_ACQUIRE ) == c->rp ) && ( !c->ending ) )
+    {
+        pthread_cond_wait( &c->wake, &c->lock );
+    }
+
+    pthread_mutex_unlock( &c->lock );
+    return ( __atomic_load_n( &c->wp, __ATOMIC_ACQUIRE ) != c->rp ) || ( !c->ending );
+}
+// ====================================================================================================
+// Outputs for the channels
+// ====================================================================================================
+static bool _outputCreate( struct Channel *c )
+
+/* Make whatever it is that the channel is published as */
+
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
 
     /* Remove the file if it exists */
     unlink( c->fifoName );
 
-    if ( !params->permafile )
+    switch ( c->params.output )
+    {
+        case ITMFIFO_OUTPUT_FIFO:
+            /* This is a 'conventional' fifo, so it must be created */
+            return mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) >= 0;
+
+        case ITMFIFO_OUTPUT_SHM:
+            return ChanRingCreate( &c->shm, c->fifoName, FIFO_SHM_LEN );
+
+        case ITMFIFO_OUTPUT_SOCKET:
+            if ( strlen( c->fifoName ) >= sizeof( addr.sun_path ) )
+            {
+                return false;
+            }
+
+            strcpy( addr.sun_path, c->fifoName );
+            c->numClients = 0;
+
+            if ( ( c->listenFd = socket( AF_UNIX, SOCK_SEQPACKET, 0 ) ) < 0 )
+            {
+                return false;
+            }
+
+            fcntl( c->listenFd, F_SETFL, O_NONBLOCK );
+            return ( bind( c->listenFd, ( struct sockaddr * )&addr, sizeof( addr ) ) >= 0 ) && ( listen( c->listenFd, FIFO_MAX_CLIENTS ) >= 0 );
+
+        default:
+            return true;
+    }
+}
+// ====================================================================================================
+static void _outputOpen( struct Channel *c )
+
+/* Get ready for output, which for a fifo means waiting for something to open the other end */
+
+{
+    switch ( c->params.output )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
+        case ITMFIFO_OUTPUT_FIFO:
+            c->opfile = open( c->fifoName, O_WRONLY );
+            break;
+
+        case ITMFIFO_OUTPUT_PERMAFILE:
+            c->opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+static void _socketSend( struct Channel *c, const void *b, uint32_t len )
+
+/* Send a message to every reader of a socket, picking up any new ones first. Readers that can't */
+/* take it right now miss it, and those that have gone away are forgotten about.                */
+
+{
+    int fd;
+
+    while ( ( c->numClients < FIFO_MAX_CLIENTS ) && ( ( fd = accept( c->listenFd, NULL, NULL ) ) >= 0 ) )
+    {
+        c->client[c->numClients++] = fd;
+    }
+
+    for ( uint32_t i = 0; i < c->numClients; )
+    {
+        if ( send( c->client[i], b, len, MSG_DONTWAIT | MSG_NOSIGNAL ) < 0 )
         {
-            pthread_exit( NULL );
+            if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+            {
+                close( c->client[i] );
+                c->client[i] = c->client[--c->numClients];
+                continue;
+            }
+
+            c->clientDrops++;
         }
+
+        i++;
     }
+}
+// ====================================================================================================
+static bool _outputWrite( struct Channel *c, const void *b, uint32_t len )
 
-    do
+/* Send output on its way. Only fifos and files can fail, after which they're opened again */
+
+{
+    switch ( c->params.output )
+    {
+        case ITMFIFO_OUTPUT_SHM:
+            ChanRingWrite( &c->shm, b, len );
+            return true;
+
+        case ITMFIFO_OUTPUT_SOCKET:
+            _socketSend( c, b, len );
+            return true;
+
+        default:
+            return write( c->opfile, b, len ) > 0;
+    }
+}
+// ====================================================================================================
+static void _outputClose( struct Channel *c )
+
+{
+    if ( ( c->params.output == ITMFIFO_OUTPUT_FIFO ) || ( c->params.output == ITMFIFO_OUTPUT_PERMAFILE ) )
+    {
+        close( c->opfile );
+    }
+}
+// ====================================================================================================
+static void _outputDestroy( struct Channel *c )
+
+{
+    switch ( c->params.output )
+    {
+        case ITMFIFO_OUTPUT_SHM:
+            ChanRingDestroy( &c->shm );
+            break;
+
+        case ITMFIFO_OUTPUT_SOCKET:
+            while ( c->numClients )
+            {
+                close( c->client[--c->numClients] );
+            }
+
+            close( c->listenFd );
+            break;
+
+        default:
+            break;
+    }
+}
+// ====================================================================================================
+static bool _drainChannel( struct Channel *c )
+
+/* Present all of the messages queued for a channel, writing them out in as few goes as possible */
+
+{
+    char op[FIFO_WRITE_LEN];
+    uint32_t wp = __atomic_load_n( &c->wp, __ATOMIC_ACQUIRE );
+    uint32_t fill = 0;
+    struct swMsg *m;
+
+    while ( c->rp != wp )
     {
-        if ( !params->permafile )
+        m = &c->ring[c->rp & ( FIFO_RING_MSGS - 1 )];
+
+        if ( c->presFormat )
         {
-            opfile = open( c->fifoName, O_WRONLY );
+            fill += _planRun( &c->plan, m, &op[fill] );
         }
         else
         {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+            // raw output.
+            memcpy( &op[fill], &m->value, sizeof( m->value ) );
+            fill += sizeof( m->value );
+        }
+
+        __atomic_store_n( &c->rp, c->rp + 1, __ATOMIC_RELEASE );
+
+        if ( ( FIFO_WRITE_LEN - fill < MAX_STRING_LENGTH ) || ( c->rp == wp ) )
+        {
+            if ( !_outputWrite( c, op, fill ) )
+            {
+                return false;
+            }
+
+            fill = 0;
         }
+    }
+
+    return true;
+}
+// ====================================================================================================
+// Handlers for the fifos
+// ====================================================================================================
+static void *_runFifo( void *arg )
+
+/* This is the control loop for the channel fifos (for each software port) */
+
+{
+    struct runThreadParams *params = ( struct runThreadParams * )arg;
+    struct Channel *c = params->c;
+
+    assert( &params->c->params == params );
+
+    if ( !_outputCreate( c ) )
+    {
+        genericsReport( V_ERROR, "Could not create %s (%s)" EOL, c->fifoName, strerror( errno ) );
+        pthread_exit( NULL );
+    }
+
+    do
+    {
+        /* Keep on opening the file (in case the fifo is opened/closed multiple times */
+        _outputOpen( c );
+
+        /* ....get whatever packets have been queued, and write them out together */
+        while ( ( _waitChannel( c ) ) && ( _drainChannel( c ) ) );
+
+        _outputClose( c );
+    }
+    while ( !c->ending );
+
+    _outputDestroy( c );
+    __atomic_store_n( &c->finished, true, __ATOMIC_RELEASE );
+    pthread_exit( NULL );
+}
+// ====================================================================================================
+static void *_runHWFifo( void *arg )
+
+/* This is the control loop for the hardware fifo */
+
+{
+    struct runThreadParams *params = ( struct runThreadParams * )arg;
+    struct Channel *c = params->c;
+    ssize_t readDataLen = 0;
+    bool written = false;
+    uint8_t p[FIFO_WRITE_LEN];
+
+    if ( !_outputCreate( c ) )
+    {
+        genericsReport( V_ERROR, "Could not create %s (%s)" EOL, c->fifoName, strerror( errno ) );
+        pthread_exit( NULL );
+    }
+
+    do
+    {
+        _outputOpen( c );
 
         do
         {
             /* ....get the packet, don't worry if it can't be written */
-            readDataLen = read( params->listenHandle, p, MAX_STRING_LENGTH );
+            readDataLen = read( params->listenHandle, p, FIFO_WRITE_LEN );
 
             if ( readDataLen > 0 )
             {
-                writeDataLen = write( opfile, p, readDataLen );
+                written = _outputWrite( c, p, readDataLen );
             }
         }
-        while ( ( readDataLen > 0 ) && ( writeDataLen > 0 ) );
+        while ( ( readDataLen > 0 ) && ( written ) );
 
-        close( opfile );
+        _outputClose( c );
     }
     while ( readDataLen > 0 );
 
+    _outputDestroy( c );
     pthread_exit( NULL );
 }
 // ====================================================================================================
@@ -382,9 +760,10 @@ void _handleSW( struct swMsg *m, struct itmfifosHandle *f )
     }
     else
     {
-        if ( ( m->srcAddr < NUM_CHANNELS ) && ( f->c[m->srcAddr].handle ) )
+        if ( ( m->srcAddr < NUM_CHANNELS ) && ( f->c[m->srcAddr].ring ) )
         {
-            write( f->c[m->srcAddr].handle, m, sizeof( struct swMsg ) );
+            _queueSW( &f->c[m->srcAddr], m, f->output == ITMFIFO_OUTPUT_PERMAFILE );
+            f->pendingChannels |= ( 1U << m->srcAddr );
         }
     }
 }
@@ -415,134 +794,6 @@ void _handleTS( struct TSMsg *m, struct itmfifosHandle *f )
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%d,%" PRIu32 EOL, HWEVENT_TS, m->timeStatus, m->timeInc );
     write( f->c[HW_CHANNEL].handle, outputString, opLen );
 }
-// ====================================================================================================
-void _itmPumpProcess( struct itmfifosHandle *f, char c )
-
-/* Handle individual characters into the itm decoder */
-
-{
-    struct msg decoded;
-
-    typedef void ( *handlers )( void *decoded, struct itmfifosHandle * f );
-
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        ( handlers )_handleSW,
-        /* MSG_NISYNC */          ( handlers )_handleNISYNC,
-        /* MSG_OSW */             ( handlers )_handleDataOffsetWP,
-        /* MSG_DATA_ACCESS_WP */  ( handlers )_handleDataAccessWP,
-        /* MSG_DATA_RWWP */       ( handlers )_handleDataRWWP,
-        /* MSG_PC_SAMPLE */       ( handlers )_handlePCSample,
-        /* MSG_DWT_EVENT */       ( handlers )_handleDWTEvent,
-        /* MSG_EXCEPTION */       ( handlers )_handleException,
-        /* MSG_TS */              ( handlers )_handleTS
-    };
-
-    switch ( ITMPump( &f->i, c ) )
-    {
-        // ------------------------------------
-        case ITM_EV_NONE:
-            break;
-
-        // ------------------------------------
-        case ITM_EV_UNSYNCED:
-            genericsReport( V_WARN, "ITM Lost Sync (%d)" EOL, ITMDecoderGetStats( &f->i )->lostSyncCount );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM In Sync (%d)" EOL, ITMDecoderGetStats( &f->i )->syncCount );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow (%d)" EOL, ITMDecoderGetStats( &f->i )->overflow );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_PACKET_RXED:
-            ITMGetDecodedPacket( &f->i, &decoded );
-
-            /* See if we decoded a dispatchable match. genericMsg is just used to access */
-            /* the first two members of the decoded structs in a portable way.           */
-            if ( h[decoded.genericMsg.msgtype] )
-            {
-                ( h[decoded.genericMsg.msgtype] )( &decoded, f );
-            }
-
-            break;
-
-            // ------------------------------------
-    }
-}
-// ====================================================================================================
-static void _tpiuProtocolPump( struct itmfifosHandle *f, uint8_t c )
-
-{
-    switch ( TPIUPump( &f->t, c ) )
-    {
-        // ------------------------------------
-        case TPIU_EV_NEWSYNC:
-            genericsReport( V_INFO, "TPIU In Sync (%d)" EOL, TPIUDecoderGetStats( &f->t )->syncCount );
-
-        // This fall-through is deliberate
-        case TPIU_EV_SYNCED:
-
-            ITMDecoderForceSync( &f->i, true );
-            break;
-
-        // ------------------------------------
-        case TPIU_EV_RXING:
-        case TPIU_EV_NONE:
-            break;
-
-        // ------------------------------------
-        case TPIU_EV_UNSYNCED:
-            genericsReport( V_INFO, "TPIU Lost Sync (%d)" EOL, TPIUDecoderGetStats( &f->t )->lostSync );
-            ITMDecoderForceSync( &f->i, false );
-            break;
-
-        // ------------------------------------
-        case TPIU_EV_RXEDPACKET:
-            if ( !TPIUGetPacket( &f->t, &f->p ) )
-            {
-                genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-            }
-
-            for ( uint32_t g = 0; g < f->p.len; g++ )
-            {
-                if ( f->p.packet[g].s == f->tpiuITMChannel )
-                {
-                    _itmPumpProcess( f, f->p.packet[g].d );
-                    continue;
-                }
-
-                /* Its perfectly legal for TPIU channels to arrive that we aren't interested in */
-                if ( ( f->p.packet[g].s != 0 ) && ( f->p.packet[g].s != 0x7f ) )
-                {
-                    genericsReport( V_INFO, "Unhandled TPIU channel %02x" EOL, f->p.packet[g].s );
-                }
-            }
-
-            break;
-
-        // ------------------------------------
-        case TPIU_EV_ERROR:
-            genericsReport( V_ERROR, "****ERROR****" EOL );
-            break;
-            // ------------------------------------
-    }
-}
 
 // ====================================================================================================
 // ====================================================================================================
@@ -579,6 +830,15 @@ void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s )
 
     f->c[chan].chanName = strdup( n );
     f->c[chan].presFormat = s ? strdup( s ) : NULL;
+
+    if ( s )
+    {
+        _planFormat( &f->c[chan].plan, s );
+    }
+    else
+    {
+        _planFree( &f->c[chan].plan );
+    }
 }
 // ====================================================================================================
 void itmfifoSetUseTPIU( struct itmfifosHandle *f, bool s )
@@ -640,31 +900,23 @@ int itmfifoGettpiuITMChannel( struct itmfifosHandle *f )
 struct TPIUCommsStats *itmfifoGetCommsStats( struct itmfifosHandle *f )
 
 {
-    return TPIUGetCommsStats( &f->t );
+    return TPIUGetCommsStats( PipelineTPIU( &f->p ) );
 }
 // ====================================================================================================
 struct ITMDecoderStats *fifoGetITMDecoderStats( struct itmfifosHandle *f )
 
 {
-    return ITMDecoderGetStats( &f->i );
+    return ITMDecoderGetStats( PipelineITM( &f->p ) );
 }
 // ====================================================================================================
 // Main interface components
 // ====================================================================================================
-void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t c )
+void itmfifoProtocolPump( struct itmfifosHandle *f, const uint8_t *c, uint32_t len )
 
 /* Top level protocol pump */
 
 {
-    if ( f->useTPIU )
-    {
-        _tpiuProtocolPump( f, c );
-    }
-    else
-    {
-        /* There's no TPIU in use, so this goes straight to the ITM layer */
-        _itmPumpProcess( f, c );
-    }
+    PipelinePump( &f->p, c, len );
 }
 // ====================================================================================================
 void itmfifoForceSync( struct itmfifosHandle *f, bool synced )
@@ -672,8 +924,7 @@ void itmfifoForceSync( struct itmfifosHandle *f, bool synced )
 /* Reset TPIU state and put ITM into defined state */
 
 {
-    TPIUDecoderForceSync( &f->t, 0 );
-    ITMDecoderForceSync( &f->i, synced );
+    PipelineForceSync( &f->p, synced );
 }
 // ====================================================================================================
 bool itmfifoCreate( struct itmfifosHandle *f )
@@ -686,9 +937,25 @@ bool itmfifoCreate( struct itmfifosHandle *f )
     /* Make sure there's an initial timestamp to work with */
     f->lastHWExceptionTS = genericsTimestampuS();
 
-    /* Reset the TPIU handler before we start */
-    TPIUDecoderInit( &f->t );
-    ITMDecoderInit( &f->i, f->forceITMSync );
+    PipelineInit( &f->p, f->forceITMSync, f );
+    PipelineOnMsg( &f->p, MSG_SOFTWARE, ( pipelineMsgCB )_handleSW );
+    PipelineOnMsg( &f->p, MSG_NISYNC, ( pipelineMsgCB )_handleNISYNC );
+    PipelineOnMsg( &f->p, MSG_OSW, ( pipelineMsgCB )_handleDataOffsetWP );
+    PipelineOnMsg( &f->p, MSG_DATA_ACCESS_WP, ( pipelineMsgCB )_handleDataAccessWP );
+    PipelineOnMsg( &f->p, MSG_DATA_RWWP, ( pipelineMsgCB )_handleDataRWWP );
+    PipelineOnMsg( &f->p, MSG_PC_SAMPLE, ( pipelineMsgCB )_handlePCSample );
+    PipelineOnMsg( &f->p, MSG_DWT_EVENT, ( pipelineMsgCB )_handleDWTEvent );
+    PipelineOnMsg( &f->p, MSG_EXCEPTION, ( pipelineMsgCB )_handleException );
+    PipelineOnMsg( &f->p, MSG_TS, ( pipelineMsgCB )_handleTS );
+
+    /* Software channel threads are woken once per batch, not per message */
+    PipelineOnBatch( &f->p, ( pipelineBatchCB )_wakeChannels );
+
+    /* Only the ITM channel is wanted out of the TPIU stream */
+    if ( ( f->useTPIU ) && ( !PipelineUseTPIU( &f->p, f->tpiuITMChannel, PIPELINE_NO_CHANNEL ) ) )
+    {
+        return false;
+    }
 
     /* Cycle through channels and create a fifo for each one that is enabled */
     for ( int t = 0; t < ( NUM_CHANNELS + 1 ); t++ )
@@ -697,23 +964,20 @@ bool itmfifoCreate( struct itmfifosHandle *f )
         {
             if ( f->c[t].chanName )
             {
-                /* This is a live software channel fifo */
-                if ( pipe( fd ) < 0 )
+                /* This is a live software channel fifo, fed through a ring rather than a pipe */
+                if ( !( f->c[t].ring = ( struct swMsg * )malloc( FIFO_RING_MSGS * sizeof( struct swMsg ) ) ) )
                 {
                     return false;
                 }
 
-                if ( !f->permafile )
-                {
-                    /* If this is not a permanent file then some data is allowed to get lost */
-                    fcntl( fd[1], F_SETFL, O_NONBLOCK );
-                }
-
-                f->c[t].handle = fd[1];
+                f->c[t].wp = f->c[t].rp = 0;
+                f->c[t].ending = f->c[t].finished = false;
+                pthread_mutex_init( &f->c[t].lock, NULL );
+                pthread_cond_init( &f->c[t].wake, NULL );
 
-                f->c[t].params.listenHandle = fd[0];
+                f->c[t].params.listenHandle = -1;
                 f->c[t].params.portNo = t;
-                f->c[t].params.permafile = f->permafile;
+                f->c[t].params.output = f->output;
                 f->c[t].params.c = &f->c[t];
 
                 f->c[t].fifoName = ( char * )malloc( strlen( f->c[t].chanName ) + strlen( f->chanPath ) + 2 );
@@ -734,7 +998,7 @@ bool itmfifoCreate( struct itmfifosHandle *f )
                 return false;
             }
 
-            if ( !f->permafile )
+            if ( f->output != ITMFIFO_OUTPUT_PERMAFILE )
             {
                 /* If this is not a permanent file then some data is allowed to get lost */
                 fcntl( fd[1], F_SETFL, O_NONBLOCK );
@@ -744,7 +1008,7 @@ bool itmfifoCreate( struct itmfifosHandle *f )
 
             f->c[t].params.listenHandle = fd[0];
             f->c[t].params.portNo = t;
-            f->c[t].params.permafile = f->permafile;
+            f->c[t].params.output = f->output;
             f->c[t].params.c = &f->c[t];
 
             f->c[t].fifoName = ( char * )malloc( strlen( HWFIFO_NAME ) + strlen( f->chanPath ) + 2 );
@@ -771,9 +1035,24 @@ void itmfifoShutdown( struct itmfifosHandle *f )
         return;
     }
 
+    /* Anything the target was writing to files gets written out */
+    if ( f->filewriter )
+    {
+        filewriterShutdown();
+        f->filewriter = false;
+    }
+
     /* Firstly go tell everything they're doomed */
     for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
+        if ( f->c[t].ring )
+        {
+            pthread_mutex_lock( &f->c[t].lock );
+            f->c[t].ending = true;
+            pthread_cond_signal( &f->c[t].wake );
+            pthread_mutex_unlock( &f->c[t].lock );
+        }
+
         if ( f->c[t].handle > 0 )
         {
             close( f->c[t].handle );
@@ -781,38 +1060,82 @@ void itmfifoShutdown( struct itmfifosHandle *f )
         }
     }
 
+    /* Software channels get a little while to write out what's queued for them... */
+    for ( int w = 0; w < FIFO_DRAIN_MS; w++ )
+    {
+        int t = 0;
+
+        while ( ( t < NUM_CHANNELS ) && ( ( !f->c[t].ring ) || ( __atomic_load_n( &f->c[t].finished, __ATOMIC_ACQUIRE ) ) ) )
+        {
+            t++;
+        }
+
+        if ( t == NUM_CHANNELS )
+        {
+            break;
+        }
+
+        usleep( 1000 );
+    }
+
+    /* ...before they're interrupted, in case they're waiting for the other end of the fifo to be opened */
+    for ( int t = 0; t < NUM_CHANNELS; t++ )
+    {
+        if ( ( f->c[t].ring ) && ( !__atomic_load_n( &f->c[t].finished, __ATOMIC_ACQUIRE ) ) )
+        {
+            pthread_kill ( f->c[t].thread, EINTR );
+        }
+    }
+
     /* ...now clean up */
     for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
-        if ( f->c[t].handle > 0 )
+        if ( ( f->c[t].handle > 0 ) || ( f->c[t].ring ) )
         {
             pthread_join( f->c[t].thread, NULL );
 
-            if ( ! f->permafile )
+            if ( f->output != ITMFIFO_OUTPUT_PERMAFILE )
             {
                 unlink( f->c[t].fifoName );
             }
         }
 
+        if ( f->c[t].ring )
+        {
+            if ( f->c[t].dropped )
+            {
+                genericsReport( V_INFO, "Channel %d dropped %" PRIu64 " messages" EOL, t, f->c[t].dropped );
+            }
+
+            if ( f->c[t].clientDrops )
+            {
+                genericsReport( V_INFO, "Channel %d readers missed %" PRIu64 " writes" EOL, t, f->c[t].clientDrops );
+            }
+
+            free( f->c[t].ring );
+        }
+
         /* Remove the name string too */
         if ( f->c[t].presFormat )
         {
             free( f->c[t].presFormat );
         }
+
+        _planFree( &f->c[t].plan );
     }
 
     free( f );
 }
 // ====================================================================================================
 
-void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath )
+void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath, enum fwSync sync )
 
 {
     f->filewriter = useFilewriter;
 
     if ( f->filewriter )
     {
-        filewriterInit( workingPath );
+        f->filewriter = filewriterInit( workingPath, sync );
     }
 }
 
@@ -820,7 +1143,19 @@ void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *work
 void itmfifoUsePermafiles( struct itmfifosHandle *f, bool usePermafilesSet )
 
 {
-    f->permafile = usePermafilesSet;
+    f->output = usePermafilesSet ? ITMFIFO_OUTPUT_PERMAFILE : ITMFIFO_OUTPUT_FIFO;
+}
+// ====================================================================================================
+void itmfifoSetOutput( struct itmfifosHandle *f, enum itmfifoOutput o )
+
+{
+    f->output = o;
+}
+// ====================================================================================================
+enum itmfifoOutput itmfifoGetOutput( struct itmfifosHandle *f )
+
+{
+    return f->output;
 }
 // ====================================================================================================
 struct itmfifosHandle *itmfifoInit( bool forceITMSyncSet, bool useTPIUSet, int TPIUchannelSet )
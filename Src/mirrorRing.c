@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Mirror Ring
+ * ===========
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mirrorRing.h"
+
+#define MIRRORRING_TMP_NAME "orbmirror-XXXXXX"  /* Name for the anonymous file, where there's no memfd */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static int _anonFile( void )
+
+/* Get a file that only we can see, to hold a ring that doesn't need to outlive us */
+
+{
+#ifdef LINUX
+    return memfd_create( "orbmirror", 0 );
+#else
+    char name[PATH_MAX];
+    const char *dir = getenv( "TMPDIR" );
+    int fd;
+
+    snprintf( name, sizeof( name ), "%s/" MIRRORRING_TMP_NAME, ( dir && *dir ) ? dir : "/tmp" );
+
+    if ( ( fd = mkstemp( name ) ) >= 0 )
+    {
+        unlink( name );
+    }
+
+    return fd;
+#endif
+}
+// ====================================================================================================
+static bool _reuse( int fd, uint64_t size )
+
+/* Check if a ring file already holds a ring of this size that can be carried on with */
+
+{
+    struct mirrorRingHeader h;
+    struct stat st;
+
+    return ( fstat( fd, &st ) == 0 ) && ( st.st_size == MIRRORRING_HEADER_LEN + size ) &&
+           ( pread( fd, &h, sizeof( h ), 0 ) == sizeof( h ) ) && ( h.magic == MIRRORRING_MAGIC ) &&
+           ( h.version == MIRRORRING_VERSION ) && ( h.size == size ) && ( h.wp >= h.rp ) && ( h.wp - h.rp <= size );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool MirrorRingCreate( struct mirrorRing *m, uint64_t size, const char *file, bool *reopened )
+
+/* Create a ring of at least size bytes, in file if it's given. If the file already holds a ring of */
+/* the same size that's carried on with, and reopened is set to say so.                            */
+
+{
+    struct mirrorRingHeader h = { .magic = MIRRORRING_MAGIC, .version = MIRRORRING_VERSION };
+    uint64_t page = sysconf( _SC_PAGESIZE );
+    bool reuse = false;
+    uint8_t *v;
+
+    memset( m, 0, sizeof( struct mirrorRing ) );
+
+    /* A power of 2 that's at least a page, so both views fall on page boundaries */
+    for ( m->size = page; m->size < size; m->size <<= 1 );
+
+    if ( ( m->fd = file ? open( file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) : _anonFile() ) < 0 )
+    {
+        return false;
+    }
+
+    if ( !( reuse = ( file ) && ( _reuse( m->fd, m->size ) ) ) )
+    {
+        h.size = m->size;
+
+        if ( ( ftruncate( m->fd, 0 ) < 0 ) || ( ftruncate( m->fd, MIRRORRING_HEADER_LEN + m->size ) < 0 ) ||
+                ( pwrite( m->fd, &h, sizeof( h ), 0 ) != sizeof( h ) ) )
+        {
+            goto fail;
+        }
+    }
+
+    if ( ( m->h = ( struct mirrorRingHeader * )mmap( NULL, sizeof( struct mirrorRingHeader ), PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0 ) ) == MAP_FAILED )
+    {
+        m->h = NULL;
+        goto fail;
+    }
+
+    /* Reserve room for both views together, then put the data into each half of it */
+    if ( ( v = ( uint8_t * )mmap( NULL, 2 * m->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) == MAP_FAILED )
+    {
+        goto fail;
+    }
+
+    if ( ( mmap( v, m->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m->fd, MIRRORRING_HEADER_LEN ) == MAP_FAILED ) ||
+            ( mmap( v + m->size, m->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m->fd, MIRRORRING_HEADER_LEN ) == MAP_FAILED ) )
+    {
+        munmap( v, 2 * m->size );
+        goto fail;
+    }
+
+    m->data = v;
+
+    if ( reopened )
+    {
+        *reopened = reuse;
+    }
+
+    return true;
+
+fail:
+
+    if ( m->h )
+    {
+        munmap( m->h, sizeof( struct mirrorRingHeader ) );
+    }
+
+    close( m->fd );
+    memset( m, 0, sizeof( struct mirrorRing ) );
+    return false;
+}
+// ====================================================================================================
+uint64_t MirrorRingPut( struct mirrorRing *m, const uint8_t *buffer, uint64_t len, bool keepOldest )
+
+/* Add data to the ring. If keepOldest is set then only what fits in the room left is put in, otherwise */
+/* the oldest data are dropped to make room. Returns the number of bytes of buffer that were used.       */
+
+{
+    uint64_t used = len;
+
+    if ( keepOldest )
+    {
+        len = ( len < m->size - MirrorRingLevel( m ) ) ? len : m->size - MirrorRingLevel( m );
+        used = len;
+    }
+    else if ( len > m->size )
+    {
+        /* Only the end of this would survive anyway */
+        m->h->wp += len - m->size;
+        buffer += len - m->size;
+        len = m->size;
+    }
+
+    memcpy( &m->data[m->h->wp & ( m->size - 1 )], buffer, len );
+    m->h->wp += len;
+
+    if ( m->h->wp - m->h->rp > m->size )
+    {
+        m->h->rp = m->h->wp - m->size;
+    }
+
+    return used;
+}
+// ====================================================================================================
+void MirrorRingDestroy( struct mirrorRing *m )
+
+/* Finish with the ring. Any file it's in is left, for it to be reopened */
+
+{
+    if ( m->data )
+    {
+        munmap( m->data, 2 * m->size );
+        munmap( m->h, sizeof( struct mirrorRingHeader ) );
+        close( m->fd );
+    }
+
+    memset( m, 0, sizeof( struct mirrorRing ) );
+}
+// ====================================================================================================
@@ -50,6 +50,7 @@ static bool _handlePCSample( struct ITMPacket *packet, struct pcSampleMsg *decod
     if ( packet->len == 1 )
     {
         decoded->sleep = true;
+        decoded->pc = 0;
     }
     else
     {
@@ -196,7 +197,8 @@ static bool _handleTS( struct ITMPacket *packet, struct TSMsg *decoded )
 
     if ( !( ( packet->d[0] ) & 0x80 ) )
     {
-        /* This is packet format 2 ... just a simple increment */
+        /* This is packet format 2 ... just a simple increment, always in step with its data */
+        decoded->timeStatus = TIME_CURRENT;
         stamp = packet->d[0] >> 4;
     }
     else
@@ -10,13 +10,14 @@
  * from https://static.docs.arm.com/ddi0403/e/DDI0403E_B_armv7m_arm.pdf
  */
 
-#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include "generics.h"
 #include "msgSeq.h"
 #include "msgDecoder.h"
 
+#define MSGSEQ_SETTLE_US (1000000) /* Host time to run for before a timestamp clock rate is estimated */
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -24,36 +25,128 @@
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static bool _bufferPacket( struct MSGSeq *d )
+static bool _grow( struct MSGSeq *d )
 
-{
-    struct msg p;
+/* Make the buffer bigger, unwrapping what's in it to the start of the new one */
 
+{
+    uint32_t newLen = ( d->pbl * 2 < d->maxEntries ) ? d->pbl * 2 : d->maxEntries;
+    uint32_t used = ( d->wp + d->pbl - d->rp ) % d->pbl;
+    uint32_t first = ( d->rp <= d->wp ) ? used : d->pbl - d->rp;
+    struct msg *n;
 
-    if ( !ITMGetDecodedPacket( d->i, &p )  )
+    if ( ( newLen <= d->pbl ) || ( !( n = calloc( newLen, sizeof( struct msg ) ) ) ) )
     {
-        /* There wasn't a decodable message in there */
         return false;
     }
 
-    /* Make a copy of it for later dispatch */
-    memcpy( &d->pbuffer[d->wp], &p, sizeof( struct msg ) );
+    memcpy( n, &d->pbuffer[d->rp], first * sizeof( struct msg ) );
+    memcpy( &n[first], d->pbuffer, ( used - first ) * sizeof( struct msg ) );
+    free( d->pbuffer );
+
+    genericsReport( V_DEBUG, "Sequencer grown to %u entries" EOL, newLen );
+    d->pbuffer = n;
+    d->pbl = newLen;
+    d->rp = 0;
+    d->wp = used;
+    return true;
+}
+// ====================================================================================================
+static void _timestamp( struct MSGSeq *d, struct TSMsg *t )
+
+/* Account for a timestamp, and the host time it arrived at */
+
+{
+    d->time += t->timeInc;
+    d->timeStatus = t->timeStatus;
+    d->stamped = true;
+
+    if ( !d->correlate )
+    {
+        return;
+    }
+
+    d->lastHost = t->ts;
+
+    if ( !d->anchored )
+    {
+        d->anchored = true;
+        d->anchorTime = d->time;
+        d->anchorHost = t->ts;
+    }
+    else if ( ( !d->tickHz ) && ( t->ts > d->anchorHost + MSGSEQ_SETTLE_US ) )
+    {
+        /* Host times jitter, but over a long enough run the rate between them settles */
+        d->ticksPerUs = ( double )( d->time - d->anchorTime ) / ( t->ts - d->anchorHost );
+    }
+}
+// ====================================================================================================
+static void _stamp( struct MSGSeq *d, struct msg *m )
+
+/* Give a message being released the times it happened at */
+
+{
+    m->targetTime = d->time;
+    m->timeStatus = d->stamped ? d->timeStatus : TIME_UNKNOWN;
+    m->hostTime = 0;
+
+    if ( d->anchored )
+    {
+        /* Until there's a rate, the best there is is when the latest timestamp arrived */
+        m->hostTime = ( d->ticksPerUs > 0 ) ? d->anchorHost + ( uint64_t )( ( d->time - d->anchorTime ) / d->ticksPerUs ) : d->lastHost;
+    }
+}
+// ====================================================================================================
+static bool _bufferPacket( struct MSGSeq *d )
+
+/* Deal with a message that has been decoded directly into the slot at the write pointer */
 
+{
     /* If this is a timestamp then we put it on the front to be released first */
     if ( d->pbuffer[d->wp].genericMsg.msgtype == MSG_TS )
     {
+        _timestamp( d, ( struct TSMsg * )&d->pbuffer[d->wp] );
         d->releaseTimeMsg = true;
         return true;
     }
-    else
+
+    d->wp = ( d->wp + 1 ) % d->pbl;
+
+    if ( d->wp == d->rp )
     {
-        d->wp = ( d->wp + 1 ) % d->pbl;
+        /* We were told to empty and didn't, so the oldest has been overwritten */
+        d->rp = ( d->rp + 1 ) % d->pbl;
+        d->dropped++;
+    }
 
-        assert( d->wp != d->rp );
+    if ( ( ( d->wp + 1 ) % d->pbl ) != d->rp )
+    {
+        return false;
+    }
 
-        /* If the next message would cause overflow, then empty regardless */
-        return ( ( ( d->wp + 1 ) % d->pbl ) == d->rp );
+    /* The next message would overflow, so make room for it somehow */
+    switch ( d->overflow )
+    {
+        case MSGSEQ_OVF_GROW:
+            if ( _grow( d ) )
+            {
+                return false;
+            }
+
+        /* Can't grow any more, so treat it as a flush */
+        /* fall through */
+
+        case MSGSEQ_OVF_FLUSH:
+            d->flushed++;
+            return true;
+
+        case MSGSEQ_OVF_DROP:
+            d->rp = ( d->rp + 1 ) % d->pbl;
+            d->dropped++;
+            return false;
     }
+
+    return true;
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -70,7 +163,36 @@ void MSGSeqInit( struct MSGSeq *d, struct ITMDecoder *i, uint32_t maxEntries )
     memset( d, 0, sizeof( struct MSGSeq ) );
     d->i = i;
     d->pbl = maxEntries;
+    d->maxEntries = maxEntries;
     d->pbuffer = calloc( maxEntries, sizeof( struct msg ) );
+    d->timeStatus = TIME_UNKNOWN;
+}
+// ====================================================================================================
+void MSGSeqSetOverflow( struct MSGSeq *d, enum MSGSeqOverflow overflow, uint32_t maxEntries )
+
+/* Set what happens when the buffer fills, and how big it can grow to if it's allowed to */
+
+{
+    d->overflow = overflow;
+    d->maxEntries = ( maxEntries > d->pbl ) ? maxEntries : d->pbl;
+}
+// ====================================================================================================
+void MSGSeqSetCorrelation( struct MSGSeq *d, bool correlate, uint64_t tickHz )
+
+/* Turn on host time correlation, with the timestamp clock rate if it's known (0 otherwise) */
+
+{
+    d->correlate = correlate;
+    d->tickHz = tickHz;
+    d->ticksPerUs = tickHz / 1000000.0;
+    d->anchored = false;
+}
+// ====================================================================================================
+void MSGSeqDestroy( struct MSGSeq *d )
+
+{
+    free( d->pbuffer );
+    d->pbuffer = NULL;
 }
 // ====================================================================================================
 struct msg *MSGSeqGetPacket( struct MSGSeq *d )
@@ -82,17 +204,21 @@ struct msg *MSGSeqGetPacket( struct MSGSeq *d )
     if ( d->releaseTimeMsg )
     {
         d->releaseTimeMsg = false;
+        _stamp( d, &d->pbuffer[d->wp] );
         return &d->pbuffer[d->wp];
     }
 
     if ( d->wp == d->rp )
     {
+        /* Anything from here on is waiting for the next timestamp */
+        d->stamped = false;
         return NULL;
     }
 
     /* Roll to next entry */
     d->rp = ( d->rp + 1 ) % d->pbl;
 
+    _stamp( d, &d->pbuffer[trp] );
     return &d->pbuffer[trp];
 }
 // ====================================================================================================
@@ -131,7 +257,7 @@ bool MSGSeqPump( struct MSGSeq *d, uint8_t c )
 
         // ------------------------------------
         case ITM_EV_PACKET_RXED:
-            r = _bufferPacket(  d );
+            r = ( ITMGetDecodedPacket( d->i, &d->pbuffer[d->wp] ) ) && ( _bufferPacket( d ) );
             break;
 
             // ------------------------------------
@@ -140,3 +266,45 @@ bool MSGSeqPump( struct MSGSeq *d, uint8_t c )
     return r;
 }
 // ====================================================================================================
+bool MSGSeqPumpBuffer( struct MSGSeq *d, const uint8_t *buffer, uint32_t len, uint32_t *consumed )
+
+/* Handle a block of bytes into the itm decoder, stopping early if the sequencer needs emptying */
+
+{
+    struct ITMDecoderStats *s = ITMDecoderGetStats( d->i );
+    uint32_t lostSyncCount = s->lostSyncCount;
+    uint32_t overflow = s->overflow;
+    uint32_t used;
+    uint32_t total = 0;
+    bool r = false;
+
+    while ( ( !r ) && ( total < len ) )
+    {
+        /* Messages are decoded straight into the sequence buffer */
+        if ( ITMDecodeBuffer( d->i, &buffer[total], len - total, &d->pbuffer[d->wp], 1, &used ) )
+        {
+            r = _bufferPacket( d );
+        }
+
+        total += used;
+    }
+
+    /* Events are reported once for the whole block */
+    if ( s->lostSyncCount != lostSyncCount )
+    {
+        genericsReport( V_WARN, "ITM Lost Sync (%d)" EOL, s->lostSyncCount );
+    }
+
+    if ( s->overflow != overflow )
+    {
+        genericsReport( V_WARN, "ITM Overflow (%d)" EOL, s->overflow );
+    }
+
+    if ( consumed )
+    {
+        *consumed = total;
+    }
+
+    return r;
+}
+// ====================================================================================================
@@ -0,0 +1,288 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Network Stream
+ * ==============
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nwStream.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint32_t _getLE32( const uint8_t *b )
+
+{
+    return b[0] | ( b[1] << 8 ) | ( b[2] << 16 ) | ( ( uint32_t )b[3] << 24 );
+}
+// ====================================================================================================
+static void _grow( uint8_t **b, uint32_t *size, uint32_t need )
+
+{
+    if ( *size < need )
+    {
+        *b = ( uint8_t * )realloc( *b, need );
+        *size = need;
+    }
+}
+// ====================================================================================================
+static bool _frameReady( const struct nwStream *s )
+
+/* Check if there's a whole frame waiting to be taken out */
+
+{
+    uint32_t avail = s->inLen - s->inOfs;
+
+    return ( avail >= NW_FRAME_HDR_LEN ) && ( avail - NW_FRAME_HDR_LEN >= _getLE32( &s->in[s->inOfs] ) );
+}
+// ====================================================================================================
+static bool _unframe( struct nwStream *s )
+
+/* Take the waiting frame out into the data ready to be read. Returns false if it isn't valid */
+
+{
+    const uint8_t *f = &s->in[s->inOfs];
+    uint32_t plen = _getLE32( f );
+    uint32_t len = _getLE32( f + 4 );
+
+    if ( plen > len )
+    {
+        return false;
+    }
+
+    _grow( &s->out, &s->outSize, len );
+
+    if ( plen == len )
+    {
+        memcpy( s->out, f + NW_FRAME_HDR_LEN, len );
+    }
+    else
+    {
+        inflateReset( &s->z );
+        s->z.next_in = ( Bytef * )( f + NW_FRAME_HDR_LEN );
+        s->z.avail_in = plen;
+        s->z.next_out = s->out;
+        s->z.avail_out = len;
+
+        if ( ( inflate( &s->z, Z_FINISH ) != Z_STREAM_END ) || ( s->z.total_out != len ) )
+        {
+            return false;
+        }
+    }
+
+    s->inOfs += NW_FRAME_HDR_LEN + plen;
+    s->outOfs = 0;
+    s->outLen = len;
+    return true;
+}
+// ====================================================================================================
+static void _findReply( struct nwStream *s )
+
+/* Look for the reply to the request for compression. Everything before it is ready to be read as it */
+/* is, apart from anything at the end that could be the start of it, which waits for more to arrive. */
+
+{
+    uint32_t p, i;
+
+    for ( p = s->inOfs; p < s->inLen; p++ )
+    {
+        /* The reply is the request coming back, with only the codec allowed to be different */
+        for ( i = 0; ( i < NW_COMPRESS_LEN ) && ( p + i < s->inLen ) &&
+                ( ( i == NW_COMPRESS_CODEC_OFS ) || ( s->in[p + i] == s->req[i] ) ); i++ );
+
+        if ( ( i == NW_COMPRESS_LEN ) || ( p + i == s->inLen ) )
+        {
+            break;
+        }
+    }
+
+    _grow( &s->out, &s->outSize, p - s->inOfs );
+    memcpy( s->out, &s->in[s->inOfs], p - s->inOfs );
+    s->outOfs = 0;
+    s->outLen = p - s->inOfs;
+    s->inOfs = p;
+
+    if ( p + NW_COMPRESS_LEN <= s->inLen )
+    {
+        s->framed = ( s->in[p + NW_COMPRESS_CODEC_OFS] == NW_CODEC_DEFLATE );
+        s->awaiting = false;
+        s->inOfs += NW_COMPRESS_LEN;
+    }
+}
+// ====================================================================================================
+static ssize_t _fill( struct nwStream *s )
+
+/* Take what there is from the socket, making sure there's room for a whole frame if one is started */
+
+{
+    uint32_t need = NWSTREAM_READ_LEN;
+    ssize_t r;
+
+    if ( ( s->framed ) && ( s->inLen - s->inOfs >= NW_FRAME_HDR_LEN ) && ( NW_FRAME_HDR_LEN + _getLE32( &s->in[s->inOfs] ) > need ) )
+    {
+        need = NW_FRAME_HDR_LEN + _getLE32( &s->in[s->inOfs] );
+    }
+
+    /* Move up whatever is left, when it's in the way */
+    if ( s->inSize - s->inOfs < need )
+    {
+        memmove( s->in, &s->in[s->inOfs], s->inLen - s->inOfs );
+        s->inLen -= s->inOfs;
+        s->inOfs = 0;
+        _grow( &s->in, &s->inSize, need );
+    }
+
+    do
+    {
+        r = read( s->fd, &s->in[s->inLen], s->inSize - s->inLen );
+    }
+    while ( ( r < 0 ) && ( errno == EINTR ) );
+
+    if ( r > 0 )
+    {
+        s->inLen += r;
+    }
+
+    return r;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool NWStreamInit( struct nwStream *s, int fd, bool compress )
+
+/* Start reading from a connected socket, asking for compression if that's wanted */
+
+{
+    struct timespec ts;
+
+    memset( s, 0, sizeof( struct nwStream ) );
+    s->fd = fd;
+
+    if ( !compress )
+    {
+        return true;
+    }
+
+    if ( inflateInit2( &s->z, -MAX_WBITS ) != Z_OK )
+    {
+        return false;
+    }
+
+    s->zReady = true;
+
+    /* The nonce only has to be unlikely to turn up in the trace */
+    clock_gettime( CLOCK_REALTIME, &ts );
+    nwCompressBuild( s->req, NW_CODEC_DEFLATE, ( ( uint64_t )ts.tv_sec << 32 ) ^ ts.tv_nsec ^ ( ( uint64_t )getpid() << 48 ) );
+
+    if ( write( fd, s->req, NW_COMPRESS_LEN ) != NW_COMPRESS_LEN )
+    {
+        NWStreamClose( s );
+        return false;
+    }
+
+    s->awaiting = true;
+    return true;
+}
+// ====================================================================================================
+ssize_t NWStreamRead( struct nwStream *s, uint8_t *buffer, size_t len )
+
+/* Read like read() would from the socket, getting whatever the server actually sent */
+
+{
+    ssize_t r;
+    uint32_t n;
+
+    while ( true )
+    {
+        if ( s->outOfs < s->outLen )
+        {
+            n = ( len < s->outLen - s->outOfs ) ? len : s->outLen - s->outOfs;
+            memcpy( buffer, &s->out[s->outOfs], n );
+            s->outOfs += n;
+            return n;
+        }
+
+        if ( s->framed )
+        {
+            if ( _frameReady( s ) )
+            {
+                if ( !_unframe( s ) )
+                {
+                    errno = EPROTO;
+                    return -1;
+                }
+
+                continue;
+            }
+        }
+        else if ( !s->awaiting )
+        {
+            if ( s->inOfs < s->inLen )
+            {
+                /* This arrived along with a reply that said no */
+                n = ( len < s->inLen - s->inOfs ) ? len : s->inLen - s->inOfs;
+                memcpy( buffer, &s->in[s->inOfs], n );
+                s->inOfs += n;
+                return n;
+            }
+
+            /* Nothing is being held, so this is just the socket */
+            return read( s->fd, buffer, len );
+        }
+
+        if ( ( r = _fill( s ) ) <= 0 )
+        {
+            return r;
+        }
+
+        if ( s->awaiting )
+        {
+            _findReply( s );
+        }
+    }
+}
+// ====================================================================================================
+bool NWStreamPending( const struct nwStream *s )
+
+/* Check if there's anything to read that has already been taken from the socket */
+
+{
+    if ( s->outOfs < s->outLen )
+    {
+        return true;
+    }
+
+    return ( s->framed ) ? _frameReady( s ) : ( ( !s->awaiting ) && ( s->inOfs < s->inLen ) );
+}
+// ====================================================================================================
+void NWStreamClose( struct nwStream *s )
+
+/* Finish with the stream. The socket is left for the caller to close */
+
+{
+    if ( s->zReady )
+    {
+        inflateEnd( &s->z );
+    }
+
+    free( s->in );
+    free( s->out );
+    memset( s, 0, sizeof( struct nwStream ) );
+    s->fd = -1;
+}
+// ====================================================================================================
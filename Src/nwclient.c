@@ -4,105 +4,196 @@
  * Network Server support
  * ======================
  *
+ * Data to be distributed is placed into a ring of reference counted blocks which is shared between all of
+ * the clients connected to a server. Each client keeps its own cursor into that ring, and a single sender
+ * thread multiplexes all of the client sockets via epoll. The producer (i.e. the USB callback path) only
+ * ever holds the ring lock for long enough to swap a block pointer, so it can never be stalled by a
+ * consumer. A client that falls more than a ring's worth of blocks behind either has data dropped or is
+ * disconnected, depending on the configured policy.
+ *
+ * A client carrying ITM can subscribe to just some of it (see nw.h). The sender thread then runs the
+ * ITM for that client through a decoder of its own, to find the packet boundaries, and sends on only
+ * the packets that were asked for. Everything else about the client is unchanged, so it still sees a
+ * valid ITM stream, just with less in it.
+ *
+ * A client can also ask for what it's sent to be compressed (see nw.h). Each block is compressed, by the
+ * sender thread, the first time any client that wants it that way gets to it, and the result is kept
+ * with the block for any others that want it too. Output filtered for a subscription is only ever for
+ * one client, so that's compressed for it alone.
  */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <string.h>
 #include <strings.h>
 #include <stdio.h>
 #include <linux/tcp.h>
+#include <zlib.h>
 #include "generics.h"
 #include "nwclient.h"
+#include "itmDecoder.h"
+#include "msgDecoder.h"
+
+#define NWCLIENT_RING_BLOCKS    (32)          /* Number of blocks held for clients that are behind */
+#define MAX_EPOLL_EVENTS        (16)          /* Number of events to collect per epoll_wait */
+#define EPOLL_TIMEOUT_MS        (100)         /* Interval to check for termination */
+#define DISCARD_BUFFER_LEN      (256)         /* Scratch for any material sent to us by clients */
+#define ITM_SYNC_LEN            (6)           /* Length of the ITM sync put at the start of filtered output */
+#define ITM_OVERFLOW_PACKET     (0x70)
+#define NW_CONTROL_LEN          (16)          /* Longest message a client can send us */
+#define NW_DEFLATE_LEVEL        (Z_BEST_SPEED) /* Keeping up matters more than the last few percent */
 
+/* A reference counted block of data, shared between the ring and any clients that are sending it */
+struct nwBlock
 
-#define CLIENT_TERM_INTERVAL_US (10000)       /* Interval to check for all clients lost */
+{
+    uint32_t refs;                            /* Number of references held on this block */
+    uint32_t len;                             /* Amount of data in the block */
+    uint32_t size;                            /* Allocated size of the buffer */
+    struct nwBlock *next;                     /* Link for the free list */
+    uint8_t *buffer;                          /* The data itself */
+
+    bool zdone;                               /* The block has been framed for compressed clients */
+    uint8_t *zbuf;                            /* ...the frame */
+    uint32_t zsize;                           /* ...its allocated size */
+    uint32_t zlen;                            /* ...and its length */
+};
 
 /* Master structure for the nwclients */
 struct nwclientsHandle
 
 {
-    struct nwClient *firstClient;             /* Head of linked list of network clients */
-    pthread_mutex_t clientList;               /* Lock for list of network clients */
+    struct nwClient *firstClient;             /* Head of linked list of network clients (owned by sender thread) */
+    volatile uint32_t numClients;             /* Number of clients currently connected */
+
+    pthread_mutex_t ringLock;                 /* Lock for the block ring, sequence and block refcounts */
+    struct nwBlock *ring[NWCLIENT_RING_BLOCKS]; /* Most recently sent blocks */
+    uint64_t wseq;                            /* Sequence number of the next block to be written */
+    struct nwBlock *freeList;                 /* Blocks available for re-use */
+
+    enum nwclientOverrunPolicy policy;        /* What to do with clients that can't keep up */
+
+    pthread_mutex_t listLock;                 /* Lock for changes to the client list, so stats can walk it */
+    struct stageStat lockHold;                /* Time the producer holds ringLock for, per send */
+    uint64_t dropped;                         /* Blocks dropped by clients that have gone */
+    uint64_t disconnects;                     /* Clients disconnected for being too slow */
+
+    z_stream z;                               /* Compressor, only ever used by the sender thread */
+    bool zReady;                              /* ...and it could be set up */
 
     int sockfd;                               /* The socket for the inferior */
-    pthread_t ipThread;                       /* The listening thread for n/w clients */
-    bool finish;                              /* Its time to leave */
+    int epollfd;                              /* Event set for the sender thread */
+    int wakefd;                               /* Event used to signal new data to the sender thread */
+    pthread_t ipThread;                       /* The listening and sending thread for n/w clients */
+    volatile bool finish;                     /* Its time to leave */
+    volatile bool running;                    /* Sender thread is still active */
 };
 
 /* List of any connected network clients */
 struct nwClient
 
 {
-    int handle;                               /* Handle to client */
-    pthread_t thread;                         /* Execution thread */
     struct nwclientsHandle *parent;           /* Who owns this list */
     struct nwClient *nextClient;
     struct nwClient *prevClient;
-    bool finish;                              /* Flag indicating it's time to cease operation */
 
     /* Parameters used to run the client */
     int portNo;                               /* Port of connection */
-    int listenHandle;                         /* Handle for listener */
-
+    char addr[INET_ADDRSTRLEN];               /* Where it's connected from */
+    uint64_t rseq;                            /* Sequence number of the next block to be sent */
+    struct nwBlock *cur;                      /* Block currently being sent */
+    uint32_t offset;                          /* ...and how far through it we are */
+    bool waitingWrite;                        /* Waiting for the socket to become writable */
+    uint64_t droppedBlocks;                   /* Number of blocks lost because we fell behind */
+
+    /* Control messages from the client */
+    uint8_t rx[NW_CONTROL_LEN];               /* Message being received */
+    uint32_t rxLen;                           /* ...and how much of it has arrived */
+
+    /* Subscription, if the client has asked for one */
+    bool subscribed;                          /* Only send what has been subscribed to */
+    uint32_t channels;                        /* Stimulus ports wanted */
+    uint32_t msgTypes;                        /* Message types wanted (bit per enum MSGType) */
+    struct ITMDecoder itm;                    /* Decoder finding packets in the data for this client */
+    uint8_t pend[ITM_MAX_PACKET];             /* Bytes of the packet being found */
+    uint32_t pendLen;                         /* ...and how many of them there are */
+    bool needSync;                            /* Start the next filtered output with a sync */
+    uint8_t *fbuf;                            /* Filtered output of the current block */
+    uint32_t fsize;                           /* ...its allocated size */
+    uint32_t flen;                            /* ...and how much of it is to go */
+    uint64_t filteredBytes;                   /* Bytes not sent because they weren't subscribed to */
+
+    /* Compression, if the client has asked for it */
+    uint8_t reply[NW_COMPRESS_LEN];           /* Reply to send at the next block boundary */
+    bool replyPending;                        /* ...there is one to send */
+    enum nwCodec codec;                       /* How everything is being sent */
+    uint8_t *zbuf;                            /* Frame of the filtered output */
+    uint32_t zsize;                           /* ...its allocated size */
+    uint64_t rawBytes;                        /* Bytes framed for sending */
+    uint64_t wireBytes;                       /* ...and the length of the frames */
 };
 
-static int lock_with_timeout( pthread_mutex_t *mutex, const struct timespec *ts )
-{
-    int ret;
-    int left, step;
+// ====================================================================================================
+// Block ring management
+// ====================================================================================================
+static void _blockRelease( struct nwclientsHandle *h, struct nwBlock *b )
 
-    left = ts->tv_sec * 1000;       /* how much waiting is left, in msec */
-    step = 10;              /* msec to sleep at each trywait() failure */
+/* Drop a reference to a block, returning it to the free list when unused. Call with ringLock held */
 
-    do
+{
+    if ( !--b->refs )
     {
-        if ( ( ret = pthread_mutex_trylock( mutex ) ) != 0 )
-        {
-            struct timespec dly;
-
-            dly.tv_sec = 0;
-            dly.tv_nsec = step * 1000000;
-            nanosleep( &dly, NULL );
-
-            left -= step;
-        }
+        b->next = h->freeList;
+        h->freeList = b;
     }
-    while ( ret != 0 && left > 0 );
-
-    return ret;
 }
+// ====================================================================================================
+static void _blockFree( struct nwBlock *b )
 
+{
+    free( b->zbuf );
+    free( b->buffer );
+    free( b );
+}
 // ====================================================================================================
-// Network server implementation for raw SWO feed
+// Client management
 // ====================================================================================================
 static void _clientRemove( struct nwClient *c )
 
 {
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+    struct nwclientsHandle *h = c->parent;
 
+    epoll_ctl( h->epollfd, EPOLL_CTL_DEL, c->portNo, NULL );
     close( c->portNo );
-    close( c->listenHandle );
-
-    /* First of all, make sure we can get access to the client list */
 
-    if ( lock_with_timeout( &c->parent->clientList, &ts ) < 0 )
+    if ( c->cur )
     {
-        genericsExit( -1, "Failed to acquire mutex" EOL );
+        pthread_mutex_lock( &h->ringLock );
+        _blockRelease( h, c->cur );
+        pthread_mutex_unlock( &h->ringLock );
     }
 
+    pthread_mutex_lock( &h->listLock );
+    h->dropped += c->droppedBlocks;
+
     if ( c->prevClient )
     {
         c->prevClient->nextClient = c->nextClient;
     }
     else
     {
-        c->parent->firstClient = c->nextClient;
+        h->firstClient = c->nextClient;
     }
 
     if ( c->nextClient )
@@ -110,108 +201,630 @@ static void _clientRemove( struct nwClient *c )
         c->nextClient->prevClient = c->prevClient;
     }
 
-    /* OK, we made our modifications */
-    pthread_mutex_unlock( &c->parent->clientList );
+    h->numClients--;
+    pthread_mutex_unlock( &h->listLock );
 
     /* Remove the memory that was allocated for this client */
+    free( c->zbuf );
+    free( c->fbuf );
     free( c );
 }
 // ====================================================================================================
-static void *_client( void *args )
+static void _clientWaitWrite( struct nwClient *c, bool wait )
+
+/* Arm or disarm writable notifications for this client */
+
+{
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | ( wait ? EPOLLOUT : 0 ), .data.ptr = c };
+
+    if ( c->waitingWrite != wait )
+    {
+        epoll_ctl( c->parent->epollfd, EPOLL_CTL_MOD, c->portNo, &ev );
+        c->waitingWrite = wait;
+    }
+}
+// ====================================================================================================
+static uint8_t *_putSync( uint8_t *op )
+
+{
+    memset( op, 0, ITM_SYNC_LEN - 1 );
+    op[ITM_SYNC_LEN - 1] = 0x80;
+    return op + ITM_SYNC_LEN;
+}
+// ====================================================================================================
+static uint8_t *_fReserve( struct nwClient *c, uint8_t *op, uint32_t need )
+
+/* Make sure there's room for need more bytes of filtered output at op, returning where op now is */
+
+{
+    uint32_t used = op - c->fbuf;
+
+    if ( c->fsize - used < need )
+    {
+        c->fsize = ( c->fsize * 2 > used + need ) ? c->fsize * 2 : used + need;
+        c->fbuf = ( uint8_t * )realloc( c->fbuf, c->fsize );
+    }
+
+    return c->fbuf + used;
+}
+// ====================================================================================================
+static bool _wanted( struct nwClient *c )
+
+/* Decide if the packet the client's decoder just found is one it subscribed to */
+
+{
+    struct msg m;
+
+    /* Extension packets change the meaning of what follows, so always go */
+    if ( c->itm.pk.type == ITM_PT_XTN )
+    {
+        return true;
+    }
+
+    if ( ( !ITMGetDecodedPacket( &c->itm, &m ) ) || ( m.genericMsg.msgtype >= 32 ) || ( !( c->msgTypes & ( 1 << m.genericMsg.msgtype ) ) ) )
+    {
+        return false;
+    }
+
+    return ( m.genericMsg.msgtype != MSG_SOFTWARE ) || ( ( m.swMsg.srcAddr < 32 ) && ( c->channels & ( 1 << m.swMsg.srcAddr ) ) );
+}
+// ====================================================================================================
+static void _filterBlock( struct nwClient *c, const uint8_t *buffer, uint32_t len )
+
+/* Put whatever the client subscribed to from this block into its filtered output */
+
+{
+    uint8_t *op;
+
+    /* Output is usually no longer than the input plus a leading sync, but syncs found in the stream */
+    /* and packets carried over from the last block can make it longer, so room is checked as it goes */
+    op = _fReserve( c, c->fbuf, len + ITM_SYNC_LEN );
+
+    if ( c->needSync )
+    {
+        op = _putSync( op );
+        c->needSync = false;
+    }
+
+    for ( uint32_t n = 0; n < len; n++ )
+    {
+        if ( c->pendLen < ITM_MAX_PACKET )
+        {
+            c->pend[c->pendLen++] = buffer[n];
+        }
+
+        switch ( ITMPump( &c->itm, buffer[n] ) )
+        {
+            case ITM_EV_PACKET_RXED:
+                if ( _wanted( c ) )
+                {
+                    op = _fReserve( c, op, c->pendLen );
+                    memcpy( op, c->pend, c->pendLen );
+                    op += c->pendLen;
+                }
+
+                c->pendLen = 0;
+                break;
+
+            case ITM_EV_SYNCED:
+                op = _putSync( _fReserve( c, op, ITM_SYNC_LEN ) );
+                c->pendLen = 0;
+                break;
+
+            case ITM_EV_OVERFLOW:
+                op = _fReserve( c, op, 1 );
+                *op++ = ITM_OVERFLOW_PACKET;
+                c->pendLen = 0;
+                break;
+
+            case ITM_EV_NONE:
+
+                /* Anything that didn't leave the decoder part way through a packet isn't needed */
+                if ( ( c->itm.p == ITM_IDLE ) || ( c->itm.p == ITM_UNSYNCED ) )
+                {
+                    c->pendLen = 0;
+                }
+
+                break;
+
+            default:
+                c->pendLen = 0;
+                break;
+        }
+    }
+
+    c->flen = op - c->fbuf;
+    c->offset = 0;
+
+    /* Inserted syncs can leave the output longer than the input, and then nothing was filtered out */
+    if ( len > c->flen )
+    {
+        c->filteredBytes += len - c->flen;
+    }
+}
+// ====================================================================================================
+static void _putLE32( uint8_t *b, uint32_t v )
+
+{
+    for ( uint32_t i = 0; i < 4; i++ )
+    {
+        b[i] = ( v >> ( 8 * i ) ) & 0xff;
+    }
+}
+// ====================================================================================================
+static uint32_t _frame( z_stream *z, const uint8_t *in, uint32_t len, uint8_t **out, uint32_t *size )
+
+/* Put data into a frame for a client that's receiving compressed, returning the length of the frame */
+
+{
+    uint32_t need = NW_FRAME_HDR_LEN + deflateBound( z, len );
+    uint32_t plen = len;
+
+    if ( *size < need )
+    {
+        *out = ( uint8_t * )realloc( *out, need );
+        *size = need;
+    }
+
+    deflateReset( z );
+    z->next_in = ( Bytef * )in;
+    z->avail_in = len;
+    z->next_out = *out + NW_FRAME_HDR_LEN;
+    z->avail_out = need - NW_FRAME_HDR_LEN;
+
+    if ( ( deflate( z, Z_FINISH ) == Z_STREAM_END ) && ( z->total_out < len ) )
+    {
+        plen = z->total_out;
+    }
+    else
+    {
+        /* It didn't get any smaller, so it goes as it is */
+        memcpy( *out + NW_FRAME_HDR_LEN, in, len );
+    }
+
+    _putLE32( *out, plen );
+    _putLE32( *out + 4, len );
+    return NW_FRAME_HDR_LEN + plen;
+}
+// ====================================================================================================
+static void _blockFrame( struct nwClient *c )
 
-/* Handle an individual network client account */
+/* Make sure the block the client is on is framed, doing it if no other client has yet */
 
 {
-    struct nwClient *c = ( struct nwClient * )args;
-    int readDataLen;
-    uint8_t maxTransitPacket[TRANSFER_SIZE];
+    struct nwBlock *b = c->cur;
 
-    while ( !c->finish )
+    if ( !b->zdone )
     {
-        readDataLen = read( c->listenHandle, maxTransitPacket, TRANSFER_SIZE );
+        b->zlen = _frame( &c->parent->z, b->buffer, b->len, &b->zbuf, &b->zsize );
+        b->zdone = true;
+    }
+
+    c->rawBytes += b->len;
+    c->wireBytes += b->zlen;
+}
+// ====================================================================================================
+static void _filteredFrame( struct nwClient *c )
+
+/* Swap the filtered output for a frame of it */
 
-        if ( ( c->finish ) || ( readDataLen <= 0 ) || ( write( c->portNo, maxTransitPacket, readDataLen ) < 0 ) )
+{
+    uint8_t *t = c->fbuf;
+    uint32_t tsize = c->fsize;
+
+    c->rawBytes += c->flen;
+    c->flen = _frame( &c->parent->z, c->fbuf, c->flen, &c->zbuf, &c->zsize );
+    c->wireBytes += c->flen;
+    c->fbuf = c->zbuf;
+    c->fsize = c->zsize;
+    c->zbuf = t;
+    c->zsize = tsize;
+}
+// ====================================================================================================
+static bool _clientService( struct nwClient *c )
+
+/* Send as much as the socket will take. Returns false if the client should be removed */
+
+{
+    struct nwclientsHandle *h = c->parent;
+    const uint8_t *p;
+    uint32_t len;
+    ssize_t w;
+
+    while ( true )
+    {
+        if ( ( !c->cur ) && ( !c->flen ) && ( c->replyPending ) )
         {
-            /* This port went away, so remove it */
-            if ( !c->finish )
+            /* This is a block boundary, so the change to how things are sent can happen here */
+            if ( c->fsize < NW_COMPRESS_LEN )
             {
-                genericsReport( V_INFO, "Connection dropped" EOL );
+                c->fbuf = ( uint8_t * )realloc( c->fbuf, NW_COMPRESS_LEN );
+                c->fsize = NW_COMPRESS_LEN;
             }
 
-            c->finish = true;
+            memcpy( c->fbuf, c->reply, NW_COMPRESS_LEN );
+            c->flen = NW_COMPRESS_LEN;
+            c->offset = 0;
+            c->codec = c->reply[NW_COMPRESS_CODEC_OFS];
+            c->replyPending = false;
+        }
+
+        if ( ( !c->cur ) && ( !c->flen ) )
+        {
+            pthread_mutex_lock( &h->ringLock );
+
+            if ( c->rseq == h->wseq )
+            {
+                /* Nothing more to send */
+                pthread_mutex_unlock( &h->ringLock );
+                break;
+            }
+
+            if ( h->wseq - c->rseq > NWCLIENT_RING_BLOCKS )
+            {
+                /* This client has fallen off the end of the ring */
+                if ( h->policy == NWCLIENT_OVERRUN_DISCONNECT )
+                {
+                    pthread_mutex_unlock( &h->ringLock );
+                    h->disconnects++;
+                    genericsReport( V_WARN, "Client too slow, disconnecting" EOL );
+                    return false;
+                }
+
+                c->droppedBlocks += h->wseq - NWCLIENT_RING_BLOCKS - c->rseq;
+                c->rseq = h->wseq - NWCLIENT_RING_BLOCKS;
+
+                /* Anything being filtered has lost its place in the packets */
+                c->pendLen = 0;
+                genericsReport( V_WARN, "Client too slow, %" PRIu64 " blocks dropped in total" EOL, c->droppedBlocks );
+            }
+
+            c->cur = h->ring[c->rseq % NWCLIENT_RING_BLOCKS];
+            c->cur->refs++;
+            c->rseq++;
+            c->offset = 0;
+            pthread_mutex_unlock( &h->ringLock );
+
+            if ( c->subscribed )
+            {
+                /* The block is only needed while it's filtered, which is done outside of the lock */
+                _filterBlock( c, c->cur->buffer, c->cur->len );
+                pthread_mutex_lock( &h->ringLock );
+                _blockRelease( h, c->cur );
+                pthread_mutex_unlock( &h->ringLock );
+                c->cur = NULL;
+
+                if ( ( c->codec != NW_CODEC_NONE ) && ( c->flen ) )
+                {
+                    _filteredFrame( c );
+                }
+
+                continue;
+            }
+
+            if ( c->codec != NW_CODEC_NONE )
+            {
+                _blockFrame( c );
+            }
+        }
+
+        if ( c->cur )
+        {
+            p = ( c->codec != NW_CODEC_NONE ) ? c->cur->zbuf : c->cur->buffer;
+            len = ( c->codec != NW_CODEC_NONE ) ? c->cur->zlen : c->cur->len;
+        }
+        else
+        {
+            p = c->fbuf;
+            len = c->flen;
+        }
+
+        w = send( c->portNo, &p[c->offset], len - c->offset, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+            {
+                /* Socket is full, come back when it has space */
+                _clientWaitWrite( c, true );
+                return true;
+            }
+
+            genericsReport( V_INFO, "Connection dropped" EOL );
+            return false;
+        }
+
+        c->offset += w;
+
+        if ( c->offset == len )
+        {
+            if ( c->cur )
+            {
+                pthread_mutex_lock( &h->ringLock );
+                _blockRelease( h, c->cur );
+                pthread_mutex_unlock( &h->ringLock );
+                c->cur = NULL;
+            }
+
+            c->offset = c->flen = 0;
         }
     }
 
-    close( c->listenHandle );
+    _clientWaitWrite( c, false );
+    return true;
+}
+// ====================================================================================================
+static uint32_t _getLE32( const uint8_t *b )
 
-    _clientRemove( c );
-    return NULL;
+{
+    return b[0] | ( b[1] << 8 ) | ( b[2] << 16 ) | ( ( uint32_t )b[3] << 24 );
 }
 // ====================================================================================================
-static void *_listenTask( void *arg )
+static uint32_t _rxMagic( struct nwClient *c )
+
+/* The magic number of the control message being received. The first byte is the same for all of them */
+
+{
+    return ( c->rx[1] == ( ( NW_COMPRESS_MAGIC >> 8 ) & 0xff ) ) ? NW_COMPRESS_MAGIC : NW_SUBSCRIBE_MAGIC;
+}
+// ====================================================================================================
+static bool _magicByte( struct nwClient *c, uint8_t b )
+
+/* Check if b can be the next byte of the magic number of a control message */
+
+{
+    uint32_t shift = 8 * c->rxLen;
+
+    /* Until the second byte has arrived it could be either */
+    if ( c->rxLen < 2 )
+    {
+        return ( b == ( ( NW_SUBSCRIBE_MAGIC >> shift ) & 0xff ) ) || ( b == ( ( NW_COMPRESS_MAGIC >> shift ) & 0xff ) );
+    }
+
+    return b == ( ( _rxMagic( c ) >> shift ) & 0xff );
+}
+// ====================================================================================================
+static void _clientSubscribe( struct nwClient *c )
+
+/* Act on a subscription that's arrived from the client */
+
+{
+    if ( c->rx[4] != NW_SUBSCRIBE_VERSION )
+    {
+        genericsReport( V_WARN, "Unknown subscription version %d from %s" EOL, c->rx[4], c->addr );
+        return;
+    }
+
+    c->channels = _getLE32( &c->rx[8] );
+    c->msgTypes = _getLE32( &c->rx[12] );
+
+    /* Filtering starts from the next block, with the decoder starting in step with it */
+    c->subscribed = ( c->msgTypes != 0 );
+    ITMDecoderInit( &c->itm, true );
+    c->pendLen = 0;
+    c->needSync = true;
+    genericsReport( V_INFO, "Client %s subscribed to types %08x channels %08x" EOL, c->addr, c->msgTypes, c->channels );
+}
+// ====================================================================================================
+static void _clientCompress( struct nwClient *c )
+
+/* Act on a request for compression from the client. It's told what it's getting at the next block boundary */
+
+{
+    if ( c->rx[4] != NW_COMPRESS_VERSION )
+    {
+        genericsReport( V_WARN, "Unknown compression request version %d from %s" EOL, c->rx[4], c->addr );
+        return;
+    }
+
+    memcpy( c->reply, c->rx, NW_COMPRESS_LEN );
+
+    if ( ( c->rx[NW_COMPRESS_CODEC_OFS] != NW_CODEC_DEFLATE ) || ( !c->parent->zReady ) )
+    {
+        c->reply[NW_COMPRESS_CODEC_OFS] = NW_CODEC_NONE;
+    }
+
+    c->replyPending = true;
+    genericsReport( V_INFO, "Client %s %s compression" EOL, c->addr, c->reply[NW_COMPRESS_CODEC_OFS] ? "using" : "not using" );
+}
+// ====================================================================================================
+static void _clientControl( struct nwClient *c, uint8_t b )
+
+/* Collect a control message from the client, a byte at a time. Anything else it sends is ignored */
+
+{
+    /* The bytes of each magic number are all different, and the only one they share is the first, */
+    /* so a mismatch in one can only be a new start.                                               */
+    if ( ( c->rxLen < 4 ) && ( !_magicByte( c, b ) ) )
+    {
+        c->rxLen = 0;
+
+        if ( !_magicByte( c, b ) )
+        {
+            return;
+        }
+    }
+
+    c->rx[c->rxLen++] = b;
+
+    if ( c->rxLen < NW_CONTROL_LEN )
+    {
+        return;
+    }
+
+    c->rxLen = 0;
+
+    if ( _getLE32( c->rx ) == NW_COMPRESS_MAGIC )
+    {
+        _clientCompress( c );
+    }
+    else
+    {
+        _clientSubscribe( c );
+    }
+}
+// ====================================================================================================
+static bool _clientRead( struct nwClient *c )
+
+/* Absorb anything the client sends us, and spot when it goes away */
+
+{
+    uint8_t discard[DISCARD_BUFFER_LEN];
+    ssize_t r = recv( c->portNo, discard, DISCARD_BUFFER_LEN, MSG_DONTWAIT );
+
+    if ( ( r == 0 ) || ( ( r < 0 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) ) )
+    {
+        genericsReport( V_INFO, "Connection dropped" EOL );
+        return false;
+    }
+
+    for ( ssize_t i = 0; i < r; i++ )
+    {
+        _clientControl( c, discard[i] );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _clientAccept( struct nwclientsHandle *h )
 
 {
-    struct nwclientsHandle *h = ( struct nwclientsHandle * )arg;
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
     int newsockfd;
     socklen_t clilen;
     struct sockaddr_in cli_addr;
-    int f[2];                               /* File descriptor set for pipe */
     struct nwClient *client;
-    char s[100];
+    struct epoll_event ev;
 
     clilen = sizeof( cli_addr );
+    newsockfd = accept( h->sockfd, ( struct sockaddr * ) &cli_addr, &clilen );
+
+    if ( newsockfd < 0 )
+    {
+        return;
+    }
+
+    client = ( struct nwClient * )calloc( 1, sizeof( struct nwClient ) );
+    client->parent = h;
+    client->portNo = newsockfd;
+
+    inet_ntop( AF_INET, &cli_addr.sin_addr, client->addr, sizeof( client->addr ) );
+    genericsReport( V_INFO, "New connection from %s" EOL, client->addr );
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = client;
+
+    if ( epoll_ctl( h->epollfd, EPOLL_CTL_ADD, newsockfd, &ev ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to add client to event set" EOL );
+        close( newsockfd );
+        free( client );
+        return;
+    }
+
+    /* New clients start with live data */
+    pthread_mutex_lock( &h->ringLock );
+    client->rseq = h->wseq;
+    pthread_mutex_unlock( &h->ringLock );
+
+    /* Hook into linked list */
+    pthread_mutex_lock( &h->listLock );
+    client->nextClient = h->firstClient;
+    client->prevClient = NULL;
+
+    if ( client->nextClient )
+    {
+        client->nextClient->prevClient = client;
+    }
+
+    h->firstClient = client;
+    h->numClients++;
+    pthread_mutex_unlock( &h->listLock );
+}
+// ====================================================================================================
+static void *_serverTask( void *arg )
+
+/* Accept new clients and send data to existing ones */
+
+{
+    struct nwclientsHandle *h = ( struct nwclientsHandle * )arg;
+    struct epoll_event ev[MAX_EPOLL_EVENTS];
+    struct nwClient *c;
+    struct nwClient *next;
+    uint64_t wakes;
+    int n;
+
     listen( h->sockfd, 5 );
 
     while ( !h->finish )
     {
-        newsockfd = accept( h->sockfd, ( struct sockaddr * ) &cli_addr, &clilen );
+        n = epoll_wait( h->epollfd, ev, MAX_EPOLL_EVENTS, EPOLL_TIMEOUT_MS );
 
         if ( h->finish )
         {
-            close( newsockfd );
             break;
         }
 
-        inet_ntop( AF_INET, &cli_addr.sin_addr, s, 99 );
-        genericsReport( V_INFO, "New connection from %s" EOL, s );
-
-        /* We got a new connection - spawn a thread to handle it */
-        if ( !pipe( f ) )
+        for ( int i = 0; i < n; i++ )
         {
-            client = ( struct nwClient * )calloc( 1, sizeof( struct nwClient ) );
-            client->handle = f[1];
-            client->parent = h;
-            client->listenHandle = f[0];
-            client->portNo = newsockfd;
-
-            if ( !pthread_create( &( client->thread ), NULL, &_client, client ) )
+            if ( ev[i].data.ptr == h )
             {
-                /* Auto-cleanup for this thread */
-                pthread_detach( client->thread );
-
-                /* Hook into linked list */
-                if ( lock_with_timeout( &h->clientList, &ts ) < 0 )
+                _clientAccept( h );
+            }
+            else if ( ev[i].data.ptr == NULL )
+            {
+                /* New data available, send it to anyone who isn't waiting on their socket */
+                if ( read( h->wakefd, &wakes, sizeof( wakes ) ) < 0 )
                 {
-                    genericsExit( -1, "Failed to acquire mutex" EOL );
+                    genericsReport( V_DEBUG, "Failed to clear wake event" EOL );
                 }
 
-                client->nextClient = h->firstClient;
-                client->prevClient = NULL;
-
-                if ( client->nextClient )
+                for ( c = h->firstClient; c; c = next )
                 {
-                    client->nextClient->prevClient = client;
-                }
+                    next = c->nextClient;
 
-                h->firstClient = client;
+                    if ( ( !c->waitingWrite ) && ( !_clientService( c ) ) )
+                    {
+                        _clientRemove( c );
+                    }
+                }
+            }
+            else
+            {
+                c = ( struct nwClient * )ev[i].data.ptr;
 
-                pthread_mutex_unlock( &h->clientList );
+                if ( ( ev[i].events & ( EPOLLERR | EPOLLHUP | EPOLLRDHUP ) ) ||
+                        ( ( ev[i].events & EPOLLIN ) && ( !_clientRead( c ) ) ) ||
+                        ( ( ev[i].events & EPOLLOUT ) && ( !_clientService( c ) ) ) )
+                {
+                    /* Removed clients may still appear later in this event set, so drop those */
+                    for ( int j = i + 1; j < n; j++ )
+                    {
+                        if ( ev[j].data.ptr == c )
+                        {
+                            ev[j].data.ptr = h;
+                            ev[j].events = 0;
+                        }
+                    }
+
+                    _clientRemove( c );
+                }
             }
         }
     }
 
+    /* Tell all the clients to terminate */
+    while ( h->firstClient )
+    {
+        _clientRemove( h->firstClient );
+    }
+
     close( h->sockfd );
+    h->running = false;
     return NULL;
 }
 // ====================================================================================================
@@ -221,38 +834,131 @@ static void *_listenTask( void *arg )
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-void nwclientSend( struct nwclientsHandle *h, uint32_t len, uint8_t *buffer )
+void nwclientSend( struct nwclientsHandle *h, uint32_t len, const uint8_t *buffer )
 
 {
     assert( h );
     assert( len );
 
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
-    struct nwClient *n = h->firstClient;
+    struct nwBlock *b;
+    uint64_t wake = 1;
+    uint64_t start;
+
+    if ( ( h->finish ) || ( !h->numClients ) )
+    {
+        return;
+    }
+
+    /* Get a block to put this data into */
+    pthread_mutex_lock( &h->ringLock );
+    start = StageNow();
+
+    if ( ( b = h->freeList ) )
+    {
+        h->freeList = b->next;
+    }
+
+    StageRecord( &h->lockHold, start, 0 );
+    pthread_mutex_unlock( &h->ringLock );
+
+    if ( !b )
+    {
+        b = ( struct nwBlock * )calloc( 1, sizeof( struct nwBlock ) );
+    }
+
+    if ( b->size < len )
+    {
+        b->buffer = ( uint8_t * )realloc( b->buffer, len );
+        b->size = len;
+    }
+
+    memcpy( b->buffer, buffer, len );
+    b->len = len;
+    b->refs = 1;
+    b->zdone = false;
+
+    /* ...and swap it into the ring, releasing whatever was there before */
+    pthread_mutex_lock( &h->ringLock );
+    start = StageNow();
 
-    if ( !h->finish )
+    if ( h->ring[h->wseq % NWCLIENT_RING_BLOCKS] )
     {
-        if ( lock_with_timeout( &h->clientList, &ts ) < 0 )
+        _blockRelease( h, h->ring[h->wseq % NWCLIENT_RING_BLOCKS] );
+    }
+
+    h->ring[h->wseq % NWCLIENT_RING_BLOCKS] = b;
+    h->wseq++;
+    StageRecord( &h->lockHold, start, len );
+    pthread_mutex_unlock( &h->ringLock );
+
+    if ( write( h->wakefd, &wake, sizeof( wake ) ) < 0 )
+    {
+        genericsReport( V_DEBUG, "Failed to signal sender" EOL );
+    }
+}
+// ====================================================================================================
+uint32_t nwclientGetStats( struct nwclientsHandle *h, struct nwclientStats *s, struct nwclientClientStats *c, uint32_t maxClients )
+
+/* Get the state of the server and, for up to maxClients of them, each of its clients. Returns the number of clients filled in */
+
+{
+    struct nwClient *n;
+    uint32_t count = 0;
+
+    memset( s, 0, sizeof( struct nwclientStats ) );
+
+    if ( !h )
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock( &h->listLock );
+    pthread_mutex_lock( &h->ringLock );
+
+    s->clients = h->numClients;
+    s->sent = h->wseq;
+    s->dropped = h->dropped;
+    s->disconnects = h->disconnects;
+    s->lockHold = h->lockHold;
+
+    for ( n = h->firstClient; n; n = n->nextClient )
+    {
+        /* Anything part sent counts as still queued */
+        uint32_t depth = h->wseq - n->rseq + ( ( n->cur ) || ( n->flen ) ? 1 : 0 );
+
+        s->dropped += n->droppedBlocks;
+
+        if ( depth > s->maxDepth )
         {
-            genericsExit( -1, "Failed to acquire mutex" EOL );
+            s->maxDepth = depth;
         }
 
-        while ( n )
+        if ( count < maxClients )
         {
-            write( n->handle, buffer, len );
-            n = n->nextClient;
+            strncpy( c[count].addr, n->addr, sizeof( c[count].addr ) );
+            c[count].depth = depth;
+            c[count].dropped = n->droppedBlocks;
+            c[count].subscribed = n->subscribed;
+            c[count].filteredBytes = n->filteredBytes;
+            c[count].compressed = ( n->codec != NW_CODEC_NONE );
+            c[count].rawBytes = n->rawBytes;
+            c[count].wireBytes = n->wireBytes;
+            count++;
         }
-
-        pthread_mutex_unlock( &h->clientList );
     }
+
+    pthread_mutex_unlock( &h->ringLock );
+    pthread_mutex_unlock( &h->listLock );
+    return count;
 }
 // ====================================================================================================
-struct nwclientsHandle *nwclientStart( int port )
+struct nwclientsHandle *nwclientStart( int port, enum nwclientOverrunPolicy policy )
 
 /* Creating the listening server thread */
 
 {
     struct sockaddr_in serv_addr;
+    struct epoll_event ev;
     int flag = 1;
     struct nwclientsHandle *h = ( struct nwclientsHandle * )calloc( 1, sizeof( struct nwclientsHandle ) );
 
@@ -261,6 +967,8 @@ struct nwclientsHandle *nwclientStart( int port )
         return NULL;
     }
 
+    h->policy = policy;
+    h->epollfd = h->wakefd = -1;
     h->sockfd = socket( AF_INET, SOCK_STREAM, 0 );
     setsockopt( h->sockfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
 
@@ -290,11 +998,49 @@ struct nwclientsHandle *nwclientStart( int port )
         goto free_and_return;
     }
 
-    /* Create a mutex to lock the client list */
-    pthread_mutex_init( &h->clientList, NULL );
+    /* Create the event set for the sender, containing the listening socket and the wakeup */
+    h->epollfd = epoll_create1( EPOLL_CLOEXEC );
+    h->wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if ( ( h->epollfd < 0 ) || ( h->wakefd < 0 ) )
+    {
+        genericsReport( V_ERROR, "Failed to create event set" EOL );
+        goto free_and_return;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = h;
+    fcntl( h->sockfd, F_SETFL, fcntl( h->sockfd, F_GETFL ) | O_NONBLOCK );
+
+    if ( epoll_ctl( h->epollfd, EPOLL_CTL_ADD, h->sockfd, &ev ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to add listening socket to event set" EOL );
+        goto free_and_return;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if ( epoll_ctl( h->epollfd, EPOLL_CTL_ADD, h->wakefd, &ev ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to add wakeup to event set" EOL );
+        goto free_and_return;
+    }
+
+    /* Without a compressor clients still work, they just can't have compression */
+    if ( !( h->zReady = ( deflateInit2( &h->z, NW_DEFLATE_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) == Z_OK ) ) )
+    {
+        genericsReport( V_WARN, "Failed to set up compression" EOL );
+    }
+
+    /* Create mutexes to lock the block ring and the client list */
+    pthread_mutex_init( &h->ringLock, NULL );
+    pthread_mutex_init( &h->listLock, NULL );
 
     /* We have the listening socket - spawn a thread to handle it */
-    if ( pthread_create( &( h->ipThread ), NULL, &_listenTask, h ) )
+    h->running = true;
+
+    if ( pthread_create( &( h->ipThread ), NULL, &_serverTask, h ) )
     {
         genericsReport( V_ERROR, "Failed to create listening thread" EOL );
         goto free_and_return;
@@ -303,6 +1049,22 @@ struct nwclientsHandle *nwclientStart( int port )
     return h;
 
 free_and_return:
+
+    if ( h->epollfd >= 0 )
+    {
+        close( h->epollfd );
+    }
+
+    if ( h->wakefd >= 0 )
+    {
+        close( h->wakefd );
+    }
+
+    if ( h->sockfd >= 0 )
+    {
+        close( h->sockfd );
+    }
+
     free( h );
     return NULL;
 }
@@ -310,48 +1072,58 @@ free_and_return:
 void nwclientShutdown( struct nwclientsHandle *h )
 
 {
-    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+    uint64_t wake = 1;
 
     if ( !h )
     {
         return;
     }
 
-    /* Flag that we're ending */
+    /* Flag that we're ending, and kick the sender so it notices */
     h->finish = true;
 
-    if ( lock_with_timeout( &h->clientList, &ts ) < 0 )
+    if ( write( h->wakefd, &wake, sizeof( wake ) ) < 0 )
     {
-        genericsExit( -1, "Failed to acquire mutex" EOL );
+        genericsReport( V_DEBUG, "Failed to signal sender" EOL );
     }
+}
+// ====================================================================================================
+bool nwclientShutdownComplete( struct nwclientsHandle *h )
 
-    struct nwClient *c = h->firstClient;
+{
+    struct nwBlock *b;
 
-    /* Tell all the clients to terminate */
-    while ( c )
+    if ( h->running )
     {
-        c->finish = true;
+        return false;
+    }
 
-        /* Closing both ends of the connection will kill the client */
-        close( c->handle );
-        close( c->listenHandle );
+    pthread_join( h->ipThread, NULL );
 
-        /* This is safe because we are locked by the mutex */
-        c = c->nextClient;
+    for ( uint32_t i = 0; i < NWCLIENT_RING_BLOCKS; i++ )
+    {
+        if ( ( h->ring[i] ) && ( !--h->ring[i]->refs ) )
+        {
+            _blockFree( h->ring[i] );
+        }
     }
 
-    pthread_mutex_unlock( &h->clientList );
-}
-// ====================================================================================================
-bool nwclientShutdownComplete( struct nwclientsHandle *h )
+    while ( ( b = h->freeList ) )
+    {
+        h->freeList = b->next;
+        _blockFree( b );
+    }
 
-{
-    if ( ! h->firstClient )
+    if ( h->zReady )
     {
-        free( h );
-        return true;
+        deflateEnd( &h->z );
     }
 
-    return false;
+    close( h->epollfd );
+    close( h->wakefd );
+    pthread_mutex_destroy( &h->ringLock );
+    pthread_mutex_destroy( &h->listLock );
+    free( h );
+    return true;
 }
 // ====================================================================================================
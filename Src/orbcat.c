@@ -12,6 +12,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -21,17 +22,20 @@
 #include <netdb.h>
 
 #include "nw.h"
+#include "nwStream.h"
 #include "git_version_info.h"
 #include "generics.h"
-#include "tpiuDecoder.h"
-#include "itmDecoder.h"
-#include "msgDecoder.h"
+#include "pipeline.h"
+#include "fileSource.h"
 
 #define NUM_CHANNELS  32
 #define HW_CHANNEL    (NUM_CHANNELS)      /* Make the hardware fifo on the end of the software ones */
 
 #define MAX_STRING_LENGTH (100)           /* Maximum length that will be output from a fifo for a single event */
 
+#define BINARY_RECORD_LEN (24)            /* Length of each record in binary output */
+#define BINARY_BUFLEN     (1024*1024)     /* Binary output collected before it's written */
+
 // Record for options, either defaults or from command line
 struct
 {
@@ -43,26 +47,29 @@ struct
 
     /* Sink information */
     char *presFormat[NUM_CHANNELS + 1];
+    char *binaryFile;                                    /* Binary record output, "-" for stdout */
 
     /* Source information */
     int port;
     char *server;
+    bool compress;                                       /* Ask the server to compress what it sends */
 
     char *file;                                          /* File host connection */
+    char *startAt;                                       /* Where in the file to start from */
     bool endTerminate;                                  /* Terminate when file/socket "ends" */
 
 } options = {.forceITMSync = true, .tpiuChannel = 1, .port = NWCLIENT_SERVER_PORT, .server = "localhost"};
 
 struct
 {
-    /* The decoders and the packets from them */
-    struct ITMDecoder i;
-    struct ITMPacket h;
-    struct TPIUDecoder t;
-    struct TPIUPacket p;
+    struct pipeline p;                   /* Decoders all the way to the messages */
     enum timeDelay timeStatus;           /* Indicator of if this time is exact */
     uint64_t timeStamp;                  /* Latest received time */
-} _r;
+
+    int binaryFd;                        /* Where binary records go, -1 if they don't */
+    uint8_t *binary;                     /* Binary records waiting to be written */
+    uint32_t binaryLen;                  /* ...and how many bytes of them there are */
+} _r = { .binaryFd = -1 };
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -210,140 +217,156 @@ void _handleTS( struct TSMsg *m, struct ITMDecoder *i )
     fprintf( stdout, "%d,%d,%" PRIu64 EOL, HWEVENT_TS, _r.timeStatus, _r.timeStamp );
 }
 // ====================================================================================================
-void _itmPumpProcess( char c )
+// ====================================================================================================
+// ====================================================================================================
+// Binary output of decoded messages
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _binaryFlush( void )
+
+/* Write out whatever binary records are waiting */
+
+{
+    uint32_t done = 0;
+    ssize_t w;
+
+    while ( done < _r.binaryLen )
+    {
+        if ( ( w = write( _r.binaryFd, &_r.binary[done], _r.binaryLen - done ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            genericsExit( -3, "Binary output failed (%s)" EOL, strerror( errno ) );
+        }
+
+        done += w;
+    }
+
+    _r.binaryLen = 0;
+}
+// ====================================================================================================
+static void _binaryLE( uint8_t *p, uint64_t v, uint32_t len )
+
+/* Put an integer of len bytes into a record, least significant byte first */
 
 {
-    struct msg decoded;
-
-    typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
-
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        ( handlers )_handleSW,
-        /* MSG_NISYNC */          NULL,
-        /* MSG_OSW */             ( handlers )_handleDataOffsetWP,
-        /* MSG_DATA_ACCESS_WP */  ( handlers )_handleDataAccessWP,
-        /* MSG_DATA_RWWP */       ( handlers )_handleDataRWWP,
-        /* MSG_PC_SAMPLE */       ( handlers )_handlePCSample,
-        /* MSG_DWT_EVENT */       ( handlers )_handleDWTEvent,
-        /* MSG_EXCEPTION */       ( handlers )_handleException,
-        /* MSG_TS */              ( handlers )_handleTS
-    };
-
-    switch ( ITMPump( &_r.i, c ) )
-    {
-        case ITM_EV_NONE:
+    while ( len-- )
+    {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+}
+// ====================================================================================================
+static void _binaryRecord( struct msg *m )
+
+/* Add a message to the binary output as a fixed length record. All values are little endian; */
+/*                                                                                              */
+/*   u8  message type (enum MSGType)                                                            */
+/*   u8  aux   (SW: bytes of value, RWWP: 1 for a write, PC: 1 for sleep, EXC: event, TS: status) */
+/*   u16 addr  (SW: channel, watchpoints: comparator, EXC: exception number, DWT: event bits)   */
+/*   u32 value (SW: value, watchpoints: data or offset, PC: pc, TS: increment)                  */
+/*   u64 host time of decode (uS)                                                               */
+/*   u64 target time, the total of the timestamps before this message. A TS record has already  */
+/*       had its own increment added, so it carries the time it marks, not the one before       */
+
+{
+    uint8_t aux = 0;
+    uint32_t addr = 0;
+    uint32_t value = 0;
+    uint8_t *p;
+
+    switch ( m->genericMsg.msgtype )
+    {
+        case MSG_SOFTWARE:
+            aux = m->swMsg.len;
+            addr = m->swMsg.srcAddr;
+            value = m->swMsg.value;
             break;
 
-        case ITM_EV_UNSYNCED:
-            genericsReport( V_INFO, "ITM Unsynced" EOL );
+        case MSG_OSW:
+            addr = m->oswMsg.comp;
+            value = m->oswMsg.offset;
             break;
 
-        case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM Synced" EOL );
+        case MSG_DATA_ACCESS_WP:
+            addr = m->wptMsg.comp;
+            value = m->wptMsg.data;
             break;
 
-        case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow" EOL );
+        case MSG_DATA_RWWP:
+            aux = m->watchMsg.isWrite;
+            addr = m->watchMsg.comp;
+            value = m->watchMsg.data;
             break;
 
-        case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
+        case MSG_PC_SAMPLE:
+            aux = m->pcSampleMsg.sleep;
+            value = m->pcSampleMsg.pc;
             break;
 
-        case ITM_EV_PACKET_RXED:
-            ITMGetDecodedPacket( &_r.i, &decoded );
+        case MSG_DWT_EVENT:
+            addr = m->dwtMsg.event;
+            break;
 
-            /* See if we decoded a dispatchable match. genericMsg is just used to access */
-            /* the first two members of the decoded structs in a portable way.           */
-            if ( h[decoded.genericMsg.msgtype] )
-            {
-                ( h[decoded.genericMsg.msgtype] )( &decoded, &_r.i );
-            }
+        case MSG_EXCEPTION:
+            aux = m->excMsg.eventType;
+            addr = m->excMsg.exceptionNumber;
+            break;
 
+        case MSG_TS:
+            aux = ( ( struct TSMsg * )m )->timeStatus;
+            value = ( ( struct TSMsg * )m )->timeInc;
             break;
 
         default:
-            break;
+            return;
     }
-}
-// ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-// Protocol pump for decoding messages
-// ====================================================================================================
-// ====================================================================================================
-// ====================================================================================================
-void _protocolPump( uint8_t c )
 
-{
-    if ( options.useTPIU )
+    if ( _r.binaryLen + BINARY_RECORD_LEN > BINARY_BUFLEN )
     {
-        switch ( TPIUPump( &_r.t, c ) )
-        {
-            case TPIU_EV_NEWSYNC:
-            case TPIU_EV_SYNCED:
-                ITMDecoderForceSync( &_r.i, true );
-                break;
-
-            case TPIU_EV_RXING:
-            case TPIU_EV_NONE:
-                break;
-
-            case TPIU_EV_UNSYNCED:
-                ITMDecoderForceSync( &_r.i, false );
-                break;
-
-            case TPIU_EV_RXEDPACKET:
-                if ( !TPIUGetPacket( &_r.t, &_r.p ) )
-                {
-                    genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                }
-
-                for ( uint32_t g = 0; g < _r.p.len; g++ )
-                {
-                    if ( _r.p.packet[g].s == options.tpiuChannel )
-                    {
-                        _itmPumpProcess( _r.p.packet[g].d );
-                        continue;
-                    }
-
-                    if  ( _r.p.packet[g].s != 0 )
-                    {
-                        genericsReport( V_INFO, "Unknown TPIU channel %02x" EOL, _r.p.packet[g].s );
-                    }
-                }
+        _binaryFlush();
+    }
 
-                break;
+    p = &_r.binary[_r.binaryLen];
+    _binaryLE( &p[0], m->genericMsg.msgtype, 1 );
+    _binaryLE( &p[1], aux, 1 );
+    _binaryLE( &p[2], addr, 2 );
+    _binaryLE( &p[4], value, 4 );
+    _binaryLE( &p[8], m->genericMsg.ts, 8 );
+    _binaryLE( &p[16], _r.timeStamp, 8 );
+    _r.binaryLen += BINARY_RECORD_LEN;
+}
+// ====================================================================================================
+void _handleBinary( struct msg *m, struct ITMDecoder *i )
 
-            case TPIU_EV_ERROR:
-                genericsReport( V_WARN, "****ERROR****" EOL );
-                break;
-        }
-    }
-    else
+{
+    if ( m->genericMsg.msgtype == MSG_TS )
     {
-        _itmPumpProcess( c );
+        _r.timeStamp += ( ( struct TSMsg * )m )->timeInc;
     }
+
+    _binaryRecord( m );
 }
 // ====================================================================================================
 void _printHelp( char *progName )
 
 {
     fprintf( stdout, "Usage: %s [options]" EOL, progName );
+    fprintf( stdout, "      -b: <filename> Write every decoded message as a binary record to file (- for stdout)" EOL );
     fprintf( stdout, "      -c: <Number>,<Format> of channel to add into output stream (repeat per channel)" EOL );
     fprintf( stdout, "      -e: Terminate when the file/socket ends/is closed, or attempt to wait for more / reconnect" EOL );
     fprintf( stdout, "      -f: <filename> Take input from specified file" EOL );
+    fprintf( stdout, "      -F: <pos> Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     fprintf( stdout, "      -h: This help" EOL );
     fprintf( stdout, "      -n: Enforce sync requirement for ITM (i.e. ITM needsd to issue syncs)" EOL );
     fprintf( stdout, "      -s: <Server>:<Port> to use" EOL );
     fprintf( stdout, "      -t <channel>: Use TPIU decoder on specified channel (normally 1)" EOL );
     fprintf( stdout, "      -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    fprintf( stdout, "      -Z: Ask the server to compress what it sends" EOL );
 }
 // ====================================================================================================
 int _processOptions( int argc, char *argv[] )
@@ -355,7 +378,7 @@ int _processOptions( int argc, char *argv[] )
     char *chanIndex;
 #define DELIMITER ','
 
-    while ( ( c = getopt ( argc, argv, "c:ef:hns:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "b:c:ef:F:hns:t:v:Z" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -363,6 +386,11 @@ int _processOptions( int argc, char *argv[] )
                 _printHelp( argv[0] );
                 return false;
 
+            // ------------------------------------
+            case 'b':
+                options.binaryFile = optarg;
+                break;
+
             // ------------------------------------
             case 'e':
                 options.endTerminate = true;
@@ -373,6 +401,11 @@ int _processOptions( int argc, char *argv[] )
                 options.file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                options.startAt = optarg;
+                break;
+
             // ------------------------------------
             case 'n':
                 options.forceITMSync = false;
@@ -414,6 +447,11 @@ int _processOptions( int argc, char *argv[] )
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
 
+            // ------------------------------------
+            case 'Z':
+                options.compress = true;
+                break;
+
             // ------------------------------------
             /* Individual channel setup */
             case 'c':
@@ -467,10 +505,17 @@ int _processOptions( int argc, char *argv[] )
         return false;
     }
 
+    if ( ( options.useTPIU ) && ( options.tpiuChannel >= TPIU_NUM_STREAMS ) )
+    {
+        genericsReport( V_ERROR, "Illegal TPIU channel" EOL );
+        return false;
+    }
+
     genericsReport( V_INFO, "orbcat V" VERSION " (Git %08X %s, Built " BUILD_DATE EOL, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
 
     genericsReport( V_INFO, "Server     : %s:%d" EOL, options.server, options.port );
     genericsReport( V_INFO, "ForceSync  : %s" EOL, options.forceITMSync ? "true" : "false" );
+    genericsReport( V_INFO, "Compress   : %s" EOL, options.compress ? "true" : "false" );
 
     if ( options.file )
     {
@@ -496,6 +541,11 @@ int _processOptions( int argc, char *argv[] )
         genericsReport( V_INFO, "Using TPIU : false" EOL );
     }
 
+    if ( options.binaryFile )
+    {
+        genericsReport( V_INFO, "Binary     : %s" EOL, options.binaryFile );
+    }
+
     genericsReport( V_INFO, "Channels   :" EOL );
 
     for ( int g = 0; g < NUM_CHANNELS; g++ )
@@ -513,16 +563,22 @@ int _processOptions( int argc, char *argv[] )
 int fileFeeder( void )
 
 {
-    int f;
-    unsigned char cbw[TRANSFER_SIZE];
+    struct fileSource f;
+    const uint8_t *data;
     ssize_t t;
 
-    if ( ( f = open( options.file, O_RDONLY ) ) < 0 )
+    if ( !FileSourceOpen( &f, options.file ) )
     {
         genericsExit( -4, "Can't open file %s" EOL, options.file );
     }
 
-    while ( ( t = read( f, cbw, TRANSFER_SIZE ) ) >= 0 )
+    if ( ( options.startAt ) && ( !FileSourceSeek( &f, options.startAt ) ) )
+    {
+        genericsExit( -4, "Can't start %s from %s" EOL, options.file, options.startAt );
+    }
+
+    /* Spans come straight out of the mapped file, so there's no copying on the way to the decoder */
+    while ( ( t = FileSourceGet( &f, &data, 0 ) ) >= 0 )
     {
 
         if ( !t )
@@ -539,12 +595,12 @@ int fileFeeder( void )
             }
         }
 
-        unsigned char *c = cbw;
+        PipelinePump( &_r.p, data, t );
+    }
 
-        while ( t-- )
-        {
-            _protocolPump( *c++ );
-        }
+    if ( _r.binaryFd >= 0 )
+    {
+        _binaryFlush();
     }
 
     if ( !options.endTerminate )
@@ -552,7 +608,7 @@ int fileFeeder( void )
         genericsReport( V_INFO, "File read error" EOL );
     }
 
-    close( f );
+    FileSourceClose( &f );
     return true;
 }
 
@@ -564,6 +620,7 @@ int socketFeeder( void )
     struct sockaddr_in serv_addr;
     struct hostent *server;
     unsigned char cbw[TRANSFER_SIZE];
+    struct nwStream ns;
     ssize_t t;
     int flag = 1;
 
@@ -598,13 +655,20 @@ int socketFeeder( void )
         return -1;
     }
 
-    while ( ( t = read( sockfd, cbw, TRANSFER_SIZE ) ) > 0 )
+    if ( !NWStreamInit( &ns, sockfd, options.compress ) )
+    {
+        genericsReport( V_ERROR, "Could not ask for compression" EOL );
+        close( sockfd );
+        return -1;
+    }
+
+    while ( ( t = NWStreamRead( &ns, cbw, TRANSFER_SIZE ) ) > 0 )
     {
-        unsigned char *c = cbw;
+        PipelinePump( &_r.p, cbw, t );
 
-        while ( t-- )
+        if ( _r.binaryFd >= 0 )
         {
-            _protocolPump( *c++ );
+            _binaryFlush();
         }
 
         fflush( stdout );
@@ -612,6 +676,7 @@ int socketFeeder( void )
 
     genericsReport( V_ERROR, "Read failed" EOL );
 
+    NWStreamClose( &ns );
     close( sockfd );
     return -2;
 
@@ -626,9 +691,37 @@ int main( int argc, char *argv[] )
         exit( -1 );
     }
 
-    /* Reset the TPIU handler before we start */
-    TPIUDecoderInit( &_r.t );
-    ITMDecoderInit( &_r.i, options.forceITMSync );
+    /* Only the ITM channel is wanted out of the TPIU stream */
+    PipelineInit( &_r.p, options.forceITMSync, &_r.p.i );
+
+    if ( ( options.useTPIU ) && ( !PipelineUseTPIU( &_r.p, options.tpiuChannel, PIPELINE_NO_CHANNEL ) ) )
+    {
+        genericsExit( -1, "Can't set up TPIU decode" EOL );
+    }
+
+    if ( options.binaryFile )
+    {
+        _r.binaryFd = strcmp( options.binaryFile, "-" ) ? open( options.binaryFile, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) : STDOUT_FILENO;
+
+        if ( ( _r.binaryFd < 0 ) || ( !( _r.binary = malloc( BINARY_BUFLEN ) ) ) )
+        {
+            genericsExit( -4, "Can't open binary output %s" EOL, options.binaryFile );
+        }
+
+        /* Everything decoded goes into the binary output, in place of being handled */
+        PipelineOnAllMsgs( &_r.p, ( pipelineMsgCB )_handleBinary );
+    }
+    else
+    {
+        PipelineOnMsg( &_r.p, MSG_SOFTWARE, ( pipelineMsgCB )_handleSW );
+        PipelineOnMsg( &_r.p, MSG_OSW, ( pipelineMsgCB )_handleDataOffsetWP );
+        PipelineOnMsg( &_r.p, MSG_DATA_ACCESS_WP, ( pipelineMsgCB )_handleDataAccessWP );
+        PipelineOnMsg( &_r.p, MSG_DATA_RWWP, ( pipelineMsgCB )_handleDataRWWP );
+        PipelineOnMsg( &_r.p, MSG_PC_SAMPLE, ( pipelineMsgCB )_handlePCSample );
+        PipelineOnMsg( &_r.p, MSG_DWT_EVENT, ( pipelineMsgCB )_handleDWTEvent );
+        PipelineOnMsg( &_r.p, MSG_EXCEPTION, ( pipelineMsgCB )_handleException );
+        PipelineOnMsg( &_r.p, MSG_TS, ( pipelineMsgCB )_handleTS );
+    }
 
     if ( options.file )
     {
@@ -8,7 +8,13 @@
 
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -17,16 +23,24 @@
 #include "uthash.h"
 #include "git_version_info.h"
 #include "generics.h"
-#include "tpiuDecoder.h"
-#include "itmDecoder.h"
+#include "pipeline.h"
+#include "capture.h"
 
 #include "nw.h"
+#include "nwStream.h"
 
 #define MAX_STRING_LENGTH (256)              /* Maximum length that will be output from a fifo for a single event */
 
 #define DEFAULT_OUTFILE "/dev/stdout"
 #define DEFAULT_TIMELEN 10000
 
+#define RAW_MOVE_LEN      (1024*1024)        /* Most to move from the socket to the file at once in raw mode */
+#define RAW_ALIGN         (4096)             /* Alignment for direct writes */
+#define RAW_SAMPLE_LEN    (4096)             /* Length of each sample looked at in raw mode */
+#define RAW_SAMPLE_EVERY  (4*1024*1024)      /* ...and how far apart they are */
+#define RAW_SAMPLE_MISSES (8)                /* Samples in a row without TPIU sync before it's reported */
+#define RAW_TAIL_INTERVAL (100)              /* Longest, in ms, the part block of a direct dump waits for the file */
+
 /* ---------- CONFIGURATION ----------------- */
 
 struct                                      /* Record for options, either defaults or from command line */
@@ -38,6 +52,10 @@ struct                                      /* Record for options, either defaul
 
     /* File to output dump to */
     char *outfile;
+    char *capturefile;                      /* ...or indexed capture file */
+
+    /* Only decode until sync, and just sample after that */
+    bool raw;
 
     /* Do we need to write syncronously */
     bool writeSync;
@@ -48,6 +66,7 @@ struct                                      /* Record for options, either defaul
     /* Source information */
     int port;
     char *server;
+    bool compress;
 } options =
 {
     .forceITMSync = true,
@@ -62,12 +81,27 @@ struct                                      /* Record for options, either defaul
 /* ----------- LIVE STATE ----------------- */
 struct
 {
-    /* The decoders and the packets from them */
-    struct ITMDecoder i;
-    struct ITMPacket h;
-    struct TPIUDecoder t;
-    struct TPIUPacket p;
-} _r;
+    /* The decoders, only there to find sync */
+    struct pipeline p;
+
+    /* The output */
+    int outFd;                               /* File the dump goes to */
+    bool direct;                             /* ...opened for direct I/O, so only written in aligned pieces */
+    uint8_t *obuf;                           /* Data on the way to it */
+    uint32_t ofill;                          /* ...and how much of it there is */
+    uint64_t written;                        /* Where in the file the data waiting go, for direct I/O */
+    bool tailStale;                          /* ...the part block of them hasn't been written out yet */
+    uint64_t tailAt;                         /* ...and when it last was */
+    bool capturing;                          /* Writing an indexed capture file instead */
+    struct captureWriter cap;
+
+    /* Raw mode */
+    bool useSplice;                          /* Data go from the socket to the file without being copied */
+    int pipe[2];                             /* ...by way of this */
+    uint8_t sample[RAW_SAMPLE_LEN];          /* Sample of the data, when they're spliced */
+    uint32_t misses;                         /* Samples in a row without TPIU sync */
+    bool stop;                               /* A sample says the dump should finish */
+} _r = { .outFd = -1 };
 
 // ====================================================================================================
 // ====================================================================================================
@@ -78,79 +112,475 @@ struct
 // ====================================================================================================
 uint64_t _timestamp( void )
 
+/* Only used to time the dump, so the coarse clock, which is much cheaper to read, is plenty */
+
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+#else
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+#endif
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+// ====================================================================================================
+static bool _writeAll( int fd, const uint8_t *buffer, size_t len )
+
+{
+    ssize_t w;
+
+    while ( len )
+    {
+        if ( ( w = write( fd, buffer, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        buffer += w;
+        len -= w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _setDirect( bool on )
+
+/* Move the output on to or off direct I/O */
+
+{
+#ifdef O_DIRECT
+    int flags = fcntl( _r.outFd, F_GETFL );
+
+    if ( ( flags < 0 ) || ( fcntl( _r.outFd, F_SETFL, on ? ( flags | O_DIRECT ) : ( flags & ~O_DIRECT ) ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Could not turn direct I/O %s (%s)" EOL, on ? "on" : "off", strerror( errno ) );
+        return false;
+    }
+
+#endif
+    return true;
+}
+// ====================================================================================================
+static bool _directFlush( bool all )
+
+/* Write out what's waiting in whole aligned pieces or, at the end, all of it. Direct I/O has to be */
+/* left behind for that, for the part piece.                                                        */
+
 {
-    struct timeval te;
-    gettimeofday( &te, NULL ); // get current time
-    uint64_t milliseconds = te.tv_sec * 1000LL + te.tv_usec / 1000; // caculate milliseconds
-    return milliseconds;
+    uint32_t len = all ? _r.ofill : _r.ofill & ~( RAW_ALIGN - 1 );
+
+    if ( ( all ) && ( _r.ofill & ( RAW_ALIGN - 1 ) ) && ( !_setDirect( false ) ) )
+    {
+        return false;
+    }
+
+    if ( !_writeAll( _r.outFd, _r.obuf, len ) )
+    {
+        return false;
+    }
+
+    memmove( _r.obuf, &_r.obuf[len], _r.ofill - len );
+    _r.ofill -= len;
+    _r.written += len;
+    _r.tailStale = ( _r.ofill != 0 );
+    return true;
+}
+// ====================================================================================================
+static bool _directTail( void )
+
+/* Put the part block that's waiting into the file too, so it isn't only in memory. It's written where */
+/* it goes without moving on, and the aligned write of the whole block goes over it later.             */
+
+{
+    uint32_t done = 0;
+    ssize_t w;
+
+    _r.tailAt = _timestamp();
+
+    if ( !_r.tailStale )
+    {
+        return true;
+    }
+
+    if ( !_setDirect( false ) )
+    {
+        return false;
+    }
+
+    while ( done < _r.ofill )
+    {
+        if ( ( w = pwrite( _r.outFd, &_r.obuf[done], _r.ofill - done, _r.written + done ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        done += w;
+    }
+
+    _r.tailStale = false;
+
+    if ( !_setDirect( true ) )
+    {
+        /* Carry on without it, from the end of what's just been written */
+        _r.written += _r.ofill;
+        _r.ofill = 0;
+        _r.direct = false;
+        return lseek( _r.outFd, _r.written, SEEK_SET ) >= 0;
+    }
+
+    return true;
 }
 // ====================================================================================================
+static int _directWait( int sockfd, struct nwStream *ns )
+
+/* Wait for more to read, writing out the part block whenever nothing turns up for a while. Returns */
+/* like poll would.                                                                                 */
+
+{
+    struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+    int r;
+
+    if ( NWStreamPending( ns ) )
+    {
+        return 1;
+    }
+
+    while ( ( r = poll( &pfd, 1, RAW_TAIL_INTERVAL ) ) < 0 )
+    {
+        if ( errno != EINTR )
+        {
+            return -1;
+        }
+    }
+
+    if ( ( !r ) && ( !_directTail() ) )
+    {
+        return -1;
+    }
+
+    return r;
+}
 // ====================================================================================================
+static bool _outOpen( void )
+
+/* Open whatever the dump is going to. Direct I/O is only used for raw dumps that can't be spliced */
+
+{
+    if ( options.capturefile )
+    {
+        _r.capturing = true;
+        return CaptureWriterOpen( &_r.cap, options.capturefile );
+    }
+
+#ifdef O_DIRECT
+
+    /* Not everything the output could be can do it, so it's only a preference */
+    if ( ( options.raw ) && ( !_r.useSplice ) && ( !options.writeSync ) &&
+            ( ( _r.outFd = open( options.outfile, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644 ) ) >= 0 ) )
+    {
+        _r.direct = true;
+        return true;
+    }
+
+#endif
+    return ( _r.outFd = open( options.outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) >= 0;
+}
 // ====================================================================================================
-// Protocol pump for decoding messages
+static bool _outWrite( const uint8_t *buffer, size_t len, bool tpiuSynced )
+
+{
+    uint32_t n;
+
+    if ( _r.capturing )
+    {
+        return CaptureWrite( &_r.cap, buffer, len, tpiuSynced );
+    }
+
+    if ( !_r.direct )
+    {
+        return _writeAll( _r.outFd, buffer, len );
+    }
+
+    while ( len )
+    {
+        n = ( len < RAW_MOVE_LEN - _r.ofill ) ? len : RAW_MOVE_LEN - _r.ofill;
+        memcpy( &_r.obuf[_r.ofill], buffer, n );
+        _r.ofill += n;
+        buffer += n;
+        len -= n;
+
+        if ( !_directFlush( false ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
 // ====================================================================================================
+static bool _outClose( void )
+
+{
+    bool ok = true;
+
+    if ( _r.capturing )
+    {
+        return CaptureWriterClose( &_r.cap );
+    }
+
+    if ( _r.direct )
+    {
+        ok = _directFlush( true );
+    }
+
+    close( _r.outFd );
+    return ok;
+}
 // ====================================================================================================
+static void _outSync( void )
+
+{
+    if ( ( options.writeSync ) && ( !_r.capturing ) )
+    {
+        fdatasync( _r.outFd );
+    }
+}
 // ====================================================================================================
-void _protocolPump( uint8_t c )
+static void _sampleCheck( const uint8_t *buffer, uint32_t len )
 
-/* Top level protocol pump */
+/* Look at a sample of what's being dumped, in place of decoding all of it. With TPIU it's checked for */
+/* sync, and without it that there isn't TPIU in there that shouldn't be.                              */
 
 {
+    struct TPIUDecoder t;
+    struct ITMDecoder i;
+
     if ( options.useTPIU )
     {
-        switch ( TPIUPump( &_r.t, c ) )
+        TPIUDecoderInit( &t );
+
+        for ( uint32_t n = 0; ( n < len ) && ( !TPIUDecoderSynced( &t ) ); n++ )
         {
-            // ------------------------------------
-            case TPIU_EV_NEWSYNC:
-            case TPIU_EV_SYNCED:
-                ITMDecoderForceSync( &_r.i, true );
-                break;
+            TPIUPump( &t, buffer[n] );
+        }
 
-            // ------------------------------------
-            case TPIU_EV_RXING:
-            case TPIU_EV_NONE:
-                break;
+        if ( TPIUDecoderSynced( &t ) )
+        {
+            if ( _r.misses >= RAW_SAMPLE_MISSES )
+            {
+                genericsReport( V_WARN, "TPIU sync seen again" EOL );
+            }
 
-            // ------------------------------------
-            case TPIU_EV_UNSYNCED:
-                ITMDecoderForceSync( &_r.i, false );
-                break;
+            _r.misses = 0;
+        }
+        else if ( ++_r.misses == RAW_SAMPLE_MISSES )
+        {
+            genericsReport( V_WARN, "Warning:No TPIU sync in the last %d samples" EOL, RAW_SAMPLE_MISSES );
+        }
 
-            // ------------------------------------
-            case TPIU_EV_RXEDPACKET:
-                if ( !TPIUGetPacket( &_r.t, &_r.p ) )
-                {
-                    genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                }
+        return;
+    }
 
-                for ( uint32_t g = 0; g < _r.p.len; g++ )
-                {
-                    if ( _r.p.packet[g].s == options.tpiuITMChannel )
-                    {
-                        ITMPump( &_r.i, _r.p.packet[g].d );
-                        continue;
-                    }
-
-                    if ( _r.p.packet[g].s != 0 )
-                    {
-                        genericsReport( V_WARN, "Unknown TPIU channel %02x" EOL, _r.p.packet[g].s );
-                    }
-                }
+    ITMDecoderInit( &i, false );
 
-                break;
+    for ( uint32_t n = 0; n < len; n++ )
+    {
+        ITMPump( &i, buffer[n] );
+    }
 
-            // ------------------------------------
-            case TPIU_EV_ERROR:
-                genericsReport( V_WARN, "****ERROR****" EOL );
-                break;
-                // ------------------------------------
+    if ( ITMDecoderGetStats( &i )->tpiuSyncCount )
+    {
+        genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
+        _r.stop = true;
+    }
+}
+// ====================================================================================================
+#ifdef LINUX
+static bool _drainPipe( uint32_t len )
+
+/* Take what's left in the pipe out the ordinary way */
+
+{
+    ssize_t r;
+
+    while ( len )
+    {
+        if ( ( r = read( _r.pipe[0], _r.obuf, ( len < RAW_MOVE_LEN ) ? len : RAW_MOVE_LEN ) ) <= 0 )
+        {
+            if ( ( r < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        if ( !_outWrite( _r.obuf, r, false ) )
+        {
+            return false;
         }
+
+        len -= r;
     }
-    else
+
+    return true;
+}
+// ====================================================================================================
+static ssize_t _spliceMove( int sockfd, bool sample )
+
+/* Move what's arrived on the socket into the file, through the pipe, without copying it at all */
+
+{
+    ssize_t n, w, p;
+    uint32_t left;
+
+    /* A look at what's about to go past doesn't take it off the socket */
+    if ( ( sample ) && ( ( p = recv( sockfd, _r.sample, RAW_SAMPLE_LEN, MSG_PEEK ) ) > 0 ) )
+    {
+        _sampleCheck( _r.sample, p );
+    }
+
+    if ( ( n = splice( sockfd, NULL, _r.pipe[1], NULL, RAW_MOVE_LEN, SPLICE_F_MOVE | SPLICE_F_MORE ) ) <= 0 )
+    {
+        return n;
+    }
+
+    for ( left = n; left; left -= w )
+    {
+        if ( ( w = splice( _r.pipe[0], NULL, _r.outFd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                w = 0;
+                continue;
+            }
+
+            if ( errno != EINVAL )
+            {
+                return -1;
+            }
+
+            /* This output can't be spliced into, so it gets copied to from now on */
+            genericsReport( V_INFO, "Output can't be spliced to, copying instead" EOL );
+            _r.useSplice = false;
+            return _drainPipe( left ) ? n : -1;
+        }
+    }
+
+    return n;
+}
+#endif
+// ====================================================================================================
+static ssize_t _copyMove( struct nwStream *ns, bool sample )
+
+/* Move what's arrived to the file by way of a buffer, where it can't be spliced */
+
+{
+    ssize_t n;
+    uint32_t want;
+
+    if ( _r.direct )
+    {
+        /* This goes straight into the buffer for the direct writes, so it's still only copied the once */
+        want = RAW_MOVE_LEN - _r.ofill;
+
+        if ( ( n = NWStreamRead( ns, &_r.obuf[_r.ofill], want ) ) <= 0 )
+        {
+            return n;
+        }
+
+        if ( sample )
+        {
+            _sampleCheck( &_r.obuf[_r.ofill], ( n < RAW_SAMPLE_LEN ) ? n : RAW_SAMPLE_LEN );
+        }
+
+        /* Whole blocks go to the file now, and the part block once the stream has caught up, now and again */
+        _r.ofill += n;
+
+        if ( !_directFlush( false ) )
+        {
+            return -1;
+        }
+
+        if ( ( n < want ) && ( _timestamp() - _r.tailAt >= RAW_TAIL_INTERVAL ) && ( !_directTail() ) )
+        {
+            return -1;
+        }
+
+        return n;
+    }
+
+    if ( ( n = NWStreamRead( ns, _r.obuf, RAW_MOVE_LEN ) ) <= 0 )
     {
-        /* There's no TPIU in use, so this goes straight to the ITM layer */
-        ITMPump( &_r.i, c );
+        return n;
     }
+
+    if ( sample )
+    {
+        _sampleCheck( _r.obuf, ( n < RAW_SAMPLE_LEN ) ? n : RAW_SAMPLE_LEN );
+    }
+
+    return _outWrite( _r.obuf, n, ( options.useTPIU ) && ( !_r.misses ) ) ? n : -1;
+}
+// ====================================================================================================
+static ssize_t _rawDump( int sockfd, struct nwStream *ns, uint64_t firstTime, size_t *octets )
+
+/* Carry on with the dump without decoding, only sampling it now and again. Returns like a read would */
+/* when it's done.                                                                                    */
+
+{
+    uint64_t since = RAW_SAMPLE_EVERY;
+    ssize_t n = 1;
+    int w;
+
+    while ( !_r.stop )
+    {
+        /* The clock is only read once per move, however much that turns out to be */
+        if ( ( options.timelen ) && ( _timestamp() - firstTime > options.timelen ) )
+        {
+            break;
+        }
+
+        /* Direct output holds on to a part block, so don't just sit in a read while there's one */
+        if ( ( _r.direct ) && ( ( w = _directWait( sockfd, ns ) ) <= 0 ) )
+        {
+            if ( w < 0 )
+            {
+                n = -1;
+                break;
+            }
+
+            continue;
+        }
+
+#ifdef LINUX
+        n = _r.useSplice ? _spliceMove( sockfd, since >= RAW_SAMPLE_EVERY ) : _copyMove( ns, since >= RAW_SAMPLE_EVERY );
+#else
+        n = _copyMove( ns, since >= RAW_SAMPLE_EVERY );
+#endif
+
+        if ( n <= 0 )
+        {
+            break;
+        }
+
+        since = ( since >= RAW_SAMPLE_EVERY ) ? n : since + n;
+        *octets += n;
+        _outSync();
+    }
+
+    return n;
 }
 // ====================================================================================================
 void _printHelp( char *progName )
@@ -161,11 +591,14 @@ void _printHelp( char *progName )
     fprintf( stdout, "       -l: <timelen> Length of time in ms to record from point of acheiving sync (defaults to %dmS)" EOL, options.timelen );
     fprintf( stdout, "       -n: Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     fprintf( stdout, "       -o: <filename> to be used for dump file (defaults to %s)" EOL, options.outfile );
+    fprintf( stdout, "       -O: <filename> Dump to an indexed capture file instead" EOL );
     fprintf( stdout, "       -p: <Port> to use" EOL );
     fprintf( stdout, "       -s: <Server> to use" EOL );
+    fprintf( stdout, "       -r: Raw dump; only decode until sync, then move the data without looking at more than samples of it" EOL );
     fprintf( stdout, "       -t: <channel> Use TPIU decoder on specified channel, normally 1" EOL );
     fprintf( stdout, "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
     fprintf( stdout, "       -w: Write syncronously to the output file after every packet" EOL );
+    fprintf( stdout, "       -Z: Ask the server to compress what it sends" EOL );
 }
 // ====================================================================================================
 int _processOptions( int argc, char *argv[] )
@@ -173,13 +606,21 @@ int _processOptions( int argc, char *argv[] )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "hl:no:p:s:t:v:w" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "hl:no:O:p:rs:t:v:wZ" ) ) != -1 )
         switch ( c )
         {
             case 'o':
                 options.outfile = optarg;
                 break;
 
+            case 'O':
+                options.capturefile = optarg;
+                break;
+
+            case 'r':
+                options.raw = true;
+                break;
+
             case 'l':
                 options.timelen = atoi( optarg );
                 break;
@@ -210,6 +651,10 @@ int _processOptions( int argc, char *argv[] )
                 options.server = optarg;
                 break;
 
+            case 'Z':
+                options.compress = true;
+                break;
+
             case 'h':
                 _printHelp( argv[0] );
                 return false;
@@ -241,6 +686,7 @@ int _processOptions( int argc, char *argv[] )
 
     genericsReport( V_INFO, "Server    : %s:%d" EOL, options.server, options.port );
     genericsReport( V_INFO, "ForceSync : %s" EOL, options.forceITMSync ? "true" : "false" );
+    genericsReport( V_INFO, "Compress  : %s" EOL, options.compress ? "true" : "false" );
 
     if ( options.timelen )
     {
@@ -252,6 +698,12 @@ int _processOptions( int argc, char *argv[] )
     }
 
     genericsReport( V_INFO, "Sync Write: %s" EOL, options.writeSync ? "true" : "false" );
+    genericsReport( V_INFO, "Raw Dump  : %s" EOL, options.raw ? "true" : "false" );
+
+    if ( options.capturefile )
+    {
+        genericsReport( V_INFO, "Capture   : %s" EOL, options.capturefile );
+    }
 
     if ( options.useTPIU )
     {
@@ -268,11 +720,11 @@ int main( int argc, char *argv[] )
     struct sockaddr_in serv_addr;
     struct hostent *server;
     uint8_t cbw[TRANSFER_SIZE];
+    struct nwStream ns;
     uint64_t firstTime = 0;
     size_t octetsRxed = 0;
-    FILE *opFile;
 
-    ssize_t readLength, t;
+    ssize_t readLength;
     int flag = 1;
 
     bool haveSynced = false;
@@ -282,9 +734,13 @@ int main( int argc, char *argv[] )
         exit( -1 );
     }
 
-    /* Reset the TPIU handler before we start */
-    TPIUDecoderInit( &_r.t );
-    ITMDecoderInit( &_r.i, options.forceITMSync );
+    /* Only the ITM channel is wanted out of the TPIU stream */
+    PipelineInit( &_r.p, options.forceITMSync, NULL );
+
+    if ( ( options.useTPIU ) && ( !PipelineUseTPIU( &_r.p, options.tpiuITMChannel, PIPELINE_NO_CHANNEL ) ) )
+    {
+        return -1;
+    }
 
     sockfd = socket( AF_INET, SOCK_STREAM, 0 );
     setsockopt( sockfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
@@ -318,10 +774,31 @@ int main( int argc, char *argv[] )
         return -1;
     }
 
-    /* .... and the file to dump it into */
-    opFile = fopen( options.outfile, "wb" );
+    if ( !NWStreamInit( &ns, sockfd, options.compress ) )
+    {
+        genericsReport( V_ERROR, "Could not ask for compression" EOL );
+        return -1;
+    }
+
+    /* Raw data can go straight from the socket to the file, unless something has to be done to them on the way */
+#ifdef LINUX
+    _r.useSplice = ( options.raw ) && ( !options.compress ) && ( !options.capturefile ) && ( pipe( _r.pipe ) == 0 );
+
+    if ( _r.useSplice )
+    {
+        fcntl( _r.pipe[1], F_SETPIPE_SZ, RAW_MOVE_LEN );
+    }
+
+#endif
 
-    if ( !opFile )
+    if ( ( options.raw ) && ( posix_memalign( ( void ** )&_r.obuf, RAW_ALIGN, RAW_MOVE_LEN ) ) )
+    {
+        genericsReport( V_ERROR, "Could not allocate dump buffer" EOL );
+        return -2;
+    }
+
+    /* .... and the file to dump it into */
+    if ( !_outOpen() )
     {
         genericsReport( V_ERROR, "Could not open output file for writing" EOL );
         return -2;
@@ -330,7 +807,7 @@ int main( int argc, char *argv[] )
     genericsReport( V_INFO, "Waiting for sync" EOL );
 
     /* Start the process of collecting the data */
-    while ( ( readLength = read( sockfd, cbw, TRANSFER_SIZE ) ) > 0 )
+    while ( ( readLength = NWStreamRead( &ns, cbw, TRANSFER_SIZE ) ) > 0 )
     {
         if ( ( options.timelen ) && ( ( firstTime != 0 ) && ( ( _timestamp() - firstTime ) > options.timelen ) ) )
         {
@@ -338,17 +815,10 @@ int main( int argc, char *argv[] )
             break;
         }
 
-        uint8_t *c = cbw;
-
-        t = readLength;
-
-        while ( t-- )
-        {
-            _protocolPump( *c++ );
-        }
+        PipelinePump( &_r.p, cbw, readLength );
 
         /* Check to make sure there's not an unexpected TPIU in here */
-        if ( ITMDecoderGetStats( &_r.i )->tpiuSyncCount )
+        if ( ITMDecoderGetStats( PipelineITM( &_r.p ) )->tpiuSyncCount )
         {
             genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
             break;
@@ -357,7 +827,7 @@ int main( int argc, char *argv[] )
         /* ... now check if we've acheived sync so can write frames */
         if ( !haveSynced )
         {
-            if ( !ITMDecoderIsSynced( &_r.i ) )
+            if ( !ITMDecoderIsSynced( PipelineITM( &_r.p ) ) )
             {
                 continue;
             }
@@ -369,21 +839,36 @@ int main( int argc, char *argv[] )
             genericsReport( V_INFO, "Started recording" EOL );
         }
 
-        octetsRxed += fwrite( cbw, 1, readLength, opFile );
+        if ( !_outWrite( cbw, readLength, ( options.useTPIU ) && ( TPIUDecoderSynced( PipelineTPIU( &_r.p ) ) ) ) )
+        {
+            genericsReport( V_ERROR, "Failed to write output" EOL );
+            break;
+        }
 
-        if ( !ITMDecoderIsSynced( &_r.i ) )
+        octetsRxed += readLength;
+
+        if ( !ITMDecoderIsSynced( PipelineITM( &_r.p ) ) )
         {
             genericsReport( V_WARN, "Warning:Sync lost while writing output" EOL );
         }
 
-        if ( options.writeSync )
+        _outSync();
+
+        /* Once there's sync a raw dump stops decoding */
+        if ( options.raw )
         {
-            sync();
+            readLength = _rawDump( sockfd, &ns, firstTime, &octetsRxed );
+            break;
         }
     }
 
+    NWStreamClose( &ns );
     close( sockfd );
-    fclose( opFile );
+
+    if ( !_outClose() )
+    {
+        genericsReport( V_ERROR, "Failed to write output" EOL );
+    }
 
     if ( readLength <= 0 )
     {
@@ -24,6 +24,7 @@
 #include "generics.h"
 #include "fileWriter.h"
 #include "nw.h"
+#include "fileSource.h"
 
 #include "itmfifos.h"
 
@@ -36,10 +37,12 @@ struct
     /* Config information */
     bool filewriter;                    /* Supporting filewriter functionality */
     char *fwbasedir;                    /* Base directory for filewriter output */
-    bool permafile;                     /* Use permanent files rather than fifos */
+    enum fwSync fwsync;                 /* When filewriter output is forced out to storage */
+    enum itmfifoOutput output;          /* What to publish the channels as */
 
     /* Source information */
     char *file;                         /* File host connection */
+    char *startAt;                      /* Where in the file to start from */
     bool fileTerminate;                 /* Terminate when file read isn't successful */
 
     int port;                           /* Source information */
@@ -51,6 +54,9 @@ struct
     .server = "localhost"
 };
 
+/* Names of each sort of output, for reporting */
+static const char *_outputNames[] = { "fifo", "permafile", "shared memory", "socket" };
+
 struct
 {
     struct itmfifosHandle *f;           /* Link to the itmfifo subsystem */
@@ -79,11 +85,15 @@ static void _printHelp( char *progName )
     genericsPrintf( "       -c <Number>,<Name>,<Format> of channel to populate (repeat per channel)" EOL );
     genericsPrintf( "       -e When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -f <filename> Take input from specified file" EOL );
+    genericsPrintf( "       -F <pos> Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     genericsPrintf( "       -h This help" EOL );
     genericsPrintf( "       -P Create permanent files rather than fifos" EOL );
+    genericsPrintf( "       -S Publish channels as shared memory rings rather than fifos" EOL );
     genericsPrintf( "       -t <channel> Use TPIU decoder on specified channel (normally 1)" EOL );
+    genericsPrintf( "       -U Publish channels as UNIX sockets rather than fifos" EOL );
     genericsPrintf( "       -v <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "       -w <path> Enable filewriter functionality using specified base path" EOL );
+    genericsPrintf( "       -W <none|close|always> When filewriter output is synced to storage (Default none)" EOL );
 }
 // ====================================================================================================
 static int _processOptions( int argc, char *argv[] )
@@ -97,7 +107,7 @@ static int _processOptions( int argc, char *argv[] )
     uint chan;
     char *chanIndex;
 
-    while ( ( c = getopt ( argc, argv, "b:c:ef:hn:Pt:v:w:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "b:c:ef:F:hn:PSt:Uv:w:W:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -117,6 +127,11 @@ static int _processOptions( int argc, char *argv[] )
                 options.file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                options.startAt = optarg;
+                break;
+
             // ------------------------------------
 
             case 'h':
@@ -132,7 +147,13 @@ static int _processOptions( int argc, char *argv[] )
             // ------------------------------------
 
             case 'P':
-                options.permafile = true;
+                options.output = ITMFIFO_OUTPUT_PERMAFILE;
+                break;
+
+            // ------------------------------------
+
+            case 'S':
+                options.output = ITMFIFO_OUTPUT_SHM;
                 break;
 
             // ------------------------------------
@@ -144,6 +165,12 @@ static int _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'U':
+                options.output = ITMFIFO_OUTPUT_SOCKET;
+                break;
+
+            // ------------------------------------
+
             case 'v':
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
@@ -157,6 +184,29 @@ static int _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'W':
+                if ( !strcmp( optarg, "none" ) )
+                {
+                    options.fwsync = FW_SYNC_NONE;
+                }
+                else if ( !strcmp( optarg, "close" ) )
+                {
+                    options.fwsync = FW_SYNC_CLOSE;
+                }
+                else if ( !strcmp( optarg, "always" ) )
+                {
+                    options.fwsync = FW_SYNC_ALWAYS;
+                }
+                else
+                {
+                    genericsReport( V_ERROR, "Unrecognised filewriter sync policy %s" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             /* Individual channel setup */
             case 'c':
                 chanIndex = chanConfig = strdup( optarg );
@@ -224,7 +274,7 @@ static int _processOptions( int argc, char *argv[] )
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, argv[0], GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "BasePath    : %s" EOL, itmfifoGetChanPath( _r.f ) );
     genericsReport( V_INFO, "ForceSync   : %s" EOL, itmfifoGetForceITMSync( _r.f ) ? "true" : "false" );
-    genericsReport( V_INFO, "Permafile   : %s" EOL, options.permafile ? "true" : "false" );
+    genericsReport( V_INFO, "Output      : %s" EOL, _outputNames[options.output] );
 
     if ( itmfifoGetUseTPIU( _r.f ) )
     {
@@ -264,7 +314,7 @@ static int _processOptions( int argc, char *argv[] )
     return true;
 }
 // ====================================================================================================
-static void _processBlock( int s, unsigned char *cbw )
+static void _processBlock( int s, const unsigned char *cbw )
 
 /* Generic block processor for received data */
 
@@ -274,7 +324,7 @@ static void _processBlock( int s, unsigned char *cbw )
     if ( s )
     {
 #ifdef DUMP_BLOCK
-        uint8_t *c = cbw;
+        const uint8_t *c = cbw;
         uint32_t y = s;
 
         fprintf( stderr, EOL );
@@ -291,10 +341,7 @@ static void _processBlock( int s, unsigned char *cbw )
 
 #endif
 
-        while ( s-- )
-        {
-            itmfifoProtocolPump( _r.f, *cbw++ );
-        }
+        itmfifoProtocolPump( _r.f, cbw, s );
     }
 
 }
@@ -311,12 +358,15 @@ static void _doExit( void )
 int main( int argc, char *argv[] )
 
 {
-    int sourcefd;
+    int sourcefd = 0;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     uint8_t cbw[TRANSFER_SIZE];
     int flag = 1;
 
+    struct fileSource fs;
+    const uint8_t *data;
+
     ssize_t t;
     int64_t lastTime;
     int r;
@@ -334,7 +384,7 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "" EOL );
     }
 
-    itmfifoUsePermafiles( _r.f, options.permafile );
+    itmfifoSetOutput( _r.f, options.output );
 
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
@@ -360,7 +410,21 @@ int main( int argc, char *argv[] )
     }
 
     /* Start the filewriter */
-    itmfifoFilewriter( _r.f, options.filewriter, options.fwbasedir );
+    itmfifoFilewriter( _r.f, options.filewriter, options.fwbasedir, options.fwsync );
+
+    /* A file is opened once, and followed as it grows unless we're told to stop at its end */
+    if ( options.file )
+    {
+        if ( !FileSourceOpen( &fs, options.file ) )
+        {
+            genericsExit( -4, "Can't open file %s" EOL, options.file );
+        }
+
+        if ( ( options.startAt ) && ( !FileSourceSeek( &fs, options.startAt ) ) )
+        {
+            genericsExit( -4, "Can't start %s from %s" EOL, options.file, options.startAt );
+        }
+    }
 
     while ( !_r.ending )
     {
@@ -411,16 +475,34 @@ int main( int argc, char *argv[] )
                 continue;
             }
         }
-        else
+
+        while ( !_r.ending )
         {
-            if ( ( sourcefd = open( options.file, O_RDONLY ) ) < 0 )
+            if ( options.file )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, options.file );
+                /* Files are sent through straight out of the mapping, as much at a time as there is */
+                if ( ( t = FileSourceGet( &fs, &data, 0 ) ) < 0 )
+                {
+                    break;
+                }
+
+                if ( t )
+                {
+                    _processBlock( t, data );
+                }
+                else if ( options.fileTerminate )
+                {
+                    _r.ending = true;
+                }
+                else
+                {
+                    // Just spin for a while to avoid clogging the CPU
+                    usleep( 100000 );
+                }
+
+                continue;
             }
-        }
 
-        while ( !_r.ending )
-        {
             remainTime = ( ( lastTime + 1000 - genericsTimestampmS() ) * 1000 ) - 500;
 
             r = t = 0;
@@ -456,12 +538,15 @@ int main( int argc, char *argv[] )
             }
         }
 
-        close( sourcefd );
-
-        if ( options.fileTerminate )
+        if ( options.file )
         {
+            FileSourceClose( &fs );
             _r.ending = true;
         }
+        else
+        {
+            close( sourcefd );
+        }
     }
 
     return -ESRCH;
@@ -16,8 +16,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "git_version_info.h"
 #include "generics.h"
@@ -26,30 +28,83 @@
 #include "tpiuDecoder.h"
 #include "symbols.h"
 #include "sio.h"
+#include "fileSource.h"
+#include "mirrorRing.h"
+#include "traceTrigger.h"
 
 #define REMOTE_SERVER       "localhost"
 
 #define SCRATCH_STRING_LEN  (65535)     /* Max length for a string under construction */
 //#define DUMP_BLOCK
 #define DEFAULT_PM_BUFLEN_K (32)        /* Default size of the Postmortem buffer */
+#define MAX_PM_BUFLEN_K     (2*1024*1024) /* ...and the largest it can be, since offsets into it are 32 bits */
 #define MAX_TAGS            (10)        /* How many tags we will allow */
+#define ITM_STREAM          (1)         /* TPIU stream carrying ITM, for ITM triggers */
+#define ITM_TRIGGER_CHUNK   (256)       /* Most TPIU data stripped at a time when watching ITM, to place triggers closely */
 
 #define INTERVAL_TIME_MS    (1000)      /* Intervaltime between acculumator resets */
 #define HANG_TIME_MS        (200)       /* Time without a packet after which we dump the buffer */
+#define SYMBOL_WAIT_MS      (30000)     /* Longest to wait for the first load of the symbols on a dump */
 #define TICK_TIME_MS        (100)       /* Time intervals for screen updates and keypress check */
 
+#define OP_CHUNK_SIZE       (256*1024)  /* Size of each chunk of the output text arena */
+#define OP_LINES_INITIAL    (4096)      /* Initial allocation of output buffer lines */
+
+#define CHECKPOINT_SPACING  (4096)      /* Minimum bytes of trace between decode checkpoints */
+#define DECODE_WINDOW_LINES (10000)     /* Lines to decode at a time, working back from the end */
+#define DECODE_QUEUE_LEN    (8)         /* Decoded batches that can be waiting for the UI to pick them up */
+
+/* Changes that _etmCB always consumes, so the index pass has to as well to leave the decoder in the same state */
+#define OP_CONSUMED_CHANGES ((1<<EV_CH_ADDRESS)|(1<<EV_CH_ENATOMS)|(1<<EV_CH_VMID)|(1<<EV_CH_EX_ENTRY)|(1<<EV_CH_EX_EXIT)| \
+                             (1<<EV_CH_TSTAMP)|(1<<EV_CH_TRIGGER)|(1<<EV_CH_CLOCKSPEED)|(1<<EV_CH_ISLSIP)|(1<<EV_CH_CYCLECOUNT)| \
+                             (1<<EV_CH_CONTEXTID)|(1<<EV_CH_SECURE)|(1<<EV_CH_ALTISA)|(1<<EV_CH_HYP)|(1<<EV_CH_JAZELLE)|(1<<EV_CH_THUMB))
+
+/* A chunk of the output text arena. Chunks are kept once allocated and reused for each new decode */
+struct opChunk
+{
+    struct opChunk *next;
+    size_t used;
+    size_t size;
+    char d[];
+};
+
+/* A point in the post-mortem buffer from which decoding can be restarted. These are taken just before the */
+/* final byte of a packet carrying an address, so the output state doesn't depend on what came before it  */
+struct decodeCheckpoint
+{
+    struct ETMDecoder i;                /* Decoder state at this point */
+    uint32_t ofs;                       /* Offset from the buffer read pointer */
+};
+
+/* A run of decoded lines, in order, handed from the decode thread to the UI to go on the front of opText */
+struct decodeBatch
+{
+    struct line *lines;
+    int32_t numLines;
+    bool moreAbove;                     /* There's still more of the buffer to decode before these */
+};
+
+/* Work for the decode thread */
+enum decodeJob { DJ_NONE, DJ_DUMP, DJ_EXTEND };
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
     /* Source information */
     char *file;                         /* File host connection */
+    char *startAt;                      /* Where in the file to start from */
     bool fileTerminate;                 /* Terminate when file read isn't successful */
     char *deleteMaterial;               /* Material to delete off front end of filenames */
     bool demangle;                      /* Indicator that C++ should be demangled */
 
     char *elffile;                      /* File to use for symbols etc. */
 
-    int buflen;                         /* Length of post-mortem buffer, in bytes */
+    uint64_t buflen;                    /* Length of post-mortem buffer, in bytes */
+    char *holdFile;                     /* File to keep the post-mortem buffer in, if any */
+    char *trigger[TRACETRIGGER_MAX_CONDS]; /* Trigger conditions to freeze capture on */
+    int numTriggers;                    /* ...and how many of them there are */
+    uint64_t preTrigger;                /* Bytes to keep from before the trigger */
+    uint64_t postTrigger;               /* ...and to capture after it */
     bool useTPIU;                       /* Are we using TPIU, and stripping TPIU frames? */
     int channel;                        /* When TPIU is in use, which channel to decode? */
     int port;                           /* Source information */
@@ -63,7 +118,8 @@ struct Options
     .server = REMOTE_SERVER,
     .demangle = true,
     .channel = 2,
-    .buflen = DEFAULT_PM_BUFLEN_K * 1024
+    .buflen = DEFAULT_PM_BUFLEN_K * 1024,
+    .preTrigger = UINT64_MAX
 };
 
 /* A block of received data */
@@ -89,7 +145,8 @@ struct RunTime
     struct TPIUDecoder t;
 
     const char *progName;               /* Name by which this program was called */
-    struct SymbolSet *s;                /* Symbols read from elf */
+    struct SymbolReload *reload;        /* Symbols kept loaded from the elf in the background */
+    struct SymbolSet *s;                /* ...and the set the output buffer refers into */
     bool     ending;                    /* Flag indicating app is terminating */
     bool     singleShot;                /* Flag indicating take a single buffer then stop */
     uint64_t newTotalBytes;             /* Number of bytes of real data transferred in total */
@@ -97,12 +154,42 @@ struct RunTime
     uint64_t oldTotalIntervalBytes;     /* Number of bytes transferred in previous interval */
     uint64_t oldTotalHangBytes;         /* Number of bytes transferred in previous hang interval */
 
-    uint8_t *pmBuffer;                  /* The post-mortem buffer */
-    int wp;                             /* Index pointers for ring buffer */
-    int rp;
+    struct mirrorRing pm;               /* The post-mortem buffer */
+
+    struct traceTrigger trig;           /* What to watch the incoming trace for */
+    bool triggered;                     /* The trigger has fired... */
+    uint64_t trigAt;                    /* ...with this many bytes put in the post-mortem buffer */
+    uint64_t stopAt;                    /* ...and capture stops once there are this many */
+    bool frozen;                        /* Capture has been stopped by the trigger, or the end of the file */
 
     struct line *opText;                /* Text of the output buffer */
     int32_t numLines;                   /* Number of lines in the output buffer */
+    int32_t opTextAlloc;                /* Number of lines allocated in opText */
+    struct opChunk *opChunks;           /* Arena holding the text of the output buffer */
+    struct opChunk *opChunk;            /* ...and the chunk currently being filled */
+    struct line *stageText;             /* Lines being decoded before they're put on the front of opText */
+    int32_t stageLines;                 /* ...how many of them there are */
+    int32_t stageAlloc;                 /* ...and how many are allocated */
+
+    struct decodeCheckpoint *cp;        /* Places decoding can restart from in the post-mortem buffer */
+    uint32_t cpCount;                   /* Number of checkpoints */
+    uint32_t cpAlloc;                   /* ...and how many are allocated */
+    uint32_t cpDecoded;                 /* First checkpoint that's been decoded into opText */
+    uint32_t pmLen;                     /* Length of the data in the post-mortem buffer being decoded */
+    struct ETMDecoder endState;         /* Decoder state at the end of the buffer */
+    bool indexSawAddress;               /* Index pass saw a packet carrying an address */
+    bool dumped;                        /* The buffer has been handed over for decoding */
+
+    pthread_t decodeThread;             /* Thread doing the decoding, so the UI and capture keep going */
+    pthread_mutex_t decodeLock;         /* Lock for the job handed to it */
+    pthread_cond_t decodeCond;          /* ...signalled when a job is set or finished */
+    enum decodeJob job;                 /* Job for the decode thread, DJ_NONE while it's idle */
+    bool cancelDecode;                  /* Flag telling the decode thread to drop what it's doing */
+    const char *progressWhat;           /* What the decode thread is doing, for the status line */
+    int32_t progress;                   /* ...and how far through it is, in percent */
+    struct decodeBatch q[DECODE_QUEUE_LEN]; /* Decoded output waiting for the UI */
+    uint32_t qHead;                     /* ...next to be written, only by the decode thread */
+    uint32_t qTail;                     /* ...next to be read, only by the UI */
 
     int32_t diveline;                   /* Line number we're currently diving into */
     char *divefile;                     /* Filename we're currently diving into */
@@ -115,12 +202,19 @@ struct RunTime
     struct SIOInstance *sio;            /* Our screen IO instance for managed I/O */
 
     struct dataBlock rawBlock;          /* Datablock received from distribution */
+    struct dataBlock strippedBlock;     /* ETM data with TPIU framing removed */
+    struct TPIUSpan tpiuSpan;           /* Output span for our channel when decoding TPIU */
+    struct dataBlock itmBlock;          /* ITM data with TPIU framing removed, for ITM triggers */
+    struct TPIUSpan itmSpan;            /* ...and the output span for it */
+    struct TPIUSpan *tpiuStream[TPIU_NUM_STREAMS]; /* Output spans for each TPIU stream */
 
     struct opConstruct op;              /* The mechanical elements for creating the output buffer */
 
     struct Options *options;            /* Our runtime configuration */
 } _r =
 {
+    .decodeLock = PTHREAD_MUTEX_INITIALIZER,
+    .decodeCond = PTHREAD_COND_INITIALIZER,
     .options = &_options
 };
 
@@ -153,17 +247,22 @@ static void _printHelp( struct RunTime *r )
 {
     genericsPrintf( "Usage: %s [options]" EOL, r->progName );
     genericsPrintf( "       -a: Do not use alternate address encoding" EOL );
-    genericsPrintf( "       -b: <Length> Length of post-mortem buffer, in KBytes (Default %d KBytes)" EOL, DEFAULT_PM_BUFLEN_K );
+    genericsPrintf( "       -b: <Length> Length of post-mortem buffer, in KBytes, rounded up to a power of 2 (Default %d KBytes)" EOL, DEFAULT_PM_BUFLEN_K );
+    genericsPrintf( "       -B: <filename> Keep the post-mortem buffer in a file, and pick up what's in it on start" EOL );
     genericsPrintf( "       -c: <command> Command line for external editor (%f = filename, %l = line)" EOL );
     genericsPrintf( "       -D: Switch off C++ symbol demangling" EOL );
     genericsPrintf( "       -d: <String> Material to delete off front of filenames" EOL );
     genericsPrintf( "       -e: <ElfFile> to use for symbols and source" EOL );
     genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
+    genericsPrintf( "       -F <pos>: Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     genericsPrintf( "       -h: This help" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
     genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel" EOL );
+    genericsPrintf( "       -T: <trigger> Freeze capture when this is seen, one of trigger, ex:<n>[-<m>], addr:<lo>[-<hi>] or" EOL );
+    genericsPrintf( "           itm:<chan>[=<value>] (ITM read from TPIU stream %d). Can be given up to %d times" EOL, ITM_STREAM, TRACETRIGGER_MAX_CONDS );
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "       -w: [pre]:<post> KBytes of trace to keep from before a trigger, and to capture after it (Default all:0)" EOL );
     genericsPrintf( EOL "(Will connect one port higher than that set in -s when TPIU is not used)" EOL );
     genericsPrintf( EOL "(this will automatically select the second output stream from orb TPIU.)" EOL );
     genericsPrintf( EOL "Environment Variables;" EOL );
@@ -175,7 +274,7 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "ab:c:Dd:Ee:f:hs:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "ab:B:c:Dd:Ee:f:F:hs:t:T:v:w:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -185,7 +284,12 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
             case 'b':
-                r->options->buflen = atoi( optarg ) * 1024;
+                r->options->buflen = ( uint64_t )atoi( optarg ) * 1024;
+                break;
+
+            // ------------------------------------
+            case 'B':
+                r->options->holdFile = optarg;
                 break;
 
             // ------------------------------------
@@ -220,6 +324,11 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->startAt = optarg;
+                break;
+
             // ------------------------------------
 
             case 'h':
@@ -261,12 +370,34 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'T':
+                if ( r->options->numTriggers == TRACETRIGGER_MAX_CONDS )
+                {
+                    genericsExit( -1, "Too many triggers" EOL );
+                }
+
+                r->options->trigger[r->options->numTriggers++] = optarg;
+                break;
+
+            // ------------------------------------
+
             case 'v':
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
 
             // ------------------------------------
 
+            case 'w':
+                if ( *optarg != ':' )
+                {
+                    r->options->preTrigger = ( uint64_t )atoi( optarg ) * 1024;
+                }
+
+                r->options->postTrigger = strchr( optarg, ':' ) ? ( uint64_t )atoi( strchr( optarg, ':' ) + 1 ) * 1024 : 0;
+                break;
+
+            // ------------------------------------
+
             case '?':
                 if ( optopt == 'b' )
                 {
@@ -294,141 +425,227 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( V_ERROR, "Elf File not specified" EOL );
     }
 
-    if ( !r->options->buflen )
+    if ( ( r->options->useTPIU ) && ( ( r->options->channel < 0 ) || ( r->options->channel >= TPIU_NUM_STREAMS ) ) )
+    {
+        genericsExit( -1, "Illegal TPIU channel" EOL );
+    }
+
+    if ( ( !r->options->buflen ) || ( r->options->buflen > ( uint64_t )MAX_PM_BUFLEN_K * 1024 ) )
     {
         genericsExit( -1, "Illegal value for Post Mortem Buffer length" EOL );
     }
 
+    TraceTriggerInit( &r->trig, !r->options->noAltAddr );
+
+    for ( int t = 0; t < r->options->numTriggers; t++ )
+    {
+        if ( !TraceTriggerAdd( &r->trig, r->options->trigger[t] ) )
+        {
+            genericsExit( -1, "Illegal trigger %s" EOL, r->options->trigger[t] );
+        }
+    }
+
+    if ( ( r->trig.wantsITM ) && ( ( !r->options->useTPIU ) || ( r->options->channel == ITM_STREAM ) ) )
+    {
+        genericsExit( -1, "ITM triggers need TPIU, with ITM on stream %d" EOL, ITM_STREAM );
+    }
+
+    /* The post-trigger window mustn't push out any of the pre-trigger one */
+    if ( ( r->options->postTrigger >= r->options->buflen ) ||
+            ( ( r->options->preTrigger != UINT64_MAX ) && ( r->options->preTrigger + r->options->postTrigger > r->options->buflen ) ) )
+    {
+        genericsExit( -1, "Trigger window doesn't fit in the Post Mortem Buffer" EOL );
+    }
+
     return true;
 }
 // ====================================================================================================
-static void _processBlock( struct RunTime *r )
+static void _freeze( struct RunTime *r )
 
-/* Generic block processor for received data */
+/* Stop capture for the trigger, keeping only as much from before it as was asked for */
 
 {
-    uint8_t *c = r->rawBlock.buffer;
-    uint32_t y = r->rawBlock.fillLevel;
+    uint64_t before = MirrorRingLevel( &r->pm ) - ( MirrorRingWritten( &r->pm ) - r->trigAt );
 
-    genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, y );
+    if ( before > r->options->preTrigger )
+    {
+        /* The window starts partway into the buffer, so any idea of where the decoder was is lost */
+        MirrorRingDrop( &r->pm, before - r->options->preTrigger );
+        ETMDecoderForceSync( &r->i, false );
+    }
 
-    if ( y )
+    r->frozen = true;
+    r->held = true;
+}
+// ====================================================================================================
+static void _triggered( struct RunTime *r, uint64_t at )
+
+/* The trigger fired with at bytes put in the post mortem buffer, so the end of capture is now known */
+
+{
+    char why[SCRATCH_STRING_LEN];
+
+    r->triggered = true;
+    r->trigAt = at;
+    r->stopAt = at + r->options->postTrigger;
+    genericsReport( V_INFO, "%s" EOL, TraceTriggerDescribe( &r->trig, why, sizeof( why ) ) );
+
+    if ( MirrorRingWritten( &r->pm ) >= r->stopAt )
+    {
+        _freeze( r );
+    }
+}
+// ====================================================================================================
+static void _storeBlock( struct RunTime *r, const uint8_t *c, uint32_t y )
+
+/* Put decoded-to-be data into the post mortem buffer */
+
+{
+    int64_t ofs;
+
+    r->newTotalBytes += y;
+
+    /* Packets are watched for as they go by, so finding the trigger doesn't need a decode */
+    if ( ( !r->triggered ) && ( ( ofs = TraceTriggerETM( &r->trig, c, y ) ) >= 0 ) )
     {
+        _triggered( r, MirrorRingWritten( &r->pm ) + ofs );
+    }
+
+    if ( r->triggered )
+    {
+        /* ...and once it's fired, only as much as the post-trigger window needs goes in */
+        y = ( r->stopAt - MirrorRingWritten( &r->pm ) < y ) ? r->stopAt - MirrorRingWritten( &r->pm ) : y;
+    }
+
+    /* The ring is mirrored, so the block goes in with one copy wherever it lands */
+    if ( MirrorRingPut( &r->pm, c, y, r->singleShot ) < y )
+    {
+        r->held = true;
+    }
+
+    if ( ( r->triggered ) && ( !r->frozen ) && ( MirrorRingWritten( &r->pm ) == r->stopAt ) )
+    {
+        _freeze( r );
+    }
+}
+// ====================================================================================================
+static void _processBlock( struct RunTime *r, const uint8_t *c, uint32_t y )
+
+/* Generic block processor for received data, which can be any length */
+
+{
+    uint32_t maxChunk = r->trig.wantsITM ? ITM_TRIGGER_CHUNK : TRANSFER_SIZE;
+    uint32_t chunk;
+
+    genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, y );
+
 #ifdef DUMP_BLOCK
-        fprintf( stderr, EOL );
+    fprintf( stderr, EOL );
 
-        while ( y-- )
-        {
-            fprintf( stderr, "%02X ", *c++ );
+    for ( uint32_t i = 0; i < y; i++ )
+    {
+        fprintf( stderr, "%02X ", c[i] );
 
-            if ( !( y % 16 ) )
-            {
-                fprintf( stderr, EOL );
-            }
+        if ( !( ( y - i - 1 ) % 16 ) )
+        {
+            fprintf( stderr, EOL );
         }
+    }
 
-        c = r->rawBlock.buffer;
-        y = r->rawBlock.fillLevel;
 #endif
 
-        if ( r->options->useTPIU )
+    if ( !r->options->useTPIU )
+    {
+        _storeBlock( r, c, y );
+        return;
+    }
+
+    /* Strip the TPIU framing, leaving only the ETM data from our channel. This is done in */
+    /* pieces that are sure to fit in the stripped block, and when ITM triggers are being  */
+    /* watched for, that are small enough to say closely where in the ETM they happened.   */
+    while ( ( y ) && ( !r->held ) )
+    {
+        chunk = ( y > maxChunk ) ? maxChunk : y;
+        TPIUDecodeBlock( &r->t, c, chunk, r->tpiuStream );
+        c += chunk;
+        y -= chunk;
+
+        _storeBlock( r, r->strippedBlock.buffer, r->tpiuSpan.fill );
+        r->tpiuSpan.fill = 0;
+
+        if ( ( !r->triggered ) && ( TraceTriggerITM( &r->trig, r->itmBlock.buffer, r->itmSpan.fill ) ) )
         {
-            struct TPIUPacket p;
+            _triggered( r, MirrorRingWritten( &r->pm ) );
+        }
 
-            while ( y-- )
-            {
-                if ( TPIU_EV_RXEDPACKET == TPIUPump( &r->t, *c++ ) )
-                {
-                    if ( !TPIUGetPacket( &r->t, &p ) )
-                    {
-                        genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                    }
-                    else
-                    {
-                        /* Iterate through the packet, putting bytes for ETM into the processing buffer */
-                        for ( uint32_t g = 0; g < p.len; g++ )
-                        {
-                            if ( r->options->channel == p.packet[g].s )
-                            {
-                                r->pmBuffer[r->wp] = p.packet[g].d;
-                                r->newTotalBytes++;
-                                uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
-
-                                if ( nwp == r->rp )
-                                {
-                                    if ( r->singleShot )
-                                    {
-                                        r->held = true;
-                                        return;
-                                    }
-                                    else
-                                    {
-                                        r->rp = ( r->rp + 1 ) % r->options->buflen;
-                                    }
-                                }
-
-                                r->wp = nwp;
-                            }
-                        }
-                    }
-                }
-            }
+        r->itmSpan.fill = 0;
+    }
+}
+// ====================================================================================================
+static char *_storeOPText( struct RunTime *r, const char *str, size_t len )
+
+/* Copy text into the output arena. Chunks never move, so the result stays valid until the next flush */
+
+{
+    struct opChunk *c = r->opChunk;
+    char *d;
+
+    if ( ( !c ) || ( c->size - c->used < len + 1 ) )
+    {
+        if ( ( c ) && ( c->next ) && ( c->next->size >= len + 1 ) )
+        {
+            /* Reuse the next chunk from a previous decode */
+            c = c->next;
         }
         else
         {
-            r->newTotalBytes += y;
+            size_t size = ( len + 1 > OP_CHUNK_SIZE ) ? len + 1 : OP_CHUNK_SIZE;
+            struct opChunk *n = ( struct opChunk * )malloc( sizeof( struct opChunk ) + size );
+            n->size = size;
 
-            while ( y-- )
+            /* Chain it in after the current one, so anything already allocated is still reused */
+            if ( c )
             {
-                r->pmBuffer[r->wp] = *c++;
-                uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
-
-                if ( nwp == r->rp )
-                {
-                    if ( r->singleShot )
-                    {
-                        r->held = true;
-                        return;
-                    }
-                    else
-                    {
-                        r->rp = ( r->rp + 1 ) % r->options->buflen;
-                    }
-                }
-
-                r->wp = nwp;
+                n->next = c->next;
+                c->next = n;
             }
+            else
+            {
+                n->next = r->opChunks;
+                r->opChunks = n;
+            }
+
+            c = n;
         }
+
+        c->used = 0;
+        r->opChunk = c;
     }
+
+    d = &c->d[c->used];
+    memcpy( d, str, len );
+    d[len] = 0;
+    c->used += len + 1;
+    return d;
 }
 // ====================================================================================================
-static void _flushBuffer( struct RunTime *r )
+static struct line *_newOPLine( struct RunTime *r, int32_t lineno, enum LineType lt )
 
-/* Empty the output buffer, and de-allocate its memory */
+/* Get the next line of the staging area the decoder writes into, growing it if needed */
 
 {
-    /* Tell the UI there's nothing more to show */
-    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
+    struct line *l;
 
-    /* Remove all of the recorded lines */
-    while ( r->numLines-- )
+    if ( r->stageLines == r->stageAlloc )
     {
-        if ( !r->opText[r->numLines].isRef )
-        {
-            free( r->opText[r->numLines].buffer );
-        }
+        r->stageAlloc = r->stageAlloc ? r->stageAlloc * 2 : OP_LINES_INITIAL;
+        r->stageText = ( struct line * )realloc( r->stageText, ( sizeof( struct line ) ) * r->stageAlloc );
     }
 
-    /* and the opText buffer */
-    free( r->opText );
-    r->opText = NULL;
-    r->numLines = 0;
-
-    /* ...and the file/line references */
-    r->op.currentLine = NO_LINE;
-    r->op.currentFileindex = NO_FILE;
-    r->op.currentFunctionindex = NO_FUNCTION;
-    r->op.workingAddr = NO_DESTADDRESS;
+    l = &r->stageText[r->stageLines++];
+    l->lt   = lt;
+    l->line = lineno;
+    return l;
 }
 // ====================================================================================================
 static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType lt, const char *fmt, ... )
@@ -437,6 +654,7 @@ static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType
 
 {
     char construct[SCRATCH_STRING_LEN];
+    struct line *l;
     va_list va;
     char *p;
 
@@ -447,14 +665,9 @@ static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType
     /* Make sure we didn't accidentially admit a CR or LF */
     for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
 
-    *p = 0;
-
-    r->opText = ( struct line * )realloc( r->opText, ( sizeof( struct line ) ) * ( r->numLines + 1 ) );
-    r->opText[r->numLines].buffer = strdup( construct );
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = false;
-    r->numLines++;
+    l = _newOPLine( r, lineno, lt );
+    l->buffer = _storeOPText( r, construct, p - construct );
+    l->isRef  = false;
 }
 // ====================================================================================================
 static void _appendRefToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType lt, const char *ref )
@@ -462,14 +675,12 @@ static void _appendRefToOPBuffer( struct RunTime *r, int32_t lineno, enum LineTy
 /* Add line to output buffer, as a reference (which don't be free'd later) */
 
 {
-    r->opText = ( struct line * )realloc( r->opText, ( sizeof( struct line ) ) * ( r->numLines + 1 ) );
+    struct line *l = _newOPLine( r, lineno, lt );
+
 
     /* This line removes the 'const', but we know to not mess with this line */
-    r->opText[r->numLines].buffer = ( char * )ref;
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = true;
-    r->numLines++;
+    l->buffer = ( char * )ref;
+    l->isRef  = true;
 }
 // ====================================================================================================
 static void _etmReport( enum verbLevel l, const char *fmt, ... )
@@ -683,49 +894,418 @@ static void _etmCB( void *d )
     }
 }
 // ====================================================================================================
-static void _dumpBuffer( struct RunTime *r )
+static void _pumpRange( struct RunTime *r, uint32_t from, uint32_t to, etmDecodeCB cb, genericsReportCB report )
 
-/* Dump received data buffer into text buffer */
+/* Pump part of the post-mortem buffer through the decoder, offsets being relative to the oldest data */
 
 {
-    _flushBuffer( r );
+    /* The ring is mirrored, so even a range that wraps is contiguous */
+    ETMDecoderPump( &r->i, MirrorRingSpan( &r->pm, from ), to - from, cb, report, r );
+}
+// ====================================================================================================
+static void _indexCB( void *d )
+
+/* Decoder callback for the index pass. Consume changes just as _etmCB would, noting any address */
 
-    if ( !SymbolSetValid( &r->s, r->options->elffile ) )
+{
+    struct RunTime *r = ( struct RunTime * )d;
+    struct ETMCPUState *cpu = ETMCPUState( &r->i );
+
+    r->indexSawAddress |= ( cpu->changeRecord & ( 1 << EV_CH_ADDRESS ) ) != 0;
+
+    if ( cpu->changeRecord & ( 1 << EV_CH_EX_ENTRY ) )
+    {
+        cpu->changeRecord &= ~( 1 << EV_CH_CANCELLED );
+    }
+
+    cpu->changeRecord &= ~OP_CONSUMED_CHANGES;
+}
+// ====================================================================================================
+static void _addCheckpoint( struct RunTime *r, struct ETMDecoder *i, uint32_t ofs )
+
+{
+    if ( r->cpCount == r->cpAlloc )
+    {
+        r->cpAlloc = r->cpAlloc ? r->cpAlloc * 2 : 64;
+        r->cp = ( struct decodeCheckpoint * )realloc( r->cp, sizeof( struct decodeCheckpoint ) * r->cpAlloc );
+    }
+
+    r->cp[r->cpCount].i = *i;
+    r->cp[r->cpCount].ofs = ofs;
+    r->cpCount++;
+}
+// ====================================================================================================
+static void _indexBuffer( struct RunTime *r )
+
+/* Run the decoder alone over the whole buffer, which is quick, recording places we can restart from later */
+
+{
+    struct ETMDecoder before;
+    uint32_t ofs = 0;
+
+    _addCheckpoint( r, &r->i, 0 );
+
+    while ( ( ofs < r->pmLen ) && ( !__atomic_load_n( &r->cancelDecode, __ATOMIC_RELAXED ) ) )
     {
-        if ( !( r->s = SymbolSetCreate( r->options->elffile, r->options->deleteMaterial, r->options->demangle, true, true ) ) )
+        __atomic_store_n( &r->progress, ( int32_t )( ( uint64_t )ofs * 100 / r->pmLen ), __ATOMIC_RELAXED );
+        uint32_t next = r->cp[r->cpCount - 1].ofs + CHECKPOINT_SPACING;
+
+        if ( ofs < next )
         {
-            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
-            return;
+            /* Not due another checkpoint yet, so go at full speed */
+            next = ( next < r->pmLen ) ? next : r->pmLen;
+            _pumpRange( r, ofs, next, _indexCB, NULL );
+            ofs = next;
         }
         else
         {
-            genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+            /* Looking for an address packet, so go a byte at a time to know exactly where it finished */
+            before = r->i;
+            r->indexSawAddress = false;
+            _pumpRange( r, ofs, ofs + 1, _indexCB, NULL );
+
+            if ( r->indexSawAddress )
+            {
+                _addCheckpoint( r, &before, ofs );
+            }
+
+            ofs++;
         }
     }
 
-    /* Pump the received messages through the ETM decoder, it will callback to _etmCB with complete sentences */
-    int bytesAvailable = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
+    r->endState = r->i;
+}
+// ====================================================================================================
+static void _decodeChunk( struct RunTime *r, uint32_t c )
 
-    /* If we started wrapping (i.e. the rx ring buffer got full) then any guesses about sync status are invalid */
-    if ( ( bytesAvailable == r->options->buflen - 1 ) && ( !r->singleShot ) )
+/* Decode from one checkpoint to the next into the staging area */
+
+{
+    r->i = r->cp[c].i;
+    r->op.currentLine = NO_LINE;
+    r->op.currentFileindex = NO_FILE;
+    r->op.currentFunctionindex = NO_FUNCTION;
+    r->op.workingAddr = NO_DESTADDRESS;
+
+    _pumpRange( r, r->cp[c].ofs, ( c + 1 < r->cpCount ) ? r->cp[c + 1].ofs : r->pmLen, _etmCB, _etmReport );
+}
+// ====================================================================================================
+static bool _decodeWindow( struct RunTime *r, bool all, struct decodeBatch *b )
+
+/* Decode chunks working back from the start of what's already been decoded, into a batch of lines in order */
+
+{
+    uint32_t last = r->cpDecoded;
+    int32_t *starts = ( int32_t * )malloc( sizeof( int32_t ) * ( last ? last : 1 ) );
+    bool cancelled = false;
+    int32_t w = 0;
+
+    /* Chunks are decoded latest first into the staging area, noting where each one starts */
+    r->stageLines = 0;
+
+    while ( ( r->cpDecoded ) && ( ( all ) || ( r->stageLines < DECODE_WINDOW_LINES ) ) )
     {
-        ETMDecoderForceSync( &r->i, false );
+        if ( ( cancelled = __atomic_load_n( &r->cancelDecode, __ATOMIC_RELAXED ) ) )
+        {
+            break;
+        }
+
+        __atomic_store_n( &r->progress, all ? ( int32_t )( ( last - r->cpDecoded ) * 100 / last ) :
+                          ( r->stageLines * 100 / DECODE_WINDOW_LINES ), __ATOMIC_RELAXED );
+        starts[--r->cpDecoded] = r->stageLines;
+        _decodeChunk( r, r->cpDecoded );
     }
 
-    if ( ( bytesAvailable + r->rp ) > r->options->buflen )
+    /* Leave the decoder as it would be after a complete run, ready for the next capture */
+    r->i = r->endState;
+
+    if ( cancelled )
     {
-        /* Buffer is wrapped - submit both parts */
-        ETMDecoderPump( &r->i, &r->pmBuffer[r->rp], r->options->buflen - r->rp, _etmCB, _etmReport, r );
-        ETMDecoderPump( &r->i, &r->pmBuffer[0], r->wp, _etmCB, _etmReport, r );
+        free( starts );
+        return false;
     }
-    else
+
+    /* ...then the chunks are copied out into the batch in the right order */
+    b->numLines = r->stageLines;
+    b->lines = ( struct line * )malloc( sizeof( struct line ) * ( b->numLines ? b->numLines : 1 ) );
+    b->moreAbove = ( r->cpDecoded != 0 );
+
+    for ( uint32_t c = r->cpDecoded; c < last; c++ )
     {
-        /* Buffer is not wrapped */
-        ETMDecoderPump( &r->i, &r->pmBuffer[r->rp], bytesAvailable, _etmCB, _etmReport, r );
+        /* Chunk c runs up to the start of the one decoded after it, which is the one before it in the buffer */
+        int32_t end = ( c > r->cpDecoded ) ? starts[c - 1] : r->stageLines;
+        memcpy( &b->lines[w], &r->stageText[starts[c]], sizeof( struct line ) * ( end - starts[c] ) );
+        w += end - starts[c];
     }
 
-    /* Submit this constructed buffer for display */
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+    free( starts );
+    return true;
+}
+// ====================================================================================================
+static bool _pushBatch( struct RunTime *r, struct decodeBatch *b )
+
+/* Hand a batch to the UI, waiting for room if needed. Only ever called from the decode thread */
+
+{
+    uint32_t head = r->qHead;
+
+    while ( head - __atomic_load_n( &r->qTail, __ATOMIC_ACQUIRE ) == DECODE_QUEUE_LEN )
+    {
+        if ( __atomic_load_n( &r->cancelDecode, __ATOMIC_RELAXED ) )
+        {
+            return false;
+        }
+
+        usleep( 1000 );
+    }
+
+    r->q[head % DECODE_QUEUE_LEN] = *b;
+
+    /* Releasing the head publishes the lines, and the arena text they point to, along with it */
+    __atomic_store_n( &r->qHead, head + 1, __ATOMIC_RELEASE );
+    return true;
+}
+// ====================================================================================================
+static bool _popBatch( struct RunTime *r, struct decodeBatch *b )
+
+/* Take the next batch from the decode thread, if there is one. Only ever called from the UI */
+
+{
+    uint32_t tail = r->qTail;
+
+    if ( tail == __atomic_load_n( &r->qHead, __ATOMIC_ACQUIRE ) )
+    {
+        return false;
+    }
+
+    *b = r->q[tail % DECODE_QUEUE_LEN];
+    __atomic_store_n( &r->qTail, tail + 1, __ATOMIC_RELEASE );
+    return true;
+}
+// ====================================================================================================
+static void *_decodeThread( void *arg )
+
+/* Do the decoding jobs handed over by the UI, passing the output back as it's completed */
+
+{
+    struct RunTime *r = ( struct RunTime * )arg;
+    struct decodeBatch b;
+    enum decodeJob job;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &r->decodeLock );
+
+        while ( r->job == DJ_NONE )
+        {
+            pthread_cond_wait( &r->decodeCond, &r->decodeLock );
+        }
+
+        job = r->job;
+        pthread_mutex_unlock( &r->decodeLock );
+
+        if ( job == DJ_DUMP )
+        {
+            /* Find the places we can decode from, then decode the end of the buffer */
+            __atomic_store_n( &r->progressWhat, "Indexing", __ATOMIC_RELAXED );
+            _indexBuffer( r );
+            r->cpDecoded = r->cpCount;
+        }
+
+        __atomic_store_n( &r->progressWhat, "Decoding", __ATOMIC_RELAXED );
+
+        if ( ( !__atomic_load_n( &r->cancelDecode, __ATOMIC_RELAXED ) ) && ( _decodeWindow( r, false, &b ) ) && ( !_pushBatch( r, &b ) ) )
+        {
+            free( b.lines );
+        }
+
+        __atomic_store_n( &r->progressWhat, NULL, __ATOMIC_RELAXED );
+
+        pthread_mutex_lock( &r->decodeLock );
+        r->job = DJ_NONE;
+        pthread_cond_broadcast( &r->decodeCond );
+        pthread_mutex_unlock( &r->decodeLock );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _startDecode( struct RunTime *r, enum decodeJob job )
+
+/* Give the decode thread something to do */
+
+{
+    pthread_mutex_lock( &r->decodeLock );
+    r->cancelDecode = false;
+    r->job = job;
+    pthread_cond_broadcast( &r->decodeCond );
+    pthread_mutex_unlock( &r->decodeLock );
+}
+// ====================================================================================================
+static bool _decodeBusy( struct RunTime *r )
+
+{
+    bool busy;
+
+    pthread_mutex_lock( &r->decodeLock );
+    busy = ( r->job != DJ_NONE );
+    pthread_mutex_unlock( &r->decodeLock );
+    return busy;
+}
+// ====================================================================================================
+static void _takeBatch( struct RunTime *r, struct decodeBatch *b )
+
+/* Put a batch of decoded lines on the front of the output buffer, moving what's there already up */
+
+{
+    bool first = ( !r->numLines );
+
+    if ( b->numLines )
+    {
+        while ( r->numLines + b->numLines > r->opTextAlloc )
+        {
+            r->opTextAlloc = r->opTextAlloc ? r->opTextAlloc * 2 : OP_LINES_INITIAL;
+        }
+
+        r->opText = ( struct line * )realloc( r->opText, ( sizeof( struct line ) ) * r->opTextAlloc );
+        memmove( &r->opText[b->numLines], r->opText, sizeof( struct line ) * r->numLines );
+        memcpy( r->opText, b->lines, sizeof( struct line ) * b->numLines );
+        r->numLines += b->numLines;
+    }
+
+    free( b->lines );
+
+    if ( first )
+    {
+        /* This is the end of the buffer, so submit it for display */
+        SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+    }
+    else if ( b->numLines )
+    {
+        SIOprependedOutput( r->sio, r->numLines, b->numLines );
+    }
+
+    SIOsetMoreAbove( r->sio, b->moreAbove );
+}
+// ====================================================================================================
+static void _collectDecoded( struct RunTime *r )
+
+/* Pick up whatever the decode thread has finished, and show how it's getting on */
+
+{
+    struct decodeBatch b;
+
+    /* Anything arriving while we're diving waits until we surface, since opText isn't what's on view */
+    while ( ( !r->diving ) && ( _popBatch( r, &b ) ) )
+    {
+        _takeBatch( r, &b );
+    }
+
+    SIOsetProgress( r->sio, __atomic_load_n( &r->progressWhat, __ATOMIC_RELAXED ), __atomic_load_n( &r->progress, __ATOMIC_RELAXED ) );
+}
+// ====================================================================================================
+static void _waitDecode( struct RunTime *r, bool cancel )
+
+/* Wait for the decode thread to be idle, either dropping what it's done or putting it in the output buffer */
+
+{
+    struct decodeBatch b;
+
+    if ( cancel )
+    {
+        __atomic_store_n( &r->cancelDecode, true, __ATOMIC_RELAXED );
+    }
+
+    pthread_mutex_lock( &r->decodeLock );
+
+    while ( r->job != DJ_NONE )
+    {
+        pthread_cond_wait( &r->decodeCond, &r->decodeLock );
+    }
+
+    pthread_mutex_unlock( &r->decodeLock );
+
+    while ( _popBatch( r, &b ) )
+    {
+        if ( cancel )
+        {
+            free( b.lines );
+        }
+        else
+        {
+            _takeBatch( r, &b );
+        }
+    }
+
+    SIOsetProgress( r->sio, NULL, 0 );
+}
+// ====================================================================================================
+static void _flushBuffer( struct RunTime *r )
+
+/* Empty the output buffer, and de-allocate its memory */
+
+{
+    /* Make sure the decode thread has let go of everything first */
+    _waitDecode( r, true );
+
+    /* Tell the UI there's nothing more to show */
+    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
+
+    /* Forget all of the recorded lines, but keep the memory for next time */
+    r->numLines = 0;
+    r->cpCount = r->cpDecoded = 0;
+    r->dumped = false;
+
+    if ( ( r->opChunk = r->opChunks ) )
+    {
+        r->opChunk->used = 0;
+    }
+
+    /* ...and the file/line references */
+    r->op.currentLine = NO_LINE;
+    r->op.currentFileindex = NO_FILE;
+    r->op.currentFunctionindex = NO_FUNCTION;
+    r->op.workingAddr = NO_DESTADDRESS;
+}
+// ====================================================================================================
+static void _dumpBuffer( struct RunTime *r )
+
+/* Dump received data buffer into text buffer */
+
+{
+    _flushBuffer( r );
+
+    /* Nothing refers into the old set now, so move on to the latest one. It's held until the next dump */
+    SymbolReloadExit( r->reload, 0 );
+
+    if ( !SymbolReloadGeneration( r->reload ) )
+    {
+        /* The first load is still going on, and there's nothing to show without it */
+        SymbolReloadWait( r->reload, SYMBOL_WAIT_MS );
+    }
+
+    if ( !( r->s = SymbolReloadEnter( r->reload, 0 ) ) )
+    {
+        genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+        return;
+    }
+
+    genericsReport( V_DEBUG, "Using %s (generation %u)" EOL, r->options->elffile, r->s->generation );
+
+    /* Pump the received messages through the ETM decoder, it will callback to _etmCB with complete sentences */
+    uint64_t bytesAvailable = MirrorRingLevel( &r->pm );
+
+    /* If we started wrapping (i.e. the rx ring buffer got full) then any guesses about sync status are invalid */
+    if ( ( bytesAvailable == r->pm.size ) && ( !r->singleShot ) )
+    {
+        ETMDecoderForceSync( &r->i, false );
+    }
+
+    /* The decode thread indexes the buffer and decodes the end of it, leaving us free to keep the UI going. */
+    /* The rest is decoded as the user moves up towards it.                                                   */
+    r->pmLen = bytesAvailable;
+    r->dumped = true;
+    _startDecode( r, DJ_DUMP );
 }
 // ====================================================================================================
 static bool _currentFileAndLine( struct RunTime *r, char **file, int32_t *l )
@@ -956,6 +1536,16 @@ static void _doSave( struct RunTime *r )
     uint32_t w;
     char *p;
 
+    struct decodeBatch b;
+
+    /* The report needs everything, not just what's been looked at */
+    _waitDecode( r, false );
+
+    if ( _decodeWindow( r, true, &b ) )
+    {
+        _takeBatch( r, &b );
+    }
+
     snprintf( fn, SCRATCH_STRING_LEN, "%s.trace", SIOgetSaveFilename( r->sio ) );
     f = fopen( fn, "wb" );
 
@@ -965,14 +1555,7 @@ static void _doSave( struct RunTime *r )
         return;
     }
 
-    w = r->rp;
-
-    while ( w != r->wp )
-    {
-        fwrite( &r->pmBuffer[w], 1, 1, f );
-        w = ( w + 1 ) % r->options->buflen;
-    }
-
+    fwrite( MirrorRingSpan( &r->pm, 0 ), 1, MirrorRingLevel( &r->pm ), f );
     fclose( f );
 
     snprintf( fn, SCRATCH_STRING_LEN, "%s.report", SIOgetSaveFilename( r->sio ) );
@@ -1039,7 +1622,7 @@ static void _doExit( void )
 int main( int argc, char *argv[] )
 
 {
-    int sourcefd;
+    int sourcefd = 0;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     int flag = 1;
@@ -1049,6 +1632,12 @@ int main( int argc, char *argv[] )
     struct timeval tv;
     fd_set readfds;
 
+    struct fileSource fs;
+    bool fileOpen = false;
+    bool reopened = false;
+    const uint8_t *data;
+    ssize_t t;
+
     /* Have a basic name and search string set up */
     _r.progName = genericsBasename( argv[0] );
 
@@ -1061,6 +1650,9 @@ int main( int argc, char *argv[] )
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
 
+    /* Symbols are loaded in the background, to be ready by the time they're needed */
+    _r.reload = SymbolReloadStart( _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true );
+
     /* Create a screen and interaction handler */
     _r.sio = SIOsetup( _r.progName, _r.options->elffile, ( _r.options->file != NULL ) );
 
@@ -1079,14 +1671,47 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-    /* Create the buffer memory */
-    _r.pmBuffer = ( uint8_t * )calloc( 1, _r.options->buflen );
+    /* Create the buffer memory, mapped twice over so the decoder never sees it wrap */
+    if ( !MirrorRingCreate( &_r.pm, _r.options->buflen, _r.options->holdFile, &reopened ) )
+    {
+        genericsExit( -1, "Failed to create post-mortem buffer" EOL );
+    }
+
+    /* Whatever was held when we last went away is shown again, until capture is restarted */
+    if ( ( reopened ) && ( MirrorRingLevel( &_r.pm ) ) )
+    {
+        genericsReport( V_INFO, "Reopened %" PRIu64 " bytes held in %s" EOL, MirrorRingLevel( &_r.pm ), _r.options->holdFile );
+        _r.held = true;
+        SIOheld( _r.sio, _r.held );
+
+        /* ...and if a trigger is set, it's as if it had just fired and frozen this */
+        _r.triggered = _r.frozen = true;
+    }
 
     ETMDecoderInit( &_r.i, !( _r.options->noAltAddr ) );
 
+    /* _etmCB walks the disposition bits, so it can take a whole run of atoms at once */
+    ETMDecoderBatchAtoms( &_r.i, true );
+
+    /* Decoding happens off to the side, so we can keep capturing and talking to the user while it goes on */
+    if ( pthread_create( &_r.decodeThread, NULL, &_decodeThread, &_r ) )
+    {
+        genericsExit( -1, "Failed to create decode thread" EOL );
+    }
+
     if ( _r.options->useTPIU )
     {
         TPIUDecoderInit( &_r.t );
+        _r.tpiuSpan.buffer = _r.strippedBlock.buffer;
+        _r.tpiuSpan.len = TRANSFER_SIZE;
+        _r.tpiuStream[_r.options->channel] = &_r.tpiuSpan;
+
+        if ( _r.trig.wantsITM )
+        {
+            _r.itmSpan.buffer = _r.itmBlock.buffer;
+            _r.itmSpan.len = TRANSFER_SIZE;
+            _r.tpiuStream[ITM_STREAM] = &_r.itmSpan;
+        }
     }
 
     while ( !_r.ending )
@@ -1138,10 +1763,14 @@ int main( int argc, char *argv[] )
         }
         else
         {
+            if ( !( fileOpen = FileSourceOpen( &fs, _r.options->file ) ) )
+            {
+                genericsExit( -4, "Can't open file %s" EOL, _r.options->file );
+            }
 
-            if ( ( sourcefd = open( _r.options->file, O_RDONLY ) ) < 0 )
+            if ( ( _r.options->startAt ) && ( !FileSourceSeek( &fs, _r.options->startAt ) ) )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, _r.options->file );
+                genericsExit( -4, "Can't start %s from %s" EOL, _r.options->file, _r.options->startAt );
             }
         }
 
@@ -1171,25 +1800,38 @@ int main( int argc, char *argv[] )
                 break;
             }
 
-            if ( sourcefd && FD_ISSET( sourcefd, &readfds ) )
+            if ( fileOpen )
             {
-                /* We always read the data, even if we're held, to keep the socket alive */
-                _r.rawBlock.fillLevel = read( sourcefd, _r.rawBlock.buffer, TRANSFER_SIZE );
+                /* Files come straight out of the mapping, as much as will fit in the buffer at a time */
+                t = FileSourceGet( &fs, &data, _r.options->buflen );
 
-                if ( ( _r.rawBlock.fillLevel <= 0 ) && _r.options->file )
+                if ( t <= 0 )
+                {
+                    /* Read from file is complete */
+                    FileSourceClose( &fs );
+                    fileOpen = false;
+                }
+                else if ( !_r.held )
                 {
-                    /* Read from file is complete, remove fd */
-                    close( sourcefd );
-                    sourcefd = 0;
+                    _processBlock( &_r, data, t );
                 }
+            }
 
-                if ( !_r.held )
+            if ( sourcefd && FD_ISSET( sourcefd, &readfds ) )
+            {
+                /* We always read the data, even if we're held, to keep the socket alive */
+                _r.rawBlock.fillLevel = read( sourcefd, _r.rawBlock.buffer, TRANSFER_SIZE );
+
+                if ( ( !_r.held ) && ( _r.rawBlock.fillLevel > 0 ) )
                 {
                     /* Pump all of the data through the protocol handler */
-                    _processBlock( &_r );
+                    _processBlock( &_r, _r.rawBlock.buffer, _r.rawBlock.fillLevel );
                 }
             }
 
+            /* Take on anything that's been decoded since last time */
+            _collectDecoded( &_r );
+
             /* Update the outputs and deal with any keys that made it up this high */
             switch ( SIOHandler( _r.sio, ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS, _r.oldTotalIntervalBytes ) )
             {
@@ -1200,7 +1842,13 @@ int main( int argc, char *argv[] )
 
                         if ( !_r.held )
                         {
-                            _r.wp = _r.rp = 0;
+                            /* Resuming capture, so anything still being decoded is of no interest */
+                            _waitDecode( &_r, true );
+                            MirrorRingEmpty( &_r.pm );
+
+                            /* ...and the trigger starts watching again */
+                            _r.triggered = _r.frozen = false;
+                            TraceTriggerArm( &_r.trig );
 
                             if ( _r.diving )
                             {
@@ -1240,6 +1888,14 @@ int main( int argc, char *argv[] )
                     _doFilesurface( &_r );
                     break;
 
+                case SIO_EV_EXTEND:
+                    if ( !_decodeBusy( &_r ) )
+                    {
+                        _startDecode( &_r, DJ_EXTEND );
+                    }
+
+                    break;
+
                 case SIO_EV_QUIT:
                     _r.ending = true;
                     break;
@@ -1248,15 +1904,32 @@ int main( int argc, char *argv[] )
                     break;
             }
 
-            /* Deal with possible timeout on sampling, or if this is a read-from-file that is finished */
-            if ( ( !_r.numLines )  &&
-                    (
-                                ( _r.options->file && !sourcefd ) ||
+            /* A file that finishes before the trigger window is complete has whatever there is of it decoded */
+            if ( ( TraceTriggerSet( &_r.trig ) ) && ( _r.options->file ) && ( !fileOpen ) && ( !_r.frozen ) )
+            {
+                if ( _r.triggered )
+                {
+                    _freeze( &_r );
+                }
+                else
+                {
+                    _r.frozen = _r.held = true;
+                    SIOheld( _r.sio, _r.held );
+                    SIOalert( _r.sio, "Trigger not seen" );
+                }
+            }
 
-                                ( ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS ) &&
-                                  ( _r.newTotalBytes - _r.oldTotalHangBytes == 0 ) &&
-                                  ( _r.wp != _r.rp ) )
-                    )
+            /* Deal with a trigger window being complete or, without a trigger, possible timeout on sampling */
+            /* or a read-from-file that is finished                                                        */
+            if ( ( !_r.numLines ) && ( !_r.dumped ) &&
+                    ( TraceTriggerSet( &_r.trig ) ? ( _r.frozen && _r.triggered ) :
+                      (
+                                  ( _r.options->file && !fileOpen ) ||
+
+                                  ( ( ( genericsTimestampmS() - lastHTime ) > HANG_TIME_MS ) &&
+                                    ( _r.newTotalBytes - _r.oldTotalHangBytes == 0 ) &&
+                                    ( MirrorRingLevel( &_r.pm ) ) )
+                      ) )
                )
             {
                 _dumpBuffer( &_r );
@@ -1291,6 +1964,13 @@ int main( int argc, char *argv[] )
         if ( sourcefd )
         {
             close( sourcefd );
+            sourcefd = 0;
+        }
+
+        if ( fileOpen )
+        {
+            FileSourceClose( &fs );
+            fileOpen = false;
         }
 
         if ( _r.options->file )
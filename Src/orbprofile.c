@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <signal.h>
@@ -26,22 +27,20 @@
 #include "symbols.h"
 #include "nw.h"
 #include "ext_fileformats.h"
+#include "fileSource.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
+#define SNAPSHOT_POLL_MS    (100)        /* Longest the processing thread waits for data before checking for a snapshot */
+#define MAX_DECODE_THREADS  (64)         /* Most threads a file can be decoded with */
+#define SEGMENT_PUMP_LEN    (1024*1024)  /* Segments are pumped through their decoder this much at a time */
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
 
 /* How many transfer buffers from the source to allocate */
 #define NUM_RAW_BLOCKS (1000)
 
-#define DBG_OUT(...) printf(__VA_ARGS__)
-//#define DBG_OUT(...)
-
-struct _subcallAccount
-{
-    struct subcallSig sig;
-    uint64_t inTicks;
-};
+/* Largest number of halfword slots in the flat instruction table (i.e. 32MB of address space) */
+#define MAX_INST_TABLE_SLOTS (16*1024*1024)
 
 
 /* ---------- CONFIGURATION ----------------- */
@@ -49,6 +48,7 @@ struct Options                           /* Record for options, either defaults
 {
     bool demangle;                       /* Demangle C++ names */
     char *file;                          /* File host connection */
+    char *startAt;                       /* Where in the file to start from */
     bool fileTerminate;                  /* Terminate when file read isn't successful */
 
     char *deleteMaterial;                /* Material to strip off front of filenames for target */
@@ -60,6 +60,13 @@ struct Options                           /* Record for options, either defaults
     char *profile;                       /* File to output profile information */
     int  sampleDuration;                 /* How long we are going to sample for */
 
+    int  threads;                        /* Number of threads to decode a file with */
+    int  snapshotInterval;               /* Seconds between snapshots of the profile, zero for none */
+    bool rolling;                        /* Snapshots are of everything so far, rather than since the last one */
+
+    enum traceLevel traceLevel;          /* How much of the decode to trace */
+    char *traceFile;                     /* ...and where to write it */
+
     bool noaltAddr;                      /* Dont use alternate addressing */
     bool useTPIU;                        /* Are we using TPIU, and stripping TPIU frames? */
     int  channel;                        /* When TPIU is in use, which channel to decode? */
@@ -85,6 +92,9 @@ struct opConstruct
     uint32_t nextAddr;                   /* The address we will next be accessing (if known) */
     uint32_t lastfn;                     /* The function of the last instruction carried out */
 
+    uint32_t incAddr;                    /* Atoms outstanding from the last batch, the last one still to be actioned */
+    uint32_t disposition;                /* ...and what happened to each of them */
+
     uint64_t firsttstamp;                /* First timestamp we recorded (that was valid) */
     uint64_t lasttstamp;                 /* Last timestamp we recorded (that was valid) */
 
@@ -99,6 +109,19 @@ struct dataBlock
     uint8_t buffer[TRANSFER_SIZE];
 };
 
+/* Copy of the counts, taken by the processing thread for the snapshot writer */
+struct snapshot
+{
+    struct execEntryHash *inst;          /* Exec entries with counts to report */
+    uint32_t instCount;                  /* ...number of them */
+    uint32_t instAlloc;                  /* ...and how many there's room for */
+    struct subcall *call;                /* Calls with counts to report */
+    uint32_t callCount;                  /* ...number of them */
+    uint32_t callAlloc;                  /* ...and how many there's room for */
+    uint64_t timelen;                    /* Trace time covered */
+    uint32_t seq;                        /* Number of this snapshot, from 1 */
+};
+
 /* ----------- LIVE STATE ----------------- */
 struct RunTime
 {
@@ -110,13 +133,26 @@ struct RunTime
     struct SymbolSet *s;                        /* Symbols read from elf */
 
     /* Calls related info */
-    struct edge *calls;                         /* Call data table */
-    struct subcall *subhead;                    /* Calls onstruct data */
+    struct callGraph calls;                     /* Calls between each source/dest pair */
     struct execEntryHash *insthead;             /* Exec table handle for hash */
 
+    /* Flat, address indexed, exec entries for the image. Anything outside of it uses the hash */
+    struct execEntryHash *instTable;            /* Record for each instruction in the image */
+    struct execEntryHash **instIndex;           /* Halfword indexed pointers into instTable */
+    uint32_t instBase;                          /* Address corresponding to instIndex[0] */
+    uint32_t instSlots;                         /* Number of entries in instIndex */
+
     /* Subroutine related info...the call stack and its length */
-    struct _subcallAccount *substack;           /* Calls stack data */
-    uint32_t substacklen;                       /* Calls stack length */
+    struct callStack stack;                     /* Calls stack data */
+
+    /* Snapshots, written out by their own thread while decode continues */
+    struct snapshot snap;                       /* The current snapshot */
+    bool snapPending;                           /* ...waiting for, or being, written */
+    uint32_t snapDue;                           /* When the next one should be taken, in mS */
+    uint64_t snapTstamp;                        /* Trace time the last one was taken at */
+    pthread_t snapThread;                       /* Thread writing them out */
+    pthread_mutex_t snapLock;                   /* Lock and condition for passing them over */
+    pthread_cond_t snapCond;
 
     /* Stats about the run */
     int instCount;                              /* Number of instruction locations */
@@ -133,7 +169,7 @@ struct RunTime
     /* Ring buffer for samples ... this 'pads' the rate data arrive and how fast they can be processed */
     int wp;                                     /* Read and write pointers into transfer buffers */
     int rp;
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];  /* Transfer buffers from the receiver */
+    struct dataBlock *rawBlock;                 /* Transfer buffers from the receiver, NUM_RAW_BLOCKS of them */
 
     /* State info */
     volatile bool ending;                       /* Flag indicating app is terminating */
@@ -151,6 +187,15 @@ struct RunTime
     .options = &_options
 };
 
+/* Part of a file, decoded by its own thread */
+struct segment
+{
+    const uint8_t *buf;                  /* Start of the segment */
+    size_t len;                          /* ...and its length */
+    pthread_t thread;                    /* Thread decoding it */
+    struct RunTime r;                    /* Decoder and accumulations for this segment */
+};
+
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -164,35 +209,13 @@ static void _callEvent( struct RunTime *r, uint32_t retAddr, uint32_t to )
 
 {
     struct ETMCPUState *cpu = ETMCPUState( &r->i );
-    struct subcall *s;
-
-    /* ...add it to the call stack */
-    r->substack = ( struct _subcallAccount * )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct _subcallAccount ) );
-
-    /* This is a call */
-    r->substack[r->substacklen].sig.src     = retAddr;
-    r->substack[r->substacklen].sig.dst     = to;
-    r->substack[r->substacklen].inTicks     = cpu->instCount;
-
-    /* Find a record for this source/dest pair */
-    HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
-
-    if ( !s )
-    {
-        /* This call entry doesn't exist (i.e. it's the first time this from/to pair have been seen...let's create it */
-        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-        memcpy( &s->sig, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ) );
-        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
-    }
-
-    r->substacklen++;
 
-    for ( uint32_t g = 0; g < r->substacklen; g++ )
-    {
-        putchar( ' ' );
-    }
+    /* Find (or make, if it's the first time this from/to pair have been seen) a record for it, and stack it */
+    struct subcallAccount *e = CallStackPush( &r->stack );
+    e->s       = CallGraphFindOrCreate( &r->calls, retAddr, to, NULL );
+    e->inTicks = cpu->instCount;
 
-    DBG_OUT( "INC:%3d %08x -> %08x" EOL, r->substacklen, retAddr, to );
+    GTRACE( T_CALLS, r->stack.depth, "INC:%3d %08x -> %08x" EOL, r->stack.depth, retAddr, to );
 }
 // ====================================================================================================
 static void _returnEvent( struct RunTime *r, uint32_t to )
@@ -201,11 +224,11 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
 
 {
     struct ETMCPUState *cpu = ETMCPUState( &r->i );
-    struct subcall *s;
-    uint32_t orig = r->substacklen;
+    struct subcallAccount *e;
+    uint32_t orig = r->stack.depth;
 
     /* Cover the startup case that we happen to hit a return before a call */
-    if ( !r->substack )
+    if ( !r->stack.e )
     {
         return;
     }
@@ -213,45 +236,128 @@ static void _returnEvent( struct RunTime *r, uint32_t to )
     /* Check we've got a valid stack entry to match to */
     do
     {
-        if ( !r->substacklen )
+        if ( !r->stack.depth )
         {
-            DBG_OUT( "OUT OUT OF STACK ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^" EOL );
+            GTRACE( T_FLOW, 0, "OUT OUT OF STACK ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^" EOL );
             break;
         }
 
         /* The -1th entry was the last written, so see if that is back far enough */
-        r->substacklen--;
-
-        for ( uint32_t g = 0; g < r->substacklen + 1; g++ )
-        {
-            putchar( ' ' );
-        }
+        e = &r->stack.e[--r->stack.depth];
 
-        DBG_OUT( " DEC:%3d %08x " EOL, r->substacklen + 1, r->substack[r->substacklen].sig.src );
-        HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
-        assert( s );
+        GTRACE( T_CALLS, r->stack.depth + 1, " DEC:%3d %08x " EOL, r->stack.depth + 1, e->s->sig.src );
 
-        /* We don't bother deallocating memory here cos it'll be done the next time we make a call */
-        s->myCost += cpu->instCount - r->substack[r->substacklen].inTicks;
-        s->count++;
+        /* The entry stays allocated, ready for the next call to reuse */
+        e->s->myCost += cpu->instCount - e->inTicks;
+        e->s->count++;
     }
-    while ( to != r->substack[r->substacklen].sig.src );
+    while ( to != e->s->sig.src );
 
     /* Check function we popped back to matches where we think we should be */
-    if ( to != r->substack[r->substacklen].sig.src )
+    if ( ( genericsTraceOn( T_FLOW ) ) && ( to != r->stack.e[r->stack.depth].s->sig.src ) )
     {
         for ( uint32_t ty = 0; ty < orig; ty++ )
         {
-            DBG_OUT( "%d:%08X ", ty, r->substack[ty].sig.src );
+            genericsTrace( 0, "%d:%08X ", ty, r->stack.e[ty].s->sig.src );
         }
 
-        DBG_OUT( "(wanted %08x, got %08x)" EOL, to, r->substack[r->substacklen].sig.src );
+        genericsTrace( 0, "(wanted %08x, got %08x)" EOL, to, r->stack.e[r->stack.depth].s->sig.src );
+    }
+}
+// ====================================================================================================
+static void _buildInstTable( struct RunTime *r )
+
+/* Create exec entries for every instruction in the image, indexed directly by address */
+
+{
+    struct sourceLineEntry *src;
+    struct assyLineEntry *a;
+    struct execEntryHash *e;
+    uint32_t lowAddr = 0xffffffff;
+    uint32_t highAddr = 0;
+    uint32_t count = 0;
+
+    for ( uint32_t i = 0; i < r->s->sourceCount; i++ )
+    {
+        src = &r->s->sources[i];
+
+        for ( uint32_t j = 0; j < src->assyLines; j++ )
+        {
+            lowAddr = ( src->assy[j].addr < lowAddr ) ? src->assy[j].addr : lowAddr;
+            highAddr = ( src->assy[j].addr > highAddr ) ? src->assy[j].addr : highAddr;
+            count++;
+        }
+    }
+
+    if ( !count )
+    {
+        genericsReport( V_WARN, "No assembly available for instruction table" EOL );
+        return;
+    }
+
+    lowAddr &= ~1;
+
+    if ( ( ( highAddr - lowAddr ) >> 1 ) >= MAX_INST_TABLE_SLOTS )
+    {
+        genericsReport( V_WARN, "Image too sparse for instruction table, only covering %08x-%08x" EOL, lowAddr, lowAddr + ( ( MAX_INST_TABLE_SLOTS - 1 ) << 1 ) );
+        highAddr = lowAddr + ( ( MAX_INST_TABLE_SLOTS - 1 ) << 1 );
+    }
+
+    r->instBase  = lowAddr;
+    r->instSlots = ( ( highAddr - lowAddr ) >> 1 ) + 1;
+    r->instIndex = ( struct execEntryHash ** )calloc( r->instSlots, sizeof( struct execEntryHash * ) );
+    e = r->instTable = ( struct execEntryHash * )calloc( count, sizeof( struct execEntryHash ) );
+
+    for ( uint32_t i = 0; i < r->s->sourceCount; i++ )
+    {
+        src = &r->s->sources[i];
+
+        for ( uint32_t j = 0; j < src->assyLines; j++ )
+        {
+            a = &src->assy[j];
+            uint32_t idx = ( a->addr - r->instBase ) >> 1;
+
+            /* Only the first claim on an address counts, the same as a lookup would find */
+            if ( ( a->addr & 1 ) || ( a->addr < r->instBase ) || ( idx >= r->instSlots ) || ( r->instIndex[idx] ) )
+            {
+                continue;
+            }
+
+            e->addr          = a->addr;
+            e->fileindex     = src->fileIdx;
+            e->line          = src->lineNo;
+            e->functionindex = src->functionIdx;
+            e->isJump        = a->isJump;
+            e->isSubCall     = a->isSubCall;
+            e->isReturn      = a->isReturn;
+            e->jumpdest      = a->jumpdest;
+            e->is4Byte       = a->is4Byte;
+            e->codes         = a->codes;
+            e->assyText      = a->lineText;
+            r->instIndex[idx] = e++;
+        }
     }
+
+    genericsReport( V_DEBUG, "Instruction table covers %08x-%08x with %d entries" EOL, r->instBase, highAddr, ( int )( e - r->instTable ) );
 }
 // ====================================================================================================
 static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntryHash **h )
 {
     struct nameEntry n;
+    uint32_t idx = ( addr - r->instBase ) >> 1;
+
+    /* Anything in the image is found by index */
+    if ( ( idx < r->instSlots ) && ( ( *h = r->instIndex[idx] ) ) && ( ( *h )->addr == addr ) )
+    {
+        /* Every find is followed by a count, so an uncounted entry is a first visit. Put it in */
+        /* the hash at that point so the reporting sees the same set of addresses as before.    */
+        if ( !( *h )->count )
+        {
+            HASH_ADD_INT( r->insthead, addr, ( *h ) );
+        }
+
+        return;
+    }
 
     HASH_FIND_INT( r->insthead, &addr, *h );
 
@@ -288,6 +394,36 @@ static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntr
     }
 }
 // ====================================================================================================
+static struct execEntryHash *_execEntryFor( struct RunTime *r, uint32_t addr )
+
+/* Find the exec entry for an address without counting it as a visit. Anything never seen is put down to the interrupt source */
+
+{
+    struct execEntryHash *h;
+    uint32_t idx = ( addr - r->instBase ) >> 1;
+
+    if ( ( idx < r->instSlots ) && ( ( h = r->instIndex[idx] ) ) && ( h->addr == addr ) )
+    {
+        return h;
+    }
+
+    HASH_FIND_INT( r->insthead, &addr, h );
+    return ( h ) ? h : r->op.inth;
+}
+// ====================================================================================================
+static void _labelCalls( struct RunTime *r )
+
+/* Connect each call to the instructions at either end of it, for the reports */
+
+{
+    for ( uint32_t i = 0; i < CallGraphCount( &r->calls ); i++ )
+    {
+        struct subcall *s = CallGraphGet( &r->calls, i );
+        s->srch = _execEntryFor( r, s->sig.src );
+        s->dsth = _execEntryFor( r, s->sig.dst );
+    }
+}
+// ====================================================================================================
 static void _handleInstruction( struct RunTime *r, bool actioned )
 
 {
@@ -299,7 +435,7 @@ static void _handleInstruction( struct RunTime *r, bool actioned )
     r->op.oldh = r->op.h;
     _hashFindOrCreate( r, r->op.workingAddr, &r->op.h );
 
-    //    if ( r->op.oldh ) DBG_OUT( "%4d,%4d %4d %s%s%c %s", r->op.h->functionindex, ( r->op.h ? r->op.oldh->functionindex : 0 ),  r->op.h->fileindex,
+    //    if ( r->op.oldh ) GTRACE( T_DETAIL, 0, "%4d,%4d %4d %s%s%c %s", r->op.h->functionindex, ( r->op.h ? r->op.oldh->functionindex : 0 ),  r->op.h->fileindex,
     //                               ( r->op.h->isJump ) ? "J" : " ", ( r->op.h->isSubCall ) ? "S" : r->op.h->isReturn ? "R" : " ", ( actioned ) ? ( r->op.h->is4Byte ? 'X' : 'x' ) : '-',
     //                               r->op.h->assyText );
 
@@ -351,8 +487,6 @@ static void _etmCB( void *d )
 {
     struct RunTime *r       = ( struct RunTime * )d;
     struct ETMCPUState *cpu = ETMCPUState( &r->i );
-    static uint32_t incAddr        = 0;
-    static uint32_t disposition    = 0;
 
     /* This routine gets called when valid data are available */
     /* if these are the first data, then reset counters etc.  */
@@ -366,7 +500,7 @@ static void _etmCB( void *d )
         if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
         {
             r->op.workingAddr = cpu->addr;
-            printf( "Got initial address %08x" EOL, r->op.workingAddr );
+            GTRACE( T_FLOW, 0, "Got initial address %08x" EOL, r->op.workingAddr );
             r->sampling  = true;
         }
 
@@ -390,20 +524,20 @@ static void _etmCB( void *d )
         /* instructions was cancelled and, if it wasn't and it's still outstanding, action it. */
         if ( ETMStateChanged( &r->i, EV_CH_CANCELLED ) )
         {
-            printf( "CANCELLED" EOL );
+            GTRACE( T_DETAIL, 0, "CANCELLED" EOL );
         }
         else
         {
-            if ( incAddr )
+            if ( r->op.incAddr )
             {
-                printf( "***" EOL );
-                _handleInstruction( r, disposition & 1 );
+                GTRACE( T_DETAIL, 0, "***" EOL );
+                _handleInstruction( r, r->op.disposition & 1 );
 
                 if ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) || ( r->op.h->isReturn ) )
                 {
                     if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
                     {
-                        printf( "New addr %08x" EOL, cpu->addr );
+                        GTRACE( T_DETAIL, 0, "New addr %08x" EOL, cpu->addr );
                         r->op.workingAddr = cpu->addr;
                     }
 
@@ -416,28 +550,28 @@ static void _etmCB( void *d )
         {
             if ( ETMStateChanged( &r->i, EV_CH_EX_ENTRY ) )
             {
-                printf( "INTERRUPT!!" EOL );
+                GTRACE( T_FLOW, 0, "INTERRUPT!!" EOL );
                 _callEvent( r, r->op.workingAddr, cpu->addr );
             }
 
             r->op.workingAddr = cpu->addr;
-            printf( "A:%08x" EOL, cpu->addr );
+            GTRACE( T_DETAIL, 0, "A:%08x" EOL, cpu->addr );
         }
 
         /* ================================================ */
         /* OK, now collect the next iterations worth of fun */
         /* ================================================ */
-        incAddr     = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
-        printf( "E:%d N:%d" EOL, cpu->eatoms, cpu->natoms );
+        r->op.incAddr     = cpu->eatoms + cpu->natoms;
+        r->op.disposition = cpu->disposition;
+        GTRACE( T_DETAIL, 0, "E:%d N:%d" EOL, cpu->eatoms, cpu->natoms );
 
         /* Action those changes, except the last one */
-        while ( incAddr > 1 )
+        while ( r->op.incAddr > 1 )
         {
-            incAddr--;
-            _handleInstruction( r, disposition & 1 );
+            r->op.incAddr--;
+            _handleInstruction( r, r->op.disposition & 1 );
             _checkJumps( r );
-            disposition >>= 1;
+            r->op.disposition >>= 1;
         }
     }
 }
@@ -461,8 +595,14 @@ static void _printHelp( struct RunTime *r )
     genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -e: <ElfFile> to use for symbols" EOL );
     genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
+    genericsPrintf( "       -F <pos>: Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     genericsPrintf( "       -h: This help" EOL );
     genericsPrintf( "       -I <Interval>: Time to sample (in mS)" EOL );
+    genericsPrintf( "       -j <Threads>: Decode a file (from -f) split across this many threads" EOL );
+    genericsPrintf( "       -L <level>: Trace decode 0(off), 1(flow), 2(calls), 3(detail)" EOL );
+    genericsPrintf( "       -l <filename>: Write trace to file rather than stdout" EOL );
+    genericsPrintf( "       -R: Snapshots cover everything since the start, rather than since the last one" EOL );
+    genericsPrintf( "       -S <Interval>: Write a snapshot of the profile every <Interval> seconds, running until stopped unless -I is given" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
     //genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel (defaults to 2)" EOL );
     genericsPrintf( "       -T: truncate -d material off all references (i.e. make output relative)" EOL );
@@ -476,8 +616,9 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 
 {
     int c;
+    bool durationSet = false;
 
-    while ( ( c = getopt ( argc, argv, "aDd:Ee:f:hI:s:Tv:y:z:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "aDd:Ee:f:F:hI:j:L:l:RS:s:Tv:y:z:" ) ) != -1 )
 
         switch ( c )
         {
@@ -511,6 +652,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->startAt = optarg;
+                break;
+
             // ------------------------------------
             case 'h':
                 _printHelp( r );
@@ -519,6 +665,32 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
             // ------------------------------------
             case 'I':
                 r->options->sampleDuration = atoi( optarg );
+                durationSet = true;
+                break;
+
+            // ------------------------------------
+            case 'j':
+                r->options->threads = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'L':
+                r->options->traceLevel = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'l':
+                r->options->traceFile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'R':
+                r->options->rolling = true;
+                break;
+
+            // ------------------------------------
+            case 'S':
+                r->options->snapshotInterval = atoi( optarg );
                 break;
 
             // ------------------------------------
@@ -591,11 +763,41 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( -2, "Elf File not specified" EOL );
     }
 
-    if ( !r->options->sampleDuration )
+    /* Snapshotting carries on until it's stopped, unless it's been told otherwise */
+    if ( ( r->options->snapshotInterval ) && ( !durationSet ) )
+    {
+        r->options->sampleDuration = 0;
+    }
+    else if ( r->options->sampleDuration <= 0 )
     {
         genericsExit( -2, "Illegal sample duration" EOL );
     }
 
+    if ( r->options->snapshotInterval < 0 )
+    {
+        genericsExit( -2, "Illegal snapshot interval" EOL );
+    }
+
+    if ( r->options->threads > 1 )
+    {
+        if ( !r->options->file )
+        {
+            genericsExit( -2, "Only a file can be decoded with multiple threads" EOL );
+        }
+
+        if ( ( r->options->snapshotInterval ) || ( r->options->traceLevel ) || ( r->options->startAt ) )
+        {
+            genericsExit( -2, "Snapshots, tracing and starting part way through need a single decode thread" EOL );
+        }
+
+        r->options->threads = ( r->options->threads > MAX_DECODE_THREADS ) ? MAX_DECODE_THREADS : r->options->threads;
+    }
+
+    if ( ( r->options->traceLevel ) && ( !genericsTraceSetup( r->options->traceLevel, r->options->traceFile ) ) )
+    {
+        genericsExit( -2, "Could not open trace file %s" EOL, r->options->traceFile );
+    }
+
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, r->progName, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
@@ -603,6 +805,17 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
     genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
 
+    if ( r->options->threads > 1 )
+    {
+        genericsReport( V_INFO, "Decode Threads  : %d" EOL, r->options->threads );
+    }
+
+    if ( r->options->snapshotInterval )
+    {
+        genericsReport( V_INFO, "Snapshots       : Every %d S (%s)" EOL, r->options->snapshotInterval, r->options->rolling ? "Rolling" : "Delta" );
+    }
+    genericsReport( V_INFO, "Trace           : Level %d to %s" EOL, genericsTraceLevel, r->options->traceFile ? r->options->traceFile : "stdout" );
+
     return true;
 }
 // ====================================================================================================
@@ -617,6 +830,231 @@ static void _doExit( void )
     usleep( 200 );
 }
 // ====================================================================================================
+static void _writeSnapshot( struct RunTime *r, struct snapshot *s )
+
+/* Write out a snapshot. This is on the snapshot thread, and only touches the copies and what never changes */
+
+{
+    struct execEntryHash *insthead = NULL;
+    struct callGraph calls = { 0 };
+    char *name;
+
+    for ( uint32_t i = 0; i < s->instCount; i++ )
+    {
+        HASH_ADD_INT( insthead, addr, ( &s->inst[i] ) );
+    }
+
+    for ( uint32_t i = 0; i < s->callCount; i++ )
+    {
+        *CallGraphFindOrCreate( &calls, s->call[i].sig.src, s->call[i].sig.dst, NULL ) = s->call[i];
+    }
+
+    if ( ( r->options->dotfile ) && ( CallGraphCount( &calls ) ) && ( asprintf( &name, "%s.%u", r->options->dotfile, s->seq ) >= 0 ) )
+    {
+        if ( !ext_ff_outputDot( name, &calls, r->s ) )
+        {
+            genericsReport( V_ERROR, "Failed to output DOT snapshot %s" EOL, name );
+        }
+
+        free( name );
+    }
+
+    if ( ( r->options->profile ) && ( asprintf( &name, "%s.%u", r->options->profile, s->seq ) >= 0 ) )
+    {
+        if ( !ext_ff_outputProfile( name, r->options->elffile,
+                                    r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL,
+                                    true, s->timelen, insthead, &calls, r->s ) )
+        {
+            genericsReport( V_ERROR, "Failed to output profile snapshot %s" EOL, name );
+        }
+
+        free( name );
+    }
+
+    genericsReport( V_INFO, "Snapshot %u: %u addresses, %u calls" EOL, s->seq, s->instCount, s->callCount );
+    HASH_CLEAR( hh, insthead );
+    CallGraphDelete( &calls );
+}
+// ====================================================================================================
+static void *_snapshotThread( void *params )
+
+/* Write out each snapshot as it's handed over */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &r->snapLock );
+
+        while ( ( !r->snapPending ) && ( !r->ending ) )
+        {
+            pthread_cond_wait( &r->snapCond, &r->snapLock );
+        }
+
+        pthread_mutex_unlock( &r->snapLock );
+
+        if ( !r->snapPending )
+        {
+            return NULL;
+        }
+
+        _writeSnapshot( r, &r->snap );
+
+        pthread_mutex_lock( &r->snapLock );
+        r->snapPending = false;
+        pthread_cond_broadcast( &r->snapCond );
+        pthread_mutex_unlock( &r->snapLock );
+    }
+}
+// ====================================================================================================
+static void _waitSnapshot( struct RunTime *r )
+
+/* Wait for any snapshot being written to be finished with */
+
+{
+    pthread_mutex_lock( &r->snapLock );
+
+    while ( r->snapPending )
+    {
+        pthread_cond_wait( &r->snapCond, &r->snapLock );
+    }
+
+    pthread_mutex_unlock( &r->snapLock );
+}
+// ====================================================================================================
+static void _takeSnapshot( struct RunTime *r )
+
+/* Copy the counts for the snapshot thread, if it's free. If it isn't, this snapshot runs on into the next one */
+
+{
+    struct snapshot *s = &r->snap;
+    bool busy;
+
+    pthread_mutex_lock( &r->snapLock );
+    busy = r->snapPending;
+    pthread_mutex_unlock( &r->snapLock );
+
+    if ( busy )
+    {
+        return;
+    }
+
+    /* The ends of the calls, and everything else the writer reads from the live */
+    /* entries, are fixed once they're made, so only the counts need copying     */
+    _labelCalls( r );
+    s->instCount = s->callCount = 0;
+
+    for ( struct execEntryHash *f = r->insthead; f; f = f->hh.next )
+    {
+        if ( ( !r->options->rolling ) && ( f->count == f->snapCount ) && ( f->scount == f->snapScount ) )
+        {
+            continue;
+        }
+
+        if ( s->instCount == s->instAlloc )
+        {
+            s->instAlloc = s->instAlloc ? s->instAlloc * 2 : 1024;
+            s->inst = ( struct execEntryHash * )realloc( s->inst, sizeof( struct execEntryHash ) * s->instAlloc );
+        }
+
+        struct execEntryHash *c = &s->inst[s->instCount++];
+        *c = *f;
+        memset( &c->hh, 0, sizeof( c->hh ) );
+
+        if ( !r->options->rolling )
+        {
+            c->count  -= f->snapCount;
+            c->scount -= f->snapScount;
+            f->snapCount  = f->count;
+            f->snapScount = f->scount;
+        }
+    }
+
+    for ( uint32_t i = 0; i < CallGraphCount( &r->calls ); i++ )
+    {
+        struct subcall *a = CallGraphGet( &r->calls, i );
+
+        if ( ( !r->options->rolling ) && ( a->count == a->snapCount ) )
+        {
+            continue;
+        }
+
+        if ( s->callCount == s->callAlloc )
+        {
+            s->callAlloc = s->callAlloc ? s->callAlloc * 2 : 1024;
+            s->call = ( struct subcall * )realloc( s->call, sizeof( struct subcall ) * s->callAlloc );
+        }
+
+        struct subcall *c = &s->call[s->callCount++];
+        *c = *a;
+
+        if ( !r->options->rolling )
+        {
+            c->count  -= a->snapCount;
+            c->myCost -= a->snapCost;
+            a->snapCount = a->count;
+            a->snapCost  = a->myCost;
+        }
+    }
+
+    s->timelen = r->op.lasttstamp - ( ( ( r->options->rolling ) || ( !s->seq ) ) ? r->op.firsttstamp : r->snapTstamp );
+    r->snapTstamp = r->op.lasttstamp;
+    s->seq++;
+
+    pthread_mutex_lock( &r->snapLock );
+    r->snapPending = true;
+    pthread_cond_broadcast( &r->snapCond );
+    pthread_mutex_unlock( &r->snapLock );
+}
+// ====================================================================================================
+static void _checkSnapshot( struct RunTime *r )
+
+/* Take a snapshot if one is due */
+
+{
+    uint32_t now = genericsTimestampmS();
+
+    if ( ( !r->options->snapshotInterval ) || ( !r->sampling ) )
+    {
+        return;
+    }
+
+    if ( !r->snapDue )
+    {
+        r->snapDue = now + r->options->snapshotInterval * 1000;
+    }
+    else if ( ( int32_t )( now - r->snapDue ) >= 0 )
+    {
+        r->snapDue = now + r->options->snapshotInterval * 1000;
+        _takeSnapshot( r );
+    }
+}
+// ====================================================================================================
+static void _checkSymbols( struct RunTime *r )
+
+/* Make sure the symbols are loaded and current */
+
+{
+    if ( !SymbolSetValid( &r->s, r->options->elffile ) )
+    {
+        if ( !( r->s = SymbolSetCreate( r->options->elffile, r->options->deleteMaterial, r->options->demangle, true, true ) ) )
+        {
+            genericsExit( -1, "Elf file or symbols in it not found" EOL );
+        }
+        else
+        {
+            genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+        }
+
+        /* Entries from any earlier table are already linked into the hash, so that one is kept */
+        if ( !r->instTable )
+        {
+            _buildInstTable( r );
+        }
+    }
+}
+// ====================================================================================================
 static void *_processBlocks( void *params )
 
 /* Generic block processor for received data. This runs in a task parallel to the receiver and *
@@ -625,9 +1063,28 @@ static void *_processBlocks( void *params )
 {
     struct RunTime *r = ( struct RunTime * )params;
 
+    struct timespec ts;
+
     while ( true )
     {
-        sem_wait( &r->dataForClients );
+        if ( r->options->snapshotInterval )
+        {
+            /* Don't wait so long for data that a snapshot gets missed */
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += SNAPSHOT_POLL_MS * 1000000L;
+            ts.tv_sec  += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+
+            if ( sem_timedwait( &r->dataForClients, &ts ) )
+            {
+                _checkSnapshot( r );
+                continue;
+            }
+        }
+        else
+        {
+            sem_wait( &r->dataForClients );
+        }
 
         if ( r->rp != ( volatile int )r->wp )
         {
@@ -660,12 +1117,224 @@ static void *_processBlocks( void *params )
             ETMDecoderPump( &r->i, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _etmCB, genericsReport, &_r );
 
             r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+            _checkSnapshot( r );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _decodeFile( struct RunTime *r )
+
+/* Decode a file on this thread, straight out of its mapping. Unless we're told to stop at the end */
+/* it's followed as it grows, until the sample duration is up.                                     */
+
+{
+    struct fileSource fs;
+    const uint8_t *data;
+    ssize_t t;
+
+    if ( !FileSourceOpen( &fs, r->options->file ) )
+    {
+        genericsExit( -4, "Can't open file %s" EOL, r->options->file );
+    }
+
+    if ( ( r->options->startAt ) && ( !FileSourceSeek( &fs, r->options->startAt ) ) )
+    {
+        genericsExit( -4, "Can't start %s from %s" EOL, r->options->file, r->options->startAt );
+    }
+
+    while ( !r->ending )
+    {
+        if ( ( t = FileSourceGet( &fs, &data, SEGMENT_PUMP_LEN ) ) < 0 )
+        {
+            genericsReport( V_INFO, "File read error" EOL );
+            break;
+        }
+
+        if ( t )
+        {
+            r->intervalBytes += t;
+            ETMDecoderPump( &r->i, data, t, _etmCB, genericsReport, r );
+        }
+        else
+        {
+            if ( r->options->fileTerminate )
+            {
+                break;
+            }
+
+            /* Wait for the file to grow */
+            usleep( TICK_TIME_MS * 1000 );
+        }
+
+        _checkSnapshot( r );
+
+        if ( ( r->options->sampleDuration ) && ( r->sampling ) && ( ( genericsTimestampmS() - r->starttime ) > r->options->sampleDuration ) )
+        {
+            r->ending = true;
         }
     }
 
+    FileSourceClose( &fs );
+}
+// ====================================================================================================
+static void *_decodeSegment( void *params )
+
+/* Decode one segment of a file, with a decoder and accumulations all of its own */
+
+{
+    struct segment *g = ( struct segment * )params;
+    struct RunTime *r = &g->r;
+
+    ETMDecoderInit( &r->i, !r->options->noaltAddr );
+    ETMDecoderBatchAtoms( &r->i, true );
+    _buildInstTable( r );
+
+    for ( size_t p = 0; p < g->len; p += SEGMENT_PUMP_LEN )
+    {
+        ETMDecoderPump( &r->i, &g->buf[p], ( g->len - p > SEGMENT_PUMP_LEN ) ? SEGMENT_PUMP_LEN : g->len - p, _etmCB, genericsReport, r );
+    }
+
     return NULL;
 }
 // ====================================================================================================
+static void _mergeSegment( struct RunTime *r, struct RunTime *g )
+
+/* Add the accumulations from a decoded segment into the totals */
+
+{
+    struct execEntryHash *h, *n;
+
+    for ( struct execEntryHash *f = g->insthead; f; f = f->hh.next )
+    {
+        uint32_t idx = ( f->addr - r->instBase ) >> 1;
+
+        if ( ( idx < r->instSlots ) && ( ( h = r->instIndex[idx] ) ) && ( h->addr == f->addr ) )
+        {
+            if ( !h->count )
+            {
+                HASH_ADD_INT( r->insthead, addr, h );
+            }
+        }
+        else
+        {
+            HASH_FIND_INT( r->insthead, &f->addr, h );
+
+            if ( !h )
+            {
+                h = ( struct execEntryHash * )malloc( sizeof( struct execEntryHash ) );
+                *h = *f;
+                h->count = h->scount = 0;
+                HASH_ADD_INT( r->insthead, addr, h );
+            }
+        }
+
+        if ( f == g->op.inth )
+        {
+            /* There's only ever one interrupt source, whatever it's count says */
+            r->op.inth = h;
+            h->count = f->count;
+            continue;
+        }
+
+        h->count  += f->count;
+        h->scount += f->scount;
+    }
+
+    for ( uint32_t i = 0; i < CallGraphCount( &g->calls ); i++ )
+    {
+        struct subcall *a = CallGraphGet( &g->calls, i );
+        struct subcall *c = CallGraphFindOrCreate( &r->calls, a->sig.src, a->sig.dst, NULL );
+
+        c->count  += a->count;
+        c->myCost += a->myCost;
+    }
+
+    r->op.lasttstamp += g->op.lasttstamp - g->op.firsttstamp;
+
+    /* The segment's done with now */
+    HASH_ITER( hh, g->insthead, h, n )
+    {
+        uint32_t idx = ( h->addr - g->instBase ) >> 1;
+        HASH_DEL( g->insthead, h );
+
+        if ( ( idx >= g->instSlots ) || ( g->instIndex[idx] != h ) )
+        {
+            free( h );
+        }
+    }
+
+    free( g->instTable );
+    free( g->instIndex );
+    CallGraphDelete( &g->calls );
+    CallStackDelete( &g->stack );
+}
+// ====================================================================================================
+static bool _decodeFileParallel( struct RunTime *r )
+
+/* Decode a whole file at once, split at sync points into segments which are decoded by their own threads. */
+/* Each segment starts with an empty call stack, so calls which straddle a split aren't costed, but there  */
+/* are only as many of those as there are threads. Everything else is merged in file order. Returns false */
+/* if the file isn't one that can be split like this.                                                     */
+
+{
+    struct segment *g;
+    struct fileSource fs;
+    const uint8_t *buf;
+    size_t len;
+    size_t start = 0, next;
+    uint32_t segs = 0;
+
+    if ( !FileSourceOpen( &fs, r->options->file ) )
+    {
+        genericsExit( -1, "Can't open file %s" EOL, r->options->file );
+    }
+
+    /* Only raw data that's all there already can be split up */
+    if ( ( !( buf = FileSourceMap( &fs, &len ) ) ) || ( fs.capture ) )
+    {
+        FileSourceClose( &fs );
+        return false;
+    }
+
+    g = ( struct segment * )calloc( r->options->threads, sizeof( struct segment ) );
+
+    /* Each segment after the first starts at the first place a decoder can pick up from nothing */
+    while ( start < len )
+    {
+        next = ( segs + 1 == r->options->threads ) ? len :
+               ETMDecoderFindSync( buf, len, ( ( uint64_t )len * ( segs + 1 ) ) / r->options->threads );
+
+        g[segs].buf = &buf[start];
+        g[segs].len = next - start;
+        g[segs].r.progName = r->progName;
+        g[segs].r.s        = r->s;
+        g[segs].r.options  = r->options;
+        start = next;
+
+        if ( pthread_create( &g[segs].thread, NULL, _decodeSegment, &g[segs] ) )
+        {
+            genericsExit( -1, "Failed to start decode thread" EOL );
+        }
+
+        segs++;
+    }
+
+    genericsReport( V_INFO, "Decoding %" PRIu64 " bytes as %u segments" EOL, ( uint64_t )len, segs );
+
+    for ( uint32_t i = 0; i < segs; i++ )
+    {
+        pthread_join( g[i].thread, NULL );
+        _mergeSegment( r, &g[i].r );
+    }
+
+    r->intervalBytes = len;
+    free( g );
+    FileSourceClose( &fs );
+    return true;
+}
+// ====================================================================================================
 int main( int argc, char *argv[] )
 
 {
@@ -687,6 +1356,13 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "" EOL );
     }
 
+    if ( _r.options->snapshotInterval )
+    {
+        pthread_mutex_init( &_r.snapLock, NULL );
+        pthread_cond_init( &_r.snapCond, NULL );
+        pthread_create( &_r.snapThread, NULL, &_snapshotThread, &_r );
+    }
+
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
 
@@ -704,74 +1380,79 @@ int main( int argc, char *argv[] )
 
     ETMDecoderInit( &_r.i, !_r.options->noaltAddr );
 
-    while ( !_r.ending )
+    /* _etmCB walks the disposition bits, so it can take a whole run of atoms at once */
+    ETMDecoderBatchAtoms( &_r.i, true );
+
+    if ( _r.options->file )
     {
-        if ( !_r.options->file )
+        /* A file is decoded where it's read, with no need to hand it over, split over threads if wanted */
+        _checkSymbols( &_r );
+
+        if ( ( _r.options->threads <= 1 ) || ( !_decodeFileParallel( &_r ) ) )
         {
-            /* Get the socket open */
-            sourcefd = socket( AF_INET, SOCK_STREAM, 0 );
-            setsockopt( sourcefd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
+            _decodeFile( &_r );
+        }
 
-            if ( sourcefd < 0 )
-            {
-                perror( "Error creating socket\n" );
-                return -EIO;
-            }
+        _r.ending = true;
+    }
+    else
+    {
+        _r.rawBlock = ( struct dataBlock * )calloc( NUM_RAW_BLOCKS, sizeof( struct dataBlock ) );
+    }
 
-            if ( setsockopt( sourcefd, SOL_SOCKET, SO_REUSEADDR, &( int )
-        {
-            1
-        }, sizeof( int ) ) < 0 )
-            {
-                perror( "setsockopt(SO_REUSEADDR) failed" );
-                return -EIO;
-            }
+    while ( !_r.ending )
+    {
+        /* Get the socket open */
+        sourcefd = socket( AF_INET, SOCK_STREAM, 0 );
+        setsockopt( sourcefd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
 
-            /* Now open the network connection */
-            bzero( ( char * ) &serv_addr, sizeof( serv_addr ) );
-            server = gethostbyname( _r.options->server );
+        if ( sourcefd < 0 )
+        {
+            perror( "Error creating socket\n" );
+            return -EIO;
+        }
 
-            if ( !server )
-            {
-                perror( "Cannot find host" );
-                return -EIO;
-            }
+        if ( setsockopt( sourcefd, SOL_SOCKET, SO_REUSEADDR, &( int )
+    {
+        1
+    }, sizeof( int ) ) < 0 )
+        {
+            perror( "setsockopt(SO_REUSEADDR) failed" );
+            return -EIO;
+        }
 
-            serv_addr.sin_family = AF_INET;
-            bcopy( ( char * )server->h_addr,
-                   ( char * )&serv_addr.sin_addr.s_addr,
-                   server->h_length );
-            serv_addr.sin_port = htons( _r.options->port + ( _r.options->useTPIU ? 0 : 1 ) );
+        /* Now open the network connection */
+        bzero( ( char * ) &serv_addr, sizeof( serv_addr ) );
+        server = gethostbyname( _r.options->server );
 
-            if ( connect( sourcefd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
-            {
-                perror( "Could not connect" );
-                close( sourcefd );
-                usleep( 1000000 );
-                continue;
-            }
+        if ( !server )
+        {
+            perror( "Cannot find host" );
+            return -EIO;
         }
-        else
+
+        serv_addr.sin_family = AF_INET;
+        bcopy( ( char * )server->h_addr,
+               ( char * )&serv_addr.sin_addr.s_addr,
+               server->h_length );
+        serv_addr.sin_port = htons( _r.options->port + ( _r.options->useTPIU ? 0 : 1 ) );
+
+        if ( connect( sourcefd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
         {
-            if ( ( sourcefd = open( _r.options->file, O_RDONLY ) ) < 0 )
-            {
-                genericsExit( sourcefd, "Can't open file %s" EOL, _r.options->file );
-            }
+            perror( "Could not connect" );
+            close( sourcefd );
+            usleep( 1000000 );
+            continue;
         }
 
-        /* We need symbols constantly while running ... lets get them */
-        if ( !SymbolSetValid( &_r.s, _r.options->elffile ) )
+        /* We need symbols constantly while running ... lets get them, not while a snapshot is using them */
+        if ( _r.options->snapshotInterval )
         {
-            if ( !( _r.s = SymbolSetCreate( _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true ) ) )
-            {
-                genericsExit( -1, "Elf file or symbols in it not found" EOL );
-            }
-            else
-            {
-                genericsReport( V_DEBUG, "Loaded %s" EOL, _r.options->elffile );
-            }
+            _waitSnapshot( &_r );
         }
 
+        _checkSymbols( &_r );
+
         _r.intervalBytes = 0;
 
         /* Now start the result processing task */
@@ -827,7 +1508,8 @@ int main( int argc, char *argv[] )
             }
 
             /* Update the intervals */
-            if ( ( ( volatile bool ) _r.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
+            if ( ( _r.options->sampleDuration ) && ( ( volatile bool ) _r.sampling ) &&
+                    ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
             {
                 _r.ending = true;
 
@@ -849,15 +1531,29 @@ int main( int argc, char *argv[] )
     }
 
     /* Wait for data processing to be completed */
-    pthread_join( _r.processThread, NULL );
+    if ( _r.rawBlock )
+    {
+        pthread_join( _r.processThread, NULL );
+    }
+
+    /* ...and for the last snapshot to be written */
+    if ( _r.options->snapshotInterval )
+    {
+        pthread_mutex_lock( &_r.snapLock );
+        pthread_cond_broadcast( &_r.snapCond );
+        pthread_mutex_unlock( &_r.snapLock );
+        pthread_join( _r.snapThread, NULL );
+    }
 
     /* Data are collected, now process and report */
     genericsReport( V_INFO, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL,
-                    _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
+                    _r.intervalBytes, CallGraphCount( &_r.calls ), HASH_COUNT( _r.insthead ) );
 
-    if ( HASH_COUNT( _r.subhead ) )
+    if ( CallGraphCount( &_r.calls ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
+        _labelCalls( &_r );
+
+        if ( ext_ff_outputDot( _r.options->dotfile, &_r.calls, _r.s ) )
         {
             genericsReport( V_INFO, "Output DOT" EOL );
         }
@@ -874,7 +1570,7 @@ int main( int argc, char *argv[] )
                                    true,
                                    _r.op.lasttstamp - _r.op.firsttstamp,
                                    _r.insthead,
-                                   _r.subhead,
+                                   &_r.calls,
                                    _r.s ) )
         {
             genericsReport( V_INFO, "Output Profile" EOL );
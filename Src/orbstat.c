@@ -20,12 +20,12 @@
 #include "git_version_info.h"
 #include "uthash.h"
 #include "generics.h"
-#include "itmDecoder.h"
-#include "tpiuDecoder.h"
-#include "msgDecoder.h"
+#include "pipeline.h"
 #include "symbols.h"
 #include "nw.h"
+#include "nwStream.h"
 #include "ext_fileformats.h"
+#include "fileSource.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
@@ -46,6 +46,7 @@ struct Options                           /* Record for options, either defaults
 {
     bool demangle;                       /* Demangle C++ names */
     char *file;                          /* File host connection */
+    char *startAt;                       /* Where in the file to start from */
     bool fileTerminate;                  /* Terminate when file read isn't successful */
 
     char *deleteMaterial;                /* Material to strip off front of filenames for target */
@@ -66,6 +67,7 @@ struct Options                           /* Record for options, either defaults
 
     int port;                            /* Source information for where to connect to */
     char *server;
+    bool compress;                       /* Ask the server to compress what it sends */
 
 } _options =
 {
@@ -88,11 +90,7 @@ struct dataBlock
 /* ----------- LIVE STATE ----------------- */
 struct RunTime
 {
-    struct ITMDecoder i;                /* The decoders and the packets from them */
-    struct ITMPacket h;
-    struct TPIUDecoder t;
-    struct TPIUPacket p;
-    struct msg m;                       /* Decoded message out of ITM layer */
+    struct pipeline p;                  /* Decoders all the way to the messages */
 
     const char *progName;               /* Name by which this program was called */
     bool      ending;                   /* Flag indicating app is terminating */
@@ -100,11 +98,8 @@ struct RunTime
 
     /* Calls related info */
     enum CDState CDState;               /* State of the call data machine */
-    struct edge *calls;                 /* Call data table */
-
-    struct subcall *subhead;            /* Calls onstruct data */
-    struct subcall **substack;          /* Calls stack data */
-    uint32_t substacklen;               /* Calls stack length */
+    struct callGraph calls;             /* Calls between each source/dest pair */
+    struct callStack stack;             /* Calls stack data */
 
     struct execEntryHash *insthead;     /* Exec table handle for hash */
 
@@ -142,17 +137,16 @@ struct RunTime
 // ====================================================================================================
 // Callback function for trace messages from the target CPU (via ITM channel)
 // ====================================================================================================
-static void _handleSW( struct RunTime *r )
+static void _handleSW( struct swMsg *m, struct RunTime *r )
 
 {
     struct nameEntry n;
-    struct subcallSig sig;
+    struct subcallAccount *e;
     struct subcall *s;
+    bool created;
     static bool isIn;
     uint32_t addr;
 
-    struct swMsg *m = ( struct swMsg * )&r->m;
-
     if ( m->srcAddr == r->options->traceChannel )
     {
         switch ( r->CDState )
@@ -269,47 +263,39 @@ static void _handleSW( struct RunTime *r )
                 /* ----------------------------------------------------------------------------------------------------------*/
                 if ( isIn )
                 {
-                    /* Now make calling record */
-                    sig.src = r->from->addr;
-                    sig.dst = r->to->addr;
-
                     /* Find, or create, the call record */
-                    HASH_FIND( hh, r->subhead, &sig, sizeof( struct subcallSig ), s );
+                    s = CallGraphFindOrCreate( &r->calls, r->from->addr, r->to->addr, &created );
 
-                    if ( !s )
+                    if ( created )
                     {
-                        /* This entry doesn't exist...let's create it */
-                        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-                        memcpy( &s->sig, &sig, sizeof( struct subcallSig ) );
                         s->srch = r->from;
                         s->dsth = r->to;
-                        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
                     }
 
-
                     /* Now handle calling/return stack */
                     /* However we got here, we've got a subcall record, so initialise its starting ticks */
-                    s->inTicks = r->tcount;
                     s->count++;
 
                     /* ...and add it to the call stack */
-                    r->substack = ( struct subcall ** )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct subcall * ) );
-                    r->substack[r->substacklen++] = s;
+                    e = CallStackPush( &r->stack );
+                    e->s       = s;
+                    e->inTicks = r->tcount;
                 }
                 else
                 {
                     /* We've come out */
-                    if ( r->substacklen )
+                    if ( r->stack.depth )
                     {
-                        /* We don't bother deallocating memory here cos it'll be done on the next isSubCall */
-                        s = r->substack[--r->substacklen];
+                        /* The entry stays allocated, ready for the next isSubCall to reuse */
+                        e = &r->stack.e[--r->stack.depth];
+                        s = e->s;
 
                         if ( ( s->sig.src != r->from->addr ) || ( s->sig.dst != r->to->addr ) )
                         {
                             genericsReport( V_WARN, "Address mismatch" EOL );
                         }
 
-                        s->myCost = ( r->tcount - s->inTicks );
+                        s->myCost = ( r->tcount - e->inTicks );
                     }
                 }
 
@@ -319,140 +305,6 @@ static void _handleSW( struct RunTime *r )
     }
 }
 
-// ====================================================================================================
-void _itmPumpProcess( struct RunTime *r, char c )
-
-/* Handle individual characters into the itm decoder */
-
-{
-
-    typedef void ( *handlers )( struct RunTime * r );
-
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        ( handlers )_handleSW,
-        /* MSG_NISYNC */          NULL,
-        /* MSG_OSW */             NULL,
-        /* MSG_DATA_ACCESS_WP */  NULL,
-        /* MSG_DATA_RWWP */       NULL,
-        /* MSG_PC_SAMPLE */       NULL,
-        /* MSG_DWT_EVENT */       NULL,
-        /* MSG_EXCEPTION */       NULL,
-        /* MSG_TS */              NULL
-    };
-
-    switch ( ITMPump( &r->i, c ) )
-    {
-        // ------------------------------------
-        case ITM_EV_NONE:
-            break;
-
-        // ------------------------------------
-        case ITM_EV_UNSYNCED:
-            genericsReport( V_INFO, "ITM Lost Sync (%d)" EOL, ITMDecoderGetStats( &r->i )->lostSyncCount );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_SYNCED:
-            genericsReport( V_INFO, "ITM In Sync (%d)" EOL, ITMDecoderGetStats( &r->i )->syncCount );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_OVERFLOW:
-            genericsReport( V_WARN, "ITM Overflow (%d)" EOL, ITMDecoderGetStats( &r->i )->overflow );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_ERROR:
-            genericsReport( V_WARN, "ITM Error" EOL );
-            break;
-
-        // ------------------------------------
-        case ITM_EV_PACKET_RXED:
-            ITMGetDecodedPacket( &r->i, &r->m );
-
-            /* See if we decoded a dispatchable match. genericMsg is just used to access */
-            /* the first two members of the decoded structs in a portable way.           */
-            if ( h[r->m.genericMsg.msgtype] )
-            {
-                ( h[r->m.genericMsg.msgtype] )( r );
-            }
-
-            break;
-
-            // ------------------------------------
-    }
-}
-// ====================================================================================================
-void _protocolPump( struct RunTime *r, uint8_t c )
-
-/* Top level protocol pump */
-
-{
-    if ( r->options->useTPIU )
-    {
-        switch ( TPIUPump( &r->t, c ) )
-        {
-            // ------------------------------------
-            case TPIU_EV_NEWSYNC:
-                genericsReport( V_INFO, "TPIU In Sync (%d)" EOL, TPIUDecoderGetStats( &r->t )->syncCount );
-
-            case TPIU_EV_SYNCED:
-                ITMDecoderForceSync( &r->i, true );
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_RXING:
-            case TPIU_EV_NONE:
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_UNSYNCED:
-                genericsReport( V_INFO, "TPIU Lost Sync (%d)" EOL, TPIUDecoderGetStats( &r->t )->lostSync );
-                ITMDecoderForceSync( &r->i, false );
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_RXEDPACKET:
-                if ( !TPIUGetPacket( &r->t, &r->p ) )
-                {
-                    genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                }
-
-                for ( uint32_t g = 0; g < r->p.len; g++ )
-                {
-                    if ( r->p.packet[g].s == r->options->tpiuITMChannel )
-                    {
-                        _itmPumpProcess( r, r->p.packet[g].d );
-                        continue;
-                    }
-
-                    if ( r->p.packet[g].s != 0 )
-                    {
-                        genericsReport( V_WARN, "Unknown TPIU channel %02x" EOL, r->p.packet[g].s );
-                    }
-                }
-
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_ERROR:
-                genericsReport( V_WARN, "****ERROR****" EOL );
-                break;
-                // ------------------------------------
-        }
-    }
-    else
-    {
-        /* There's no TPIU in use, so this goes straight to the ITM layer */
-        _itmPumpProcess( r, c );
-    }
-}
 // ====================================================================================================
 static void _intHandler( int sig )
 
@@ -471,6 +323,7 @@ static void _printHelp( struct RunTime *r )
     genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -e: <ElfFile> to use for symbols" EOL );
     genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
+    genericsPrintf( "       -F <pos>: Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     genericsPrintf( "       -g: <TraceChannel> for trace output (default %d)" EOL, r->options->traceChannel );
     genericsPrintf( "       -h: This help" EOL );
     genericsPrintf( "       -I <Interval>: Time to sample (in mS)" EOL );
@@ -481,6 +334,7 @@ static void _printHelp( struct RunTime *r )
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "       -y: <Filename> dotty filename for structured callgraph output" EOL );
     genericsPrintf( "       -z: <Filename> profile filename for kcachegrind output" EOL );
+    genericsPrintf( "       -Z: Ask the server to compress what it sends" EOL );
     genericsPrintf( EOL "(Will connect one port higher than that set in -s when TPIU is not used)" EOL );
 
 }
@@ -490,7 +344,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "Dd:Ee:f:g:hI:n:s:Tt:v:y:z:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "Dd:Ee:f:F:g:hI:n:s:Tt:v:y:z:Z" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -518,6 +372,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->startAt = optarg;
+                break;
+
             // ------------------------------------
             case 'g':
                 r->options->traceChannel = atoi( optarg );
@@ -589,6 +448,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->profile = optarg;
                 break;
 
+            // ------------------------------------
+            case 'Z':
+                r->options->compress = true;
+                break;
+
             // ------------------------------------
             case '?':
                 if ( optopt == 'b' )
@@ -621,8 +485,15 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         exit( -2 );
     }
 
+    if ( ( r->options->useTPIU ) && ( r->options->tpiuITMChannel >= TPIU_NUM_STREAMS ) )
+    {
+        genericsReport( V_ERROR, "Illegal TPIU channel" EOL );
+        exit( -2 );
+    }
+
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, r->progName, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
+    genericsReport( V_INFO, "Compress        : %s" EOL, r->options->compress ? "true" : "false" );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
     genericsReport( V_INFO, "Elf File        : %s %s" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "(Truncate)" : "(Don't Truncate)" );
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
@@ -656,6 +527,11 @@ int main( int argc, char *argv[] )
     struct timeval tv;
     fd_set readfds;
 
+    struct fileSource fs;
+    struct nwStream ns;
+    const uint8_t *data;
+    ssize_t t;
+
     /* Have a basic name and search string set up */
     _r.progName = genericsBasename( argv[0] );
 
@@ -680,9 +556,25 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-    /* Reset the TPIU handler before we start */
-    TPIUDecoderInit( &_r.t );
-    ITMDecoderInit( &_r.i, _r.options->forceITMSync );
+    /* Only the ITM channel is wanted out of the TPIU stream */
+    PipelineInit( &_r.p, _r.options->forceITMSync, &_r );
+    PipelineOnMsg( &_r.p, MSG_SOFTWARE, ( pipelineMsgCB )_handleSW );
+
+    if ( ( _r.options->useTPIU ) && ( !PipelineUseTPIU( &_r.p, _r.options->tpiuITMChannel, PIPELINE_NO_CHANNEL ) ) )
+    {
+        genericsExit( -1, "Can't set up TPIU decode" EOL );
+    }
+
+    /* A file is only opened once, then followed as it grows unless we're told to stop at its end */
+    if ( ( _r.options->file ) && ( !FileSourceOpen( &fs, _r.options->file ) ) )
+    {
+        genericsExit( -4, "Can't open file %s" EOL, _r.options->file );
+    }
+
+    if ( ( _r.options->startAt ) && ( !FileSourceSeek( &fs, _r.options->startAt ) ) )
+    {
+        genericsExit( -4, "Can't start %s from %s" EOL, _r.options->file, _r.options->startAt );
+    }
 
     while ( !_r.ending )
     {
@@ -730,12 +622,13 @@ int main( int argc, char *argv[] )
                 usleep( 1000000 );
                 continue;
             }
-        }
-        else
-        {
-            if ( ( sourcefd = open( _r.options->file, O_RDONLY ) ) < 0 )
+
+            if ( !NWStreamInit( &ns, sourcefd, _r.options->compress ) )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, _r.options->file );
+                genericsReport( V_WARN, "Failed to ask for compression" EOL );
+                close( sourcefd );
+                usleep( 1000000 );
+                continue;
             }
         }
 
@@ -760,45 +653,72 @@ int main( int argc, char *argv[] )
         /* ----------------------------------------------------------------------------- */
         while ( !_r.ending )
         {
-            /* Each time segment is restricted */
-            tv.tv_sec = 0;
-            tv.tv_usec  = TICK_TIME_MS * 1000;
-
-            FD_SET( sourcefd, &readfds );
-            FD_SET( STDIN_FILENO, &readfds );
-            r = select( sourcefd + 1, &readfds, NULL, NULL, &tv );
-
-            if ( r < 0 )
+            if ( _r.options->file )
             {
-                /* Something went wrong in the select */
-                break;
-            }
+                /* Files are decoded straight out of the mapping, as much at a time as there is */
+                if ( ( t = FileSourceGet( &fs, &data, 0 ) ) < 0 )
+                {
+                    _r.ending = true;
+                    break;
+                }
 
-            if ( FD_ISSET( sourcefd, &readfds ) )
+                if ( !t )
+                {
+                    if ( _r.options->fileTerminate )
+                    {
+                        _r.ending = true;
+                    }
+                    else
+                    {
+                        /* Wait for the file to grow */
+                        usleep( TICK_TIME_MS * 1000 );
+                    }
+                }
+                else
+                {
+                    _r.intervalBytes += t;
+                    PipelinePump( &_r.p, data, t );
+                }
+            }
+            else
             {
-                /* We always read the data, even if we're held, to keep the socket alive */
-                _r.rawBlock.fillLevel = read( sourcefd, _r.rawBlock.buffer, TRANSFER_SIZE );
+                /* Each time segment is restricted */
+                tv.tv_sec = 0;
+                tv.tv_usec  = TICK_TIME_MS * 1000;
+
+                FD_SET( sourcefd, &readfds );
+                FD_SET( STDIN_FILENO, &readfds );
 
-                if ( _r.rawBlock.fillLevel <= 0 )
+                /* Data already held won't show on the socket */
+                r = NWStreamPending( &ns ) ? 1 : select( sourcefd + 1, &readfds, NULL, NULL, &tv );
+
+                if ( r < 0 )
                 {
-                    /* We are at EOF (Probably the descriptor closed) */
+                    /* Something went wrong in the select */
                     break;
                 }
 
-                /* ...and record the fact that we received some data */
-                _r.intervalBytes += _r.rawBlock.fillLevel;
+                if ( FD_ISSET( sourcefd, &readfds ) )
+                {
+                    /* We always read the data, even if we're held, to keep the socket alive */
+                    _r.rawBlock.fillLevel = NWStreamRead( &ns, _r.rawBlock.buffer, TRANSFER_SIZE );
 
-                /* Pump all of the data through the protocol handler */
-                uint8_t *c = _r.rawBlock.buffer;
+                    if ( _r.rawBlock.fillLevel <= 0 )
+                    {
+                        /* We are at EOF (Probably the descriptor closed) */
+                        break;
+                    }
 
-                while ( _r.rawBlock.fillLevel-- )
-                {
-                    _protocolPump( &_r, *c++ );
+                    /* ...and record the fact that we received some data */
+                    _r.intervalBytes += _r.rawBlock.fillLevel;
+
+                    /* Pump all of the data through the protocol handler */
+                    PipelinePump( &_r.p, _r.rawBlock.buffer, _r.rawBlock.fillLevel );
                 }
             }
 
             /* Check to make sure there's not an unexpected TPIU in here */
-            if ( ITMDecoderGetStats( &_r.i )->tpiuSyncCount )
+            if ( ITMDecoderGetStats( PipelineITM( &_r.p ) )->tpiuSyncCount )
             {
                 genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
             }
@@ -810,21 +730,30 @@ int main( int argc, char *argv[] )
             }
         }
 
-        close( sourcefd );
+        if ( !_r.options->file )
+        {
+            NWStreamClose( &ns );
+            close( sourcefd );
+        }
+    }
+
+    if ( _r.options->file )
+    {
+        FileSourceClose( &fs );
     }
 
     /* Data are collected, now process and report */
-    genericsReport( V_WARN, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL, _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
+    genericsReport( V_WARN, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL, _r.intervalBytes, CallGraphCount( &_r.calls ), HASH_COUNT( _r.insthead ) );
 
-    if ( HASH_COUNT( _r.subhead ) )
+    if ( CallGraphCount( &_r.calls ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
+        if ( ext_ff_outputDot( _r.options->dotfile, &_r.calls, _r.s ) )
         {
             genericsReport( V_WARN, "Output DOT" EOL );
         }
 
         if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile, _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL, false,
-                                   _r.tcount - _r.starttcount, _r.insthead, _r.subhead, _r.s ) )
+                                   _r.tcount - _r.starttcount, _r.insthead, &_r.calls, _r.s ) )
         {
             genericsReport( V_WARN, "Output Profile" EOL );
         }
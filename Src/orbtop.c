@@ -11,22 +11,23 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <pthread.h>
 
-#include "cJSON.h"
 #include "generics.h"
-#include "uthash.h"
 #include "git_version_info.h"
 #include "generics.h"
-#include "tpiuDecoder.h"
-#include "itmDecoder.h"
+#include "pipeline.h"
 #include "symbols.h"
-#include "msgSeq.h"
 #include "nw.h"
+#include "nwStream.h"
+#include "fileSource.h"
 
 #define CUTOFF              (10)             /* Default cutoff at 0.1% */
 #define TOP_UPDATE_INTERVAL (1000)           /* Interval between each on screen update */
@@ -34,14 +35,51 @@
 #define MAX_EXCEPTIONS      (512)            /* Maximum number of exceptions to be considered */
 #define NO_EXCEPTION        (0xFFFFFFFF)     /* Flag indicating no exception is being processed */
 
-#define MSG_REORDER_BUFLEN  (10)             /* Maximum number of samples to re-order for timekeeping */
+#define MSG_REORDER_BUFLEN  (10)             /* Initial number of samples to re-order for timekeeping */
+#define MSG_REORDER_MAXLEN  (1000)           /* ...and the most it can grow to when timestamps are sparse */
 
-struct visitedAddr                           /* Structure for Hashmap of visited/observed addresses */
+#define PC_TABLE_INITIAL    (4096)           /* Initial slots in the PC tables, must be a power of 2 */
+#define NAME_BLOCK_LEN      (4096)           /* Names resolved per block of the name cache */
+#define SYMBOL_WAIT_MS      (30000)          /* Longest to wait for the first symbols when reading from a file */
+
+#define OP_FRAME_INITIAL    (4096)           /* Initial size of the buffer output frames are built in */
+#define PRINTF_MAX_LEN      (256)            /* Room made for each formatted item, it's grown if that's not enough */
+#define BINARY_FRAME_VERSION (1)             /* Version of the binary output frame layout */
+#define DECAY_RESCALE       (1e-100)         /* Scale below which decayed samples are brought back into range */
+
+struct pcName                                /* Entry in the name cache */
 {
-    uint64_t visits;
-    struct nameEntry *n;
+    struct nameEntry n;                      /* Symbol for the PC */
+    uint32_t group;                          /* Report group the PC's samples are aggregated into */
+};
+
+struct pcCount                               /* Slot in the open addressed table of samples by PC */
+{
+    uint32_t pc;
+    struct pcName *name;                     /* Name of the PC, from the name cache */
+    uint64_t visits;                         /* Samples this interval, zero if the slot is empty */
+};
 
-    UT_hash_handle hh;
+struct pcNames                               /* Cache of the symbol for each PC seen, kept across intervals */
+{
+    struct pcName **slot;                    /* Open addressed index of the resolved names, NULL if empty */
+    uint32_t slots;                          /* ...number of slots, a power of 2 */
+    struct pcName **block;                   /* The resolved names, in blocks so they never move once made */
+    uint32_t blocks;                         /* ...how many blocks there are */
+    uint32_t count;                          /* ...and how many names are in them */
+
+    uint32_t *groupSlot;                     /* Open addressed index of the groups, offset by one so zero is empty */
+    uint32_t groupSlots;                     /* ...number of slots, a power of 2 */
+    struct nameEntry **group;                /* A name from each group, which the group is matched against */
+    uint32_t groups;                         /* ...how many groups there are */
+    uint32_t groupAlloc;                     /* ...and how many are allocated */
+};
+
+struct opFrame                               /* Buffer an output frame is built in, reused for each one */
+{
+    char *buf;
+    uint32_t len;                            /* Length of the frame so far */
+    uint32_t alloc;                          /* ...and space allocated for it */
 };
 
 struct reportLine
@@ -49,6 +87,7 @@ struct reportLine
 {
     uint64_t count;
     struct nameEntry *n;
+    uint32_t group;                          /* Group this line reports */
 };
 
 struct exceptionRecord                       /* Record of exception activity */
@@ -66,6 +105,54 @@ struct exceptionRecord                       /* Record of exception activity */
     uint32_t prev;
 };
 
+struct interval                              /* An interval's samples, filled by the decoder then handed over for reporting */
+{
+    struct pcCount *counts;                  /* Samples for each PC received in the SWV this interval */
+    uint32_t countSlots;                     /* ...number of slots in the table, a power of 2 */
+    uint32_t countsUsed;                     /* ...and how many are in use */
+    uint32_t sleeps;                         /* Samples taken while asleep */
+
+    struct exceptionRecord er[MAX_EXCEPTIONS]; /* Exceptions we received on this interval */
+    struct ITMDecoderStats startStats;       /* ITM decoder statistics at the start of the interval */
+    struct ITMDecoderStats endStats;         /* ...and at the end of it */
+    struct TPIUDecoderStats tpiuStats;       /* TPIU decoder statistics at the end of the interval */
+    int64_t startmS;                         /* Start of the interval, in milliseconds */
+    int64_t endmS;                           /* ...and end of it */
+    uint64_t startTicks;                     /* Start of the interval in ticks, or zero if not known */
+    uint64_t endTicks;                       /* ...and end of it */
+    bool restart;                            /* Groups were renumbered during the interval, so history is void */
+};
+
+struct groupCount                            /* Samples for one group over an interval */
+{
+    uint32_t group;
+    uint32_t count;
+};
+
+struct snapshot                              /* Compact record of an interval's samples, kept for the sliding window */
+{
+    struct groupCount *c;
+    uint32_t n;                              /* Number of groups with samples */
+    uint32_t alloc;                          /* ...and how many there's room for */
+    uint32_t sleeps;                         /* Samples taken while asleep */
+};
+
+struct history                               /* Samples carried over from earlier intervals, for the window and decay views */
+{
+    struct snapshot *ring;                   /* The intervals in the sliding window */
+    uint32_t next;                           /* ...where the next one goes */
+    uint32_t filled;                         /* ...and how many are in it */
+
+    double *value;                           /* Samples for each group, before scaling */
+    struct nameEntry **name;                 /* A name for each group, to report it under */
+    bool *isLive;                            /* Is each group in the view? */
+    uint32_t *live;                          /* ...the groups that are */
+    uint32_t liveCount;                      /* ...and how many of them there are */
+    double sleeps;                           /* Samples taken while asleep, before scaling */
+    double scale;                            /* Scale from the held values to samples, which falls as they decay */
+    double decay;                            /* Factor the samples decay by each interval */
+};
+
 
 /* ---------- CONFIGURATION ----------------- */
 struct                                       /* Record for options, either defaults or from command line */
@@ -75,7 +162,10 @@ struct                                       /* Record for options, either defau
     bool outputExceptions;                   /* Set to include exceptions in output flow */
     uint32_t tpiuITMChannel;                 /* What channel? */
     bool forceITMSync;                       /* Must ITM start synced? */
+    bool subscribe;                          /* Ask the server to only send what's used */
+    bool compress;                           /* Ask the server to compress what it sends */
     char *file;                              /* File host connection */
+    char *startAt;                           /* Where in the file to start from */
 
     uint32_t hwOutputs;                      /* What hardware outputs are enabled */
 
@@ -84,6 +174,7 @@ struct                                       /* Record for options, either defau
     char *elffile;                           /* Target program config */
 
     char *json;                              /* Output in JSON format rather than human readable, either '-' for screen or filename */
+    char *binary;                            /* Output as binary frames, either '-' for screen or filename */
     char *outfile;                           /* File to output current information */
     char *logfile;                           /* File to output historic information */
 
@@ -92,6 +183,8 @@ struct                                       /* Record for options, either defau
     bool lineDisaggregation;                 /* Aggregate per line or per function? */
     bool demangle;                           /* Do we want to demangle any C++ we come across? */
     int64_t displayInterval;                 /* What is the display interval? */
+    uint32_t window;                         /* Intervals in the sliding window view, zero if not in use */
+    double halfLife;                         /* Half life of the decay view in intervals, zero if not in use */
 
     int port;                                /* Source information */
     char *server;
@@ -114,34 +207,42 @@ struct                                       /* Record for options, either defau
 /* ----------- LIVE STATE ----------------- */
 struct
 {
-    struct ITMDecoder i;                               /* The decoders and the packets from them */
-    struct MSGSeq    d;                                   /* Message (re-)sequencer */
-    struct ITMPacket h;
-    struct TPIUDecoder t;
-    struct TPIUPacket p;
+    struct pipeline p;                                 /* Decoders all the way to (re-)sequenced messages */
     enum timeDelay timeStatus;                         /* Indicator of if this time is exact */
     uint64_t timeStamp;                                /* Latest received time */
 
-    struct SymbolSet *s;                               /* Symbols read from elf */
+    struct SymbolReload *reload;                       /* Symbols kept loaded from the elf in the background */
+    struct SymbolSet *s;                               /* ...and the set in use, NULL until there is one */
     struct nameEntry *n;                               /* Current table of recognised names */
 
-    struct visitedAddr *addresses;                     /* Addresses we received in the SWV */
-
-    struct exceptionRecord er[MAX_EXCEPTIONS];         /* Exceptions we received on this interval */
+    struct interval iv[2];                             /* Interval being filled by the decoder, and the one being reported */
+    struct interval *cur;                              /* ...the one being filled */
+    struct interval *pending;                          /* ...the one being reported, NULL once it's done */
+    pthread_t reportThread;                            /* Thread turning the intervals into reports */
+    pthread_mutex_t reportLock;                        /* Lock for passing intervals over */
+    pthread_cond_t reportCond;                         /* ...and signal that one has been */
+
+    struct pcNames names;                              /* Symbols for each PC, resolved once for the session */
+    uint32_t *groupLine;                               /* Report line for each group, offset by one so zero is none yet */
+    uint32_t groupLineAlloc;                           /* ...and how many groups there's room for, in this and the history */
+    struct history hist;                               /* Samples from earlier intervals, for the window and decay views */
+    struct reportLine *report;                         /* Report built from the samples */
+    uint32_t reportAlloc;                              /* ...and how many lines are allocated for it */
+    struct nameEntry sleeping;                         /* Name entry for samples taken while sleeping */
+
+    struct exceptionRecord er[MAX_EXCEPTIONS];         /* Exception activity, as it's received */
     uint32_t currentException;                         /* Exception we are currently embedded in */
     uint32_t erDepth;                                  /* Current depth of exception stack */
     char *depthList;                                   /* Record of maximum depth of exceptions */
 
     int64_t lastReportmS;                              /* Last time an output report was generated, in milliseconds */
     int64_t lastReportTicks;                           /* Last time an output report was generated, in ticks */
-    uint32_t ITMoverflows;                             /* Has an ITM overflow been detected? */
-    uint32_t SWPkt;                                    /* Number of SW Packets received */
-    uint32_t TSPkt;                                    /* Number of TS Packets received */
-    uint32_t HWPkt;                                    /* Number of HW Packets received */
+    struct ITMDecoderStats lastStats;                  /* ITM decoder statistics when the last report was generated */
 
     FILE *jsonfile;                                    /* File where json output is being dumped */
+    FILE *binaryfile;                                  /* File where binary output is being dumped */
+    struct opFrame op;                                 /* Frame the output is built in */
     uint32_t interrupts;
-    uint32_t sleeps;
     uint32_t notFound;
 } _r;
 
@@ -161,51 +262,13 @@ int64_t _timestamp( void )
     return milliseconds;
 }
 // ====================================================================================================
-int _addresses_sort_fn( void *a, void *b )
-
-{
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) < ( ( ( struct visitedAddr * )b )->n->addr ) )
-    {
-        return -1;
-    }
-
-    if ( ( ( ( struct visitedAddr * )a )->n->addr ) > ( ( ( struct visitedAddr * )b )->n->addr ) )
-    {
-        return 1;
-    }
-
-    return 0;
-}
-// ====================================================================================================
-int _routines_sort_fn( void *a, void *b )
-
-{
-    int r;
-
-    if ( ( options.reportFilenames ) && ( ( ( ( struct visitedAddr * )a )->n->fileindex ) && ( ( ( struct visitedAddr * )b )->n->fileindex ) ) )
-    {
-        r = ( ( int )( ( struct visitedAddr * )a )->n->fileindex ) - ( ( int )( ( struct visitedAddr * )b )->n->fileindex );
-
-        if ( r )
-        {
-            return r;
-        }
-    }
-
-    r = ( ( int )( ( struct visitedAddr * )a )->n->functionindex ) - ( ( int )( ( struct visitedAddr * )b )->n->functionindex );
-
-    if ( r )
-    {
-        return r;
-    }
-
-    return ( ( int )( ( struct visitedAddr * )a )->n->line ) - ( ( int )( ( struct visitedAddr * )b )->n->line );
-}
-// ====================================================================================================
 int _report_sort_fn( const void *a, const void *b )
 
 {
-    return ( ( struct reportLine * )b )->count - ( ( struct reportLine * )a )->count;
+    uint64_t ca = ( ( struct reportLine * )a )->count;
+    uint64_t cb = ( ( struct reportLine * )b )->count;
+
+    return ( ca < cb ) - ( ca > cb );
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -336,75 +399,352 @@ void _handleSW( struct ITMDecoder *i, struct ITMPacket *p )
 // ====================================================================================================
 // Outputter routines
 // ====================================================================================================
+static bool _screenIsText( void )
+
+/* Is the screen free for human readable output, or is one of the machine outputs going there? */
+
+{
+    return ( ( !options.json ) || ( options.json[0] != '-' ) ) && ( ( !options.binary ) || ( options.binary[0] != '-' ) );
+}
 // ====================================================================================================
-uint32_t _consolodateReport( struct reportLine **returnReport, uint32_t *returnReportLines )
+static uint32_t _pickShown( struct reportLine *report, uint32_t reportLines, uint32_t total )
+
+/* Move the lines that get past the cutoff to the front of the report, returning how many there are */
 
 {
-    struct nameEntry *n;
-    struct visitedAddr *a;
+    struct reportLine t;
+    uint32_t shown = 0;
 
-    uint32_t reportLines = 0;
-    struct reportLine *report = NULL;
-    uint32_t total = 0;
+    for ( uint32_t i = 0; ( total ) && ( i < reportLines ); i++ )
+    {
+        if ( ( report[i].count * 10000 ) / total >= CUTOFF )
+        {
+            t = report[shown];
+            report[shown++] = report[i];
+            report[i] = t;
+        }
+    }
 
+    return shown;
+}
+// ====================================================================================================
+static void _pickLargest( struct reportLine *report, uint32_t reportLines, uint32_t k )
 
-    /* Put the address into order of the file and function names */
-    HASH_SORT( _r.addresses, _routines_sort_fn );
+/* Partition the report so its k largest lines come first, in no particular order, like nth_element */
 
-    /* Now merge them together */
-    for ( a = _r.addresses; a != NULL; a = a->hh.next )
+{
+    struct reportLine t;
+    uint32_t lo = 0, hi = reportLines;
+
+    while ( hi - lo > 1 )
     {
-        if ( !a->visits )
+        /* Three way split around the middle element; [lo,lt) bigger, [lt,gt) equal and [gt,hi) smaller */
+        uint64_t pivot = report[lo + ( hi - lo ) / 2].count;
+        uint32_t lt = lo, i = lo, gt = hi;
+
+        while ( i < gt )
         {
-            continue;
+            if ( report[i].count > pivot )
+            {
+                t = report[lt];
+                report[lt++] = report[i];
+                report[i++] = t;
+            }
+            else if ( report[i].count < pivot )
+            {
+                t = report[--gt];
+                report[gt] = report[i];
+                report[i] = t;
+            }
+            else
+            {
+                i++;
+            }
         }
 
-        if ( ( reportLines == 0 ) ||
-                ( ( options.reportFilenames ) &&  ( report[reportLines - 1].n->fileindex != a->n->fileindex ) ) ||
-                ( report[reportLines - 1].n->functionindex != a->n->functionindex ) ||
-                ( ( report[reportLines - 1].n->line != a->n->line ) && ( options.lineDisaggregation ) ) )
+        if ( k <= lt )
         {
-            /* Make room for a report line */
-            reportLines++;
-            report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines ) );
-            report[reportLines - 1].n = a->n;
-            report[reportLines - 1].count = 0;
+            hi = lt;
+        }
+        else if ( k <= gt )
+        {
+            return;
+        }
+        else
+        {
+            lo = gt;
+        }
+    }
+}
+// ====================================================================================================
+static void _reportRoom( uint32_t lines )
+
+/* Make sure there's room in the report for this many lines */
+
+{
+    if ( _r.reportAlloc < lines )
+    {
+        while ( _r.reportAlloc < lines )
+        {
+            _r.reportAlloc = _r.reportAlloc ? _r.reportAlloc * 2 : PC_TABLE_INITIAL;
         }
 
-        report[reportLines - 1].count += a->visits;
-        total += a->visits;
-        a->visits = 0;
+        _r.report = ( struct reportLine * )realloc( _r.report, sizeof( struct reportLine ) * _r.reportAlloc );
     }
+}
+// ====================================================================================================
+static void _groupRoom( uint32_t g )
 
+/* Make sure the tables indexed by group have room for this one */
 
-    /* Now fold in any sleeping entries */
-    report = ( struct reportLine * )realloc( report, sizeof( struct reportLine ) * ( reportLines + 1 ) );
+{
+    uint32_t was = _r.groupLineAlloc;
+
+    if ( g < was )
+    {
+        return;
+    }
+
+    while ( g >= _r.groupLineAlloc )
+    {
+        _r.groupLineAlloc = _r.groupLineAlloc ? _r.groupLineAlloc * 2 : PC_TABLE_INITIAL;
+    }
+
+    _r.groupLine = ( uint32_t * )realloc( _r.groupLine, sizeof( uint32_t ) * _r.groupLineAlloc );
+    memset( &_r.groupLine[was], 0, sizeof( uint32_t ) * ( _r.groupLineAlloc - was ) );
+
+    if ( ( options.window ) || ( options.halfLife ) )
+    {
+        _r.hist.value = ( double * )realloc( _r.hist.value, sizeof( double ) * _r.groupLineAlloc );
+        _r.hist.name = ( struct nameEntry ** )realloc( _r.hist.name, sizeof( struct nameEntry * ) * _r.groupLineAlloc );
+        _r.hist.isLive = ( bool * )realloc( _r.hist.isLive, sizeof( bool ) * _r.groupLineAlloc );
+        _r.hist.live = ( uint32_t * )realloc( _r.hist.live, sizeof( uint32_t ) * _r.groupLineAlloc );
+        memset( &_r.hist.value[was], 0, sizeof( double ) * ( _r.groupLineAlloc - was ) );
+        memset( &_r.hist.isLive[was], 0, sizeof( bool ) * ( _r.groupLineAlloc - was ) );
+    }
+}
+// ====================================================================================================
+static void _historyAdd( uint32_t g, double samples )
+
+/* Add (or take away) samples for a group in the history */
+
+{
+    _r.hist.value[g] += samples;
 
-    uint32_t addr = FN_SLEEPING;
-    HASH_FIND_INT( _r.addresses, &addr, a );
+    if ( !_r.hist.isLive[g] )
+    {
+        _r.hist.isLive[g] = true;
+        _r.hist.live[_r.hist.liveCount++] = g;
+    }
+}
+// ====================================================================================================
+static uint32_t _applyHistory( struct interval *v, uint32_t reportLines, uint32_t *total )
+
+/* Fold this interval's report into the history, then replace the report with the sliding window or decayed */
+/* view. Only the groups in this interval and the one leaving the window are touched, so a long window costs */
+/* no more than a short one. The sleeping line is always the last one in the interval's report.              */
+
+{
+    struct snapshot *snap;
+    uint32_t lines = 0;
+    uint32_t w = 0;
 
-    if ( a )
+    if ( ( v->restart ) || ( !_r.hist.scale ) )
     {
-        n = a->n;
+        /* Groups mean something different now, so there's nothing to carry over */
+        for ( uint32_t i = 0; i < _r.hist.liveCount; i++ )
+        {
+            _r.hist.value[_r.hist.live[i]] = 0;
+            _r.hist.isLive[_r.hist.live[i]] = false;
+        }
+
+        _r.hist.liveCount = _r.hist.filled = _r.hist.next = 0;
+        _r.hist.sleeps = 0;
+        _r.hist.scale = 1;
+        _r.hist.decay = options.halfLife ? pow( 0.5, 1 / options.halfLife ) : 1;
+        v->restart = false;
+    }
+
+    if ( options.window )
+    {
+        if ( !_r.hist.ring )
+        {
+            _r.hist.ring = ( struct snapshot * )calloc( options.window, sizeof( struct snapshot ) );
+        }
+
+        snap = &_r.hist.ring[_r.hist.next];
+
+        /* The oldest interval drops out of the window, and this one takes its place */
+        if ( _r.hist.filled == options.window )
+        {
+            for ( uint32_t i = 0; i < snap->n; i++ )
+            {
+                _r.hist.value[snap->c[i].group] -= snap->c[i].count;
+            }
+
+            _r.hist.sleeps -= snap->sleeps;
+        }
+        else
+        {
+            _r.hist.filled++;
+        }
+
+        if ( snap->alloc < reportLines )
+        {
+            snap->alloc = reportLines;
+            snap->c = ( struct groupCount * )realloc( snap->c, sizeof( struct groupCount ) * snap->alloc );
+        }
+
+        snap->n = reportLines - 1;
+        snap->sleeps = _r.report[reportLines - 1].count;
+
+        for ( uint32_t i = 0; i < snap->n; i++ )
+        {
+            snap->c[i].group = _r.report[i].group;
+            snap->c[i].count = _r.report[i].count;
+        }
+
+        _r.hist.next = ( _r.hist.next + 1 ) % options.window;
     }
     else
     {
-        n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
+        /* Rather than decaying everything, the scale falls and new samples are added at the current scale */
+        _r.hist.scale *= _r.hist.decay;
+
+        if ( _r.hist.scale < DECAY_RESCALE )
+        {
+            for ( uint32_t i = 0; i < _r.hist.liveCount; i++ )
+            {
+                _r.hist.value[_r.hist.live[i]] *= _r.hist.scale;
+            }
+
+            _r.hist.sleeps *= _r.hist.scale;
+            _r.hist.scale = 1;
+        }
+    }
+
+    for ( uint32_t i = 0; i < reportLines - 1; i++ )
+    {
+        _r.hist.name[_r.report[i].group] = _r.report[i].n;
+        _historyAdd( _r.report[i].group, _r.report[i].count / _r.hist.scale );
+    }
+
+    _r.hist.sleeps += _r.report[reportLines - 1].count / _r.hist.scale;
+
+    /* Now the view becomes the report, dropping any groups that have faded out of it as we go */
+    _reportRoom( _r.hist.liveCount + 1 );
+    *total = 0;
+
+    for ( uint32_t i = 0; i < _r.hist.liveCount; i++ )
+    {
+        uint32_t g = _r.hist.live[i];
+        uint64_t count = llround( _r.hist.value[g] * _r.hist.scale );
+
+        if ( !count )
+        {
+            _r.hist.value[g] = 0;
+            _r.hist.isLive[g] = false;
+            continue;
+        }
+
+        _r.hist.live[w++] = g;
+        _r.report[lines].n = _r.hist.name[g];
+        _r.report[lines].count = count;
+        _r.report[lines].group = g;
+        *total += count;
+        lines++;
+    }
+
+    _r.hist.liveCount = w;
+
+    _r.report[lines].n = &_r.sleeping;
+    _r.report[lines].count = llround( _r.hist.sleeps * _r.hist.scale );
+    *total += _r.report[lines].count;
+    return lines + 1;
+}
+// ====================================================================================================
+uint32_t _consolodateReport( struct interval *v, struct reportLine **returnReport, uint32_t *returnReportLines )
+
+/* Aggregate the samples into report lines, with the lines that are going to be shown sorted to the front */
+
+{
+    struct pcCount *a;
+
+    uint32_t reportLines = 0;
+    uint32_t ordered;
+    struct reportLine *report;
+    uint32_t total = 0;
+
+    /* There can't be more report lines than samples, plus one for sleeping */
+    _reportRoom( v->countsUsed + 1 );
+    report = _r.report;
+
+    /* Each sample goes into the line for its group, which is started when the group is first seen */
+    for ( a = v->counts; a < &v->counts[v->countSlots]; a++ )
+    {
+        if ( a->visits )
+        {
+            uint32_t g = a->name->group;
+
+            _groupRoom( g );
+
+            if ( !_r.groupLine[g] )
+            {
+                report[reportLines].n = &a->name->n;
+                report[reportLines].count = 0;
+                report[reportLines].group = g;
+                _r.groupLine[g] = ++reportLines;
+            }
+
+            report[_r.groupLine[g] - 1].count += a->visits;
+            total += a->visits;
+        }
+    }
+
+    /* The samples are all accounted for, so the tables are emptied ready to be filled again */
+    for ( uint32_t i = 0; i < reportLines; i++ )
+    {
+        _r.groupLine[report[i].group] = 0;
     }
 
-    n->fileindex = NO_FILE;
-    n->functionindex = FN_SLEEPING;
-    n->addr = 0;
-    n->line = 0;
+    memset( v->counts, 0, sizeof( struct pcCount ) * v->countSlots );
+    v->countsUsed = 0;
+
+    /* Now fold in any sleeping entries */
+    _r.sleeping.fileindex = NO_FILE;
+    _r.sleeping.functionindex = FN_SLEEPING;
+    _r.sleeping.addr = 0;
+    _r.sleeping.line = 0;
 
-    report[reportLines].n = n;
-    report[reportLines].count = _r.sleeps;
+    report[reportLines].n = &_r.sleeping;
+    report[reportLines].count = v->sleeps;
     reportLines++;
-    total += _r.sleeps;
-    _r.sleeps = 0;
+    total += v->sleeps;
+    v->sleeps = 0;
 
-    /* Now put the whole thing into order of number of samples */
-    qsort( report, reportLines, sizeof( struct reportLine ), _report_sort_fn );
+    /* For the window and decay views, this interval is only part of what's reported */
+    if ( ( options.window ) || ( options.halfLife ) )
+    {
+        reportLines = _applyHistory( v, reportLines, &total );
+        report = _r.report;
+    }
+
+    /* Now put into order of number of samples whatever will be seen. The machine outputs get every */
+    /* line, but on screen it's only those past the cutoff, and maybe only the first screenful.     */
+    ordered = reportLines;
+
+    if ( ( !options.json ) && ( !options.binary ) )
+    {
+        ordered = _pickShown( report, reportLines, total );
+
+        if ( ( options.cutscreen ) && ( !options.outfile ) && ( !options.logfile ) && ( ordered > options.cutscreen ) )
+        {
+            _pickLargest( report, ordered, options.cutscreen );
+            ordered = options.cutscreen;
+        }
+    }
+
+    qsort( report, ordered, sizeof( struct reportLine ), _report_sort_fn );
 
     *returnReport = report;
     *returnReportLines = reportLines;
@@ -412,134 +752,288 @@ uint32_t _consolodateReport( struct reportLine **returnReport, uint32_t *returnR
     return total;
 }
 // ====================================================================================================
-static void _outputJson( FILE *f, uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t timeStamp )
+static void _opRoom( uint32_t len )
 
-/* Produce the output to JSON */
+/* Make sure there's room for a further len bytes in the output frame */
 
 {
-    /* JSON output constructor */
-    cJSON *jsonStore;
-    cJSON *jsonElement;
-    cJSON *jsonTopTable;
-    cJSON *jsonStatsTable;
-    cJSON *jsonTableEntry;
-    cJSON *jsonIntTable;
-    char *opString;
+    if ( _r.op.len + len > _r.op.alloc )
+    {
+        while ( _r.op.len + len > _r.op.alloc )
+        {
+            _r.op.alloc = _r.op.alloc ? _r.op.alloc * 2 : OP_FRAME_INITIAL;
+        }
 
-    /* Start of frame  ====================================================== */
-    jsonStore = cJSON_CreateObject();
-    assert( jsonStore );
-    jsonElement = cJSON_CreateNumber( timeStamp );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "timestamp", jsonElement );
-    jsonElement = cJSON_CreateNumber( total );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "elements", jsonElement );
-    jsonElement = cJSON_CreateNumber( timeStamp - _r.lastReportmS );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStore, "interval", jsonElement );
+        _r.op.buf = ( char * )realloc( _r.op.buf, _r.op.alloc );
+    }
+}
+// ====================================================================================================
+static void _opPrintf( const char *fmt, ... )
 
-    /* Create stats ========================================================= */
-    jsonStatsTable = cJSON_CreateObject();
-    assert( jsonStatsTable );
-    cJSON_AddItemToObject( jsonStore, "stats", jsonStatsTable );
+/* Format onto the end of the output frame */
 
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->overflow );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "overflow", jsonElement );
+{
+    va_list va;
+    int len;
 
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->syncCount );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "itmsync", jsonElement );
-    jsonElement = cJSON_CreateNumber( TPIUDecoderGetStats( &_r.t )->syncCount );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "tpiusync", jsonElement );
-    jsonElement = cJSON_CreateNumber( ITMDecoderGetStats( &_r.i )->ErrorPkt );
-    assert( jsonElement );
-    cJSON_AddItemToObject( jsonStatsTable, "error", jsonElement );
+    _opRoom( PRINTF_MAX_LEN );
+    va_start( va, fmt );
+    len = vsnprintf( &_r.op.buf[_r.op.len], _r.op.alloc - _r.op.len, fmt, va );
+    va_end( va );
 
+    if ( len >= ( int )( _r.op.alloc - _r.op.len ) )
+    {
+        /* Didn't fit, so make room for it and go again */
+        _opRoom( len + 1 );
+        va_start( va, fmt );
+        vsnprintf( &_r.op.buf[_r.op.len], _r.op.alloc - _r.op.len, fmt, va );
+        va_end( va );
+    }
 
-    /* Create top table ====================================================== */
-    jsonTopTable = cJSON_CreateArray();
-    assert( jsonTopTable );
-    cJSON_AddItemToObject( jsonStore, "toptable", jsonTopTable );
+    _r.op.len += len;
+}
+// ====================================================================================================
+static void _opJsonString( const char *str )
 
-    for ( uint32_t n = 0; n < reportLines; n++ )
+/* Add a quoted string to the output frame, escaped the same way cJSON does it */
+
+{
+    _opRoom( strlen( str ) * 6 + 2 );
+    _r.op.buf[_r.op.len++] = '"';
+
+    for ( const unsigned char *c = ( const unsigned char * )str; *c; c++ )
     {
-        if ( report[n].count )
+        switch ( *c )
         {
-            char *d = NULL;
+            case '"':
+            case '\\':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = *c;
+                break;
 
-            /* Output in JSON Format */
-            jsonTableEntry = cJSON_CreateObject();
-            assert( jsonTableEntry );
+            case '\b':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = 'b';
+                break;
 
-            jsonElement = cJSON_CreateNumber( report[n].count );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "count", jsonElement );
-            jsonElement = cJSON_CreateString( SymbolFilename( _r.s, report[n].n->fileindex ) );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "filename", jsonElement );
+            case '\f':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = 'f';
+                break;
+
+            case '\n':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = 'n';
+                break;
+
+            case '\r':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = 'r';
+                break;
+
+            case '\t':
+                _r.op.buf[_r.op.len++] = '\\';
+                _r.op.buf[_r.op.len++] = 't';
+                break;
+
+            default:
+                if ( *c < ' ' )
+                {
+                    _r.op.len += sprintf( &_r.op.buf[_r.op.len], "\\u%04x", *c );
+                }
+                else
+                {
+                    _r.op.buf[_r.op.len++] = *c;
+                }
+
+                break;
+        }
+    }
+
+    _r.op.buf[_r.op.len++] = '"';
+}
+// ====================================================================================================
+static void _opBytes( const void *d, uint32_t len )
+
+{
+    _opRoom( len );
+    memcpy( &_r.op.buf[_r.op.len], d, len );
+    _r.op.len += len;
+}
+// ====================================================================================================
+static void _opLE( uint64_t v, uint32_t len )
+
+/* Add an integer of len bytes to the output frame, least significant byte first */
+
+{
+    _opRoom( len );
+
+    while ( len-- )
+    {
+        _r.op.buf[_r.op.len++] = v & 0xff;
+        v >>= 8;
+    }
+}
+// ====================================================================================================
+static void _opPatchLE( uint32_t at, uint64_t v, uint32_t len )
+
+/* Fill in an integer already reserved in the output frame, once its value is known */
+
+{
+    while ( len-- )
+    {
+        _r.op.buf[at++] = v & 0xff;
+        v >>= 8;
+    }
+}
+// ====================================================================================================
+static void _opBinString( const char *str )
+
+/* Add a string to the output frame, preceded by its length */
+
+{
+    uint32_t len = strlen( str );
+
+    if ( len > 0xffff )
+    {
+        len = 0xffff;
+    }
+
+    _opLE( len, 2 );
+    _opBytes( str, len );
+}
+// ====================================================================================================
+static void _outputJson( FILE *f, struct interval *v, uint32_t total, uint32_t reportLines, struct reportLine *report )
+
+/* Produce the output to JSON, written straight into the output frame */
+
+{
+    bool first = true;
+
+    _r.op.len = 0;
+
+    /* Start of frame  ====================================================== */
+    _opPrintf( "{\"timestamp\":%" PRId64 ",\"elements\":%" PRIu32 ",\"interval\":%" PRId64, v->endmS, total, v->endmS - v->startmS );
 
-            jsonElement = cJSON_CreateString(  d ? d : SymbolFunction( _r.s, report[n].n->functionindex ) );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "function", jsonElement );
+    /* Create stats ========================================================= */
+    _opPrintf( ",\"stats\":{\"overflow\":%" PRIu32 ",\"itmsync\":%" PRIu32 ",\"tpiusync\":%" PRIu32 ",\"error\":%" PRIu32 "}",
+               v->endStats.overflow, v->endStats.syncCount, v->tpiuStats.syncCount, v->endStats.ErrorPkt );
+
+    /* Create top table ====================================================== */
+    _opPrintf( ",\"toptable\":[" );
+
+    for ( uint32_t n = 0; n < reportLines; n++ )
+    {
+        if ( report[n].count )
+        {
+            _opPrintf( "%s{\"count\":%" PRIu64 ",\"filename\":", first ? "" : ",", report[n].count );
+            _opJsonString( SymbolFilename( _r.s, report[n].n->fileindex ) );
+            _opPrintf( ",\"function\":" );
+            _opJsonString( SymbolFunction( _r.s, report[n].n->functionindex ) );
 
             if ( options.lineDisaggregation )
             {
-                jsonElement = cJSON_CreateNumber( report[n].n->line ? report[n].n->line : 0 );
-                assert( jsonElement );
-                cJSON_AddItemToObject( jsonTableEntry, "line", jsonElement );
+                _opPrintf( ",\"line\":%" PRIu32, report[n].n->line );
             }
 
-            cJSON_AddItemToObject( jsonTopTable, "top", jsonTableEntry );
+            _opPrintf( "}" );
+            first = false;
         }
     }
 
     /* Now add the interrupt metrics ================================================ */
-    jsonIntTable = cJSON_CreateArray();
-    assert( jsonIntTable );
-    cJSON_AddItemToObject( jsonStore, "exceptions", jsonIntTable );
+    _opPrintf( "],\"exceptions\":[" );
+    first = true;
 
     for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
     {
-        if ( _r.er[e].visits )
+        if ( v->er[e].visits )
+        {
+            _opPrintf( "%s{\"ex\":%" PRIu32 ",\"count\":%" PRIu64 ",\"maxd\":%" PRIu32 ",\"totalt\":%" PRId64 ",\"mint\":%" PRId64 ",\"maxt\":%" PRId64 "}",
+                       first ? "" : ",", e, v->er[e].visits, v->er[e].maxDepth, v->er[e].totalTime, v->er[e].minTime, v->er[e].maxTime );
+            first = false;
+        }
+    }
+
+    /* Close off JSON report */
+    _opPrintf( "]}" EOL );
+    fwrite( _r.op.buf, 1, _r.op.len, f );
+    fflush( f );
+}
+// ====================================================================================================
+static void _outputBinary( FILE *f, struct interval *v, uint32_t total, uint32_t reportLines, struct reportLine *report )
+
+/* Produce the output as a length prefixed binary frame. All values are little endian;                   */
+/*                                                                                                          */
+/*   u32 length of the rest of the frame                                                                    */
+/*   u8  'T', u8 version (1), u16 flags (bit 0 set when aggregating per line)                               */
+/*   u64 timestamp (mS), u32 interval (mS), u32 elements                                                     */
+/*   u32 overflow, u32 itmsync, u32 tpiusync, u32 error                                                     */
+/*   u32 number of top table entries, then for each: u64 count, u32 line, u16+bytes file, u16+bytes function */
+/*   u32 number of exceptions, then for each: u32 ex, u64 count, u32 maxd, i64 totalt, i64 mint, i64 maxt   */
+
+{
+    uint32_t entries = 0;
+    uint32_t countAt;
+
+    _r.op.len = 0;
+    _opLE( 0, 4 );
+    _opLE( 'T', 1 );
+    _opLE( BINARY_FRAME_VERSION, 1 );
+    _opLE( options.lineDisaggregation ? 1 : 0, 2 );
+    _opLE( v->endmS, 8 );
+    _opLE( v->endmS - v->startmS, 4 );
+    _opLE( total, 4 );
+    _opLE( v->endStats.overflow, 4 );
+    _opLE( v->endStats.syncCount, 4 );
+    _opLE( v->tpiuStats.syncCount, 4 );
+    _opLE( v->endStats.ErrorPkt, 4 );
+
+    /* Counts go in once we know them */
+    countAt = _r.op.len;
+    _opLE( 0, 4 );
+
+    for ( uint32_t n = 0; n < reportLines; n++ )
+    {
+        if ( report[n].count )
         {
-            jsonTableEntry = cJSON_CreateObject();
-            assert( jsonTableEntry );
-            cJSON_AddItemToObject( jsonIntTable, "exceptions", jsonTableEntry );
-            jsonElement = cJSON_CreateNumber( e );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "ex", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].visits );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "count", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].maxDepth );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "maxd", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].totalTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "totalt", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].minTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "mint", jsonElement );
-            jsonElement = cJSON_CreateNumber( _r.er[e].maxTime );
-            assert( jsonElement );
-            cJSON_AddItemToObject( jsonTableEntry, "maxt", jsonElement );
+            _opLE( report[n].count, 8 );
+            _opLE( report[n].n->line, 4 );
+            _opBinString( SymbolFilename( _r.s, report[n].n->fileindex ) );
+            _opBinString( SymbolFunction( _r.s, report[n].n->functionindex ) );
+            entries++;
         }
     }
 
-    /* Close off JSON report - if you want your printing pretty then use the first line */
-    //opString=cJSON_Print(jsonStore);
+    _opPatchLE( countAt, entries, 4 );
+
+    countAt = _r.op.len;
+    _opLE( 0, 4 );
+    entries = 0;
+
+    for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+    {
+        if ( v->er[e].visits )
+        {
+            _opLE( e, 4 );
+            _opLE( v->er[e].visits, 8 );
+            _opLE( v->er[e].maxDepth, 4 );
+            _opLE( v->er[e].totalTime, 8 );
+            _opLE( v->er[e].minTime, 8 );
+            _opLE( v->er[e].maxTime, 8 );
+            entries++;
+        }
+    }
 
-    opString = cJSON_PrintUnformatted( jsonStore );
-    cJSON_Delete( jsonStore );
-    fprintf( f, "%s" EOL, opString );
-    free( opString );
+    _opPatchLE( countAt, entries, 4 );
+    _opPatchLE( 0, _r.op.len - 4, 4 );
+
+    fwrite( _r.op.buf, 1, _r.op.len, f );
+    fflush( f );
 }
 
 // ====================================================================================================
-static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine *report, int64_t lastTime )
+static void _outputTop( struct interval *v, uint32_t total, uint32_t reportLines, struct reportLine *report )
 
 /* Produce the output */
 
@@ -625,267 +1119,493 @@ static void _outputTop( uint32_t total, uint32_t reportLines, struct reportLine
                             fprintf( p, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
                         }
 
-                        if ( q )
-                        {
-                            fprintf( q, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
-                        }
-                    }
+                        if ( q )
+                        {
+                            fprintf( q, "%s::%d,%3d.%02d" EOL, d ? d : SymbolFunction( _r.s, report[n].n->functionindex ), report[n].n->line, percentage / 100, percentage % 100 );
+                        }
+                    }
+
+
+                }
+            }
+        }
+    }
+
+    fprintf( stdout, C_RESET "-----------------" EOL );
+
+    fprintf( stdout, C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, samples );
+
+    if ( p )
+    {
+        fclose( p );
+    }
+
+    if ( q )
+    {
+        fprintf( q, "===================================" EOL );
+        fclose( q );
+    }
+
+
+    if ( options.outputExceptions )
+    {
+        /* Tidy up screen output */
+        while ( printed++ <= options.cutscreen )
+        {
+            fprintf( stdout, EOL );
+        }
+
+        fprintf( stdout, EOL " Ex |   Count  |  MaxD | TotalTicks  |  AveTicks  |  minTicks  |  maxTicks " EOL );
+        fprintf( stdout, "----+----------+-------+-------------+------------+------------+------------" EOL );
+
+        for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+        {
+
+            if ( v->er[e].visits )
+            {
+                fprintf( stdout, C_DATA "%3" PRIu32 C_RESET " | " C_DATA "%8" PRIu64 C_RESET " |" C_DATA " %5"
+                         PRIu32 C_RESET " | "C_DATA " %9" PRIu64 C_RESET "  |  " C_DATA "%9" PRIu64 C_RESET " | " C_DATA "%9" PRIu64 C_RESET "  | " C_DATA" %9" PRIu64 C_RESET EOL,
+                         e, v->er[e].visits, v->er[e].maxDepth, v->er[e].totalTime, v->er[e].totalTime / v->er[e].visits, v->er[e].minTime, v->er[e].maxTime );
+            }
+        }
+    }
+
+    fprintf( stdout, EOL C_RESET "[%s%s%s%s" C_RESET "] ",
+             ( v->startStats.overflow != v->endStats.overflow ) ? C_OVF_IND "V" : C_RESET "-",
+             ( v->startStats.SWPkt != v->endStats.SWPkt ) ? C_SOFT_IND "S" : C_RESET "-",
+             ( v->startStats.TSPkt != v->endStats.TSPkt ) ? C_TSTAMP_IND "T" : C_RESET "-",
+             ( v->startStats.HWPkt != v->endStats.HWPkt ) ? C_HW_IND "H" : C_RESET "-" );
+
+    if ( v->startTicks )
+        fprintf( stdout, "Interval = " C_DATA "%" PRIu64 "mS " C_RESET "/ "C_DATA "%" PRIu64 C_RESET " (~" C_DATA "%" PRIu64 C_RESET " Ticks/mS)" EOL,
+                 v->endmS - v->startmS, v->endTicks - v->startTicks, ( v->endTicks - v->startTicks ) / ( v->endmS - v->startmS ) );
+    else
+    {
+        fprintf( stdout, C_RESET "Interval = " C_DATA "%" PRIu64 C_RESET "mS" EOL, v->endmS - v->startmS );
+    }
+
+    genericsReport( V_INFO, "         Ovf=%3d  ITMSync=%3d TPIUSync=%3d ITMErrors=%3d" EOL,
+                    v->endStats.overflow,
+                    v->endStats.syncCount,
+                    v->tpiuStats.syncCount,
+                    v->endStats.ErrorPkt );
+
+}
+// ====================================================================================================
+static void *_reportThread( void *arg )
+
+/* Turn each interval handed over into a report, leaving decoding to carry on with the next one */
+
+{
+    struct interval *v;
+    struct reportLine *report;
+    uint32_t reportLines;
+    uint32_t total;
+
+    while ( true )
+    {
+        pthread_mutex_lock( &_r.reportLock );
+
+        while ( !_r.pending )
+        {
+            pthread_cond_wait( &_r.reportCond, &_r.reportLock );
+        }
+
+        v = _r.pending;
+        pthread_mutex_unlock( &_r.reportLock );
+
+        /* Create the report that we will output */
+        total = _consolodateReport( v, &report, &reportLines );
+
+        if ( options.json )
+        {
+            _outputJson( _r.jsonfile, v, total, reportLines, report );
+        }
+
+        if ( options.binary )
+        {
+            _outputBinary( _r.binaryfile, v, total, reportLines, report );
+        }
+
+        if ( _screenIsText() )
+        {
+            _outputTop( v, total, reportLines, report );
+        }
+
+        /* Interval is emptied, ready to be filled again */
+        pthread_mutex_lock( &_r.reportLock );
+        _r.pending = NULL;
+        pthread_cond_broadcast( &_r.reportCond );
+        pthread_mutex_unlock( &_r.reportLock );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _reportIdle( void )
+
+{
+    bool idle;
+
+    pthread_mutex_lock( &_r.reportLock );
+    idle = ( !_r.pending );
+    pthread_mutex_unlock( &_r.reportLock );
+    return idle;
+}
+// ====================================================================================================
+static void _waitReport( void )
+
+/* Wait for any interval being reported to be finished with */
+
+{
+    pthread_mutex_lock( &_r.reportLock );
+
+    while ( _r.pending )
+    {
+        pthread_cond_wait( &_r.reportCond, &_r.reportLock );
+    }
+
+    pthread_mutex_unlock( &_r.reportLock );
+}
+// ====================================================================================================
+static void _handOver( int64_t now )
+
+/* Pass the interval just finished over to be reported, and start filling the other one. If the   */
+/* last report isn't done yet then this interval is just extended, so decoding is never held up.  */
+
+{
+    struct interval *v = _r.cur;
+
+    if ( !_reportIdle() )
+    {
+        return;
+    }
+
+    memcpy( v->er, _r.er, sizeof( _r.er ) );
+    v->startStats = _r.lastStats;
+    v->endStats = *ITMDecoderGetStats( PipelineITM( &_r.p ) );
+    v->tpiuStats = *TPIUDecoderGetStats( PipelineTPIU( &_r.p ) );
+    v->startmS = _r.lastReportmS;
+    v->endmS = now;
+    v->startTicks = _r.lastReportTicks;
+    v->endTicks = _r.timeStamp;
+
+    pthread_mutex_lock( &_r.reportLock );
+    _r.pending = v;
+    pthread_cond_broadcast( &_r.reportCond );
+    pthread_mutex_unlock( &_r.reportLock );
+
+    _r.cur = ( v == &_r.iv[0] ) ? &_r.iv[1] : &_r.iv[0];
+
+    /* ...and zero the exception records */
+    for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+    {
+        _r.er[e].visits = _r.er[e].maxDepth = _r.er[e].totalTime = _r.er[e].minTime = _r.er[e].maxTime = 0;
+    }
+
+    /* It's safe to update these here because the ticks won't be updated until more
+     * records arrive. */
+    _r.lastStats = v->endStats;
+    _r.lastReportmS = now;
+    _r.lastReportTicks = _r.timeStamp;
+}
+
+// ====================================================================================================
+static inline uint32_t _pcHash( uint32_t pc, uint32_t slots )
+
+/* Slot to start looking for a PC in. They're always halfword aligned, so the bottom bit is no use */
+
+{
+    return ( ( pc >> 1 ) * 2654435761U ) & ( slots - 1 );
+}
+// ====================================================================================================
+static uint32_t _groupHash( struct nameEntry *n, uint32_t slots )
+
+/* Slot to start looking for the group of a name in, from the parts of it that are reported on */
+
+{
+    uint32_t h = n->functionindex * 2654435761U;
+
+    if ( options.reportFilenames )
+    {
+        h = ( h ^ n->fileindex ) * 2654435761U;
+    }
+
+    if ( options.lineDisaggregation )
+    {
+        h = ( h ^ n->line ) * 2654435761U;
+    }
+
+    return ( h ^ ( h >> 16 ) ) & ( slots - 1 );
+}
+// ====================================================================================================
+static bool _sameGroup( struct nameEntry *a, struct nameEntry *b )
+
+/* Are these two names reported on the same line? */
+
+{
+    return ( a->functionindex == b->functionindex ) &&
+           ( ( !options.reportFilenames ) || ( a->fileindex == b->fileindex ) ) &&
+           ( ( !options.lineDisaggregation ) || ( a->line == b->line ) );
+}
+// ====================================================================================================
+static void _growGroups( void )
 
+/* Double the size of the group index, re-placing everything already in it */
 
-                }
-            }
+{
+    uint32_t slots = _r.names.groupSlots ? _r.names.groupSlots * 2 : PC_TABLE_INITIAL;
+    uint32_t *slot = ( uint32_t * )calloc( slots, sizeof( uint32_t ) );
+
+    for ( uint32_t i = 0; i < _r.names.groups; i++ )
+    {
+        uint32_t h = _groupHash( _r.names.group[i], slots );
+
+        while ( slot[h] )
+        {
+            h = ( h + 1 ) & ( slots - 1 );
         }
+
+        slot[h] = i + 1;
     }
 
-    fprintf( stdout, C_RESET "-----------------" EOL );
+    free( _r.names.groupSlot );
+    _r.names.groupSlot = slot;
+    _r.names.groupSlots = slots;
+}
+// ====================================================================================================
+static uint32_t _groupFor( struct nameEntry *n )
 
-    fprintf( stdout, C_DATA "%3d.%02d%% " C_SUPPORT " %7" PRIu64 " " C_RESET "of "C_DATA" %" PRIu64 " "C_RESET" Samples" EOL, totPercent / 100, totPercent % 100, dispSamples, samples );
+/* Find which group a name is aggregated into for reporting, making a new one if it's not been seen */
 
-    if ( p )
+{
+    uint32_t h;
+
+    if ( !_r.names.groupSlots )
     {
-        fclose( p );
+        _growGroups();
     }
 
-    if ( q )
+    for ( h = _groupHash( n, _r.names.groupSlots ); _r.names.groupSlot[h]; h = ( h + 1 ) & ( _r.names.groupSlots - 1 ) )
     {
-        fprintf( q, "===================================" EOL );
-        fclose( q );
+        if ( _sameGroup( _r.names.group[_r.names.groupSlot[h] - 1], n ) )
+        {
+            return _r.names.groupSlot[h] - 1;
+        }
+    }
+
+    if ( _r.names.groups == _r.names.groupAlloc )
+    {
+        _r.names.groupAlloc = _r.names.groupAlloc ? _r.names.groupAlloc * 2 : PC_TABLE_INITIAL;
+        _r.names.group = ( struct nameEntry ** )realloc( _r.names.group, sizeof( struct nameEntry * ) * _r.names.groupAlloc );
     }
 
+    _r.names.group[_r.names.groups] = n;
+    _r.names.groupSlot[h] = ++_r.names.groups;
 
-    if ( options.outputExceptions )
+    if ( _r.names.groups * 2 > _r.names.groupSlots )
     {
-        /* Tidy up screen output */
-        while ( printed++ <= options.cutscreen )
-        {
-            fprintf( stdout, EOL );
-        }
+        _growGroups();
+    }
 
-        fprintf( stdout, EOL " Ex |   Count  |  MaxD | TotalTicks  |  AveTicks  |  minTicks  |  maxTicks " EOL );
-        fprintf( stdout, "----+----------+-------+-------------+------------+------------+------------" EOL );
+    return _r.names.groups - 1;
+}
+// ====================================================================================================
+static void _growNames( void )
 
-        for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
+/* Double the size of the name cache index, re-placing everything already in it */
+
+{
+    uint32_t slots = _r.names.slots ? _r.names.slots * 2 : PC_TABLE_INITIAL;
+    struct pcName **slot = ( struct pcName ** )calloc( slots, sizeof( struct pcName * ) );
+
+    for ( uint32_t i = 0; i < _r.names.slots; i++ )
+    {
+        if ( _r.names.slot[i] )
         {
+            uint32_t h = _pcHash( _r.names.slot[i]->n.addr, slots );
 
-            if ( _r.er[e].visits )
+            while ( slot[h] )
             {
-                fprintf( stdout, C_DATA "%3" PRIu32 C_RESET " | " C_DATA "%8" PRIu64 C_RESET " |" C_DATA " %5"
-                         PRIu32 C_RESET " | "C_DATA " %9" PRIu64 C_RESET "  |  " C_DATA "%9" PRIu64 C_RESET " | " C_DATA "%9" PRIu64 C_RESET "  | " C_DATA" %9" PRIu64 C_RESET EOL,
-                         e, _r.er[e].visits, _r.er[e].maxDepth, _r.er[e].totalTime, _r.er[e].totalTime / _r.er[e].visits, _r.er[e].minTime, _r.er[e].maxTime );
+                h = ( h + 1 ) & ( slots - 1 );
             }
-        }
-    }
-
-    fprintf( stdout, EOL C_RESET "[%s%s%s%s" C_RESET "] ",
-             ( _r.ITMoverflows != ITMDecoderGetStats( &_r.i )->overflow ) ? C_OVF_IND "V" : C_RESET "-",
-             ( _r.SWPkt != ITMDecoderGetStats( &_r.i )->SWPkt ) ? C_SOFT_IND "S" : C_RESET "-",
-             ( _r.TSPkt != ITMDecoderGetStats( &_r.i )->TSPkt ) ? C_TSTAMP_IND "T" : C_RESET "-",
-             ( _r.HWPkt != ITMDecoderGetStats( &_r.i )->HWPkt ) ? C_HW_IND "H" : C_RESET "-" );
 
-    if ( _r.lastReportTicks )
-        fprintf( stdout, "Interval = " C_DATA "%" PRIu64 "mS " C_RESET "/ "C_DATA "%" PRIu64 C_RESET " (~" C_DATA "%" PRIu64 C_RESET " Ticks/mS)" EOL,
-                 lastTime - _r.lastReportmS, _r.timeStamp - _r.lastReportTicks, ( _r.timeStamp - _r.lastReportTicks ) / ( lastTime - _r.lastReportmS ) );
-    else
-    {
-        fprintf( stdout, C_RESET "Interval = " C_DATA "%" PRIu64 C_RESET "mS" EOL, lastTime - _r.lastReportmS );
+            slot[h] = _r.names.slot[i];
+        }
     }
 
-    genericsReport( V_INFO, "         Ovf=%3d  ITMSync=%3d TPIUSync=%3d ITMErrors=%3d" EOL,
-                    ITMDecoderGetStats( &_r.i )->overflow,
-                    ITMDecoderGetStats( &_r.i )->syncCount,
-                    TPIUDecoderGetStats( &_r.t )->syncCount,
-                    ITMDecoderGetStats( &_r.i )->ErrorPkt );
-
+    free( _r.names.slot );
+    _r.names.slot = slot;
+    _r.names.slots = slots;
 }
-
 // ====================================================================================================
-void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
+static struct pcName *_nameFor( uint32_t pc )
 
-{
-    assert( m->msgtype == MSG_PC_SAMPLE );
+/* Get the name cache entry for a PC, looking it up in the symbols if it's not been seen before */
 
-    struct visitedAddr *a;
+{
+    struct pcName *n;
+    uint32_t h;
 
-    if ( m->sleep )
+    if ( !_r.names.slots )
     {
-        /* This is a sleep packet */
-        _r.sleeps++;
+        _growNames();
     }
-    else
-    {
-        HASH_FIND_INT( _r.addresses, &m->pc, a );
 
-        if ( a )
+    for ( h = _pcHash( pc, _r.names.slots ); _r.names.slot[h]; h = ( h + 1 ) & ( _r.names.slots - 1 ) )
+    {
+        if ( _r.names.slot[h]->n.addr == pc )
         {
-            a->visits++;
+            return _r.names.slot[h];
         }
-        else
-        {
-            struct nameEntry n;
-
-            /* Find a matching name record if there is one */
-            SymbolLookup( _r.s, m->pc, &n );
+    }
 
-            /* This is a new entry - record it */
+    /* This is a new entry - record it. Entries are never moved, since the report holds on to them */
+    if ( _r.names.count == _r.names.blocks * NAME_BLOCK_LEN )
+    {
+        _r.names.block = ( struct pcName ** )realloc( _r.names.block, sizeof( struct pcName * ) * ( _r.names.blocks + 1 ) );
+        _r.names.block[_r.names.blocks++] = ( struct pcName * )malloc( sizeof( struct pcName ) * NAME_BLOCK_LEN );
+    }
 
-            a = ( struct visitedAddr * )calloc( 1, sizeof( struct visitedAddr ) );
-            a->visits = 1;
+    n = &_r.names.block[_r.names.count / NAME_BLOCK_LEN][_r.names.count % NAME_BLOCK_LEN];
+    SymbolLookup( _r.s, pc, &n->n );
+    n->n.addr = pc;
+    n->group = _groupFor( &n->n );
+    _r.names.slot[h] = n;
 
-            a->n = ( struct nameEntry * )malloc( sizeof( struct nameEntry ) );
-            memcpy( a->n, &n, sizeof( struct nameEntry ) );
-            HASH_ADD_INT( _r.addresses, n->addr, a );
-        }
+    /* Keep at least half of the index empty so runs stay short */
+    if ( ++_r.names.count * 2 > _r.names.slots )
+    {
+        _growNames();
     }
+
+    return n;
 }
 // ====================================================================================================
-void _flushHash( void )
+static void _growCounts( struct interval *v )
+
+/* Double the size of the sample table, re-placing everything already in it */
 
 {
-    struct visitedAddr *a;
-    UT_hash_handle hh;
+    uint32_t slots = v->countSlots ? v->countSlots * 2 : PC_TABLE_INITIAL;
+    struct pcCount *counts = ( struct pcCount * )calloc( slots, sizeof( struct pcCount ) );
 
-    for ( a = _r.addresses; a != NULL; a = hh.next )
+    for ( uint32_t i = 0; i < v->countSlots; i++ )
     {
-        hh = a->hh;
-        free( a );
+        if ( v->counts[i].visits )
+        {
+            uint32_t h = _pcHash( v->counts[i].pc, slots );
+
+            while ( counts[h].visits )
+            {
+                h = ( h + 1 ) & ( slots - 1 );
+            }
+
+            counts[h] = v->counts[i];
+        }
     }
 
-    _r.addresses = NULL;
+    free( v->counts );
+    v->counts = counts;
+    v->countSlots = slots;
 }
 // ====================================================================================================
-// Pump characters into the itm decoder
-// ====================================================================================================
-void _itmPumpProcess( uint8_t c )
+void _handlePCSample( struct pcSampleMsg *m, struct ITMDecoder *i )
 
 {
-    typedef void ( *handlers )( void *decoded, struct ITMDecoder * i );
-
-    /* Handlers for each complete message received */
-    static const handlers h[MSG_NUM_MSGS] =
-    {
-        /* MSG_UNKNOWN */         NULL,
-        /* MSG_RESERVED */        NULL,
-        /* MSG_ERROR */           NULL,
-        /* MSG_NONE */            NULL,
-        /* MSG_SOFTWARE */        NULL,
-        /* MSG_NISYNC */          NULL,
-        /* MSG_OSW */             NULL,
-        /* MSG_DATA_ACCESS_WP */  NULL,
-        /* MSG_DATA_RWWP */       NULL,
-        /* MSG_PC_SAMPLE */       ( handlers )_handlePCSample,
-        /* MSG_DWT_EVENT */       NULL,
-        /* MSG_EXCEPTION */       ( handlers )_handleException,
-        /* MSG_TS */              ( handlers )_handleTS
-    };
+    assert( m->msgtype == MSG_PC_SAMPLE );
 
-    struct msg *p;
+    struct interval *v = _r.cur;
+    struct pcCount *a;
 
-    if ( !MSGSeqPump( &_r.d, c ) )
+    if ( m->sleep )
     {
-        return;
+        /* This is a sleep packet */
+        v->sleeps++;
     }
-
-    /* We are synced timewise, so empty anything that has been waiting */
-    while ( 1 )
+    else
     {
-        p = MSGSeqGetPacket( &_r.d );
+        if ( !v->countSlots )
+        {
+            _growCounts( v );
+        }
 
-        if ( !p )
+        for ( a = &v->counts[_pcHash( m->pc, v->countSlots )]; a->visits; a = ( a == &v->counts[v->countSlots - 1] ) ? v->counts : a + 1 )
         {
-            /* all read */
-            break;
+            if ( a->pc == m->pc )
+            {
+                a->visits++;
+                return;
+            }
         }
 
-        assert( p->genericMsg.msgtype < MSG_NUM_MSGS );
+        /* First time this interval for this PC, so take the empty slot we've arrived at */
+        a->pc = m->pc;
+        a->name = _nameFor( m->pc );
+        a->visits = 1;
 
-        if ( h[p->genericMsg.msgtype] )
+        if ( ++v->countsUsed * 2 > v->countSlots )
         {
-            ( h[p->genericMsg.msgtype] )( p, &_r.i );
+            _growCounts( v );
         }
     }
-
-    return;
 }
 // ====================================================================================================
-// ====================================================================================================
-// Protocol pump for decoding messages
-// ====================================================================================================
-// ====================================================================================================
-void _protocolPump( uint8_t c )
+static void _refreshNames( void )
 
-/* Top level protocol pump */
+/* Look all of the resolved names up again in a new set with the same layout, so they keep their groups. */
+/* Only called while no interval is being reported, so nothing else is looking at the names.            */
 
 {
-    if ( options.useTPIU )
+    for ( uint32_t i = 0; i < _r.names.count; i++ )
     {
-        switch ( TPIUPump( &_r.t, c ) )
-        {
-            // ------------------------------------
-            case TPIU_EV_NEWSYNC:
-                genericsReport( V_INFO, "TPIU In Sync (%d)" EOL, TPIUDecoderGetStats( &_r.t )->syncCount );
-
-            case TPIU_EV_SYNCED:
-                ITMDecoderForceSync( &_r.i, true );
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_RXING:
-            case TPIU_EV_NONE:
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_UNSYNCED:
-                genericsReport( V_WARN, "TPIU Lost Sync (%d)" EOL, TPIUDecoderGetStats( &_r.t )->lostSync );
-                ITMDecoderForceSync( &_r.i, false );
-                break;
-
-            // ------------------------------------
-            case TPIU_EV_RXEDPACKET:
-                if ( !TPIUGetPacket( &_r.t, &_r.p ) )
-                {
-                    genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                }
+        struct pcName *n = &_r.names.block[i / NAME_BLOCK_LEN][i % NAME_BLOCK_LEN];
+        uint32_t pc = n->n.addr;
 
-                for ( uint32_t g = 0; g < _r.p.len; g++ )
-                {
-                    if ( _r.p.packet[g].s == options.tpiuITMChannel )
-                    {
-                        _itmPumpProcess( _r.p.packet[g].d );
-                        continue;
-                    }
+        SymbolLookup( _r.s, pc, &n->n );
+        n->n.addr = pc;
+    }
+}
+// ====================================================================================================
+void _flushHash( void )
 
-                    if ( _r.p.packet[g].s != 0 )
-                    {
-                        genericsReport( V_WARN, "Unknown TPIU channel %02x" EOL, _r.p.packet[g].s );
-                    }
-                }
+/* Forget all samples and resolved names, such as when the symbols they were resolved against change. */
+/* Only called while no interval is being reported, so nothing else is looking at the names.         */
 
-                break;
+{
+    if ( _r.cur->counts )
+    {
+        memset( _r.cur->counts, 0, sizeof( struct pcCount ) * _r.cur->countSlots );
+    }
 
-            // ------------------------------------
-            case TPIU_EV_ERROR:
-                genericsReport( V_WARN, "****ERROR****" EOL );
-                break;
-                // ------------------------------------
-        }
+    if ( _r.names.slot )
+    {
+        memset( _r.names.slot, 0, sizeof( struct pcName * ) * _r.names.slots );
     }
-    else
+
+    if ( _r.names.groupSlot )
     {
-        /* There's no TPIU in use, so this goes straight to the ITM layer */
-        _itmPumpProcess( c );
+        memset( _r.names.groupSlot, 0, sizeof( uint32_t ) * _r.names.groupSlots );
     }
+
+    _r.cur->countsUsed = 0;
+    _r.cur->restart = true;
+    _r.names.count = 0;
+    _r.names.groups = 0;
 }
 // ====================================================================================================
 void _printHelp( char *progName )
 
 {
     fprintf( stdout, "Usage: %s [options]" EOL, progName );
+    fprintf( stdout, "       -b: <filename> Output to file as binary frames (or screen if <filename> is '-')" EOL );
     fprintf( stdout, "       -c: <num> Cut screen output after number of lines" EOL );
     fprintf( stdout, "       -d: <DeleteMaterial> to take off front of filenames" EOL );
     fprintf( stdout, "       -D: Switch off C++ symbol demangling" EOL );
     fprintf( stdout, "       -e: <ElfFile> to use for symbols" EOL );
     fprintf( stdout, "       -E: Include exceptions in output report" EOL );
     fprintf( stdout, "       -f: <filename> Take input from specified file" EOL );
+    fprintf( stdout, "       -F: <pos> Start file input from @<offset>, or for a capture file +<secs> or <hh:mm:ss>" EOL );
     fprintf( stdout, "       -g: <LogFile> append historic records to specified file" EOL );
     fprintf( stdout, "       -h: This help" EOL );
     fprintf( stdout, "       -I: <interval> Display interval in milliseconds (defaults to %d mS)" EOL, TOP_UPDATE_INTERVAL );
@@ -896,8 +1616,12 @@ void _printHelp( char *progName )
     fprintf( stdout, "       -r: <routines> to record in live file (default %d routines)" EOL, options.maxRoutines );
     fprintf( stdout, "       -R: Report filenames as part of function discriminator" EOL );
     fprintf( stdout, "       -s: <Server>:<Port> to use" EOL );
+    fprintf( stdout, "       -S: Ask the server to only send PC samples, exceptions and timestamps" EOL );
     fprintf( stdout, "       -t: <channel> Use TPIU decoder on specified channel" EOL );
     fprintf( stdout, "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    fprintf( stdout, "       -w: <intervals> Report a sliding window over this many intervals" EOL );
+    fprintf( stdout, "       -x: <intervals> Report with samples decaying, halving over this many intervals" EOL );
+    fprintf( stdout, "       -Z: Ask the server to compress what it sends" EOL );
     fprintf( stdout, EOL "Environment Variables;" EOL );
     fprintf( stdout, "  OBJDUMP: to use non-standard obbdump binary" EOL );
 }
@@ -907,9 +1631,14 @@ int _processOptions( int argc, char *argv[] )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "c:d:DEe:f:g:hI:j:lm:no:r:Rs:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "b:c:d:DEe:f:F:g:hI:j:lm:no:r:Rs:St:v:w:x:Z" ) ) != -1 )
         switch ( c )
         {
+            // ------------------------------------
+            case 'b':
+                options.binary = optarg;
+                break;
+
             // ------------------------------------
             case 'c':
                 options.cutscreen = atoi( optarg );
@@ -930,6 +1659,11 @@ int _processOptions( int argc, char *argv[] )
                 options.file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                options.startAt = optarg;
+                break;
+
             // ------------------------------------
             case 'g':
                 options.logfile = optarg;
@@ -987,11 +1721,31 @@ int _processOptions( int argc, char *argv[] )
                 options.tpiuITMChannel = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'w':
+                options.window = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'x':
+                options.halfLife = atof( optarg );
+                break;
+
+            // ------------------------------------
+            case 'Z':
+                options.compress = true;
+                break;
+
             // ------------------------------------
             case 'R':
                 options.reportFilenames = true;
                 break;
 
+            // ------------------------------------
+            case 'S':
+                options.subscribe = true;
+                break;
+
             // ------------------------------------
             case 's':
                 options.server = optarg;
@@ -1048,6 +1802,30 @@ int _processOptions( int argc, char *argv[] )
         return -EINVAL;
     }
 
+    if ( ( options.useTPIU ) && ( options.tpiuITMChannel >= TPIU_NUM_STREAMS ) )
+    {
+        genericsReport( V_ERROR, "Illegal TPIU channel" EOL );
+        return -EINVAL;
+    }
+
+    if ( ( options.json ) && ( options.binary ) && ( options.json[0] == '-' ) && ( options.binary[0] == '-' ) )
+    {
+        genericsReport( V_ERROR, "JSON and binary output can't both go to the screen" EOL );
+        return -EINVAL;
+    }
+
+    if ( ( options.window ) && ( options.halfLife ) )
+    {
+        genericsReport( V_ERROR, "Only one of sliding window and decay can be used" EOL );
+        return -EINVAL;
+    }
+
+    if ( options.halfLife < 0 )
+    {
+        genericsReport( V_ERROR, "Decay half life must be positive" EOL );
+        return -EINVAL;
+    }
+
     if ( !options.elffile )
     {
         genericsReport( V_ERROR, "Elf File not specified" EOL );
@@ -1063,6 +1841,7 @@ int _processOptions( int argc, char *argv[] )
     else
     {
         genericsReport( V_INFO, "Server           : %s:%d" EOL, options.server, options.port );
+        genericsReport( V_INFO, "Compress         : %s" EOL, options.compress ? "true" : "false" );
     }
 
     genericsReport( V_INFO, "Delete Mat       : %s" EOL, options.deleteMaterial ? options.deleteMaterial : "None" );
@@ -1072,6 +1851,16 @@ int _processOptions( int argc, char *argv[] )
     genericsReport( V_INFO, "Display Interval : %d mS" EOL, options.displayInterval );
     genericsReport( V_INFO, "Log File         : %s" EOL, options.logfile ? options.logfile : "None" );
 
+    if ( options.window )
+    {
+        genericsReport( V_INFO, "Sliding Window   : %d intervals" EOL, options.window );
+    }
+
+    if ( options.halfLife )
+    {
+        genericsReport( V_INFO, "Decay Half Life  : %g intervals" EOL, options.halfLife );
+    }
+
     if ( options.useTPIU )
     {
         genericsReport( V_INFO, "Using TPIU       : true (ITM on channel %d)" EOL, options.tpiuITMChannel );
@@ -1093,17 +1882,15 @@ int _processOptions( int argc, char *argv[] )
 int main( int argc, char *argv[] )
 
 {
-    int sourcefd;
+    int sourcefd = 0;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     uint8_t cbw[TRANSFER_SIZE];
+    const uint8_t *data = cbw;
+    struct fileSource fs;
+    struct nwStream ns;
     int64_t lastTime;
 
-    /* Output variables for interval report */
-    uint32_t total;
-    uint32_t reportLines = 0;
-    struct reportLine *report;
-
     ssize_t t;
     int flag = 1;
     int r;
@@ -1119,14 +1906,22 @@ int main( int argc, char *argv[] )
         exit( -EINVAL );
     }
 
-    /* Reset the TPIU handler before we start */
-    TPIUDecoderInit( &_r.t );
-    ITMDecoderInit( &_r.i, options.forceITMSync );
-    MSGSeqInit( &_r.d, &_r.i, MSG_REORDER_BUFLEN );
+    /* Only the ITM channel is wanted out of the TPIU stream */
+    PipelineInit( &_r.p, options.forceITMSync, &_r.p.i );
+    PipelineSequence( &_r.p, MSG_REORDER_BUFLEN, MSGSEQ_OVF_GROW, MSG_REORDER_MAXLEN );
+    PipelineOnMsg( &_r.p, MSG_PC_SAMPLE, ( pipelineMsgCB )_handlePCSample );
+    PipelineOnMsg( &_r.p, MSG_EXCEPTION, ( pipelineMsgCB )_handleException );
+    PipelineOnMsg( &_r.p, MSG_TS, ( pipelineMsgCB )_handleTS );
+
+    if ( ( options.useTPIU ) && ( !PipelineUseTPIU( &_r.p, options.tpiuITMChannel, PIPELINE_NO_CHANNEL ) ) )
+    {
+        genericsExit( -1, "Can't set up TPIU decode" EOL );
+    }
 
     /* First interval will be from startup to first packet arriving */
     _r.lastReportmS = _timestamp();
     _r.currentException = NO_EXCEPTION;
+    _r.cur = &_r.iv[0];
 
     /* Open file for JSON output if we have one */
     if ( options.json )
@@ -1147,6 +1942,43 @@ int main( int argc, char *argv[] )
         }
     }
 
+    /* ...and likewise for binary output */
+    if ( options.binary )
+    {
+        if ( options.binary[0] == '-' )
+        {
+            _r.binaryfile = stdout;
+        }
+        else
+        {
+            _r.binaryfile = fopen( options.binary, "wb" );
+
+            if ( !_r.binaryfile )
+            {
+                perror( "Couldn't open binary output file" );
+                return -ENOENT;
+            }
+        }
+    }
+
+    /* Symbols are loaded, and reloaded whenever the elf changes, without holding up the decode */
+    _r.reload = SymbolReloadStart( options.elffile, options.deleteMaterial, options.demangle, false, false );
+
+    /* Reporting is done on its own thread, so sorting and output never hold up the decode */
+    pthread_mutex_init( &_r.reportLock, NULL );
+    pthread_cond_init( &_r.reportCond, NULL );
+
+    if ( pthread_create( &_r.reportThread, NULL, &_reportThread, NULL ) )
+    {
+        genericsExit( -1, "Failed to create report thread" EOL );
+    }
+
+    /* A file is opened once, then replayed from the start (or where asked) each time we reach its end */
+    if ( ( options.file ) && ( !FileSourceOpen( &fs, options.file ) ) )
+    {
+        genericsExit( -4, "Can't open file %s" EOL, options.file );
+    }
+
     while ( 1 )
     {
         if ( !options.file )
@@ -1188,7 +2020,7 @@ int main( int argc, char *argv[] )
 
             if ( connect( sourcefd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
             {
-                if ( ( !options.json ) || ( options.json[0] != '-' ) )
+                if ( _screenIsText() )
                 {
                     fprintf( stdout, CLEAR_SCREEN EOL );
                 }
@@ -1198,22 +2030,43 @@ int main( int argc, char *argv[] )
                 usleep( 1000000 );
                 continue;
             }
+
+            /* Filtering is done on ITM, so it can't be asked for when the TPIU is being decoded here */
+            if ( ( options.subscribe ) && ( !options.useTPIU ) )
+            {
+                uint8_t sub[NW_SUBSCRIBE_LEN];
+
+                if ( write( sourcefd, sub, nwSubscribeBuild( sub, 0, ( 1 << MSG_PC_SAMPLE ) | ( 1 << MSG_EXCEPTION ) | ( 1 << MSG_TS ) ) ) < 0 )
+                {
+                    genericsReport( V_WARN, "Failed to subscribe" EOL );
+                }
+            }
+
+            if ( !NWStreamInit( &ns, sourcefd, options.compress ) )
+            {
+                genericsReport( V_WARN, "Failed to ask for compression" EOL );
+                close( sourcefd );
+                usleep( 1000000 );
+                continue;
+            }
         }
         else
         {
-            if ( ( sourcefd = open( options.file, O_RDONLY ) ) < 0 )
+            FileSourceRewind( &fs );
+
+            if ( ( options.startAt ) && ( !FileSourceSeek( &fs, options.startAt ) ) )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, options.file );
+                genericsExit( -4, "Can't start %s from %s" EOL, options.file, options.startAt );
             }
-
         }
 
-        if ( ( !options.json ) || ( options.json[0] != '-' ) )
+        if ( _screenIsText() )
         {
             fprintf( stdout, CLEAR_SCREEN "Connected..." EOL );
         }
 
         /* ...just in case we have any readings from a previous incantation */
+        _waitReport();
         _flushHash( );
 
         lastTime = _timestamp();
@@ -1223,7 +2076,23 @@ int main( int argc, char *argv[] )
             remainTime = ( ( lastTime + options.displayInterval - _timestamp() ) * 1000 ) - 500;
             r = t = 0;
 
-            if ( remainTime > 0 )
+            if ( ( remainTime > 0 ) && ( options.file ) )
+            {
+                /* A file is always ready, so take the next piece straight out of the mapping */
+                if ( ( t = FileSourceGet( &fs, &data, TRANSFER_SIZE ) ) <= 0 )
+                {
+                    /* We are at EOF */
+                    break;
+                }
+
+                r = 1;
+            }
+            else if ( ( remainTime > 0 ) && ( NWStreamPending( &ns ) ) )
+            {
+                /* There's data held that the socket won't say is there */
+                r = 1;
+            }
+            else if ( remainTime > 0 )
             {
                 tv.tv_sec = remainTime / 1000000;
                 tv.tv_usec  = remainTime % 1000000;
@@ -1239,9 +2108,9 @@ int main( int argc, char *argv[] )
                 break;
             }
 
-            if ( r > 0 )
+            if ( ( r > 0 ) && ( !options.file ) )
             {
-                t = read( sourcefd, cbw, TRANSFER_SIZE );
+                t = NWStreamRead( &ns, cbw, TRANSFER_SIZE );
 
                 if ( t <= 0 )
                 {
@@ -1250,79 +2119,62 @@ int main( int argc, char *argv[] )
                 }
             }
 
-            if ( !SymbolSetValid( &_r.s, options.elffile ) )
+            /* A file can't be held off, so its samples would be lost if it went on before the first symbols arrived */
+            if ( ( !_r.s ) && ( options.file ) )
+            {
+                SymbolReloadWait( _r.reload, SYMBOL_WAIT_MS );
+            }
+
+            /* New symbols are loaded in the background, and only swapped in while the report isn't using them */
+            if ( ( _reportIdle() ) && ( SymbolReloadGeneration( _r.reload ) != ( _r.s ? _r.s->generation : 0 ) ) )
             {
-                /* Make sure old references are invalidated */
-                _flushHash();
+                uint32_t layout = _r.s ? _r.s->layout : 0;
+
+                SymbolReloadExit( _r.reload, 0 );
+                _r.s = SymbolReloadEnter( _r.reload, 0 );
 
-                if ( !( _r.s = SymbolSetCreate( options.elffile, options.deleteMaterial, options.demangle, false, false ) ) )
+                /* With the same files and functions the groups still stand, and only the lines can have moved */
+                if ( ( layout == _r.s->layout ) && ( !options.lineDisaggregation ) )
                 {
-                    genericsReport( V_ERROR, "Could not read symbols" EOL );
-                    usleep( 1000000 );
-                    break;
+                    _refreshNames();
                 }
                 else
                 {
-                    genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+                    /* Make sure old references are invalidated */
+                    _flushHash();
                 }
-            }
 
-            /* Pump all of the data through the protocol handler */
-            uint8_t *c = cbw;
+                genericsReport( V_WARN, "Loaded %s" EOL, options.elffile );
+            }
 
-            while ( t-- )
+            /* Pump all of the data through the protocol handler, once there are symbols to resolve it against */
+            if ( ( t > 0 ) && ( _r.s ) )
             {
-                _protocolPump( *c++ );
+                PipelinePump( &_r.p, data, t );
             }
 
             /* See if its time to post-process it */
             if ( r <= 0 )
             {
-                /* Create the report that we will output */
-                total = _consolodateReport( &report, &reportLines );
-
                 lastTime = _timestamp();
-
-                if ( options.json )
-                {
-                    _outputJson( _r.jsonfile, total, reportLines, report, lastTime );
-                }
-
-                if ( ( !options.json ) || ( options.json[0] != '-' ) )
-                {
-                    _outputTop( total, reportLines, report, lastTime );
-                }
-
-                /* ... and we are done with the report now, get rid of it */
-                free( report );
-
-                /* ...and zero the exception records */
-                for ( uint32_t e = 0; e < MAX_EXCEPTIONS; e++ )
-                {
-                    _r.er[e].visits = _r.er[e].maxDepth = _r.er[e].totalTime = _r.er[e].minTime = _r.er[e].maxTime = 0;
-                }
-
-                /* It's safe to update these here because the ticks won't be updated until more
-                 * records arrive. */
-                _r.ITMoverflows = ITMDecoderGetStats( &_r.i )->overflow;
-                _r.SWPkt = ITMDecoderGetStats( &_r.i )->SWPkt;
-                _r.TSPkt = ITMDecoderGetStats( &_r.i )->TSPkt;
-                _r.HWPkt = ITMDecoderGetStats( &_r.i )->HWPkt;
-                _r.lastReportmS = lastTime;
-                _r.lastReportTicks = _r.timeStamp;
+                _handOver( lastTime );
 
                 /* Check to make sure there's not an unexpected TPIU in here */
-                if ( ITMDecoderGetStats( &_r.i )->tpiuSyncCount )
+                if ( ITMDecoderGetStats( PipelineITM( &_r.p ) )->tpiuSyncCount )
                 {
                     genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
                 }
             }
         }
 
-        close( sourcefd );
+        if ( !options.file )
+        {
+            NWStreamClose( &ns );
+            close( sourcefd );
+        }
     }
 
-    if ( ( !ITMDecoderGetStats( &_r.i )->tpiuSyncCount ) )
+    if ( ( !ITMDecoderGetStats( PipelineITM( &_r.p ) )->tpiuSyncCount ) )
     {
         genericsReport( V_ERROR, "Read failed" EOL );
     }
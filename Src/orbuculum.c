@@ -6,6 +6,7 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
@@ -16,7 +17,10 @@
 #include <sys/stat.h>
 #include <strings.h>
 #include <string.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #if defined OSX
     #include <sys/ioctl.h>
     #include <libusb.h>
@@ -38,17 +42,24 @@
     #endif
 #endif
 #include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "git_version_info.h"
 #include "generics.h"
 #include "tpiuDecoder.h"
+#include "fileSource.h"
+#include "capture.h"
+#include "stageStats.h"
 
 #include "nwclient.h"
 
 #define SEGGER_HOST "localhost"               /* Address to connect to SEGGER */
 #define SEGGER_PORT (2332)
 
-#define NUM_TPIU_CHANNELS 0x80
+#define NUM_TPIU_CHANNELS TPIU_NUM_STREAMS
 
 /* Table of known devices to try opening */
 static const struct deviceList
@@ -69,12 +80,30 @@ static const struct deviceList
 
 //#define DUMP_BLOCK
 
-/* How many transfer buffers from the source to allocate */
-#define NUM_RAW_BLOCKS (3)
+/* How many buffers to allocate for data from a serial port or SEGGER, waiting for processing */
+#define NUM_RX_BLOCKS (32)
+
+/* Default number of USB transfers to keep in flight */
+#define DEFAULT_USB_TRANSFERS (3)
+
+/* Number of additional buffers available to hold USB data waiting for processing when decoupled */
+#define USB_QUEUED_BLOCKS (32)
 
 /* Interval between blocks for timeouts..smaller means smoother, but higher CPU load */
 #define BLOCK_TIMEOUT_INTERVAL_MS (50)
 
+/* Longest USB string descriptor to be read */
+#define MAX_USB_DESC_LEN (256)
+
+/* Most clients of each output listed in the statistics */
+#define MAX_STATS_CLIENTS (16)
+
+/* Interval between looks for probes that aren't connected */
+#define PROBE_SEARCH_INTERVAL_MS (500)
+
+#define REPLAY_TICK_US   (10000)                         /* Granularity of byte rate replay */
+#define REPLAY_MAX_SLEEP_US (100000)                     /* Longest sleep during replay, so ending isn't held up */
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
@@ -90,57 +119,135 @@ struct Options
     uint32_t dataSpeed;                                  /* Effective data speed (can be less than link speed!) */
     char *file;                                          /* File host connection */
     bool fileTerminate;                                  /* Terminate when file read isn't successful */
+    double replayRate;                                   /* Replay file input at this many bytes per second... */
+    double replaySpeed;                                  /* ...or at this multiple of the rate it was captured at */
     char *outfile;                                       /* Output file for raw data dumping */
+    char *capturefile;                                   /* Output file for indexed capture */
+    char *statsSocket;                                   /* Control socket to serve statistics on */
 
     uint32_t intervalReportTime;                         /* If we want interval reports about performance */
 
     char *channelList;                                   /* List of TPIU channels to be serviced */
+    char *serialList;                                    /* List of USB probe serial numbers to be serviced */
+
+    /* USB link */
+    bool usbDecouple;                                    /* Hand off USB data to a worker rather than processing in callback */
+    uint32_t usbTransfers;                               /* Number of USB transfers to keep in flight */
+    uint32_t usbTransferSize;                            /* Size of each USB transfer */
 
     /* Network link */
     int listenPort;                                      /* Listening port for network */
+    enum nwclientOverrunPolicy overrun;                  /* What to do with network clients that can't keep up */
+
+    /* Scheduling */
+    int rxCPU;                                           /* CPU to pin the receive thread to, -1 for any */
+    int workerCPU;                                       /* ...and the decode worker */
+    int rtPriority;                                      /* SCHED_FIFO priority for both, 0 to leave them alone */
+    bool lockMemory;                                     /* Lock everything into memory so it's never paged in */
 } _options =
 {
     .listenPort = NWCLIENT_SERVER_PORT,
+    .rxCPU = -1,
+    .workerCPU = -1,
     .seggerHost = SEGGER_HOST,
+    .usbTransfers = DEFAULT_USB_TRANSFERS,
+    .usbTransferSize = TRANSFER_SIZE
 };
 
+struct probe;
+
 struct dataBlock
 {
     ssize_t fillLevel;
     uint8_t buffer[TRANSFER_SIZE];
-    struct libusb_transfer *usbtfr;
+};
+
+/* A buffer used for received data, sized at runtime */
+struct rxBlock
+{
+    ssize_t fillLevel;
+    uint8_t *buffer;
+    struct probe *p;                                                         /* Probe this data came from */
+    uint64_t readyAt;                                                        /* When it was handed to the worker */
+};
+
+/* Lock free single producer, single consumer ring of received blocks */
+struct rxRing
+{
+    uint32_t wp;                                                             /* Only written by producer */
+    uint32_t rp;                                                             /* Only written by consumer */
+    uint32_t mask;                                                           /* Ring length - 1 (length is a power of two) */
+    struct rxBlock **e;                                                      /* The ring entries */
 };
 
 struct handlers
 {
     uint8_t channel;
+    int port;                                                                /* Network port this channel is served on */
     uint64_t intervalBytes;                                                  /* Number of depacketised bytes output on this channel */
     struct dataBlock *strippedBlock;                                         /* Processed buffer for output to clients */
+    struct TPIUSpan span;                                                    /* Decoder output span into strippedBlock */
     struct nwclientsHandle *n;                                               /* Link to the network client subsystem */
 };
 
-struct RunTime
+/* Everything belonging to one source of data. There's only more than one of these for several USB probes */
+struct probe
 {
+    char *serial;                                                            /* Serial number to match, or NULL for first found */
+
     struct TPIUDecoder t;                                                    /* TPIU decoder instance, in case we need it */
+    uint64_t intervalBytes;                                                  /* Number of bytes transferred in current interval */
+    uint64_t totalBytes;                                                     /* ...and in total */
 
-    uint64_t  intervalBytes;                                                 /* Number of bytes transferred in current interval */
+    uint8_t numHandlers;                                                     /* Number of TPIU channel handlers in use */
+    struct handlers *handler;
+    struct TPIUSpan *stream[NUM_TPIU_CHANNELS];                              /* Direct map from TPIU stream to handler output */
+    struct nwclientsHandle *n;                                               /* Link to the network client subsystem (used for non-TPIU case) */
+    int port;                                                                /* ...and the port it's served on */
+
+    struct stageStat usbStage;                                               /* USB transfer completion to resubmission */
+    struct stageStat stripStage;                                             /* TPIU stripping, by bytes stripped */
+    struct stageStat writeStage;                                             /* Writing to output and capture files */
+    struct stageStat wakeStage;                                              /* Idle worker being handed a block to it running */
+    struct stageStat lastUsb;                                                /* Stages as they were at the last interval report */
+    struct stageStat lastStrip;
+    struct stageStat lastWrite;
+    struct stageStat lastWake;
+    struct stageStat lastLock;
+    uint64_t lastDropped;
+
+    libusb_device_handle *handle;                                            /* The USB device, while it's open */
+    uint8_t iface;                                                           /* ...interface claimed on it */
+    uint8_t ep;                                                              /* ...and the endpoint data arrives on */
+    struct libusb_transfer **usbtfr;                                         /* USB transfers we keep in flight */
+    uint32_t inFlight;                                                       /* ...and how many are currently submitted */
+    uint64_t overruns;                                                       /* Count of blocks lost for lack of buffers */
+};
 
+struct RunTime
+{
     pthread_t intervalThread;                                                /* Thread reporting on intervals */
-    pthread_t processThread;                                                 /* Thread distributing to clients */
-    sem_t     dataForClients;                                                /* Semaphore counting data for clients */
     bool      ending;                                                        /* Flag indicating app is terminating */
     int f;                                                                   /* File handle to data source */
 
     int opFileHandle;                                                         /* Handle if we're writing orb output locally */
+    bool capturing;                                                          /* If we're writing an indexed capture */
+    struct captureWriter capture;                                            /* ...and what's writing it */
+    int statsfd;                                                             /* Control socket for statistics, if there is one */
+    pthread_t statsThread;                                                   /* ...and the thread serving it */
+    uint64_t startTime;                                                      /* When we started, for the statistics */
     struct Options *options;                                                 /* Command line options (reference to above) */
 
-    uint8_t wp;                                                              /* Read and write pointers into transfer buffers */
-    uint8_t rp;
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];                               /* Transfer buffers from the receiver */
+    struct probe *probe;                                                     /* The sources of data */
+    uint32_t numProbes;                                                      /* ...and how many of them there are */
 
-    uint8_t numHandlers;                                                     /* Number of TPIU channel handlers in use */
-    struct handlers *handler;
-    struct nwclientsHandle *n;                                               /* Link to the network client subsystem (used for non-TPIU case) */
+    struct rxBlock *rxBlocks;                                                /* Buffers for received data */
+    uint32_t rxBlockSize;                                                    /* ...the size of each of them */
+    struct rxRing rxFull;                                                    /* Blocks received, waiting to be processed */
+    struct rxRing rxFree;                                                    /* Blocks available to be received into */
+    sem_t rxDataReady;                                                       /* Semaphore counting blocks in rxFull */
+    pthread_t rxThread;                                                      /* Thread processing received data */
+    uint8_t discard[TRANSFER_SIZE];                                          /* Where data goes when there are no free blocks */
 } _r =
 {
     .options = &_options
@@ -252,7 +359,11 @@ static void _doExit( void )
 {
     _r.ending = true;
 
-    nwclientShutdown( _r.n );
+    for ( uint32_t i = 0; i < _r.numProbes; i++ )
+    {
+        nwclientShutdown( _r.probe[i].n );
+    }
+
     /* Give them a bit of time, then we're leaving anyway */
     usleep( 200 );
 
@@ -260,6 +371,19 @@ static void _doExit( void )
     {
         close( _r.opFileHandle );
     }
+
+    if ( _r.statsfd )
+    {
+        close( _r.statsfd );
+        unlink( _r.options->statsSocket );
+    }
+
+    if ( _r.capturing )
+    {
+        /* This writes the index trailer, without which the capture has to be searched the slow way */
+        _r.capturing = false;
+        CaptureWriterClose( &_r.capture );
+    }
 }
 // ====================================================================================================
 void _printHelp( char *progName )
@@ -267,16 +391,99 @@ void _printHelp( char *progName )
 {
     genericsPrintf( "Usage: %s [options]" EOL, progName );
     genericsPrintf( "       -a: <serialSpeed> to use" EOL );
+    genericsPrintf( "       -A: <CPU>[,<CPU>] Pin the receive thread, and the decode worker, to these CPUs" EOL );
+    genericsPrintf( "       -C: <path> Serve statistics, as JSON, on a control socket at <path>" EOL );
+    genericsPrintf( "       -D: Decouple USB reception from processing, using a worker thread" EOL );
     genericsPrintf( "       -e: When reading from file, terminate at end of file" EOL );
     genericsPrintf( "       -f: <filename> Take input from specified file" EOL );
     genericsPrintf( "       -h: This help" EOL );
+    genericsPrintf( "       -k: Disconnect network clients that can't keep up, rather than dropping data for them" EOL );
     genericsPrintf( "       -l: <port> Listen port for the incoming connections (defaults to %d)" EOL, NWCLIENT_SERVER_PORT );
+    genericsPrintf( "       -L: Lock all memory, so nothing waits on it being paged in" EOL );
     genericsPrintf( "       -m: <interval> Output monitor information about the link at <interval>ms" EOL );
+    genericsPrintf( "       -M: <Serial , ...> Use the USB probes with these serial numbers, each on its own set of ports" EOL );
     genericsPrintf( "       -o: <filename> to be used for dump file" EOL );
+    genericsPrintf( "       -O: <filename> to be used for indexed capture file, with timestamps" EOL );
     genericsPrintf( "       -p: <serialPort> to use" EOL );
+    genericsPrintf( "       -P: <priority> Run the receive thread and decode worker SCHED_FIFO at this priority" EOL );
+    genericsPrintf( "       -r: <rate>[k|M] Replay file input at rate bytes/sec, or x<factor> for a multiple of its captured timing" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
     genericsPrintf( "       -t: <Channel , ...> Use TPIU channels (and strip TIPU framing from output flows)" EOL );
+    genericsPrintf( "       -T: <Transfers> Number of USB transfers to keep in flight (defaults to %d)" EOL, DEFAULT_USB_TRANSFERS );
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "       -z: <Size> Size of each USB transfer in bytes (defaults to, and at most, %d)" EOL, TRANSFER_SIZE );
+}
+// ====================================================================================================
+static bool _parseReplay( const char *s, struct Options *o )
+
+/* Parse a replay rate, which is either bytes/sec with an optional k or M multiplier, or */
+/* x followed by the multiple of the original timing to replay at.                     */
+
+{
+    char *e;
+    double v;
+
+    if ( *s == 'x' )
+    {
+        o->replaySpeed = strtod( s + 1, &e );
+        return ( *e == 0 ) && ( o->replaySpeed > 0 );
+    }
+
+    v = strtod( s, &e );
+
+    switch ( *e )
+    {
+        case 'k':
+            v *= 1000;
+            e++;
+            break;
+
+        case 'M':
+            v *= 1000000;
+            e++;
+            break;
+
+        default:
+            break;
+    }
+
+    o->replayRate = v;
+    return ( *e == 0 ) && ( v > 0 );
+}
+// ====================================================================================================
+static bool _parseCPUs( const char *s, struct Options *o )
+
+/* Parse the CPUs for the receive thread and the decode worker, either of which can be left out */
+
+{
+    char *e;
+
+    if ( *s != ',' )
+    {
+        o->rxCPU = strtol( s, &e, 0 );
+
+        if ( ( e == s ) || ( o->rxCPU < 0 ) )
+        {
+            return false;
+        }
+
+        s = e;
+    }
+
+    if ( *s == ',' )
+    {
+        s++;
+        o->workerCPU = strtol( s, &e, 0 );
+
+        if ( ( e == s ) || ( o->workerCPU < 0 ) )
+        {
+            return false;
+        }
+
+        s = e;
+    }
+
+    return *s == 0;
 }
 // ====================================================================================================
 int _processOptions( int argc, char *argv[], struct RunTime *r )
@@ -285,7 +492,7 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
     int c;
 #define DELIMITER ','
 
-    while ( ( c = getopt ( argc, argv, "a:ef:hl:m:no:p:s:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "a:A:C:Def:hkl:Lm:M:no:O:p:P:r:s:t:T:v:z:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -294,6 +501,22 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->dataSpeed = r->options->speed;
                 break;
 
+            // ------------------------------------
+            case 'A':
+                if ( !_parseCPUs( optarg, r->options ) )
+                {
+                    genericsReport( V_ERROR, "CPUs must be <receive CPU>[,<worker CPU>]" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
+            case 'D':
+                r->options->usbDecouple = true;
+                break;
+
             // ------------------------------------
 
             case 'e':
@@ -312,16 +535,38 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'k':
+                r->options->overrun = NWCLIENT_OVERRUN_DISCONNECT;
+                break;
+
+            // ------------------------------------
+
             case 'l':
                 r->options->listenPort = atoi( optarg );
                 break;
 
             // ------------------------------------
 
+            case 'L':
+                r->options->lockMemory = true;
+                break;
+
+            // ------------------------------------
+
             case 'm':
                 r->options->intervalReportTime = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'C':
+                r->options->statsSocket = optarg;
+                break;
+
+            // ------------------------------------
+            case 'M':
+                r->options->serialList = optarg;
+                break;
+
             // ------------------------------------
 
             case 'o':
@@ -330,12 +575,35 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'O':
+                r->options->capturefile = optarg;
+                break;
+
+            // ------------------------------------
+
             case 'p':
                 r->options->port = optarg;
                 break;
 
             // ------------------------------------
 
+            case 'P':
+                r->options->rtPriority = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
+            case 'r':
+                if ( !_parseReplay( optarg, r->options ) )
+                {
+                    genericsReport( V_ERROR, "Replay rate must be <bytes/sec>[k|M] or x<factor>" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 's':
                 r->options->seggerHost = optarg;
 
@@ -366,11 +634,21 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->channelList = optarg;
                 break;
 
+            // ------------------------------------
+            case 'T':
+                r->options->usbTransfers = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'v':
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
 
+            // ------------------------------------
+            case 'z':
+                r->options->usbTransferSize = atoi( optarg );
+                break;
+
             // ------------------------------------
 
             case '?':
@@ -420,6 +698,16 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsReport( V_INFO, "Raw Output file: %s" EOL, r->options->outfile );
     }
 
+    if ( r->options->capturefile )
+    {
+        genericsReport( V_INFO, "Capture file   : %s" EOL, r->options->capturefile );
+    }
+
+    if ( r->options->statsSocket )
+    {
+        genericsReport( V_INFO, "Stats socket   : %s" EOL, r->options->statsSocket );
+    }
+
     if ( r->options->seggerPort )
     {
         genericsReport( V_INFO, "SEGGER H&P    : %s:%d" EOL, r->options->seggerHost, r->options->seggerPort );
@@ -448,6 +736,52 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
         }
     }
 
+    if ( r->options->replayRate )
+    {
+        genericsReport( V_INFO, "Replay rate    : %.0f bytes/sec" EOL, r->options->replayRate );
+    }
+
+    if ( r->options->replaySpeed )
+    {
+        genericsReport( V_INFO, "Replay rate    : x%g captured timing" EOL, r->options->replaySpeed );
+    }
+
+    if ( ( ( r->options->replayRate ) || ( r->options->replaySpeed ) ) && ( !r->options->file ) )
+    {
+        genericsReport( V_ERROR, "Replay is only possible from file" EOL );
+        return false;
+    }
+
+    if ( ( r->options->rxCPU >= 0 ) || ( r->options->workerCPU >= 0 ) )
+    {
+        genericsReport( V_INFO, "CPUs           : Receive %d, Worker %d (-1 for any)" EOL, r->options->rxCPU, r->options->workerCPU );
+    }
+
+    if ( r->options->rtPriority )
+    {
+        genericsReport( V_INFO, "Priority       : SCHED_FIFO %d" EOL, r->options->rtPriority );
+
+        if ( ( r->options->rtPriority < sched_get_priority_min( SCHED_FIFO ) ) || ( r->options->rtPriority > sched_get_priority_max( SCHED_FIFO ) ) )
+        {
+            genericsReport( V_ERROR, "SCHED_FIFO priority must be from %d to %d" EOL, sched_get_priority_min( SCHED_FIFO ), sched_get_priority_max( SCHED_FIFO ) );
+            return false;
+        }
+    }
+
+    if ( r->options->lockMemory )
+    {
+        genericsReport( V_INFO, "Lock Memory    : True" EOL );
+    }
+
+    genericsReport( V_INFO, "USB Transfers  : %d of %d bytes%s" EOL, r->options->usbTransfers, r->options->usbTransferSize,
+                    r->options->usbDecouple ? " (Decoupled)" : "" );
+
+    if ( ( !r->options->usbTransfers ) || ( !r->options->usbTransferSize ) || ( r->options->usbTransferSize > TRANSFER_SIZE ) )
+    {
+        genericsReport( V_ERROR, "Illegal USB transfer configuration" EOL );
+        return false;
+    }
+
     if ( ( r->options->file ) && ( ( r->options->port ) || ( r->options->seggerPort ) ) )
     {
         genericsReport( V_ERROR, "Cannot specify file and port or Segger at same time" EOL );
@@ -460,418 +794,1110 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
         return false;
     }
 
+    if ( r->options->serialList )
+    {
+        genericsReport( V_INFO, "USB Probes     : %s" EOL, r->options->serialList );
+
+        if ( ( r->options->file ) || ( r->options->port ) || ( r->options->seggerPort ) )
+        {
+            genericsReport( V_ERROR, "Probe serial numbers can only be used with USB" EOL );
+            return false;
+        }
+
+        /* There's only one output file, so can't mix several probes into it */
+        if ( ( strchr( r->options->serialList, DELIMITER ) ) && ( ( r->options->outfile ) || ( r->options->capturefile ) ) )
+        {
+            genericsReport( V_ERROR, "Cannot write output file with more than one probe" EOL );
+            return false;
+        }
+    }
+
     return true;
 }
 // ====================================================================================================
-void *_checkInterval( void *params )
+static void _probeNwStats( struct RunTime *r, struct probe *p, struct nwclientStats *s )
 
-/* Perform any interval reporting that may be needed */
+/* Combine the state of all of the network outputs of a probe */
 
 {
-    struct RunTime *r = ( struct RunTime * )params;
-    uint64_t snapInterval;
-    struct handlers *h;
+    struct nwclientStats o;
 
-    while ( !r->ending )
+    memset( s, 0, sizeof( struct nwclientStats ) );
+
+    for ( int i = 0; i < ( r->options->useTPIU ? p->numHandlers : 1 ); i++ )
     {
-        usleep( r->options->intervalReportTime * 1000 );
+        nwclientGetStats( r->options->useTPIU ? p->handler[i].n : p->n, &o, NULL, 0 );
+        s->clients += o.clients;
+        s->sent += o.sent;
+        s->dropped += o.dropped;
+        s->disconnects += o.disconnects;
+        s->maxDepth = ( o.maxDepth > s->maxDepth ) ? o.maxDepth : s->maxDepth;
+        StageAdd( &s->lockHold, &o.lockHold );
+    }
+}
+// ====================================================================================================
+static void _intervalStage( struct stageStat *d, const struct stageStat *s, struct stageStat *last )
 
-        /* Grab the interval and scale to 1 second */
-        snapInterval = r->intervalBytes * 1000 / r->options->intervalReportTime;
+/* Get what happened in a stage since the last interval report */
 
-        snapInterval *= 8;
-        genericsPrintf( C_PREV_LN C_CLR_LN C_DATA );
+{
+    struct stageStat now = *s;
 
-        if ( snapInterval / 1000000 )
-        {
-            genericsPrintf( "%4d.%d " C_RESET "MBits/sec ", snapInterval / 1000000, ( snapInterval * 1 / 100000 ) % 10 );
-        }
-        else if ( snapInterval / 1000 )
-        {
-            genericsPrintf( "%4d.%d " C_RESET "KBits/sec ", snapInterval / 1000, ( snapInterval / 100 ) % 10 );
-        }
-        else
-        {
-            genericsPrintf( "  %4d " C_RESET " Bits/sec ", snapInterval );
-        }
+    StageDelta( d, &now, last );
+    *last = now;
+}
+// ====================================================================================================
+static void _intervalStages( struct RunTime *r, struct probe *p )
 
-        h = r->handler;
-        uint64_t totalDat = 0;
+/* Report on the stages a probe's data went through during the interval. Times are 99th percentiles */
 
-        if ( ( r->intervalBytes ) && ( r->options->useTPIU ) )
-        {
-            for ( int chIndex = 0; chIndex < r->numHandlers; chIndex++ )
-            {
-                genericsPrintf( " %d:%3d%% ",  h->channel, ( h->intervalBytes * 100 ) / r->intervalBytes );
-                totalDat += h->intervalBytes;
-                /* TODO: This needs a mutex */
-                h->intervalBytes = 0;
+{
+    struct nwclientStats nw;
+    struct stageStat d;
 
-                h++;
-            }
+    _intervalStage( &d, &p->usbStage, &p->lastUsb );
 
-            genericsPrintf( " Waste:%3d%% ",  100 - ( ( totalDat * 100 ) / r->intervalBytes ) );
-        }
+    if ( d.count )
+    {
+        genericsPrintf( " USB:" C_DATA "%" PRIu64 C_RESET "us", StagePercentile( &d, 99 ) / 1000 );
+    }
 
-        r->intervalBytes = 0;
+    _intervalStage( &d, &p->stripStage, &p->lastStrip );
 
-        if ( r->options->dataSpeed > 100 )
-        {
-            /* Conversion to percentage done as a division to avoid overflow */
-            uint32_t fullPercent = ( snapInterval * 100 ) / r->options->dataSpeed;
-            genericsPrintf( "(" C_DATA " %3d%% " C_RESET "full)", ( fullPercent > 100 ) ? 100 : fullPercent );
-        }
+    if ( d.units )
+    {
+        genericsPrintf( " Strip:" C_DATA "%" PRIu64 ".%02" PRIu64 C_RESET "ns/B", d.totalNs / d.units, ( d.totalNs * 100 / d.units ) % 100 );
+    }
+
+    _intervalStage( &d, &p->writeStage, &p->lastWrite );
 
-        genericsPrintf( C_RESET EOL );
+    if ( d.count )
+    {
+        genericsPrintf( " Write:" C_DATA "%" PRIu64 C_RESET "us", StagePercentile( &d, 99 ) / 1000 );
     }
 
-    return NULL;
-}
-// ====================================================================================================
-static void _purgeBlock( struct RunTime *r )
+    _intervalStage( &d, &p->wakeStage, &p->lastWake );
 
-{
-    /* Now send any packets to clients who want it */
+    if ( d.count )
+    {
+        genericsPrintf( " Wake:" C_DATA "%" PRIu64 C_RESET "us", StagePercentile( &d, 99 ) / 1000 );
+    }
 
-    if ( r->options->useTPIU )
+    _probeNwStats( r, p, &nw );
+    _intervalStage( &d, &nw.lockHold, &p->lastLock );
+
+    if ( d.count )
     {
-        struct handlers *h = r->handler;
-        int i = r->numHandlers;
+        genericsPrintf( " Lock:" C_DATA "%" PRIu64 C_RESET "ns", StagePercentile( &d, 99 ) );
+    }
 
-        while ( i-- )
-        {
-            if ( h->strippedBlock->fillLevel )
-            {
-                nwclientSend( h->n, h->strippedBlock->fillLevel, h->strippedBlock->buffer );
-                h->intervalBytes += h->strippedBlock->fillLevel;
-                h->strippedBlock->fillLevel = 0;
-            }
+    if ( nw.clients )
+    {
+        genericsPrintf( " Queue:" C_DATA "%" PRIu32 C_RESET, nw.maxDepth );
+    }
 
-            h++;
-        }
+    if ( nw.dropped != p->lastDropped )
+    {
+        genericsPrintf( " Drops:" C_DATA "%" PRIu64 C_RESET, nw.dropped - p->lastDropped );
+        p->lastDropped = nw.dropped;
     }
 }
 // ====================================================================================================
-static void _stripTPIU( struct RunTime *r, uint8_t *c, int bytes )
+static void _statsStage( FILE *f, const char *name, const struct stageStat *s )
 
-{
-    struct TPIUPacket p;
+/* Write out a stage for the statistics */
 
-    struct handlers *h = NULL;
-    int cachedChannel;
-    int chIndex = 0;
+{
+    struct stageStat now = *s;
 
-    cachedChannel = -1;
+    fprintf( f, "\"%s\":{\"count\":%" PRIu64 ",\"totalNs\":%" PRIu64 ",\"maxNs\":%" PRIu64 ",\"units\":%" PRIu64
+             ",\"p50Ns\":%" PRIu64 ",\"p99Ns\":%" PRIu64 ",\"hist\":[", name, now.count, now.totalNs, now.maxNs, now.units,
+             now.count ? StagePercentile( &now, 50 ) : 0, now.count ? StagePercentile( &now, 99 ) : 0 );
 
-    while ( bytes-- )
+    for ( uint32_t i = 0; i < STAGE_BUCKETS; i++ )
     {
-        switch ( TPIUPump( &r->t, *c++ ) )
-        {
-            case TPIU_EV_RXEDPACKET:
-                if ( !TPIUGetPacket( &r->t, &p ) )
-                {
-                    genericsReport( V_WARN, "TPIUGetPacket fell over" EOL );
-                }
+        fprintf( f, "%s%" PRIu64, i ? "," : "", now.bucket[i] );
+    }
 
-                /* Iterate through the packet, putting it into the correct output buffers */
-                for ( uint32_t g = 0; g < p.len; g++ )
-                {
-                    if ( cachedChannel != p.packet[g].s )
-                    {
-                        /* Whatever happens, cache this result */
-                        cachedChannel = p.packet[g].s;
+    fprintf( f, "]}" );
+}
+// ====================================================================================================
+static void _statsOutput( FILE *f, struct nwclientsHandle *n, int channel, int port )
 
-                        /* Search for channel */
-                        h = r->handler;
+/* Write out the state of a network output and its clients for the statistics */
 
-                        for ( chIndex = 0; chIndex < r->numHandlers; chIndex++ )
-                        {
-                            if ( h->channel == p.packet[g].s )
-                            {
-                                break;
-                            }
+{
+    struct nwclientStats s;
+    struct nwclientClientStats c[MAX_STATS_CLIENTS];
+    uint32_t count = nwclientGetStats( n, &s, c, MAX_STATS_CLIENTS );
 
-                            h++;
-                        }
-                    }
+    fprintf( f, "{\"channel\":%d,\"port\":%d,\"clients\":%" PRIu32 ",\"sent\":%" PRIu64 ",\"dropped\":%" PRIu64
+             ",\"disconnects\":%" PRIu64 ",\"maxDepth\":%" PRIu32 ",", channel, port, s.clients, s.sent, s.dropped, s.disconnects, s.maxDepth );
+    _statsStage( f, "lockHold", &s.lockHold );
+    fprintf( f, ",\"clientList\":[" );
 
-                    if ( chIndex != r->numHandlers )
-                    {
-                        /* We must have found a match for this at some point, so add it to the queue */
-                        h->strippedBlock->buffer[h->strippedBlock->fillLevel++] = p.packet[g].d;
-                    }
-                }
+    for ( uint32_t i = 0; i < count; i++ )
+    {
+        fprintf( f, "%s{\"addr\":\"%s\",\"depth\":%" PRIu32 ",\"dropped\":%" PRIu64 ",\"subscribed\":%s,\"filtered\":%" PRIu64
+                 ",\"compressed\":%s,\"raw\":%" PRIu64 ",\"wire\":%" PRIu64 "}",
+                 i ? "," : "", c[i].addr, c[i].depth, c[i].dropped, c[i].subscribed ? "true" : "false", c[i].filteredBytes,
+                 c[i].compressed ? "true" : "false", c[i].rawBytes, c[i].wireBytes );
+    }
 
-                break;
+    fprintf( f, "]}" );
+}
+// ====================================================================================================
+static void _statsWrite( struct RunTime *r, FILE *f )
 
-            case TPIU_EV_ERROR:
-                genericsReport( V_WARN, "****ERROR****" EOL );
-                break;
+/* Write out all the statistics, as a single JSON object. Everything is cumulative from the start */
 
-            case TPIU_EV_NEWSYNC:
-            case TPIU_EV_SYNCED:
-            case TPIU_EV_RXING:
-            case TPIU_EV_NONE:
-            case TPIU_EV_UNSYNCED:
-            default:
-                break;
+{
+    struct probe *p;
+
+    fprintf( f, "{\"uptimeNs\":%" PRIu64 ",\"probes\":[", StageNow() - r->startTime );
+
+    for ( uint32_t i = 0; i < r->numProbes; i++ )
+    {
+        p = &r->probe[i];
+
+        fprintf( f, "%s{\"serial\":", i ? "," : "" );
+        fprintf( f, p->serial ? "\"%s\"" : "null", p->serial );
+        fprintf( f, ",\"connected\":%s,\"bytes\":%" PRIu64 ",\"overruns\":%" PRIu64 ",\"stages\":{",
+                 ( p->handle || r->options->file || r->options->port || r->options->seggerPort ) ? "true" : "false",
+                 p->totalBytes, p->overruns );
+        _statsStage( f, "usb", &p->usbStage );
+        fprintf( f, "," );
+        _statsStage( f, "strip", &p->stripStage );
+        fprintf( f, "," );
+        _statsStage( f, "write", &p->writeStage );
+        fprintf( f, "," );
+        _statsStage( f, "wake", &p->wakeStage );
+        fprintf( f, "},\"outputs\":[" );
+
+        if ( r->options->useTPIU )
+        {
+            for ( int h = 0; h < p->numHandlers; h++ )
+            {
+                fprintf( f, "%s", h ? "," : "" );
+                _statsOutput( f, p->handler[h].n, p->handler[h].channel, p->handler[h].port );
+            }
         }
+        else
+        {
+            _statsOutput( f, p->n, -1, p->port );
+        }
+
+        fprintf( f, "]}" );
     }
+
+    fprintf( f, "]}\n" );
 }
 // ====================================================================================================
-static void *_processBlocks( void *params )
-/* Generic block processor for received data */
+static void *_statsServer( void *params )
+
+/* Answer each connection to the control socket with the current statistics */
 
 {
     struct RunTime *r = ( struct RunTime * )params;
+    FILE *f;
+    int c;
 
     while ( !r->ending )
     {
-        sem_wait( &r->dataForClients );
-
-        if ( r->rp != r->wp )
+        if ( ( c = accept( r->statsfd, NULL, NULL ) ) < 0 )
         {
-            genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, r->rawBlock[r->rp].fillLevel );
-
-            if ( r->rawBlock[r->rp].fillLevel )
+            if ( errno == EINTR )
             {
-                /* Account for this reception */
-                r->intervalBytes += r->rawBlock[r->rp].fillLevel;
+                continue;
+            }
 
-#ifdef DUMP_BLOCK
-                uint8_t *c = r->rawBlock[r->rp].buffer;
-                uint32_t y = r->rawBlock[r->rp].fillLevel;
+            break;
+        }
+
+        if ( ( f = fdopen( c, "w" ) ) )
+        {
+            _statsWrite( r, f );
+            fclose( f );
+        }
+        else
+        {
+            close( c );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _statsStart( struct RunTime *r )
+
+/* Create the control socket, and the thread to serve it */
 
-                fprintf( stderr, EOL );
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
 
-                while ( y-- )
+    if ( strlen( r->options->statsSocket ) >= sizeof( addr.sun_path ) )
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    strcpy( addr.sun_path, r->options->statsSocket );
+
+    /* Anything left over from a previous run is in the way */
+    unlink( r->options->statsSocket );
+
+    if ( ( r->statsfd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        r->statsfd = 0;
+        return false;
+    }
+
+    if ( ( bind( r->statsfd, ( struct sockaddr * )&addr, sizeof( addr ) ) < 0 ) || ( listen( r->statsfd, 5 ) < 0 ) ||
+            ( pthread_create( &r->statsThread, NULL, &_statsServer, r ) ) )
+    {
+        close( r->statsfd );
+        r->statsfd = 0;
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+void *_checkInterval( void *params )
+
+/* Perform any interval reporting that may be needed */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+    uint64_t snapInterval;
+    struct handlers *h;
+    struct probe *p;
+
+    while ( !r->ending )
+    {
+        usleep( r->options->intervalReportTime * 1000 );
+
+        /* Each probe has a line of its own, so go back over all of them */
+        for ( uint32_t i = 0; i < r->numProbes; i++ )
+        {
+            genericsPrintf( C_PREV_LN );
+        }
+
+        for ( uint32_t i = 0; i < r->numProbes; i++ )
+        {
+            p = &r->probe[i];
+
+            /* Grab the interval and scale to 1 second */
+            snapInterval = p->intervalBytes * 1000 / r->options->intervalReportTime;
+
+            snapInterval *= 8;
+            genericsPrintf( C_CLR_LN );
+
+            if ( p->serial )
+            {
+                genericsPrintf( "%s: ", p->serial );
+            }
+
+            genericsPrintf( C_DATA );
+
+            if ( snapInterval / 1000000 )
+            {
+                genericsPrintf( "%4d.%d " C_RESET "MBits/sec ", snapInterval / 1000000, ( snapInterval * 1 / 100000 ) % 10 );
+            }
+            else if ( snapInterval / 1000 )
+            {
+                genericsPrintf( "%4d.%d " C_RESET "KBits/sec ", snapInterval / 1000, ( snapInterval / 100 ) % 10 );
+            }
+            else
+            {
+                genericsPrintf( "  %4d " C_RESET " Bits/sec ", snapInterval );
+            }
+
+            h = p->handler;
+            uint64_t totalDat = 0;
+
+            if ( ( p->intervalBytes ) && ( r->options->useTPIU ) )
+            {
+                for ( int chIndex = 0; chIndex < p->numHandlers; chIndex++ )
                 {
-                    fprintf( stderr, "%02X ", *c++ );
+                    genericsPrintf( " %d:%3d%% ",  h->channel, ( h->intervalBytes * 100 ) / p->intervalBytes );
+                    totalDat += h->intervalBytes;
+                    /* TODO: This needs a mutex */
+                    h->intervalBytes = 0;
+
+                    h++;
+                }
+
+                genericsPrintf( " Waste:%3d%% ",  100 - ( ( totalDat * 100 ) / p->intervalBytes ) );
+            }
+
+            p->intervalBytes = 0;
+
+            if ( p->overruns )
+            {
+                genericsPrintf( " Overruns:%" PRIu64 " ", p->overruns );
+            }
+
+            _intervalStages( r, p );
+
+            if ( r->options->dataSpeed > 100 )
+            {
+                /* Conversion to percentage done as a division to avoid overflow */
+                uint32_t fullPercent = ( snapInterval * 100 ) / r->options->dataSpeed;
+                genericsPrintf( "(" C_DATA " %3d%% " C_RESET "full)", ( fullPercent > 100 ) ? 100 : fullPercent );
+            }
+
+            genericsPrintf( C_RESET EOL );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _purgeBlock( struct RunTime *r, struct probe *p )
+
+{
+    /* Now send any packets to clients who want it */
+
+    if ( r->options->useTPIU )
+    {
+        struct handlers *h = p->handler;
+        int i = p->numHandlers;
+
+        while ( i-- )
+        {
+            if ( h->span.fill )
+            {
+                nwclientSend( h->n, h->span.fill, h->span.buffer );
+                h->intervalBytes += h->span.fill;
+                h->span.fill = 0;
+            }
+
+            h++;
+        }
+    }
+}
+// ====================================================================================================
+static void _buildStreamTable( struct probe *p )
+
+/* Create the direct map from TPIU stream to the output of the handler for it */
+
+{
+    struct handlers *h = p->handler;
+
+    memset( p->stream, 0, sizeof( p->stream ) );
+
+    for ( int i = 0; i < p->numHandlers; i++ )
+    {
+        h->span.buffer = h->strippedBlock->buffer;
+        h->span.len = TRANSFER_SIZE;
+        h->span.fill = 0;
+        p->stream[h->channel] = &h->span;
+        h++;
+    }
+}
+// ====================================================================================================
+static void _stripTPIU( struct probe *p, const uint8_t *c, int bytes )
+
+/* Remove TPIU framing, with runs of data for each stream copied directly into the output for its handler */
+
+{
+    TPIUDecodeBlock( &p->t, c, bytes, p->stream );
+}
+// ====================================================================================================
+static void _processData( struct RunTime *r, struct probe *p, const uint8_t *buffer, ssize_t len )
+
+/* Account for, record and distribute a block of received data from a probe */
+
+{
+    uint64_t start;
+
+    /* Account for this reception */
+    p->intervalBytes += len;
+    p->totalBytes += len;
+
+    if ( ( r->opFileHandle ) || ( r->capturing ) )
+    {
+        start = StageNow();
+
+        if ( r->opFileHandle )
+        {
+            if ( write( r->opFileHandle, buffer, len ) < 0 )
+            {
+                genericsExit( -4, "Writing to file failed (%s)" EOL, strerror( errno ) );
+            }
+        }
+
+        if ( r->capturing )
+        {
+            /* The TPIU state recorded is the one at the start of this data, since it's not been decoded yet */
+            if ( !CaptureWrite( &r->capture, buffer, len, ( r->options->useTPIU ) && ( p->t.state == TPIU_RXING ) ) )
+            {
+                genericsExit( -4, "Writing to capture file failed (%s)" EOL, strerror( errno ) );
+            }
+        }
+
+        StageRecord( &p->writeStage, start, len );
+    }
+
+    if ( r->options->useTPIU )
+    {
+        /* Strip the TPIU framing from this input */
+        start = StageNow();
+        _stripTPIU( p, buffer, len );
+        StageRecord( &p->stripStage, start, len );
+        _purgeBlock( r, p );
+    }
+    else
+    {
+        /* Do it the old fashioned way and send out the unfettered block */
+        nwclientSend( p->n, len, buffer );
+    }
+}
+// ====================================================================================================
+static void _rxRingInit( struct rxRing *q, uint32_t entries )
+
+/* Create a ring capable of holding at least the specified number of entries */
+
+{
+    uint32_t len = 1;
+
+    while ( len <= entries )
+    {
+        len <<= 1;
+    }
+
+    q->wp = q->rp = 0;
+    q->mask = len - 1;
+    q->e = ( struct rxBlock ** )calloc( len, sizeof( struct rxBlock * ) );
+}
+// ====================================================================================================
+static void _rxRingPut( struct rxRing *q, struct rxBlock *b )
+
+/* Add block to the ring. Can never fail since a ring is larger than the number of blocks in existence */
+
+{
+    uint32_t wp = __atomic_load_n( &q->wp, __ATOMIC_RELAXED );
+
+    q->e[wp & q->mask] = b;
+    __atomic_store_n( &q->wp, wp + 1, __ATOMIC_RELEASE );
+}
+// ====================================================================================================
+static struct rxBlock *_rxRingGet( struct rxRing *q )
+
+/* Take block from the ring, or NULL if there isn't one */
+
+{
+    struct rxBlock *b;
+    uint32_t rp = __atomic_load_n( &q->rp, __ATOMIC_RELAXED );
+
+    if ( rp == __atomic_load_n( &q->wp, __ATOMIC_ACQUIRE ) )
+    {
+        return NULL;
+    }
+
+    b = q->e[rp & q->mask];
+    __atomic_store_n( &q->rp, rp + 1, __ATOMIC_RELEASE );
+    return b;
+}
+// ====================================================================================================
+static void *_rxProcess( void *params )
+
+/* Worker processing blocks handed off by the receiver, whichever sort of source it is */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+    struct rxBlock *b;
+    bool idle;
+
+    while ( !r->ending )
+    {
+        /* Only a wait that had to sleep says anything about how quickly this thread gets to run */
+        if ( ( idle = ( sem_trywait( &r->rxDataReady ) != 0 ) ) )
+        {
+            sem_wait( &r->rxDataReady );
+        }
+
+        while ( ( b = _rxRingGet( &r->rxFull ) ) )
+        {
+            if ( idle )
+            {
+                StageRecord( &b->p->wakeStage, b->readyAt, 0 );
+                idle = false;
+            }
+
+            genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, b->fillLevel );
+#ifdef DUMP_BLOCK
+            uint8_t *c = b->buffer;
+            uint32_t y = b->fillLevel;
+
+            fprintf( stderr, EOL );
+
+            while ( y-- )
+            {
+                fprintf( stderr, "%02X ", *c++ );
+
+                if ( !( y % 16 ) )
+                {
+                    fprintf( stderr, EOL );
+                }
+            }
+
+#endif
+            _processData( r, b->p, b->buffer, b->fillLevel );
+            _rxRingPut( &r->rxFree, b );
+        }
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static void _schedule( pthread_t t, int cpu, int priority, const char *what )
+
+/* Pin a thread to a CPU and make it real time, as far as each is asked for. Neither is fatal if it */
+/* can't be done (usually for want of privileges), since capture still works, only less reliably.  */
+
+{
+    struct sched_param sp = { .sched_priority = priority };
+    int e;
+
+    if ( cpu >= 0 )
+    {
+#if defined LINUX
+        cpu_set_t s;
+
+        CPU_ZERO( &s );
+        e = EINVAL;
+
+        if ( cpu < CPU_SETSIZE )
+        {
+            CPU_SET( cpu, &s );
+            e = pthread_setaffinity_np( t, sizeof( s ), &s );
+        }
+
+        if ( e )
+        {
+            genericsReport( V_WARN, "Couldn't pin %s to CPU %d (%s)" EOL, what, cpu, strerror( e ) );
+        }
+
+#else
+        genericsReport( V_WARN, "Can't pin %s to a CPU on this platform" EOL, what );
+#endif
+    }
+
+    if ( ( priority ) && ( ( e = pthread_setschedparam( t, SCHED_FIFO, &sp ) ) ) )
+    {
+        genericsReport( V_WARN, "Couldn't make %s SCHED_FIFO (%s)" EOL, what, strerror( e ) );
+    }
+}
+// ====================================================================================================
+static void _realtimeSetup( struct RunTime *r )
+
+/* Lock memory and set up the receive thread. This is done last, once the buffers are allocated and */
+/* the other threads are created, so that none of them take the receive thread's settings on.       */
+
+{
+    if ( ( r->options->lockMemory ) && ( mlockall( MCL_CURRENT | MCL_FUTURE ) ) )
+    {
+        genericsReport( V_WARN, "Couldn't lock memory (%s)" EOL, strerror( errno ) );
+    }
+
+    _schedule( pthread_self(), r->options->rxCPU, r->options->rtPriority, "receive thread" );
+}
+// ====================================================================================================
+static bool _rxSetup( struct RunTime *r, uint32_t numBlocks, uint32_t reserved, uint32_t size, bool worker )
+
+/* Create the pool of blocks for received data. The first reserved ones are kept back by the caller, */
+/* and if there's a worker to process them the rest are made available for receiving into.          */
+
+{
+    r->rxBlockSize = size;
+
+    if ( !( r->rxBlocks = ( struct rxBlock * )calloc( numBlocks, sizeof( struct rxBlock ) ) ) )
+    {
+        return false;
+    }
+
+    for ( uint32_t b = 0; b < numBlocks; b++ )
+    {
+        if ( !( r->rxBlocks[b].buffer = ( uint8_t * )malloc( size ) ) )
+        {
+            return false;
+        }
+    }
+
+    if ( worker )
+    {
+        _rxRingInit( &r->rxFull, numBlocks );
+        _rxRingInit( &r->rxFree, numBlocks );
+        sem_init( &r->rxDataReady, 0, 0 );
+
+        for ( uint32_t b = reserved; b < numBlocks; b++ )
+        {
+            _rxRingPut( &r->rxFree, &r->rxBlocks[b] );
+        }
+
+        if ( pthread_create( &r->rxThread, NULL, &_rxProcess, r ) )
+        {
+            return false;
+        }
+
+        _schedule( r->rxThread, r->options->workerCPU, r->options->rtPriority, "decode worker" );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _rxHandOver( struct RunTime *r, struct rxBlock **b )
+
+/* Pass a block on to the worker, if anything has been received into it */
+
+{
+    if ( ( *b ) && ( ( *b )->fillLevel ) )
+    {
+        ( *b )->readyAt = StageNow();
+        _rxRingPut( &r->rxFull, *b );
+        sem_post( &r->rxDataReady );
+        *b = NULL;
+    }
+}
+// ====================================================================================================
+static bool _rxFeed( struct RunTime *r, int fd )
+
+/* Receive from a serial port or socket until the connection fails or we're ending. Everything that's  */
+/* waiting is read in one go into a block, which is then handed over, so there's no waiting on the    */
+/* worker. If it can't keep up and there's no free block then the data are read anyway, and counted. */
+/* Returns true if the connection was lost, rather than us ending.                                    */
+
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    struct probe *p = &r->probe[0];
+    struct rxBlock *b = NULL;
+    ssize_t t;
+
+    if ( fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to make source non-blocking (%s)" EOL, strerror( errno ) );
+        return true;
+    }
+
+    while ( !r->ending )
+    {
+        if ( ( poll( &pfd, 1, BLOCK_TIMEOUT_INTERVAL_MS ) < 0 ) && ( errno != EINTR ) )
+        {
+            break;
+        }
+
+        if ( !pfd.revents )
+        {
+            continue;
+        }
+
+        do
+        {
+            if ( ( !b ) && ( ( b = _rxRingGet( &r->rxFree ) ) ) )
+            {
+                b->fillLevel = 0;
+                b->p = p;
+            }
+
+            if ( b )
+            {
+                if ( ( t = read( fd, &b->buffer[b->fillLevel], r->rxBlockSize - b->fillLevel ) ) > 0 )
+                {
+                    b->fillLevel += t;
+
+                    if ( b->fillLevel == r->rxBlockSize )
+                    {
+                        _rxHandOver( r, &b );
+                    }
+                }
+            }
+            else
+            {
+                /* Worker is too far behind to give us a fresh buffer, so this data is lost */
+                if ( ( t = read( fd, r->discard, sizeof( r->discard ) ) ) > 0 )
+                {
+                    p->overruns++;
+                }
+            }
+        }
+        while ( t > 0 );
+
+        /* That's everything that was waiting, so pass it on */
+        _rxHandOver( r, &b );
+
+        if ( ( !t ) || ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) ) )
+        {
+            break;
+        }
+    }
+
+    /* A block that was taken but never received into goes back for next time */
+    if ( b )
+    {
+        _rxRingPut( &r->rxFree, b );
+    }
+
+    return !r->ending;
+}
+// ====================================================================================================
+static void _usb_callback( struct libusb_transfer *t )
+
+/* In the direct case packets are processed straight from this callback, otherwise they're handed to _rxProcess */
+
+{
+    struct rxBlock *b = ( struct rxBlock * )t->user_data;
+    struct probe *p = b->p;
+    struct rxBlock *n;
+    uint64_t start = StageNow();
+    int len = t->actual_length;
+
+    /* Whatever the status that comes back, there may be data... */
+    if ( t->actual_length > 0 )
+    {
+        if ( !_r.options->usbDecouple )
+        {
+            _processData( &_r, p, t->buffer, t->actual_length );
+        }
+        else
+        {
+            if ( !( n = _rxRingGet( &_r.rxFree ) ) )
+            {
+                /* Worker is too far behind to give us a fresh buffer, so this data is lost */
+                p->overruns++;
+            }
+            else
+            {
+                b->fillLevel = t->actual_length;
+                b->readyAt = start;
+                _rxRingPut( &_r.rxFull, b );
+                sem_post( &_r.rxDataReady );
+
+                n->p = p;
+                t->buffer = n->buffer;
+                t->user_data = n;
+            }
+        }
+    }
+
+    /* Once all of a probe's transfers have stopped coming back it can be closed, and looked for again */
+    if ( ( t->status == LIBUSB_TRANSFER_NO_DEVICE ) || ( libusb_submit_transfer( t ) ) )
+    {
+        p->inFlight--;
+    }
+    else
+    {
+        StageRecord( &p->usbStage, start, len );
+    }
+}
+// ====================================================================================================
+static bool _usbSetup( struct RunTime *r )
+
+/* Create the transfers and buffers for USB, and the worker if we're decoupled. The buffers are */
+/* a single pool shared by all of the probes, as is the worker.                                 */
+
+{
+    uint32_t numTransfers = r->options->usbTransfers * r->numProbes;
+    uint32_t numBlocks = numTransfers + ( r->options->usbDecouple ? USB_QUEUED_BLOCKS * r->numProbes : 0 );
+    struct probe *p;
+
+    /* The first blocks start off attached to transfers, and the rest are available for swapping in */
+    if ( !_rxSetup( r, numBlocks, numTransfers, r->options->usbTransferSize, r->options->usbDecouple ) )
+    {
+        return false;
+    }
 
-                    if ( !( y % 16 ) )
-                    {
-                        fprintf( stderr, EOL );
-                    }
-                }
+    for ( uint32_t i = 0; i < r->numProbes; i++ )
+    {
+        p = &r->probe[i];
 
-#endif
+        if ( !( p->usbtfr = ( struct libusb_transfer ** )calloc( r->options->usbTransfers, sizeof( struct libusb_transfer * ) ) ) )
+        {
+            return false;
+        }
 
-                if ( _r.opFileHandle )
-                {
-                    if ( write( _r.opFileHandle, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel ) < 0 )
-                    {
-                        genericsExit( -3, "Writing to file failed" EOL );
-                    }
-                }
+        for ( uint32_t t = 0; t < r->options->usbTransfers; t++ )
+        {
+            struct rxBlock *b = &r->rxBlocks[i * r->options->usbTransfers + t];
 
-                if ( r-> options->useTPIU )
-                {
-                    /* Strip the TPIU framing from this input */
-                    _stripTPIU( r, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel );
-                    _purgeBlock( r );
-                }
-                else
-                {
-                    /* Do it the old fashioned way and send out the unfettered block */
-                    nwclientSend( _r.n, r->rawBlock[r->rp].fillLevel, r->rawBlock[r->rp].buffer );
-                }
+            if ( !( p->usbtfr[t] = libusb_alloc_transfer( 0 ) ) )
+            {
+                return false;
             }
 
-            r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+            b->p = p;
+            p->usbtfr[t]->buffer = b->buffer;
+            p->usbtfr[t]->user_data = b;
         }
     }
 
-    return NULL;
+    return true;
 }
+// ====================================================================================================
+static bool _usbClaimed( struct RunTime *r, libusb_device *dev )
 
+/* Check if a device is already open for one of the probes */
+
+{
+    for ( uint32_t i = 0; i < r->numProbes; i++ )
+    {
+        if ( ( r->probe[i].handle ) && ( libusb_get_device( r->probe[i].handle ) == dev ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
 // ====================================================================================================
-static void _usb_callback( struct libusb_transfer *t )
+static libusb_device_handle *_usbFind( struct RunTime *r, struct probe *p, const struct deviceList **type )
 
-/* For the USB case the ringbuffer isn't used .. packets are sent directly from this callback */
+/* Find and open the device for this probe, in the priority order of the device list. A probe without */
+/* a serial number takes the first one found, otherwise the serial number must contain the one given. */
 
 {
-    /* Whatever the status that comes back, there may be data... */
-    if ( t->actual_length > 0 )
+    libusb_device_handle *handle = NULL;
+    libusb_device **list;
+    struct libusb_device_descriptor desc;
+    unsigned char serial[MAX_USB_DESC_LEN];
+    ssize_t count;
+
+    if ( ( count = libusb_get_device_list( NULL, &list ) ) < 0 )
+    {
+        return NULL;
+    }
+
+    for ( *type = _deviceList; ( *type )->vid; ( *type )++ )
     {
-        _r.intervalBytes += t->actual_length;
+        genericsReport( V_DEBUG, "Looking for %s (%04x:%04x)%s%s" EOL, ( *type )->name, ( *type )->vid, ( *type )->pid,
+                        p->serial ? " serial " : "", p->serial ? p->serial : "" );
 
-        if ( _r.opFileHandle )
+        for ( ssize_t i = 0; ( i < count ) && ( !handle ); i++ )
         {
-            if ( write( _r.opFileHandle, t->buffer, t->actual_length ) < 0 )
+            if ( ( libusb_get_device_descriptor( list[i], &desc ) < 0 ) ||
+                    ( desc.idVendor != ( *type )->vid ) || ( desc.idProduct != ( *type )->pid ) ||
+                    ( _usbClaimed( r, list[i] ) ) || ( libusb_open( list[i], &handle ) < 0 ) )
             {
-                genericsExit( -4, "Writing to file failed (%s)" EOL, strerror( errno ) );
+                handle = NULL;
+                continue;
             }
-        }
 
+            if ( p->serial )
+            {
+                serial[0] = 0;
 
-        if ( _r.options->useTPIU )
-        {
-            /* Strip the TPIU framing from this input */
-            _stripTPIU( &_r, t->buffer, t->actual_length );
-            _purgeBlock( &_r );
+                if ( desc.iSerialNumber )
+                {
+                    libusb_get_string_descriptor_ascii( handle, desc.iSerialNumber, serial, MAX_USB_DESC_LEN );
+                }
+
+                if ( !strstr( ( char * )serial, p->serial ) )
+                {
+                    libusb_close( handle );
+                    handle = NULL;
+                }
+            }
         }
-        else
+
+        if ( handle )
         {
-            /* Do it the old fashioned way and send out the unfettered block */
-            nwclientSend( _r.n, t->actual_length, t->buffer );
+            break;
         }
     }
 
-    libusb_submit_transfer( t );
+    libusb_free_device_list( list, 1 );
+    return handle;
 }
 // ====================================================================================================
-int usbFeeder( struct RunTime *r )
+static bool _usbOpen( struct RunTime *r, struct probe *p )
+
+/* Find the device for a probe, then claim its trace interface and get the transfers going */
 
 {
-    libusb_device_handle *handle = NULL;
+    const struct deviceList *type;
     libusb_device *dev;
-    const struct deviceList *p;
-    uint8_t iface;
-    uint8_t ep;
     uint8_t altsetting = 0;
     uint8_t num_altsetting = 0;
     int32_t err;
 
-    while ( !r->ending )
+    if ( !( p->handle = _usbFind( r, p, &type ) ) )
+    {
+        return false;
+    }
+
+    genericsReport( V_INFO, "Found %s%s%s" EOL, type->name, p->serial ? " " : "", p->serial ? p->serial : "" );
+
+    if ( !( dev = libusb_get_device( p->handle ) ) )
+    {
+        /* We didn't get the device, so try again in a while */
+        goto fail;
+    }
+
+    p->iface = type->iface;
+    p->ep = type->ep;
+
+    if ( type->autodiscover )
     {
-        if ( libusb_init( NULL ) < 0 )
+        genericsReport( V_DEBUG, "Searching for trace interface" EOL );
+
+        struct libusb_config_descriptor *config;
+
+        if ( ( err = libusb_get_active_config_descriptor( dev, &config ) ) < 0 )
         {
-            genericsReport( V_ERROR, "Failed to initalise USB interface" EOL );
-            return ( -1 );
+            genericsReport( V_WARN, "Failed to get config descriptor (%d)" EOL, err );
+            goto fail;
         }
 
-        /* Snooze waiting for the device to appear .... this is useful for when they come and go */
-        while ( 1 )
-        {
-            p = _deviceList;
+        bool interface_found = false;
 
-            while ( p->vid != 0 )
+        for ( int if_num = 0; if_num < config->bNumInterfaces && !interface_found; if_num++ )
+        {
+            for ( int alt_num = 0; alt_num < config->interface[if_num].num_altsetting && !interface_found; alt_num++ )
             {
-                genericsReport( V_DEBUG, "Looking for %s (%04x:%04x)" EOL, p->name, p->vid, p->pid );
+                const struct libusb_interface_descriptor *i = &config->interface[if_num].altsetting[alt_num];
 
-                if ( ( handle = libusb_open_device_with_vid_pid( NULL, p->vid, p->pid ) ) )
+                if (
+                            i->bInterfaceClass != 0xff ||
+                            i->bInterfaceSubClass != 0x54 ||
+                            ( i->bInterfaceProtocol != 0x00 && i->bInterfaceProtocol != 0x01 ) ||
+                            i->bNumEndpoints != 0x01 )
                 {
-                    break;
+                    continue;
                 }
 
-                p++;
-            }
+                p->iface = i->bInterfaceNumber;
+                altsetting = i->bAlternateSetting;
+                num_altsetting = config->interface[if_num].num_altsetting;
+                p->ep = i->endpoint[0].bEndpointAddress;
 
-            if ( handle )
-            {
-                break;
-            }
+                genericsReport( V_DEBUG, "Found interface %#x with altsetting %#x and ep %#x" EOL, p->iface, altsetting, p->ep );
 
-            /* Take a pause before looking again */
-            usleep( 500000 );
+                interface_found = true;
+            }
         }
 
-        genericsReport( V_INFO, "Found %s" EOL, p->name );
-
-        if ( !( dev = libusb_get_device( handle ) ) )
+        if ( !interface_found )
         {
-            /* We didn't get the device, so try again in a while */
-            continue;
+            genericsReport( V_DEBUG, "No supported interfaces found, falling back to hardcoded values" EOL );
         }
 
-        iface = p->iface;
-        ep = p->ep;
+        libusb_free_config_descriptor( config );
+    }
 
-        if ( p->autodiscover )
-        {
-            genericsReport( V_DEBUG, "Searching for trace interface" EOL );
+    if ( ( err = libusb_claim_interface ( p->handle, p->iface ) ) < 0 )
+    {
+        genericsReport( V_WARN, "Failed to claim interface (%d)" EOL, err );
+        goto fail;
+    }
 
-            struct libusb_config_descriptor *config;
+    if ( num_altsetting > 1 && ( err = libusb_set_interface_alt_setting ( p->handle, p->iface, altsetting ) ) < 0 )
+    {
+        genericsReport( V_WARN, "Failed to set altsetting (%d)" EOL, err );
+    }
 
-            if ( ( err = libusb_get_active_config_descriptor( dev, &config ) ) < 0 )
-            {
-                genericsReport( V_WARN, "Failed to get config descriptor (%d)" EOL, err );
-                continue;
-            }
+    genericsReport( V_DEBUG, "USB Interface claimed, ready for data" EOL );
 
-            bool interface_found = false;
+    for ( uint32_t t = 0; t < r->options->usbTransfers; t++ )
+    {
+        libusb_fill_bulk_transfer ( p->usbtfr[t], p->handle, p->ep,
+                                    p->usbtfr[t]->buffer,
+                                    r->options->usbTransferSize,
+                                    _usb_callback,
+                                    p->usbtfr[t]->user_data,
+                                    BLOCK_TIMEOUT_INTERVAL_MS
+                                  );
 
-            for ( int if_num = 0; if_num < config->bNumInterfaces && !interface_found; if_num++ )
-            {
-                for ( int alt_num = 0; alt_num < config->interface[if_num].num_altsetting && !interface_found; alt_num++ )
-                {
-                    const struct libusb_interface_descriptor *i = &config->interface[if_num].altsetting[alt_num];
+        int ret = libusb_submit_transfer( p->usbtfr[t] );
 
-                    if (
-                                i->bInterfaceClass != 0xff ||
-                                i->bInterfaceSubClass != 0x54 ||
-                                ( i->bInterfaceProtocol != 0x00 && i->bInterfaceProtocol != 0x01 ) ||
-                                i->bNumEndpoints != 0x01 )
-                    {
-                        continue;
-                    }
+        if ( ret )
+        {
+            genericsReport( V_ERROR, "Error submitting USB requests %d" EOL, ret );
+            _doExit();
+            break;
+        }
 
-                    iface = i->bInterfaceNumber;
-                    altsetting = i->bAlternateSetting;
-                    num_altsetting = config->interface[if_num].num_altsetting;
-                    ep = i->endpoint[0].bEndpointAddress;
+        p->inFlight++;
+    }
 
-                    genericsReport( V_DEBUG, "Found interface %#x with altsetting %#x and ep %#x" EOL, iface, altsetting, ep );
+    return true;
 
-                    interface_found = true;
-                }
-            }
+fail:
+    libusb_close( p->handle );
+    p->handle = NULL;
+    return false;
+}
+// ====================================================================================================
+int usbFeeder( struct RunTime *r )
 
-            if ( !interface_found )
-            {
-                genericsReport( V_DEBUG, "No supported interfaces found, falling back to hardcoded values" EOL );
-            }
+/* All of the probes are driven from this one thread, each being looked for again if it goes away */
 
-            libusb_free_config_descriptor( config );
-        }
+{
+    struct timeval tv;
+    uint32_t lastSearch = 0;
+    struct probe *p;
 
-        if ( ( err = libusb_claim_interface ( handle, iface ) ) < 0 )
-        {
-            genericsReport( V_WARN, "Failed to claim interface (%d)" EOL, err );
-            continue;
-        }
+    if ( !_usbSetup( r ) )
+    {
+        genericsReport( V_ERROR, "Failed to allocate USB transfers" EOL );
+        return ( -1 );
+    }
 
-        if ( num_altsetting > 1 && ( err = libusb_set_interface_alt_setting ( handle, iface, altsetting ) ) < 0 )
-        {
-            genericsReport( V_WARN, "Failed to set altsetting (%d)" EOL, err );
-        }
+    _realtimeSetup( r );
 
-        genericsReport( V_DEBUG, "USB Interface claimed, ready for data" EOL );
+    if ( libusb_init( NULL ) < 0 )
+    {
+        genericsReport( V_ERROR, "Failed to initalise USB interface" EOL );
+        return ( -1 );
+    }
 
-        for ( uint32_t t = 0; t < NUM_RAW_BLOCKS; t++ )
+    while ( !r->ending )
+    {
+        /* Snooze between looks for any probes that are missing .... this is useful for when they come and go */
+        if ( genericsTimestampmS() - lastSearch >= PROBE_SEARCH_INTERVAL_MS )
         {
-            r->rawBlock[t].usbtfr = libusb_alloc_transfer( 0 );
-
-            libusb_fill_bulk_transfer ( r->rawBlock[t].usbtfr, handle, ep,
-                                        r->rawBlock[t].buffer,
-                                        TRANSFER_SIZE,
-                                        _usb_callback,
-                                        &r->rawBlock[t].usbtfr,
-                                        BLOCK_TIMEOUT_INTERVAL_MS
-                                      );
+            lastSearch = genericsTimestampmS();
 
-            int ret = libusb_submit_transfer( r->rawBlock[t].usbtfr );
-
-            if ( ret )
+            for ( uint32_t i = 0; i < r->numProbes; i++ )
             {
-                genericsReport( V_ERROR, "Error submitting USB requests %d" EOL, ret );
-                _doExit();
+                if ( !r->probe[i].handle )
+                {
+                    _usbOpen( r, &r->probe[i] );
+                }
             }
         }
 
-        while ( !r->ending )
+        tv.tv_sec = 0;
+        tv.tv_usec = PROBE_SEARCH_INTERVAL_MS * 1000;
+
+        int ret = libusb_handle_events_timeout_completed( NULL, &tv, ( int * )&r->ending );
+
+        if ( ret )
+        {
+            genericsReport( V_ERROR, "Error waiting for USB requests to complete %d" EOL, ret );
+            _doExit();
+        }
+
+        /* Anything that's gone away can be closed now that none of its transfers are outstanding */
+        for ( uint32_t i = 0; i < r->numProbes; i++ )
         {
-            int ret = libusb_handle_events_completed( NULL, ( int * )&r->ending );
+            p = &r->probe[i];
 
-            if ( ret )
+            if ( ( p->handle ) && ( !p->inFlight ) )
             {
-                genericsReport( V_ERROR, "Error waiting for USB requests to complete %d" EOL, ret );
-                _doExit();
+                libusb_close( p->handle );
+                p->handle = NULL;
+                genericsReport( V_INFO, "USB Interface closed%s%s" EOL, p->serial ? " for " : "", p->serial ? p->serial : "" );
             }
         }
+    }
 
-        libusb_close( handle );
-        genericsReport( V_INFO, "USB Interface closed" EOL );
+    for ( uint32_t i = 0; i < r->numProbes; i++ )
+    {
+        if ( r->probe[i].handle )
+        {
+            libusb_close( r->probe[i].handle );
+        }
     }
 
     return 0;
@@ -923,20 +1949,7 @@ int seggerFeeder( struct RunTime *r )
 
         genericsReport( V_INFO, "Established Segger Link" EOL );
 
-        while ( !r->ending )
-
-        {
-            struct dataBlock *rxBlock = &r->rawBlock[r->wp];
-
-            if ( ( rxBlock->fillLevel = read( r->f, rxBlock->buffer, TRANSFER_SIZE ) ) <= 0 )
-            {
-                break;
-            }
-
-            r->wp = ( r->wp + 1 ) % NUM_RAW_BLOCKS;
-            sem_post( &r->dataForClients );
-        }
-
+        _rxFeed( r, r->f );
         close( r->f );
 
         if ( ! r->ending )
@@ -955,8 +1968,6 @@ int serialFeeder( struct RunTime *r )
     while ( !r->ending )
     {
 #ifdef OSX
-        int flags;
-
         while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY | O_NONBLOCK ) ) < 0 )
 #else
         while ( !r->ending && ( r->f = open( r->options->port, O_RDONLY ) ) < 0 )
@@ -968,42 +1979,12 @@ int serialFeeder( struct RunTime *r )
 
         genericsReport( V_INFO, "Port opened" EOL );
 
-#ifdef OSX
-        /* Remove the O_NONBLOCK flag now the port is open (OSX Only) */
-
-        if ( ( flags = fcntl( r->f, F_GETFL, NULL ) ) < 0 )
-        {
-            genericsExit( -3, "F_GETFL failed" EOL );
-        }
-
-        flags &= ~O_NONBLOCK;
-
-        if ( ( flags = fcntl( r->f, F_SETFL, flags ) ) < 0 )
-        {
-            genericsExit( -3, "F_SETFL failed" EOL );
-        }
-
-#endif
-
         if ( ( ret = _setSerialConfig ( r->f, r->options->speed ) ) < 0 )
         {
             genericsExit( ret, "setSerialConfig failed" EOL );
         }
 
-        while ( !r->ending )
-        {
-            struct dataBlock *rxBlock = &r->rawBlock[r->wp];
-
-            if ( ( rxBlock->fillLevel = read( r->f, rxBlock->buffer, TRANSFER_SIZE ) ) <= 0 )
-            {
-                break;
-            }
-
-            r->wp = ( r->wp + 1 ) % NUM_RAW_BLOCKS;
-            sem_post( &r->dataForClients );
-        }
-
-        if ( ! r->ending )
+        if ( _rxFeed( r, r->f ) )
         {
             genericsReport( V_INFO, "Read failed" EOL );
         }
@@ -1014,20 +1995,74 @@ int serialFeeder( struct RunTime *r )
     return 0;
 }
 // ====================================================================================================
+static void _replayWait( struct RunTime *r, uint64_t due, uint64_t *late )
+
+/* Pace replay by waiting until due (in ns), or noting how far behind we are if it's already passed */
+
+{
+    uint64_t now = StageNow();
+
+    while ( ( !r->ending ) && ( now < due ) )
+    {
+        usleep( ( ( due - now ) / 1000 > REPLAY_MAX_SLEEP_US ) ? REPLAY_MAX_SLEEP_US : ( due - now ) / 1000 );
+        now = StageNow();
+    }
+
+    if ( ( now > due ) && ( now - due > *late ) )
+    {
+        *late = now - due;
+    }
+}
+// ====================================================================================================
+static void _replayReport( struct RunTime *r, uint64_t offered, uint64_t start, uint64_t late )
+
+/* Summarise a replay; what was offered, how well we kept up with it and what clients lost */
+
+{
+    struct nwclientStats s;
+    double secs = ( StageNow() - start ) / 1e9;
+
+    _probeNwStats( r, &r->probe[0], &s );
+
+    genericsPrintf( "Replay: %" PRIu64 " bytes in %.2fs (%.0f bytes/sec), at worst %.1fms behind. "
+                    "Clients: %" PRIu32 " connected, %" PRIu64 " of %" PRIu64 " blocks dropped, %" PRIu64 " disconnects" EOL,
+                    offered, secs, secs ? offered / secs : 0, late / 1e6, s.clients, s.dropped, s.sent, s.disconnects );
+}
+// ====================================================================================================
 int fileFeeder( struct RunTime *r )
 
 {
-    if ( ( r->f = open( r->options->file, O_RDONLY ) ) < 0 )
+    struct fileSource f;
+    const uint8_t *data;
+    ssize_t t;
+    bool replay = ( r->options->replayRate ) || ( r->options->replaySpeed );
+    size_t maxLen = TRANSFER_SIZE;
+    uint64_t start = 0;
+    uint64_t first = 0;
+    uint64_t offered = 0;
+    uint64_t late = 0;
+
+    if ( !FileSourceOpen( &f, r->options->file ) )
     {
         genericsExit( -4, "Can't open file %s" EOL, r->options->file );
     }
 
+    /* At a byte rate, hand out no more than a tick's worth at a time so the pacing is smooth */
+    if ( ( r->options->replayRate ) && ( r->options->replayRate * REPLAY_TICK_US / 1000000 < maxLen ) )
+    {
+        maxLen = ( r->options->replayRate * REPLAY_TICK_US / 1000000 ) ? r->options->replayRate * REPLAY_TICK_US / 1000000 : 1;
+    }
+
+    /* The file is distributed straight from the mapping, transfer sized lumps at a time, without */
+    /* going through the raw block ring. That means it can't overrun the distribution either.    */
     while ( !r->ending )
     {
-        struct dataBlock *rxBlock = &r->rawBlock[r->wp];
-        rxBlock->fillLevel = read( r->f, rxBlock->buffer, TRANSFER_SIZE );
+        if ( ( t = FileSourceGet( &f, &data, maxLen ) ) < 0 )
+        {
+            break;
+        }
 
-        if ( !rxBlock->fillLevel )
+        if ( !t )
         {
             if ( r->options->fileTerminate )
             {
@@ -1041,8 +2076,26 @@ int fileFeeder( struct RunTime *r )
             }
         }
 
-        r->wp = ( r->wp + 1 ) % NUM_RAW_BLOCKS;
-        sem_post( &r->dataForClients );
+        if ( replay )
+        {
+            if ( !start )
+            {
+                if ( ( r->options->replaySpeed ) && ( !f.capture ) )
+                {
+                    genericsExit( -4, "Replay at a multiple of captured timing needs an indexed capture file" EOL );
+                }
+
+                start = StageNow();
+                first = f.tstamp;
+            }
+
+            /* Captured timing is only known to chunk granularity, so that's what it's replayed at */
+            _replayWait( r, start + ( r->options->replayRate ? ( uint64_t )( offered * 1e9 / r->options->replayRate ) :
+                                      ( uint64_t )( ( f.tstamp - first ) * 1000 / r->options->replaySpeed ) ), &late );
+            offered += t;
+        }
+
+        _processData( r, &r->probe[0], data, t );
     }
 
     if ( !r->options->fileTerminate )
@@ -1050,16 +2103,19 @@ int fileFeeder( struct RunTime *r )
         genericsReport( V_INFO, "File read error" EOL );
     }
 
-    close( r->f );
+    if ( start )
+    {
+        _replayReport( r, offered, start, late );
+    }
+
+    FileSourceClose( &f );
     return true;
 }
 // ====================================================================================================
 int main( int argc, char *argv[] )
 
 {
-    /* Setup TPIU in case we call it into service later */
-    TPIUDecoderInit( &_r.t );
-    sem_init( &_r.dataForClients, 0, 0 );
+    _r.startTime = StageNow();
 
     if ( !_processOptions( argc, argv, &_r ) )
     {
@@ -1082,52 +2138,113 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-    if ( _r.options->useTPIU )
+    /* Each probe named on the command line gets its own outputs, otherwise there's just the one probe */
+    if ( _r.options->serialList )
     {
-        char *c = _r.options->channelList;
-        int x = 0;
+        char *c = _r.options->serialList;
+        char *e;
 
         while ( *c )
         {
-            while ( *c == ',' )
+            if ( ( e = strchr( c, ',' ) ) == c )
             {
                 c++;
+                continue;
             }
 
-            while ( isdigit( *c ) )
-            {
-                x = x * 10 + ( *c++ -'0' );
-            }
+            _r.probe = ( struct probe * )realloc( _r.probe, sizeof( struct probe ) * ( _r.numProbes + 1 ) );
+            memset( &_r.probe[_r.numProbes], 0, sizeof( struct probe ) );
+            _r.probe[_r.numProbes].serial = e ? strndup( c, e - c ) : strdup( c );
+            _r.numProbes++;
+            c = e ? e + 1 : c + strlen( c );
+        }
 
-            if ( ( *c ) && ( *c != ',' ) )
-            {
-                genericsExit( -1, "Illegal character in channel list (%c)" EOL, *c );
-            }
+        if ( !_r.numProbes )
+        {
+            genericsExit( -1, "No probe serial numbers given" EOL );
+        }
+    }
+    else
+    {
+        _r.probe = ( struct probe * )calloc( 1, sizeof( struct probe ) );
+        _r.numProbes = 1;
+    }
+
+    /* Setup TPIU in case we call it into service later */
+    for ( uint32_t i = 0; i < _r.numProbes; i++ )
+    {
+        TPIUDecoderInit( &_r.probe[i].t );
+    }
+
+    /* Ports are allocated from the listen port upwards, a set for each probe in turn */
+    int nextPort = _r.options->listenPort;
+
+    for ( uint32_t i = 0; i < _r.numProbes; i++ )
+    {
+        struct probe *p = &_r.probe[i];
 
-            if ( x )
+        if ( _r.options->useTPIU )
+        {
+            char *c = _r.options->channelList;
+            int x = 0;
+
+            while ( *c )
             {
-                /* This is a good number, so open */
-                if ( ( x < 0 ) || ( x >= NUM_TPIU_CHANNELS ) )
+                while ( *c == ',' )
+                {
+                    c++;
+                }
+
+                while ( isdigit( *c ) )
+                {
+                    x = x * 10 + ( *c++ -'0' );
+                }
+
+                if ( ( *c ) && ( *c != ',' ) )
                 {
-                    genericsExit( -1, "Channel number out of range" EOL );
+                    genericsExit( -1, "Illegal character in channel list (%c)" EOL, *c );
                 }
 
-                _r.handler = ( struct handlers * )realloc( _r.handler, sizeof( struct handlers ) * ( _r.numHandlers + 1 ) );
+                if ( x )
+                {
+                    /* This is a good number, so open */
+                    if ( ( x < 0 ) || ( x >= NUM_TPIU_CHANNELS ) )
+                    {
+                        genericsExit( -1, "Channel number out of range" EOL );
+                    }
 
-                _r.handler[_r.numHandlers].channel = x;
-                _r.handler[_r.numHandlers].strippedBlock = ( struct dataBlock * )calloc( 1, sizeof( struct dataBlock ) );
-                _r.handler[_r.numHandlers].n = nwclientStart(  _r.options->listenPort + _r.numHandlers );
-                genericsReport( V_WARN, "Started Network interface for channel %d on port %d" EOL, x, _r.options->listenPort + _r.numHandlers );
-                _r.numHandlers++;
-                x = 0;
+                    p->handler = ( struct handlers * )realloc( p->handler, sizeof( struct handlers ) * ( p->numHandlers + 1 ) );
+
+                    p->handler[p->numHandlers].channel = x;
+                    p->handler[p->numHandlers].port = nextPort;
+                    p->handler[p->numHandlers].intervalBytes = 0;
+                    p->handler[p->numHandlers].strippedBlock = ( struct dataBlock * )calloc( 1, sizeof( struct dataBlock ) );
+                    p->handler[p->numHandlers].n = nwclientStart( nextPort, _r.options->overrun );
+                    genericsReport( V_WARN, "Started Network interface for %s%schannel %d on port %d" EOL,
+                                    p->serial ? p->serial : "", p->serial ? " " : "", x, nextPort );
+                    p->numHandlers++;
+                    nextPort++;
+                    x = 0;
+                }
             }
+
+            _buildStreamTable( p );
         }
-    }
-    else
-    {
-        if ( !( _r.n = nwclientStart( _r.options->listenPort ) ) )
+        else
         {
-            genericsExit( -1, "Failed to make network server" EOL );
+            if ( !( p->n = nwclientStart( nextPort, _r.options->overrun ) ) )
+            {
+                genericsExit( -1, "Failed to make network server" EOL );
+            }
+
+            p->port = nextPort;
+
+            if ( p->serial )
+            {
+                genericsReport( V_WARN, "Started Network interface for %s on port %d" EOL, p->serial, nextPort );
+            }
+
+            nextPort++;
         }
     }
 
@@ -1136,8 +2253,13 @@ int main( int argc, char *argv[] )
         pthread_create( &_r.intervalThread, NULL, &_checkInterval, &_r );
     }
 
-    /* Now start the distribution task */
-    pthread_create( &_r.processThread, NULL, &_processBlocks, &_r );
+    if ( _r.options->statsSocket )
+    {
+        if ( !_statsStart( &_r ) )
+        {
+            genericsExit( -1, "Failed to create stats socket %s (%s)" EOL, _r.options->statsSocket, strerror( errno ) );
+        }
+    }
 
     if ( _r.options->outfile )
     {
@@ -1150,18 +2272,32 @@ int main( int argc, char *argv[] )
         }
     }
 
-    if ( _r.options->seggerPort )
+    if ( _r.options->capturefile )
     {
-        exit( seggerFeeder( &_r ) );
+        if ( !CaptureWriterOpen( &_r.capture, _r.options->capturefile ) )
+        {
+            genericsReport( V_ERROR, "Could not open capture file for writing" EOL );
+            return -2;
+        }
+
+        _r.capturing = true;
     }
 
-    if ( _r.options->port )
+    if ( ( _r.options->seggerPort ) || ( _r.options->port ) )
     {
-        exit( serialFeeder( &_r ) );
+        /* Distribution is done by the worker, so reception never has to wait for it */
+        if ( !_rxSetup( &_r, NUM_RX_BLOCKS, 0, TRANSFER_SIZE, true ) )
+        {
+            genericsExit( -1, "Failed to allocate receive buffers" EOL );
+        }
+
+        _realtimeSetup( &_r );
+        exit( _r.options->seggerPort ? seggerFeeder( &_r ) : serialFeeder( &_r ) );
     }
 
     if ( _r.options->file )
     {
+        _realtimeSetup( &_r );
         exit( fileFeeder( &_r ) );
     }
 
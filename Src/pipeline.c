@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Decode Pipeline
+ * ===============
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "generics.h"
+#include "pipeline.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _dispatch( struct pipeline *p, struct msg *m )
+
+{
+    /* genericMsg is just used to access the first two members of the decoded structs in a portable way */
+    if ( ( m->genericMsg.msgtype < MSG_NUM_MSGS ) && ( p->msgCB[m->genericMsg.msgtype] ) )
+    {
+        ( p->msgCB[m->genericMsg.msgtype] )( m, p->d );
+    }
+}
+// ====================================================================================================
+static void _sequencedStage( struct pipeline *p, const uint8_t *c, uint32_t len )
+
+/* ITM through the sequencer, which reports on the ITM decoder itself */
+
+{
+    struct msg *m;
+    uint32_t used;
+
+    while ( len )
+    {
+        bool drain = MSGSeqPumpBuffer( &p->seq, c, len, &used );
+        c += used;
+        len -= used;
+
+        if ( !drain )
+        {
+            continue;
+        }
+
+        /* We are synced timewise, so empty anything that has been waiting */
+        while ( ( m = MSGSeqGetPacket( &p->seq ) ) )
+        {
+            _dispatch( p, m );
+        }
+
+        if ( p->batchCB )
+        {
+            ( p->batchCB )( p->d );
+        }
+    }
+}
+// ====================================================================================================
+static void _itmStage( struct pipeline *p, const uint8_t *c, uint32_t len )
+
+{
+    struct msg decoded[ITM_DECODE_BATCH];
+    struct ITMDecoderStats *s = ITMDecoderGetStats( &p->i );
+    uint32_t lostSyncCount = s->lostSyncCount;
+    uint32_t overflow = s->overflow;
+    uint32_t n, used;
+
+    if ( p->sequenced )
+    {
+        _sequencedStage( p, c, len );
+        return;
+    }
+
+    while ( len )
+    {
+        n = ITMDecodeBuffer( &p->i, c, len, decoded, ITM_DECODE_BATCH, &used );
+        c += used;
+        len -= used;
+
+        for ( uint32_t g = 0; g < n; g++ )
+        {
+            _dispatch( p, &decoded[g] );
+        }
+
+        if ( p->batchCB )
+        {
+            ( p->batchCB )( p->d );
+        }
+    }
+
+    if ( s->lostSyncCount != lostSyncCount )
+    {
+        genericsReport( V_WARN, "ITM Lost Sync (%d)" EOL, s->lostSyncCount );
+    }
+
+    if ( s->overflow != overflow )
+    {
+        genericsReport( V_WARN, "ITM Overflow (%d)" EOL, s->overflow );
+    }
+}
+// ====================================================================================================
+static void _etmStage( struct pipeline *p, const uint8_t *c, uint32_t len )
+
+{
+    if ( len )
+    {
+        ETMDecoderPump( &p->e, c, len, p->etmCB, genericsReport, p->d );
+    }
+}
+// ====================================================================================================
+static void _tpiuStage( struct pipeline *p, const uint8_t *c, uint32_t len )
+
+{
+    struct TPIUDecoderStats *s = TPIUDecoderGetStats( &p->t );
+    uint32_t syncCount = s->syncCount;
+    uint32_t lostSync = s->lostSync;
+    uint32_t chunk;
+
+    while ( len )
+    {
+        /* TPIU output is never longer than its input, so this chunk will always fit the spans */
+        chunk = ( len > PIPELINE_CHUNK_LEN ) ? PIPELINE_CHUNK_LEN : len;
+        TPIUDecodeBlock( &p->t, c, chunk, p->stream );
+        c += chunk;
+        len -= chunk;
+
+        if ( p->itmChannel != PIPELINE_NO_CHANNEL )
+        {
+            /* ITM sync follows TPIU sync, but data from before any loss of sync is used first */
+            if ( TPIUDecoderSynced( &p->t ) )
+            {
+                ITMDecoderForceSync( &p->i, true );
+                _itmStage( p, p->itmSpan.buffer, p->itmSpan.fill );
+            }
+            else
+            {
+                _itmStage( p, p->itmSpan.buffer, p->itmSpan.fill );
+                ITMDecoderForceSync( &p->i, false );
+            }
+
+            p->itmSpan.fill = 0;
+        }
+
+        if ( p->etmChannel != PIPELINE_NO_CHANNEL )
+        {
+            _etmStage( p, p->etmSpan.buffer, p->etmSpan.fill );
+            p->etmSpan.fill = 0;
+        }
+    }
+
+    if ( s->lostSync != lostSync )
+    {
+        genericsReport( V_INFO, "TPIU Lost Sync (%d)" EOL, s->lostSync );
+    }
+
+    if ( s->syncCount != syncCount )
+    {
+        genericsReport( V_INFO, "TPIU In Sync (%d)" EOL, s->syncCount );
+    }
+}
+// ====================================================================================================
+static bool _span( struct pipeline *p, struct TPIUSpan *span, uint32_t channel )
+
+/* Give a TPIU channel somewhere to go */
+
+{
+    if ( channel == PIPELINE_NO_CHANNEL )
+    {
+        return true;
+    }
+
+    if ( ( !span->buffer ) && ( !( span->buffer = ( uint8_t * )malloc( PIPELINE_CHUNK_LEN ) ) ) )
+    {
+        return false;
+    }
+
+    span->len = PIPELINE_CHUNK_LEN;
+    span->fill = 0;
+    p->stream[channel] = span;
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void PipelineInit( struct pipeline *p, bool forceITMSync, void *d )
+
+/* Set up a pipeline that takes everything in as ITM, and has no handlers yet */
+
+{
+    memset( p, 0, sizeof( struct pipeline ) );
+    p->d = d;
+    TPIUDecoderInit( &p->t );
+    ITMDecoderInit( &p->i, forceITMSync );
+}
+// ====================================================================================================
+bool PipelineUseTPIU( struct pipeline *p, uint32_t itmChannel, uint32_t etmChannel )
+
+/* Take the input as TPIU framed, with ITM and ETM on the given channels. Either can be left out */
+/* with PIPELINE_NO_CHANNEL. Returns false if the channels can't be used.                       */
+
+{
+    if ( ( itmChannel >= TPIU_NUM_STREAMS ) || ( etmChannel >= TPIU_NUM_STREAMS ) ||
+            ( ( itmChannel == etmChannel ) && ( itmChannel != PIPELINE_NO_CHANNEL ) ) )
+    {
+        genericsReport( V_ERROR, "Illegal TPIU channel" EOL );
+        return false;
+    }
+
+    memset( p->stream, 0, sizeof( p->stream ) );
+
+    if ( ( !_span( p, &p->itmSpan, itmChannel ) ) || ( !_span( p, &p->etmSpan, etmChannel ) ) )
+    {
+        genericsReport( V_ERROR, "No memory for TPIU decode" EOL );
+        return false;
+    }
+
+    /* Other TPIU channels are perfectly legal, they just don't have a span to go into */
+    p->useTPIU = true;
+    p->itmChannel = itmChannel;
+    p->etmChannel = etmChannel;
+    return true;
+}
+// ====================================================================================================
+void PipelineSequence( struct pipeline *p, uint32_t entries, enum MSGSeqOverflow overflow, uint32_t maxEntries )
+
+/* Put ITM messages back into time order before they're handled */
+
+{
+    if ( !p->sequenced )
+    {
+        MSGSeqInit( &p->seq, &p->i, entries );
+        p->sequenced = true;
+    }
+
+    MSGSeqSetOverflow( &p->seq, overflow, maxEntries );
+}
+// ====================================================================================================
+void PipelineOnMsg( struct pipeline *p, enum MSGType type, pipelineMsgCB cb )
+
+/* Set the handler for one type of ITM message, or remove it with NULL */
+
+{
+    if ( type < MSG_NUM_MSGS )
+    {
+        p->msgCB[type] = cb;
+    }
+}
+// ====================================================================================================
+void PipelineOnAllMsgs( struct pipeline *p, pipelineMsgCB cb )
+
+/* Set the same handler for every type of ITM message, including the ones that aren't valid */
+
+{
+    for ( uint32_t g = 0; g < MSG_NUM_MSGS; g++ )
+    {
+        p->msgCB[g] = cb;
+    }
+}
+// ====================================================================================================
+void PipelineOnBatch( struct pipeline *p, pipelineBatchCB cb )
+
+/* Set a handler to be called once each batch of ITM messages has been handled */
+
+{
+    p->batchCB = cb;
+}
+// ====================================================================================================
+void PipelineOnETM( struct pipeline *p, bool usingAltAddrEncode, etmDecodeCB cb )
+
+/* Add an ETM stage, with the handler for its decoder */
+
+{
+    if ( !p->etmReady )
+    {
+        ETMDecoderInit( &p->e, usingAltAddrEncode );
+        p->etmReady = true;
+    }
+    else
+    {
+        ETMDecodeUsingAltAddrEncode( &p->e, usingAltAddrEncode );
+    }
+
+    p->etmCB = cb;
+}
+// ====================================================================================================
+void PipelinePump( struct pipeline *p, const uint8_t *buffer, uint32_t len )
+
+/* Take a block of the input through the pipeline */
+
+{
+    if ( p->useTPIU )
+    {
+        _tpiuStage( p, buffer, len );
+    }
+    else if ( p->etmReady )
+    {
+        _etmStage( p, buffer, len );
+    }
+    else
+    {
+        _itmStage( p, buffer, len );
+    }
+}
+// ====================================================================================================
+void PipelineForceSync( struct pipeline *p, bool synced )
+
+/* Reset TPIU state and put ITM into defined state */
+
+{
+    TPIUDecoderForceSync( &p->t, 0 );
+    ITMDecoderForceSync( &p->i, synced );
+}
+// ====================================================================================================
+void PipelineDestroy( struct pipeline *p )
+
+/* Finish with the pipeline, letting go of everything it holds */
+
+{
+    if ( p->sequenced )
+    {
+        MSGSeqDestroy( &p->seq );
+    }
+
+    free( p->itmSpan.buffer );
+    free( p->etmSpan.buffer );
+    memset( p, 0, sizeof( struct pipeline ) );
+}
+// ====================================================================================================
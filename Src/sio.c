@@ -24,6 +24,27 @@ enum SRCH { SRCH_OFF, SRCH_FORWARDS, SRCH_BACKWARDS };
 /* Display modes */
 enum DISP { DISP_BOTH, DISP_SRC, DISP_ASSY, DISP_MAX_OPTIONS };
 
+#define SIG_WORDS           (4)                /* Size of a line's trigram signature, in 64 bit words */
+#define INDEX_STEP_LINES    (20000)            /* Lines to add to the search index each time round the handler */
+#define MIN_REDRAW_MS       (20)               /* Least time between screen updates, so bursts of keys get combined */
+
+/* What's being shown on a row of the output window. Rows with the same contents don't need drawing again */
+struct screenRow
+{
+    const char *buffer;                 /* Text of the line, or NULL for a blank row */
+    int32_t lineNum;                    /* Line of the output buffer it comes from */
+    int32_t line;                       /* ...the source line number shown with it */
+    enum LineType lt;                   /* ...what type of line it is */
+    bool highlight;                     /* ...if it's the current line */
+    int32_t tag;                        /* Tag marked at the end of the row, or -1 */
+};
+
+/* Bitmap of the trigrams in a line. If a line contains a string then its signature has all of the string's bits set */
+struct searchSig
+{
+    uint64_t b[SIG_WORDS];
+};
+
 struct SIOInstance
 {
     /* Materials for window handling */
@@ -43,6 +64,12 @@ struct SIOInstance
     char storedFirstSearch;             /* Storage for first char of search string to allow repeats */
     int32_t searchStartPos;             /* Location the search started from (for aborts) */
     bool searchOK;                      /* Is the search currently sucessful? */
+    int32_t matchCount;                 /* Number of lines matching the search string, or -1 if it's not known */
+
+    /* Search index */
+    struct searchSig *sig;              /* Signatures of lines, working back from the end of the buffer */
+    int32_t sigCount;                   /* Number of lines indexed so far */
+    int32_t sigAlloc;                   /* ...and how many signatures are allocated */
 
     /* Save stuff */
     char *saveFilename;                 /* Filename under construction */
@@ -58,9 +85,23 @@ struct SIOInstance
     int32_t oldopTextRline;             /* Old read position in op buffer (for redraw) */
     enum DISP displayMode;              /* How we want the file displaying */
 
+    /* Screen contents */
+    struct screenRow *row;              /* What's on each row of the output window */
+    struct screenRow *newRow;           /* ...and what should be on it next time it's drawn */
+    int32_t rowCount;                   /* Number of rows there are records for */
+    bool redrawAll;                     /* The rows can't be trusted, so draw all of them next time */
+    bool statusPending;                 /* The status window wants drawing when the rate allows */
+    uint32_t lastDraw;                  /* When the screen was last drawn */
+
     /* Diving */
     int32_t pushedopTextRline;          /* Buffered cursor position for when we're recovering from diving */
 
+    /* Incremental decoding */
+    bool moreAbove;                     /* There's more output available before the start of the buffer */
+    bool searchPending;                 /* A backwards search is waiting for more output to arrive */
+    const char *progressWhat;           /* What background work is going on, or NULL if there's none */
+    int32_t progress;                   /* ...and how far through it is, in percent */
+
     /* UI State information */
     bool held;
     bool enteringSaveFilename;          /* State indicator that we're entering filename */
@@ -98,6 +139,102 @@ static void _deleteTags( struct SIOInstance *sio )
     }
 }
 // ====================================================================================================
+static void _makeSig( const char *t, struct searchSig *sig )
+
+/* Set a bit in the signature for each trigram in the text */
+
+{
+    memset( sig, 0, sizeof( struct searchSig ) );
+
+    while ( ( t[0] ) && ( t[1] ) && ( t[2] ) )
+    {
+        uint32_t h = ( ( ( ( uint8_t )t[0] << 16 ) | ( ( uint8_t )t[1] << 8 ) | ( uint8_t )t[2] ) * 2654435761U ) >> 24;
+        sig->b[h >> 6] |= 1ULL << ( h & 63 );
+        t++;
+    }
+}
+// ====================================================================================================
+static void _indexLines( struct SIOInstance *sio )
+
+/* Add another slice of the buffer to the search index. Lines only ever arrive on the front of the buffer, */
+/* so it's indexed from the end backwards and what's been done stays valid as more arrives.             */
+
+{
+    int32_t n = 0;
+
+    /* Diving buffers are small enough to not need it */
+    if ( sio->amDiving )
+    {
+        return;
+    }
+
+    while ( ( sio->sigCount < sio->opTextWline ) && ( n++ < INDEX_STEP_LINES ) )
+    {
+        if ( sio->sigCount == sio->sigAlloc )
+        {
+            sio->sigAlloc = sio->sigAlloc ? sio->sigAlloc * 2 : INDEX_STEP_LINES;
+            sio->sig = ( struct searchSig * )realloc( sio->sig, sizeof( struct searchSig ) * sio->sigAlloc );
+        }
+
+        _makeSig( ( *sio->opText )[sio->opTextWline - 1 - sio->sigCount].buffer, &sio->sig[sio->sigCount] );
+        sio->sigCount++;
+    }
+}
+// ====================================================================================================
+static bool _searchable( struct SIOInstance *sio, struct searchSig *q )
+
+/* Get a signature for the search string, returning false if it's too short or the index isn't usable */
+
+{
+    if ( ( sio->amDiving ) || ( strlen( sio->searchString ) < 3 ) )
+    {
+        return false;
+    }
+
+    _makeSig( sio->searchString, q );
+    return true;
+}
+// ====================================================================================================
+static bool _mayMatch( struct SIOInstance *sio, int32_t l, struct searchSig *q )
+
+/* Check if a line could contain the search string. Lines that aren't in the index yet always could */
+
+{
+    int32_t i = sio->opTextWline - 1 - l;
+
+    if ( ( q ) && ( i < sio->sigCount ) )
+    {
+        for ( uint32_t w = 0; w < SIG_WORDS; w++ )
+        {
+            if ( ( sio->sig[i].b[w] & q->b[w] ) != q->b[w] )
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _countMatches( struct SIOInstance *sio )
+
+/* Count the lines that match the search string, for the status line */
+
+{
+    struct searchSig q;
+    struct searchSig *qp = _searchable( sio, &q ) ? &q : NULL;
+
+    sio->matchCount = 0;
+
+    for ( int32_t l = 0; l < sio->opTextWline; l++ )
+    {
+        if ( ( _mayMatch( sio, l, qp ) ) && ( strstr( ( *sio->opText )[l].buffer, sio->searchString ) ) )
+        {
+            sio->matchCount++;
+        }
+    }
+}
+// ====================================================================================================
 static enum SIOEvent _processSaveFilename( struct SIOInstance *sio )
 
 {
@@ -375,11 +512,17 @@ static bool _updateSearch( struct SIOInstance *sio )
 /* Progress search to next element, or ping and return false if we can't */
 
 {
+    struct searchSig q;
+    struct searchSig *qp = _searchable( sio, &q ) ? &q : NULL;
+
+    /* Any change that brings us here could change the number of matches too */
+    sio->matchCount = -1;
+
     for ( int32_t l = sio->opTextRline;
             ( sio->searchMode == SRCH_FORWARDS ) ? ( l < sio->opTextWline - 1 ) : ( l > 0 );
             ( sio->searchMode == SRCH_FORWARDS ) ? l++ : l-- )
     {
-        if ( strstr( ( *sio->opText )[l].buffer, sio->searchString ) )
+        if ( ( _mayMatch( sio, l, qp ) ) && ( strstr( ( *sio->opText )[l].buffer, sio->searchString ) ) )
         {
             /* This is a match */
             sio->opTextRline = l;
@@ -388,6 +531,14 @@ static bool _updateSearch( struct SIOInstance *sio )
         }
     }
 
+    /* If there's more to come from above then wait for it before declaring failure */
+    if ( ( sio->searchMode == SRCH_BACKWARDS ) && ( sio->moreAbove ) && ( !sio->amDiving ) )
+    {
+        sio->opTextRline = 0;
+        sio->searchPending = true;
+        return false;
+    }
+
     /* If we get here then we had no match */
     beep();
     sio->searchOK = false;
@@ -410,6 +561,7 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
         case 10: /* ----------------------------- Newline Commit Search -------------------------- */
             /* Commit the search */
             sio->searchMode = SRCH_OFF;
+            sio->searchPending = false;
             curs_set( 0 );
             sio->storedFirstSearch = *sio->searchString;
             *sio->searchString = 0;
@@ -420,6 +572,7 @@ static enum SIOEvent _processSearchKeys( struct SIOInstance *sio )
         case 3: /* ------------------------------ CTRL-C Abort Search ---------------------------- */
             /* Abort the search */
             sio->searchMode = SRCH_OFF;
+            sio->searchPending = false;
             sio->opTextRline = sio->searchStartPos;
             sio->storedFirstSearch = *sio->searchString;
             *sio->searchString = 0;
@@ -585,7 +738,9 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
 
         if ( x == OUTPUT_WINDOW_W - 1 )
         {
+            /* That's the line full, so there's nothing to pad out (which would wrap onto the next row) */
             waddch( sio->outputWindow, '>' );
+            x = OUTPUT_WINDOW_W;
             break;
         }
         else
@@ -610,24 +765,42 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
     return true;
 }
 // ====================================================================================================
-static void _outputOutput( struct SIOInstance *sio )
+static void _setRow( struct SIOInstance *sio, struct screenRow *row, int32_t lineNum, bool highlight )
+
+{
+    row->buffer    = ( *sio->opText )[lineNum].buffer;
+    row->line      = ( *sio->opText )[lineNum].line;
+    row->lt        = ( *sio->opText )[lineNum].lt;
+    row->lineNum   = lineNum;
+    row->highlight = highlight;
+}
+// ====================================================================================================
+static void _planRows( struct SIOInstance *sio, struct screenRow *row )
+
+/* Work out what should be on each row of the output window, centred on the current position */
 
 {
-    werase( sio->outputWindow );
     int32_t cp, cl;
 
+    for ( cl = 0; cl < OUTPUT_WINDOW_L; cl++ )
+    {
+        row[cl].buffer = NULL;
+        row[cl].tag = -1;
+    }
 
-    /* First, output lines _forward_ from current position */
+    /* First, lines _forward_ from current position */
     cp = sio->opTextRline;
     cl = ( OUTPUT_WINDOW_L / 2 );
 
-    /* Firstly go forwards filling in each line of the screen */
     while ( ( cl < OUTPUT_WINDOW_L ) && ( cp < sio->opTextWline ) )
     {
-        if ( _displayLine( sio, cp++, cl, ( cl == ( OUTPUT_WINDOW_L / 2 ) ) ) )
+        if ( _onDisplay( sio, cp ) )
         {
+            _setRow( sio, &row[cl], cp, ( cl == ( OUTPUT_WINDOW_L / 2 ) ) );
             cl++;
         }
+
+        cp++;
     }
 
     /* Now go backwards doing likewise */
@@ -636,11 +809,163 @@ static void _outputOutput( struct SIOInstance *sio )
 
     while ( ( cl >= 0 ) && ( cp >= 0 ) )
     {
-        if ( _displayLine( sio, cp--, cl, false ) )
+        if ( _onDisplay( sio, cp ) )
         {
+            _setRow( sio, &row[cl], cp, false );
             cl--;
         }
+
+        cp--;
+    }
+
+    /* Tags are marked at the end of the rows they're on, while not in a diving buffer */
+    if ( !sio->amDiving )
+    {
+        for ( uint32_t t = 0; t < MAX_TAGS; t++ )
+        {
+            cl = ( OUTPUT_WINDOW_L ) / 2 + sio->tag[t] - sio->opTextRline - 1;
+
+            if ( ( sio->tag[t] ) && ( cl >= 0 ) && ( cl < OUTPUT_WINDOW_L ) )
+            {
+                row[cl].tag = t;
+            }
+        }
+    }
+}
+// ====================================================================================================
+static bool _sameText( struct screenRow *a, struct screenRow *b )
+
+{
+    return ( a->buffer == b->buffer ) && ( ( !a->buffer ) || ( ( a->line == b->line ) && ( a->lt == b->lt ) ) );
+}
+// ====================================================================================================
+static bool _sameRow( struct screenRow *a, struct screenRow *b )
+
+{
+    return ( _sameText( a, b ) ) && ( ( !a->buffer ) || ( a->highlight == b->highlight ) ) && ( a->tag == b->tag );
+}
+// ====================================================================================================
+static void _drawRow( struct SIOInstance *sio, int32_t screenline, struct screenRow *row )
+
+{
+    wmove( sio->outputWindow, screenline, 0 );
+    wclrtoeol( sio->outputWindow );
+
+    if ( row->buffer )
+    {
+        _displayLine( sio, row->lineNum, screenline, row->highlight );
+    }
+
+    if ( row->tag >= 0 )
+    {
+        wattrset( sio->outputWindow, A_BOLD | COLOR_PAIR( CP_BASELINETEXT ) );
+        mvwprintw( sio->outputWindow, screenline, OUTPUT_WINDOW_W - 1, "%d", row->tag );
+    }
+}
+// ====================================================================================================
+static int32_t _findScroll( struct SIOInstance *sio )
+
+/* Find how far the rows already on screen have moved, if they have, so the window can be scrolled to match */
+
+{
+    int32_t best = 0, bestMatches = 0;
+
+    for ( int32_t k = 1 - OUTPUT_WINDOW_L; k < OUTPUT_WINDOW_L; k++ )
+    {
+        int32_t matches = 0;
+
+        for ( int32_t cl = ( k > 0 ) ? 0 : -k; ( cl < OUTPUT_WINDOW_L ) && ( cl + k < OUTPUT_WINDOW_L ); cl++ )
+        {
+            matches += ( sio->newRow[cl].buffer ) && ( _sameText( &sio->newRow[cl], &sio->row[cl + k] ) );
+        }
+
+        /* Ties go to not scrolling */
+        if ( ( matches > bestMatches ) || ( ( matches == bestMatches ) && ( !k ) ) )
+        {
+            best = k;
+            bestMatches = matches;
+        }
+    }
+
+    return best;
+}
+// ====================================================================================================
+static void _outputOutput( struct SIOInstance *sio )
+
+/* Bring the output window up to date, drawing only the rows that have changed */
+
+{
+    struct screenRow *t;
+    int32_t k;
+
+    if ( sio->rowCount != OUTPUT_WINDOW_L )
+    {
+        sio->rowCount = OUTPUT_WINDOW_L;
+        sio->row = ( struct screenRow * )realloc( sio->row, sizeof( struct screenRow ) * sio->rowCount );
+        sio->newRow = ( struct screenRow * )realloc( sio->newRow, sizeof( struct screenRow ) * sio->rowCount );
+        sio->redrawAll = true;
+    }
+
+    _planRows( sio, sio->newRow );
+
+    if ( sio->redrawAll )
+    {
+        werase( sio->outputWindow );
+
+        for ( int32_t cl = 0; cl < OUTPUT_WINDOW_L; cl++ )
+        {
+            if ( ( sio->newRow[cl].buffer ) || ( sio->newRow[cl].tag >= 0 ) )
+            {
+                _drawRow( sio, cl, &sio->newRow[cl] );
+            }
+        }
+
+        sio->redrawAll = false;
     }
+    else
+    {
+        if ( ( k = _findScroll( sio ) ) )
+        {
+            /* Move what's there already, leaving blank rows to be filled in */
+            scrollok( sio->outputWindow, true );
+            wscrl( sio->outputWindow, k );
+            scrollok( sio->outputWindow, false );
+
+            if ( k > 0 )
+            {
+                memmove( &sio->row[0], &sio->row[k], sizeof( struct screenRow ) * ( OUTPUT_WINDOW_L - k ) );
+
+                for ( int32_t cl = OUTPUT_WINDOW_L - k; cl < OUTPUT_WINDOW_L; cl++ )
+                {
+                    sio->row[cl].buffer = NULL;
+                    sio->row[cl].tag = -1;
+                }
+            }
+            else
+            {
+                memmove( &sio->row[-k], &sio->row[0], sizeof( struct screenRow ) * ( OUTPUT_WINDOW_L + k ) );
+
+                for ( int32_t cl = 0; cl < -k; cl++ )
+                {
+                    sio->row[cl].buffer = NULL;
+                    sio->row[cl].tag = -1;
+                }
+            }
+        }
+
+        for ( int32_t cl = 0; cl < OUTPUT_WINDOW_L; cl++ )
+        {
+            if ( !_sameRow( &sio->newRow[cl], &sio->row[cl] ) )
+            {
+                _drawRow( sio, cl, &sio->newRow[cl] );
+            }
+        }
+    }
+
+    /* What should be there now is */
+    t = sio->row;
+    sio->row = sio->newRow;
+    sio->newRow = t;
 }
 // ====================================================================================================
 static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
@@ -717,6 +1042,11 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
         }
     }
 
+    if ( sio->progressWhat )
+    {
+        mvwprintw( sio->statusWindow, 1, COLS - 30, "%s %d%%", sio->progressWhat, sio->progress );
+    }
+
     if ( !sio->warnTimeout )
     {
         mvwprintw( sio->statusWindow, 0, 30, " " );
@@ -729,15 +1059,8 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
         {
             if ( sio->tag[t] )
             {
+                /* Those on the visible page are marked as part of their row of the output window */
                 wattrset( sio->statusWindow, A_BOLD | COLOR_PAIR( CP_BASELINETEXT ) );
-
-                if ( ( sio->tag[t] >= ( sio->opTextRline - OUTPUT_WINDOW_L / 2 ) ) &&
-                        ( sio->tag[t] <= ( sio->opTextRline + ( OUTPUT_WINDOW_L + 1 ) / 2 ) ) )
-                {
-                    /* This tag is on the visible page */
-                    wattrset( sio->outputWindow, A_BOLD | COLOR_PAIR( CP_BASELINETEXT ) );
-                    mvwprintw( sio->outputWindow, ( OUTPUT_WINDOW_L ) / 2 + sio->tag[t] - sio->opTextRline - 1, OUTPUT_WINDOW_W - 1, "%d", t );
-                }
             }
             else
             {
@@ -766,8 +1089,20 @@ static void _outputStatus( struct SIOInstance *sio, uint64_t oldintervalBytes )
 
     if ( sio->searchMode )
     {
+        if ( ( sio->matchCount < 0 ) && ( *sio->searchString ) )
+        {
+            _countMatches( sio );
+        }
+
         wattrset( sio->statusWindow, A_BOLD | COLOR_PAIR( CP_SEARCH ) );
-        mvwprintw( sio->statusWindow, 1, 2, "%sSearch %s :%s", sio->searchOK ? "" : "(Failing) ", ( sio->searchMode == SRCH_FORWARDS ) ? "Forwards" : "Backwards", sio->searchString );
+        mvwprintw( sio->statusWindow, 1, 2, "%sSearch %s ", sio->searchOK ? "" : "(Failing) ", ( sio->searchMode == SRCH_FORWARDS ) ? "Forwards" : "Backwards" );
+
+        if ( *sio->searchString )
+        {
+            wprintw( sio->statusWindow, "[%d] ", sio->matchCount );
+        }
+
+        wprintw( sio->statusWindow, ":%s", sio->searchString );
     }
 
     if ( sio->enteringMark )
@@ -787,16 +1122,27 @@ static void _updateWindows( struct SIOInstance *sio, bool isTick, bool isKey, ui
 {
     bool refreshOutput = false; /* Flag indicating that output window needs updating */
     bool refreshStatus = false; /* Flag indicating that status window needs updating */
+    uint32_t now = genericsTimestampmS();
+
+    sio->statusPending |= ( isTick ) || ( isKey ) || ( sio->forceRefresh ) || ( sio->warnTimeout );
+
+    /* Under a burst of input only draw every so often, it's where we end up that matters */
+    if ( ( !isTick ) && ( now - sio->lastDraw < MIN_REDRAW_MS ) )
+    {
+        return;
+    }
 
     /* First, work with the output window */
     if ( sio->outputtingHelp )
     {
         _outputHelp( sio );
+        sio->redrawAll = true;
         refreshOutput = true;
     }
     else
     {
-        if ( ( sio->oldopTextRline != sio->opTextRline ) || ( sio->forceRefresh ) )
+        /* Tags are shown in the output window, so it's checked along with the status too */
+        if ( ( sio->oldopTextRline != sio->opTextRline ) || ( sio->forceRefresh ) || ( sio->statusPending ) )
         {
             _outputOutput( sio );
             sio->oldopTextRline = sio->opTextRline;
@@ -805,23 +1151,30 @@ static void _updateWindows( struct SIOInstance *sio, bool isTick, bool isKey, ui
     }
 
     /* Now update the status */
-    if ( ( isTick ) || ( isKey ) || ( sio->forceRefresh ) || ( sio->warnTimeout ) )
+    if ( sio->statusPending )
     {
         _outputStatus( sio, oldintervalBytes );
-        refreshOutput = refreshStatus = true;
+        sio->statusPending = false;
+        refreshStatus = true;
     }
 
     sio->forceRefresh = false;
 
-    /* Now do any refreshes that are needed */
+    /* Now send whatever changed to the terminal in one go, status last so it keeps the cursor */
     if ( refreshOutput )
     {
-        wrefresh( sio->outputWindow );
+        wnoutrefresh( sio->outputWindow );
     }
 
     if ( refreshStatus )
     {
-        wrefresh( sio->statusWindow );
+        wnoutrefresh( sio->statusWindow );
+    }
+
+    if ( ( refreshOutput ) || ( refreshStatus ) )
+    {
+        doupdate();
+        sio->lastDraw = now;
     }
 }
 // ====================================================================================================
@@ -865,6 +1218,9 @@ struct SIOInstance *SIOsetup( const char *progname, const char *elffile, bool is
     sio->statusWindow = newwin( STATUS_WINDOW_L, STATUS_WINDOW_W, OUTPUT_WINDOW_L, 0 );
     wtimeout( sio->statusWindow, 0 );
     scrollok( sio->outputWindow, false );
+
+    /* Let curses use the terminal's own scrolling when the output moves by a few lines */
+    idlok( sio->outputWindow, true );
     keypad( sio->statusWindow, true );
 
     /* This allows CTRL-C and CTRL-S to be used in-program */
@@ -890,6 +1246,60 @@ int32_t SIOgetCurrentLineno( struct SIOInstance *sio )
     return sio->opTextRline;
 }
 // ====================================================================================================
+void SIOsetMoreAbove( struct SIOInstance *sio, bool moreAbove )
+
+/* Flag if more output can be had from before the start of the current buffer */
+
+{
+    sio->moreAbove = moreAbove;
+
+    if ( ( !moreAbove ) && ( sio->searchPending ) )
+    {
+        /* Nothing more is coming, so a waiting search has failed */
+        sio->searchPending = false;
+        sio->searchOK = false;
+        beep();
+    }
+}
+// ====================================================================================================
+void SIOsetProgress( struct SIOInstance *sio, const char *what, int32_t percent )
+
+/* Show how far through some background work we are, what being NULL when there isn't any */
+
+{
+    sio->progressWhat = what;
+    sio->progress = percent;
+}
+// ====================================================================================================
+void SIOprependedOutput( struct SIOInstance *sio, int32_t numLines, int32_t added )
+
+/* Lines have been added on the front of the current buffer, so move everything that refers into it */
+
+{
+    sio->opTextWline = numLines;
+    sio->opTextRline += added;
+    sio->oldopTextRline += added;
+    sio->searchStartPos += added;
+    sio->matchCount = -1;
+
+    for ( uint32_t t = 0; t < MAX_TAGS; t++ )
+    {
+        if ( sio->tag[t] )
+        {
+            sio->tag[t] += added;
+        }
+    }
+
+    if ( sio->searchPending )
+    {
+        /* Carry on looking from where the search left off */
+        sio->searchPending = false;
+        _updateSearch( sio );
+    }
+
+    SIOrequestRefresh( sio );
+}
+// ====================================================================================================
 void SIOalert( struct SIOInstance *sio, const char *msg )
 
 {
@@ -948,10 +1358,20 @@ void SIOsetOutputBuffer( struct SIOInstance *sio, int32_t numLines, int32_t curr
     else
     {
         sio->opTextWline = sio->opTextRline = 0;
+        sio->moreAbove = sio->searchPending = false;
         _deleteTags( sio );
     }
 
+    /* A new main buffer needs indexing from scratch, but going into or out of a diving one doesn't change it */
+    if ( ( !sio->amDiving ) && ( !amDiving ) )
+    {
+        sio->sigCount = 0;
+    }
+
+    sio->matchCount = -1;
+
     sio->amDiving    = amDiving;
+    sio->redrawAll   = true;
     SIOrequestRefresh( sio );
 }
 // ====================================================================================================
@@ -971,9 +1391,15 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
         {
             op =  _processSaveFilename( sio );
         }
+        else if ( sio->searchMode )
+        {
+            /* Anything could change what's highlighted as matching, so everything needs drawing */
+            op = _processSearchKeys( sio );
+            sio->redrawAll = true;
+        }
         else
         {
-            op = ( sio->searchMode ) ? _processSearchKeys( sio ) : _processRegularKeys( sio );
+            op = _processRegularKeys( sio );
         }
 
         if ( op != SIO_EV_CONSUMED )
@@ -990,6 +1416,7 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
                     wresize( sio->statusWindow, STATUS_WINDOW_L, STATUS_WINDOW_W );
                     wresize( sio->outputWindow, OUTPUT_WINDOW_L, OUTPUT_WINDOW_W );
                     mvwin( sio->statusWindow, OUTPUT_WINDOW_L, 0 );
+                    sio->redrawAll = true;
                     op = SIO_EV_CONSUMED;
                     isTick = true;
                     SIOrequestRefresh( sio );
@@ -1030,6 +1457,17 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
         }
     }
 
+    /* If we're getting close to the top of the buffer, or a search ran off it, ask for what's above */
+    if ( ( sio->moreAbove ) && ( !sio->amDiving ) && ( sio->opTextWline ) &&
+            ( ( op == SIO_EV_NONE ) || ( op == SIO_EV_CONSUMED ) ) &&
+            ( ( sio->searchPending ) || ( sio->opTextRline < OUTPUT_WINDOW_L ) ) )
+    {
+        op = SIO_EV_EXTEND;
+    }
+
+    /* Build the search index a piece at a time, so it's ready by the time it's wanted */
+    _indexLines( sio );
+
     /* Now deal with the output windows */
     _updateWindows( sio, isTick, sio->Key != ERR, oldintervalBytes );
 
@@ -7,10 +7,21 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <time.h>
 #include "generics.h"
+#include "uthash.h"
 #include "symbols.h"
+#include "elfDwarf.h"
 
 #define MAX_LINE_LEN (4096)
 #define ELF_RELOAD_DELAY_TIME 1000000   /* Time before elf reload will be attempted when its been lost */
@@ -19,9 +30,26 @@
 #define OBJDUMP "arm-none-eabi-objdump"
 #define OBJENVNAME "OBJDUMP"
 
+#define JOBSENVNAME "ORBSYMJOBS"     /* Number of objdump processes to split the load across */
+#define MAX_OBJDUMP_JOBS (8)
+#define MIN_SHARD_FUNCTIONS (64)     /* Not worth splitting below this many functions per shard */
+
+#define CACHEENVNAME "ORBSYMCACHE"  /* Directory for symbol cache, empty to disable */
+#define CACHE_DIRNAME "orbuculum"
+#define CACHE_NAME_LEN (MAX_LINE_LEN+32)
+#define SYMCACHE_MAGIC "ORBSYMC"
+#define SYMCACHE_VERSION (2)
+#define SYMCACHE_BASE_ADDR (0x200000000000ULL) /* Where caches would like to be mapped, so they can be used in place */
+#define SYMCACHE_BASE(k) ((UINTPTR_MAX>0xffffffffULL)?(SYMCACHE_BASE_ADDR+(((k)&0x3ff)<<32)):0)
+#define SYMCACHE_FLAGS(s) ((s->demanglecpp?1:0)|(s->recordSource?2:0)|(s->recordAssy?4:0))
+
 #define SOURCE_INDICATOR "sRc##"
 #define SYM_NOT_FOUND (0xffffffff)
 
+#define NAME_BLOCK_SIZE (64*1024)   /* Size of each block of the name arena */
+
+#define RELOAD_POLL_MS (500)         /* Interval the background reload checks the elf file at */
+
 #define NO_FUNCTION_TXT "No Function Name"
 #define NO_FILE_TXT      "No Source"
 
@@ -34,7 +62,107 @@
 #endif
 
 enum LineType { LT_NOISE, LT_PROC_LABEL, LT_LABEL, LT_SOURCE, LT_ASSEMBLY, LT_FILEANDLINE, LT_NEWLINE, LT_ERROR };
-enum ProcessingState {PS_IDLE, PS_GET_SOURCE, PS_GET_ASSY} ps = PS_IDLE;
+enum ProcessingState {PS_IDLE, PS_GET_SOURCE, PS_GET_ASSY};
+
+/* A block of the arena holding file and function names. Blocks never move, so names can be pointed at */
+struct nameBlock
+{
+    struct nameBlock *next;
+    size_t used;
+    size_t size;
+    char d[];
+};
+
+/* Index entry for a file or function name, living in the arena next to the name */
+struct nameHash
+{
+    uint32_t idx;
+    UT_hash_handle hh;
+};
+
+/* One part of an objdump load split by address */
+struct objdumpShard
+{
+    struct SymbolSet s;                    /* Private tables for this part */
+    uint32_t startAddr;                    /* First address to disassemble, or 0 for the start */
+    uint32_t stopAddr;                     /* First address not to disassemble, or 0 for the end */
+    pthread_t thread;
+    bool ok;
+};
+
+/* Function start addresses, used to decide where to split */
+struct shardSplit
+{
+    uint32_t *addr;
+    uint32_t count;
+};
+
+/* A set replaced by a reload, waiting for its readers to finish with it */
+struct retiredSet
+{
+    struct SymbolSet *s;
+    uint64_t epoch;                         /* Readers that entered at or after this can't be using it */
+};
+
+/* Background reload of a symbol set */
+struct SymbolReload
+{
+    char *elfFile;                          /* What to load, and how */
+    char *deleteMaterial;
+    bool demanglecpp;
+    bool recordSource;
+    bool recordAssy;
+
+    struct SymbolSet *current;              /* The latest set, swapped atomically */
+    uint32_t generation;                    /* ...its generation, or 0 before the first */
+    uint64_t epoch;                         /* Bumped each time a set is retired */
+    uint64_t readers[SYMBOL_RELOAD_READERS]; /* Epoch each reader entered at, 0 when it's not in */
+
+    struct retiredSet *retired;             /* Sets that might still be in use (owned by the thread) */
+    uint32_t retiredCount;
+    uint32_t retiredAlloc;
+
+    bool failed;                            /* Last load failed, so it's been reported */
+    struct stat failedSt;                   /* ...and what the elf looked like when it did */
+    pthread_t thread;
+    pthread_mutex_t lock;                   /* Lock for the wakeup, for waiting and stopping */
+    pthread_cond_t cond;
+    bool finish;
+};
+
+/* Header of a symbol cache file. Everything up to fileCount must match for the cache to be used */
+struct symcacheHeader
+{
+    char magic[8];                          /* SYMCACHE_MAGIC */
+    uint32_t version;                       /* SYMCACHE_VERSION */
+    uint32_t flags;                         /* SYMCACHE_FLAGS of the set that was stored */
+    uint32_t headerSize;                    /* Sizes of the stored structures, to catch layout changes */
+    uint32_t fileSize;
+    uint32_t functionSize;
+    uint32_t sourceSize;
+    uint32_t assySize;
+    uint32_t spare;
+    int64_t elfSize;                        /* Size and modification time of the elf this came from */
+    int64_t elfMtimeSec;
+    int64_t elfMtimeNsec;
+
+    uint64_t fileCount;                     /* Table sizes... */
+    uint64_t functionCount;
+    uint64_t sourceCount;
+    uint64_t assyCount;
+    uint64_t stringsLen;
+
+    uint64_t filesOfs;                      /* ...and where they are in the file */
+    uint64_t functionsOfs;
+    uint64_t sourcesOfs;
+    uint64_t assyOfs;
+    uint64_t stringsOfs;
+    uint64_t pathOfs;                       /* Full path of elf, in string pool */
+    uint64_t deleteMaterialOfs;             /* Delete material used, in string pool */
+    uint64_t lineKeyOfs;                    /* The line index, in the same layout as lineKey... */
+    uint64_t lineEntryOfs;                  /* ...and lineEntry */
+    uint64_t mapBase;                       /* Address the stored pointers are relative to */
+};
 
 // ====================================================================================================
 // ====================================================================================================
@@ -43,19 +171,100 @@ enum ProcessingState {PS_IDLE, PS_GET_SOURCE, PS_GET_ASSY} ps = PS_IDLE;
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static void *_arenaAlloc( struct SymbolSet *s, size_t len )
+
+/* Get memory from the name arena, aligned for anything. It all goes at once when the set is deleted */
+
+{
+    struct nameBlock *b = s->names;
+    void *r;
+
+    len = ( len + 7 ) & ~( size_t )7;
+
+    if ( ( !b ) || ( b->size - b->used < len ) )
+    {
+        size_t size = ( len > NAME_BLOCK_SIZE ) ? len : NAME_BLOCK_SIZE;
+
+        b = ( struct nameBlock * )malloc( sizeof( struct nameBlock ) + size );
+        b->next = s->names;
+        b->used = 0;
+        b->size = size;
+        s->names = b;
+    }
+
+    r = &b->d[b->used];
+    b->used += len;
+    return r;
+}
+// ====================================================================================================
+static char *_addName( struct SymbolSet *s, struct nameHash **head, const char *name, uint32_t idx )
+
+/* Copy a name into the arena and index it */
+
+{
+    size_t l = strlen( name );
+    struct nameHash *h = ( struct nameHash * )_arenaAlloc( s, sizeof( struct nameHash ) + l + 1 );
+    char *n = ( char * )( h + 1 );
+
+    memcpy( n, name, l + 1 );
+    h->idx = idx;
+    HASH_ADD_KEYPTR( hh, *head, n, l, h );
+    return n;
+}
+// ====================================================================================================
+static uint32_t _findName( struct nameHash *head, const char *name )
+
+{
+    struct nameHash *h;
+
+    HASH_FIND( hh, head, name, strlen( name ), h );
+    return h ? h->idx : SYM_NOT_FOUND;
+}
+// ====================================================================================================
+static void _deleteNames( struct SymbolSet *s )
+
+/* Drop the indices and all the names with them */
+
+{
+    struct nameBlock *n;
+
+    HASH_CLEAR( hh, s->fileHash );
+    HASH_CLEAR( hh, s->functionHash );
+
+    while ( s->names )
+    {
+        n = s->names->next;
+        free( s->names );
+        s->names = n;
+    }
+}
+// ====================================================================================================
 static uint32_t _getFileEntryIdx( struct SymbolSet *s, char *filename )
 
 /* Get index to file entry in the files table, or SYM_NOT_FOUND */
 
 {
-    uint32_t i = 0;
+    return _findName( s->fileHash, filename );
+}
+// ====================================================================================================
+static uint32_t _getOrAddStrippedFileEntryIdx( struct SymbolSet *s, char *filename )
+
+/* Return index to file entry for a filename that's already had the delete material removed */
+
+{
+    uint32_t f = _getFileEntryIdx( s, filename );
 
-    while ( ( i < s->fileCount ) && ( strcmp( s->files[i].name, filename ) ) )
+    if ( SYM_NOT_FOUND == f )
     {
-        i++;
+        /* Doesn't exist, so create it */
+        s->files = ( struct fileEntry * )realloc( s->files, sizeof( struct fileEntry ) * ( s->fileCount + 1 ) );
+        f = s->fileCount;
+        memset( &( s->files[f] ), 0, sizeof( struct fileEntry ) );
+        s->files[f].name = _addName( s, &s->fileHash, filename, f );
+        s->fileCount++;
     }
 
-    return ( i < s->fileCount ) ? i : SYM_NOT_FOUND;
+    return f;
 }
 // ====================================================================================================
 static uint32_t _getOrAddFileEntryIdx( struct SymbolSet *s, char *filename )
@@ -80,19 +289,7 @@ static uint32_t _getOrAddFileEntryIdx( struct SymbolSet *s, char *filename )
     }
 
 
-    uint32_t f = _getFileEntryIdx( s, fl );
-
-    if ( SYM_NOT_FOUND == f )
-    {
-        /* Doesn't exist, so create it */
-        s->files = ( struct fileEntry * )realloc( s->files, sizeof( struct fileEntry ) * ( s->fileCount + 1 ) );
-        f = s->fileCount;
-        memset( &( s->files[f] ), 0, sizeof( struct fileEntry ) );
-        s->files[f].name = strdup( fl );
-        s->fileCount++;
-    }
-
-    return f;
+    return _getOrAddStrippedFileEntryIdx( s, fl );
 }
 // ====================================================================================================
 static uint32_t _getFunctionEntryIdx( struct SymbolSet *s, char *function )
@@ -100,14 +297,7 @@ static uint32_t _getFunctionEntryIdx( struct SymbolSet *s, char *function )
 /* Get index to file entry in the functions table, or SYM_NOT_FOUND */
 
 {
-    uint32_t i = 0;
-
-    while ( ( i < s->functionCount ) && ( strcmp( s->functions[i].name, function ) ) )
-    {
-        i++;
-    }
-
-    return ( i < s->functionCount ) ? i : SYM_NOT_FOUND;
+    return _findName( s->functionHash, function );
 }
 // ====================================================================================================
 static uint32_t _getOrAddFunctionEntryIdx( struct SymbolSet *s, char *function )
@@ -123,7 +313,7 @@ static uint32_t _getOrAddFunctionEntryIdx( struct SymbolSet *s, char *function )
         s->functions = ( struct functionEntry * )realloc( s->functions, sizeof( struct functionEntry ) * ( s->functionCount + 1 ) );
         f = s->functionCount;
         memset( &( s->functions[f] ), 0, sizeof( struct functionEntry ) );
-        s->functions[f].name = strdup( function );
+        s->functions[f].name = _addName( s, &s->functionHash, function, f );
         s->functionCount++;
     }
 
@@ -146,26 +336,18 @@ static struct sourceLineEntry *_AddSourceLineEntry( struct SymbolSet *s )
 // ====================================================================================================
 static int _compareLines( const void *a, const void *b )
 
-/* Compare two lines for ordinal value (used for bsort/bsearch) */
+/* Compare two lines for ordinal value (used for qsort). The lookup index needs a strict ordering of start addresses */
 
 {
     struct sourceLineEntry *sa = ( struct sourceLineEntry * )a;
     struct sourceLineEntry *sb = ( struct sourceLineEntry * )b;
 
-    /* Is it before the start of this line? */
-    if ( sa->startAddr < sb->startAddr )
+    if ( sa->startAddr != sb->startAddr )
     {
-        return -1;
-    }
-
-    /* Is it after the end of this line? */
-    if ( sa->startAddr > sb->endAddr )
-    {
-        return 1;
+        return ( sa->startAddr < sb->startAddr ) ? -1 : 1;
     }
 
-    /* Hmm...match must be on this line then */
-    return 0;
+    return ( sa->endAddr < sb->endAddr ) ? -1 : ( sa->endAddr > sb->endAddr );
 }
 
 // ====================================================================================================
@@ -177,6 +359,64 @@ static void _sortLines( struct SymbolSet *s )
     qsort( s->sources, s->sourceCount, sizeof( struct sourceLineEntry ), _compareLines );
 }
 
+// ====================================================================================================
+static uint32_t _buildLineIndex( struct SymbolSet *s, uint32_t i, uint32_t k )
+
+/* Lay the sorted line start addresses out in Eytzinger (breadth first tree) order, so a search walks */
+/* down through memory rather than jumping about it. Returns the next sorted entry to be placed.     */
+
+{
+    if ( k <= s->sourceCount )
+    {
+        i = _buildLineIndex( s, i, 2 * k );
+        s->lineKey[k]   = s->sources[i].startAddr;
+        s->lineEntry[k] = i++;
+        i = _buildLineIndex( s, i, 2 * k + 1 );
+    }
+
+    return i;
+}
+// ====================================================================================================
+static void _indexLines( struct SymbolSet *s )
+
+/* Build the lookup index over the (already sorted) source lines */
+
+{
+    free( s->lineKey );
+    free( s->lineEntry );
+    s->lineKey   = ( uint32_t * )calloc( s->sourceCount + 1, sizeof( uint32_t ) );
+    s->lineEntry = ( uint32_t * )calloc( s->sourceCount + 1, sizeof( uint32_t ) );
+    _buildLineIndex( s, 0, 1 );
+}
+// ====================================================================================================
+static struct sourceLineEntry *_findLine( struct SymbolSet *s, uint32_t addr )
+
+/* Find the line containing addr, by locating the first line that starts after it and stepping back one */
+
+{
+    uint32_t n = s->sourceCount;
+    uint32_t k = 1;
+    uint32_t next;
+    struct sourceLineEntry *l;
+
+    while ( k <= n )
+    {
+        __builtin_prefetch( &s->lineKey[( k * 16 ) <= n ? k * 16 : 0] );
+        k = 2 * k + ( s->lineKey[k] <= addr );
+    }
+
+    /* Unwind the right turns to get to the last left turn, which is the first key greater than addr */
+    k >>= __builtin_ffs( ~k );
+    next = k ? s->lineEntry[k] : n;
+
+    if ( !next )
+    {
+        return NULL;
+    }
+
+    l = &s->sources[next - 1];
+    return ( addr <= l->endAddr ) ? l : NULL;
+}
 // ====================================================================================================
 static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
                           uint32_t *fileindex, uint32_t *functionindex, uint32_t *pline,
@@ -187,8 +427,7 @@ static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
 /* Find symbol and return pointers to contents */
 
 {
-    struct sourceLineEntry needle = { .startAddr = workingAddr, .endAddr = workingAddr };
-    struct sourceLineEntry *found = bsearch( &needle, s->sources, s->sourceCount, sizeof( struct sourceLineEntry ), _compareLines );
+    struct sourceLineEntry *found = _findLine( s, workingAddr );
 
     if ( found )
     {
@@ -199,21 +438,25 @@ static bool _find_symbol( struct SymbolSet *s, uint32_t workingAddr,
         *fileindex     = found->fileIdx;
         *functionindex = found->functionIdx;
 
-        /* If there is assembly then match the line too */
-        for ( *assyLine = 0; *assyLine < found->assyLines; ( *assyLine )++ )
+        /* If there is assembly then match the line too...it's in address order */
+        uint32_t lo = 0, hi = found->assyLines;
+
+        while ( lo < hi )
         {
-            if ( ( *assy )[*assyLine].addr == workingAddr )
+            uint32_t mid = ( lo + hi ) / 2;
+
+            if ( ( *assy )[mid].addr < workingAddr )
             {
-                break;
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
             }
         }
 
         /* If the assembly line wasn't found then indicate that */
-        if ( *assyLine == found->assyLines )
-        {
-            *assyLine = ASSY_NOT_FOUND;
-        }
-
+        *assyLine = ( ( lo < found->assyLines ) && ( ( *assy )[lo].addr == workingAddr ) ) ? lo : ASSY_NOT_FOUND;
         return true;
     }
 
@@ -302,12 +545,159 @@ static bool _getDest( char *assy, uint32_t *dest )
     return ( 1 == sscanf( assy, "%*[^\t]\tr%*[0-7],%x", dest ) );
 }
 // ====================================================================================================
-static bool _getTargetProgramInfo( struct SymbolSet *s )
+// Text spool
+// ====================================================================================================
+// Source and assembly text runs to one string per instruction, which on a big image is a lot of
+// memory for something that's only ever looked at a screenful at a time. While objdump output is
+// being parsed the text is written out to an unlinked temporary file, with the string pointers
+// holding offsets into it. Once parsing is complete the file is mapped and the pointers relocated,
+// so text is only read in when it's looked at, and the kernel is free to drop it again afterwards.
+// ====================================================================================================
+static char *_textOffset( char *str, ptrdiff_t ofs )
+
+/* Offset into a string, which may still be a spool offset rather than a real pointer */
+
+{
+    return ( char * )( ( uintptr_t )str + ofs );
+}
+// ====================================================================================================
+static char *_storeText( struct SymbolSet *s, const char *str )
+
+/* Keep a copy of a string, in the spool if there is one. Spool offsets are biased by one, so zero stays NULL */
+
+{
+    uint64_t l;
+
+    if ( !s->spool )
+    {
+        return strdup( str );
+    }
+
+    l = strlen( str ) + 1;
+    fwrite( str, 1, l, s->spool );
+    s->spoolLen += l;
+    return ( char * )( uintptr_t )( s->spoolLen - l + 1 );
+}
+// ====================================================================================================
+static bool _openSpool( struct SymbolSet *s )
+
+{
+    char name[MAX_LINE_LEN];
+    const char *dir = getenv( "TMPDIR" );
+    int fd;
+
+    snprintf( name, MAX_LINE_LEN, "%s/orbsymXXXXXX", ( dir && *dir ) ? dir : "/tmp" );
+
+    if ( ( fd = mkstemp( name ) ) < 0 )
+    {
+        return false;
+    }
+
+    /* Nobody else needs to see it, and it disappears when we're done with it */
+    unlink( name );
+
+    if ( !( s->spool = fdopen( fd, "w+b" ) ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    s->spoolLen = 0;
+    return true;
+}
+// ====================================================================================================
+static char *_relocateText( struct SymbolSet *s, char *p )
+
+{
+    return p ? ( char * )s->textMap + ( ( uintptr_t )p - 1 ) : NULL;
+}
+// ====================================================================================================
+static void _abandonSpool( struct SymbolSet *s, bool sourcesToo )
+
+/* Drop the spool, clearing out any pointers that referred to it so nobody tries to free them */
+
+{
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        for ( uint32_t j = 0; j < s->sources[i].assyLines; j++ )
+        {
+            s->sources[i].assy[j].lineText = s->sources[i].assy[j].label = s->sources[i].assy[j].assy = NULL;
+        }
+
+        if ( sourcesToo )
+        {
+            s->sources[i].lineText = NULL;
+        }
+    }
+
+    fclose( s->spool );
+    s->spool = NULL;
+}
+// ====================================================================================================
+static bool _mapSpool( struct SymbolSet *s )
+
+/* Parsing is complete, so move the source text over too, then map it all in and fix up the pointers */
+
+{
+    char *t;
+
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        if ( ( t = s->sources[i].lineText ) )
+        {
+            s->sources[i].lineText = _storeText( s, t );
+            free( t );
+        }
+    }
+
+    if ( ( fflush( s->spool ) ) || ( ferror( s->spool ) ) )
+    {
+        _abandonSpool( s, true );
+        return false;
+    }
+
+    if ( s->spoolLen )
+    {
+        s->textMap = mmap( NULL, s->spoolLen, PROT_READ, MAP_PRIVATE, fileno( s->spool ), 0 );
+
+        if ( s->textMap == MAP_FAILED )
+        {
+            s->textMap = NULL;
+            _abandonSpool( s, true );
+            return false;
+        }
+
+        s->textLen = s->spoolLen;
+    }
+
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        s->sources[i].lineText = _relocateText( s, s->sources[i].lineText );
+
+        for ( uint32_t j = 0; j < s->sources[i].assyLines; j++ )
+        {
+            struct assyLineEntry *a = &s->sources[i].assy[j];
+            a->lineText = _relocateText( s, a->lineText );
+            a->label    = _relocateText( s, a->label );
+            a->assy     = _relocateText( s, a->assy );
+        }
+    }
+
+    /* The mapping holds its own reference to the file */
+    fclose( s->spool );
+    s->spool = NULL;
+    return true;
+}
+// ====================================================================================================
+static bool _readObjdump( struct SymbolSet *s, uint32_t startAddr, uint32_t stopAddr )
 
 /* Analyse line returned by objdump and categorise it, putting results into correct structures. */
 /* If objdump output is misinterpreted, this is the second place to check */
+/* A stopAddr other than zero restricts the disassembly to that part of the image */
 
 {
+    enum ProcessingState ps = PS_IDLE;          /* Where we're up to in the state machine */
+    char range[64] = "";                        /* Any address range restriction */
     FILE *f;                                    /* Connection to objdum process */
     char line[MAX_LINE_LEN];                    /* Line read from objdump process */
     char commandLine[MAX_LINE_LEN];             /* Command line used to run objdump */
@@ -327,19 +717,29 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
     uint32_t functionEntryIdx;                  /* Index into function entry table */
     uint32_t nullFileEntry;                     /* Tag for when we don't have a filename */
     struct sourceLineEntry *sourceEntry = NULL; /* pointer to current source entry */
+    char *assyText;                             /* Start of the assembly in the current line */
 
     if ( stat( s->elfFile, &s->st ) != 0 )
     {
         return false;
     }
 
+    if ( stopAddr )
+    {
+        snprintf( range, sizeof( range ), " --start-address=0x%08x --stop-address=0x%08x", startAddr, stopAddr );
+    }
+    else if ( startAddr )
+    {
+        snprintf( range, sizeof( range ), " --start-address=0x%08x", startAddr );
+    }
+
     if ( getenv( OBJENVNAME ) )
     {
-        snprintf( commandLine, MAX_LINE_LEN, "%s -Sl%s --source-comment=" SOURCE_INDICATOR " %s", getenv( OBJENVNAME ),  s->demanglecpp ? " -C" : "", s->elfFile );
+        snprintf( commandLine, MAX_LINE_LEN, "%s -Sl%s%s --source-comment=" SOURCE_INDICATOR " %s", getenv( OBJENVNAME ),  s->demanglecpp ? " -C" : "", range, s->elfFile );
     }
     else
     {
-        snprintf( commandLine, MAX_LINE_LEN, OBJDUMP " -Sl%s --source-comment=" SOURCE_INDICATOR " %s",  s->demanglecpp ? " -C" : "", s->elfFile );
+        snprintf( commandLine, MAX_LINE_LEN, OBJDUMP " -Sl%s%s --source-comment=" SOURCE_INDICATOR " %s",  s->demanglecpp ? " -C" : "", range, s->elfFile );
     }
 
     f = popen( commandLine, "r" );
@@ -354,10 +754,9 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
     functionEntryIdx = _getOrAddFunctionEntryIdx( s, NO_FUNCTION_TXT );
     nullFileEntry    = fileEntryIdx = _getOrAddFileEntryIdx( s, NO_FILE_TXT );
 
-    while ( !feof( f ) )
+    /* Checking fgets rather than feof, otherwise the last line gets processed twice */
+    while ( fgets( line, MAX_LINE_LEN, f ) )
     {
-        fgets( line, MAX_LINE_LEN, f );
-
         lt = _getLineType( line, p1, p2, p3, p4 );
 
         if ( lt == LT_ERROR )
@@ -556,20 +955,21 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
                                 sourceEntry->assy[sourceEntry->assyLines].codes |= ( strtoul( p2, NULL, 16 ) << 16 );
                             }
 
-                            sourceEntry->assy[sourceEntry->assyLines].lineText  = strdup( line );
+                            sourceEntry->assy[sourceEntry->assyLines].lineText  = _storeText( s, line );
                             sourceEntry->assy[sourceEntry->assyLines].isJump    = false;
                             sourceEntry->assy[sourceEntry->assyLines].isReturn  = false;
                             sourceEntry->assy[sourceEntry->assyLines].isSubCall = false;
                             sourceEntry->assy[sourceEntry->assyLines].jumpdest  = NO_DESTADDRESS;
 
                             /* Just hook the assy pointer to the location in the line where the assembly itself starts */
-                            sourceEntry->assy[sourceEntry->assyLines].assy = strstr( sourceEntry->assy[sourceEntry->assyLines].lineText, p4 );
+                            assyText = strstr( line, p4 );
+                            sourceEntry->assy[sourceEntry->assyLines].assy = assyText ? _textOffset( sourceEntry->assy[sourceEntry->assyLines].lineText, assyText - line ) : NULL;
 
                             /* Record the label is there was one */
-                            sourceEntry->assy[sourceEntry->assyLines].label = *label ? strdup( label ) : NULL;
+                            sourceEntry->assy[sourceEntry->assyLines].label = *label ? _storeText( s, label ) : NULL;
                             GTPIP( "%08x %x [%s]" EOL, sourceEntry->assy[sourceEntry->assyLines].addr,
                                    sourceEntry->assy[sourceEntry->assyLines].codes,
-                                   sourceEntry->assy[sourceEntry->assyLines].lineText );
+                                   line );
 
 #define MASKED_COMPARE(mask,compare) (((sourceEntry->assy[sourceEntry->assyLines].codes)&(mask))==(compare))
 
@@ -585,7 +985,7 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
                             )
                             {
                                 sourceEntry->assy[sourceEntry->assyLines].isSubCall = true;
-                                _getDest( sourceEntry->assy[sourceEntry->assyLines].assy, &sourceEntry->assy[sourceEntry->assyLines].jumpdest );
+                                _getDest( assyText, &sourceEntry->assy[sourceEntry->assyLines].jumpdest );
                             }
 
                             /* Returns are selected via the function output_return_instruction in arm.c in the gcc source.              */
@@ -618,9 +1018,9 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
                             {
                                 sourceEntry->assy[sourceEntry->assyLines].isJump = true;
 
-                                if ( !_getDest( sourceEntry->assy[sourceEntry->assyLines].assy, &sourceEntry->assy[sourceEntry->assyLines].jumpdest ) )
+                                if ( !_getDest( assyText, &sourceEntry->assy[sourceEntry->assyLines].jumpdest ) )
                                 {
-                                    GTPIP( "Failed to get jump destination for text %s " EOL, sourceEntry->assy[sourceEntry->assyLines].assy );
+                                    GTPIP( "Failed to get jump destination for text %s " EOL, assyText );
                                 }
                             }
 
@@ -659,63 +1059,1411 @@ static bool _getTargetProgramInfo( struct SymbolSet *s )
         return false;
     }
 
-    _sortLines( s );
     return true;
 }
 // ====================================================================================================
-const char *SymbolFilename( struct SymbolSet *s, uint32_t index )
+static void _deleteTables( struct SymbolSet *s )
+
+/* Delete the file, function and source tables, leaving an empty symbol set */
 
 {
-    switch ( index )
+    if ( s->cacheMap )
     {
-        default:
-            if ( index < s->fileCount )
+        /* All of the tables, and the line index, live in the mapped cache, so there's nothing else to free */
+        munmap( s->cacheMap, s->cacheLen );
+        s->cacheMap = NULL;
+        s->files = NULL;
+        s->functions = NULL;
+        s->sources = NULL;
+        s->lineKey = NULL;
+        s->lineEntry = NULL;
+    }
+
+    /* File and function names all live in the arena */
+    _deleteNames( s );
+    free( s->files );
+    free( s->functions );
+
+    /* Free off any sources dynamic memory we allocated */
+    if ( s->sources )
+    {
+        for ( uint32_t i = 0; i < s->sourceCount; i++ )
+        {
+            /* Text that lives in the spool mapping goes with it */
+            if ( ( s->sources[i].lineText ) && ( !s->textMap ) )
             {
-                return s->files[index].name;
+                free( s->sources[i].lineText );
             }
 
-            return "NONE";
+            /* For any source line, free off it's assembly if there is some */
+            if ( s->sources[i].assy )
+            {
+                for ( uint32_t j = 0; ( j < s->sources[i].assyLines ) && ( !s->textMap ); j++ )
+                {
+                    if ( s->sources[i].assy[j].label )
+                    {
+                        free( s->sources[i].assy[j].label );
+                    }
+
+                    if ( s->sources[i].assy[j].lineText )
+                    {
+                        free( s->sources[i].assy[j].lineText );
+                    }
+                }
+
+                free( s->sources[i].assy );
+            }
+        }
+
+        free( s->sources );
+    }
+
+    if ( s->textMap )
+    {
+        munmap( s->textMap, s->textLen );
+        s->textMap = NULL;
     }
+
+    s->files = NULL;
+    s->functions = NULL;
+    s->sources = NULL;
+    s->fileCount = s->functionCount = s->sourceCount = 0;
 }
 // ====================================================================================================
-const char *SymbolFunction( struct SymbolSet *s, uint32_t index )
+static void _shardFunctionCB( void *ctx, const char *name, uint32_t addr, uint32_t size, bool isGlobal )
 
 {
-    switch ( index )
-    {
-        case FN_SLEEPING:
-            return FN_SLEEPING_STR;
+    struct shardSplit *p = ( struct shardSplit * )ctx;
 
-        case INTERRUPT:
-            return FN_INTERRUPT_STR;
+    p->addr = ( uint32_t * )realloc( p->addr, sizeof( uint32_t ) * ( p->count + 1 ) );
+    p->addr[p->count++] = addr;
+}
+// ====================================================================================================
+static int _compareAddr( const void *a, const void *b )
 
-        default:
-            if ( index < s->functionCount )
-            {
-                return s->functions[index].name;
-            }
+{
+    uint32_t aa = *( const uint32_t * )a;
+    uint32_t ab = *( const uint32_t * )b;
 
-            return "NONE";
-    }
+    return ( aa < ab ) ? -1 : ( aa > ab );
 }
 // ====================================================================================================
-bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
+static uint32_t _getShardJobs( void )
 
-/* Lookup function for address to line, and hence to function */
+/* Work out how many objdumps we'd like running at once */
 
 {
-    const char *source   = NULL;
-    uint32_t fileindex;
-    uint32_t functionindex;
-    const struct assyLineEntry *assy = NULL;
-    uint32_t assyLine;
-    uint16_t linesInBlock;
-    uint32_t line;
+    long jobs = sysconf( _SC_NPROCESSORS_ONLN );
 
-    memset( n, 0, sizeof( struct nameEntry ) );
-    assert( s );
-
-    if ( ( addr & SPECIALS_MASK ) == SPECIALS_MASK )
+    if ( getenv( JOBSENVNAME ) )
+    {
+        jobs = atol( getenv( JOBSENVNAME ) );
+    }
+
+    return ( jobs < 1 ) ? 1 : ( jobs > MAX_OBJDUMP_JOBS ) ? MAX_OBJDUMP_JOBS : jobs;
+}
+// ====================================================================================================
+static uint32_t _splitShards( struct SymbolSet *s, struct objdumpShard *sh, uint32_t jobs )
+
+/* Split the image into up to jobs shards on function boundaries, so no function is cut in two */
+
+{
+    struct shardSplit p = { 0 };
+    uint32_t unique = 0;
+    uint32_t n;
+
+    /* The symbol table tells us where the functions start, without needing objdump to do it */
+    if ( !ElfDwarfLoad( s->elfFile, _shardFunctionCB, NULL, &p ) )
+    {
+        free( p.addr );
+        return 1;
+    }
+
+    qsort( p.addr, p.count, sizeof( uint32_t ), _compareAddr );
+
+    for ( uint32_t i = 0; i < p.count; i++ )
+    {
+        if ( ( !unique ) || ( p.addr[i] != p.addr[unique - 1] ) )
+        {
+            p.addr[unique++] = p.addr[i];
+        }
+    }
+
+    /* Splitting by function count rather than address keeps a sparse memory map from unbalancing things */
+    n = ( unique / MIN_SHARD_FUNCTIONS < jobs ) ? unique / MIN_SHARD_FUNCTIONS : jobs;
+
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        sh[i].startAddr = i ? p.addr[( uint64_t )unique * i / n] : 0;
+        sh[i].stopAddr  = ( i < n - 1 ) ? p.addr[( uint64_t )unique * ( i + 1 ) / n] : 0;
+    }
+
+    free( p.addr );
+    return n ? n : 1;
+}
+// ====================================================================================================
+static void *_shardThread( void *arg )
+
+{
+    struct objdumpShard *sh = ( struct objdumpShard * )arg;
+
+    sh->ok = _readObjdump( &sh->s, sh->startAddr, sh->stopAddr );
+    return NULL;
+}
+// ====================================================================================================
+static char *_mergeText( struct SymbolSet *s, char *str )
+
+/* Take ownership of text from a shard, moving it into the spool if we have one */
+
+{
+    char *r;
+
+    if ( ( !str ) || ( !s->spool ) )
+    {
+        return str;
+    }
+
+    r = _storeText( s, str );
+    free( str );
+    return r;
+}
+// ====================================================================================================
+static void _mergeShard( struct SymbolSet *s, struct SymbolSet *h )
+
+/* Move the contents of a shard into the main set, leaving the shard with nothing left to free but its tables. */
+/* Source text stays where it is, it goes into any spool with the rest once the load is complete */
+
+{
+    uint32_t *fileMap = ( uint32_t * )malloc( sizeof( uint32_t ) * ( h->fileCount + 1 ) );
+    uint32_t *functionMap = ( uint32_t * )malloc( sizeof( uint32_t ) * ( h->functionCount + 1 ) );
+
+    for ( uint32_t i = 0; i < h->fileCount; i++ )
+    {
+        fileMap[i] = _getOrAddStrippedFileEntryIdx( s, h->files[i].name );
+    }
+
+    for ( uint32_t i = 0; i < h->functionCount; i++ )
+    {
+        struct functionEntry *f = &h->functions[i];
+        functionMap[i] = _getOrAddFunctionEntryIdx( s, f->name );
+
+        /* Shards are merged in address order, so later ones win just as they would have in a single pass */
+        if ( ( f->startAddr ) || ( f->endAddr ) )
+        {
+            s->functions[functionMap[i]].startAddr = f->startAddr;
+            s->functions[functionMap[i]].endAddr = f->endAddr;
+            s->functions[functionMap[i]].fileEntryIdx = ( f->fileEntryIdx < h->fileCount ) ? fileMap[f->fileEntryIdx] : f->fileEntryIdx;
+        }
+    }
+
+    s->sources = ( struct sourceLineEntry * )realloc( s->sources, sizeof( struct sourceLineEntry ) * ( s->sourceCount + h->sourceCount ) );
+
+    for ( uint32_t i = 0; i < h->sourceCount; i++ )
+    {
+        struct sourceLineEntry *d = &s->sources[s->sourceCount++];
+        *d = h->sources[i];
+        d->fileIdx = ( d->fileIdx < h->fileCount ) ? fileMap[d->fileIdx] : d->fileIdx;
+        d->functionIdx = ( d->functionIdx < h->functionCount ) ? functionMap[d->functionIdx] : d->functionIdx;
+
+        for ( uint32_t j = 0; j < d->assyLines; j++ )
+        {
+            struct assyLineEntry *a = &d->assy[j];
+            ptrdiff_t ofs = a->assy ? a->assy - a->lineText : 0;
+            bool hasAssy = ( a->assy != NULL );
+
+            a->label = _mergeText( s, a->label );
+            a->lineText = _mergeText( s, a->lineText );
+            a->assy = hasAssy ? _textOffset( a->lineText, ofs ) : NULL;
+        }
+    }
+
+    /* The sources now belong to the main set, so the shard mustn't free anything hanging off them */
+    h->sourceCount = 0;
+
+    free( fileMap );
+    free( functionMap );
+}
+// ====================================================================================================
+static bool _readObjdumpSharded( struct SymbolSet *s )
+
+/* Run objdump over the image, split across several processes if it's big enough to be worth it */
+
+{
+    struct objdumpShard sh[MAX_OBJDUMP_JOBS] = { 0 };
+    uint32_t jobs = _getShardJobs();
+    bool ok = true;
+
+    if ( jobs > 1 )
+    {
+        jobs = _splitShards( s, sh, jobs );
+    }
+
+    if ( jobs <= 1 )
+    {
+        return _readObjdump( s, 0, 0 );
+    }
+
+    genericsReport( V_DEBUG, "Loading symbols with %u objdump processes" EOL, jobs );
+
+    for ( uint32_t i = 0; i < jobs; i++ )
+    {
+        sh[i].s.elfFile        = s->elfFile;
+        sh[i].s.deleteMaterial = s->deleteMaterial;
+        sh[i].s.recordSource   = s->recordSource;
+        sh[i].s.recordAssy     = s->recordAssy;
+        sh[i].s.demanglecpp    = s->demanglecpp;
+
+        if ( pthread_create( &sh[i].thread, NULL, _shardThread, &sh[i] ) )
+        {
+            /* Couldn't get a thread, so just do it here */
+            _shardThread( &sh[i] );
+            sh[i].thread = pthread_self();
+        }
+    }
+
+    for ( uint32_t i = 0; i < jobs; i++ )
+    {
+        if ( !pthread_equal( sh[i].thread, pthread_self() ) )
+        {
+            pthread_join( sh[i].thread, NULL );
+        }
+
+        ok &= sh[i].ok;
+    }
+
+    /* Give the null entries the same indices they'd have had from a single pass */
+    _getOrAddFunctionEntryIdx( s, NO_FUNCTION_TXT );
+    _getOrAddStrippedFileEntryIdx( s, NO_FILE_TXT );
+
+    for ( uint32_t i = 0; i < jobs; i++ )
+    {
+        if ( ok )
+        {
+            _mergeShard( s, &sh[i].s );
+        }
+
+        _deleteTables( &sh[i].s );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+static bool _getTargetProgramInfo( struct SymbolSet *s )
+
+/* Load the symbol set from objdump, with any text it carries going via the spool if we can get one */
+
+{
+    bool ok;
+
+    if ( ( s->recordSource ) || ( s->recordAssy ) )
+    {
+        _openSpool( s );
+    }
+
+    ok = _readObjdumpSharded( s );
+
+    if ( s->spool )
+    {
+        if ( ok )
+        {
+            ok = _mapSpool( s );
+        }
+        else
+        {
+            _abandonSpool( s, false );
+        }
+    }
+
+    if ( ok )
+    {
+        _sortLines( s );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+// Native loader
+// ====================================================================================================
+// When neither source text nor assembly is wanted all we need is the function and line tables,
+// and those can be read straight out of the elf a great deal faster than objdump can print them.
+// ====================================================================================================
+
+/* A function symbol as reported from the elf */
+struct nativeFunction
+{
+    const char *name;
+    uint32_t addr;
+    uint32_t size;
+    bool isGlobal;
+    uint32_t functionIdx;                   /* Index into the symbol set functions table */
+};
+
+/* A contiguous address range belonging to one source line */
+struct nativeRange
+{
+    uint32_t startAddr;
+    uint32_t endAddr;                       /* Inclusive */
+    uint32_t lineNo;
+    uint32_t fileIdx;
+};
+
+/* State built up while the elf is being read */
+struct nativeLoad
+{
+    struct SymbolSet *s;
+
+    struct nativeFunction *fn;
+    uint32_t fnCount;
+    uint32_t fnSize;
+
+    struct nativeRange *range;
+    uint32_t rangeCount;
+    uint32_t rangeSize;
+
+    char lastFile[MAX_LINE_LEN];            /* Most recent file, to save looking it up on every row */
+    uint32_t lastFileIdx;
+    bool rowValid;                          /* Previous row in the sequence, which this row terminates */
+    uint32_t rowAddr;
+    uint32_t rowLine;
+    uint32_t rowFileIdx;
+};
+// ====================================================================================================
+static void _nativeFunctionCB( void *ctx, const char *name, uint32_t addr, uint32_t size, bool isGlobal )
+
+{
+    struct nativeLoad *l = ( struct nativeLoad * )ctx;
+
+    if ( l->fnCount == l->fnSize )
+    {
+        l->fnSize = l->fnSize ? l->fnSize * 2 : 256;
+        l->fn = ( struct nativeFunction * )realloc( l->fn, sizeof( struct nativeFunction ) * l->fnSize );
+    }
+
+    l->fn[l->fnCount].name = strdup( name );
+    l->fn[l->fnCount].addr = addr;
+    l->fn[l->fnCount].size = size;
+    l->fn[l->fnCount].isGlobal = isGlobal;
+    l->fnCount++;
+}
+// ====================================================================================================
+static void _addNativeRange( struct nativeLoad *l, uint32_t startAddr, uint32_t endAddr, uint32_t lineNo, uint32_t fileIdx )
+
+{
+    struct nativeRange *r = l->rangeCount ? &l->range[l->rangeCount - 1] : NULL;
+
+    /* Consecutive rows for the same line are folded together, as objdump would show them */
+    if ( ( r ) && ( r->endAddr + 1 == startAddr ) && ( r->lineNo == lineNo ) && ( r->fileIdx == fileIdx ) )
+    {
+        r->endAddr = endAddr;
+        return;
+    }
+
+    if ( l->rangeCount == l->rangeSize )
+    {
+        l->rangeSize = l->rangeSize ? l->rangeSize * 2 : 1024;
+        l->range = ( struct nativeRange * )realloc( l->range, sizeof( struct nativeRange ) * l->rangeSize );
+    }
+
+    r = &l->range[l->rangeCount++];
+    r->startAddr = startAddr;
+    r->endAddr   = endAddr;
+    r->lineNo    = lineNo;
+    r->fileIdx   = fileIdx;
+}
+// ====================================================================================================
+static void _nativeLineCB( void *ctx, const char *file, uint32_t line, uint32_t addr, bool endSequence )
+
+{
+    struct nativeLoad *l = ( struct nativeLoad * )ctx;
+
+    /* Each row runs up to the start of the next one */
+    if ( ( l->rowValid ) && ( addr > l->rowAddr ) )
+    {
+        _addNativeRange( l, l->rowAddr, addr - 1, l->rowLine, l->rowFileIdx );
+    }
+
+    if ( endSequence )
+    {
+        l->rowValid = false;
+        return;
+    }
+
+    if ( ( !l->lastFileIdx ) || ( strcmp( file, l->lastFile ) ) )
+    {
+        snprintf( l->lastFile, MAX_LINE_LEN, "%s", file );
+        l->lastFileIdx = _getOrAddFileEntryIdx( l->s, l->lastFile );
+    }
+
+    l->rowValid   = true;
+    l->rowAddr    = addr;
+    l->rowLine    = line;
+    l->rowFileIdx = l->lastFileIdx;
+}
+// ====================================================================================================
+static int _compareNativeFunctions( const void *a, const void *b )
+
+/* Sort by address, with globals first so they're the ones that win for aliased addresses */
+
+{
+    const struct nativeFunction *fa = ( const struct nativeFunction * )a;
+    const struct nativeFunction *fb = ( const struct nativeFunction * )b;
+
+    if ( fa->addr != fb->addr )
+    {
+        return ( fa->addr < fb->addr ) ? -1 : 1;
+    }
+
+    if ( fa->isGlobal != fb->isGlobal )
+    {
+        return fa->isGlobal ? -1 : 1;
+    }
+
+    return strcmp( fa->name, fb->name );
+}
+// ====================================================================================================
+static int _compareNativeRanges( const void *a, const void *b )
+
+{
+    const struct nativeRange *ra = ( const struct nativeRange * )a;
+    const struct nativeRange *rb = ( const struct nativeRange * )b;
+
+    if ( ra->startAddr != rb->startAddr )
+    {
+        return ( ra->startAddr < rb->startAddr ) ? -1 : 1;
+    }
+
+    return ( ra->endAddr > rb->endAddr ) ? -1 : ( ra->endAddr < rb->endAddr );
+}
+// ====================================================================================================
+static uint32_t _nativeFunctionAt( struct nativeLoad *l, uint32_t addr )
+
+/* Find the function at or immediately before this address, or its index in fn[] if there isn't one */
+
+{
+    uint32_t lo = 0, hi = l->fnCount;
+
+    while ( lo < hi )
+    {
+        uint32_t mid = ( lo + hi ) / 2;
+
+        if ( l->fn[mid].addr <= addr )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo ? lo - 1 : l->fnCount;
+}
+// ====================================================================================================
+static void _addNativeSource( struct nativeLoad *l, struct nativeRange *r, uint32_t nullFileEntry )
+
+{
+    struct sourceLineEntry *src = _AddSourceLineEntry( l->s );
+    uint32_t f = _nativeFunctionAt( l, r->startAddr );
+
+    src->startAddr   = r->startAddr;
+    src->endAddr     = r->endAddr;
+    src->lineNo      = r->lineNo;
+    src->fileIdx     = r->fileIdx;
+    src->functionIdx = ( f < l->fnCount ) ? l->fn[f].functionIdx : 0;
+
+    /* Attach the function to the file its first line with a real file lives in */
+    if ( ( f < l->fnCount ) && ( r->fileIdx != nullFileEntry ) && ( l->s->functions[src->functionIdx].fileEntryIdx == nullFileEntry ) )
+    {
+        l->s->functions[src->functionIdx].fileEntryIdx = r->fileIdx;
+    }
+}
+// ====================================================================================================
+static void _fillNativeGap( struct nativeLoad *l, uint32_t startAddr, uint32_t endAddr, uint32_t fnStart, uint32_t nullFileEntry )
+
+/* Cover code in a function that has no line information. As objdump would, it's counted as part of */
+/* the line before it if there is one, otherwise it's an entry with no source of its own.           */
+
+{
+    struct sourceLineEntry *prev = l->s->sourceCount ? &l->s->sources[l->s->sourceCount - 1] : NULL;
+
+    if ( ( prev ) && ( prev->endAddr + 1 == startAddr ) && ( prev->startAddr >= fnStart ) )
+    {
+        prev->endAddr = endAddr;
+    }
+    else
+    {
+        struct nativeRange gap = { .startAddr = startAddr, .endAddr = endAddr, .fileIdx = nullFileEntry };
+        _addNativeSource( l, &gap, nullFileEntry );
+    }
+}
+// ====================================================================================================
+static bool _getNativeProgramInfo( struct SymbolSet *s )
+
+/* Populate the function and line tables directly from the elf symbol table and DWARF line program */
+
+{
+    struct nativeLoad l = { .s = s };
+    uint32_t nullFileEntry;
+    uint32_t kept = 0;
+    bool ok;
+
+    /* Create the null entries */
+    _getOrAddFunctionEntryIdx( s, NO_FUNCTION_TXT );
+    nullFileEntry = _getOrAddFileEntryIdx( s, NO_FILE_TXT );
+
+    ok = ElfDwarfLoad( s->elfFile, _nativeFunctionCB, _nativeLineCB, &l );
+
+    /* We can't demangle names ourselves, so leave anything that needs it to objdump */
+    for ( uint32_t i = 0; ( ok ) && ( s->demanglecpp ) && ( i < l.fnCount ); i++ )
+    {
+        ok = strncmp( l.fn[i].name, "_Z", 2 );
+    }
+
+    if ( ( ok ) && ( !l.rangeCount ) )
+    {
+        /* A line table with nothing in it isn't worth having */
+        ok = false;
+    }
+
+    if ( ok )
+    {
+        /* Where several symbols share an address only the first (preferably global) one is kept */
+        qsort( l.fn, l.fnCount, sizeof( struct nativeFunction ), _compareNativeFunctions );
+
+        for ( uint32_t i = 0; i < l.fnCount; i++ )
+        {
+            if ( ( kept ) && ( l.fn[kept - 1].addr == l.fn[i].addr ) )
+            {
+                free( ( char * )l.fn[i].name );
+                continue;
+            }
+
+            l.fn[kept++] = l.fn[i];
+        }
+
+        l.fnCount = kept;
+
+        for ( uint32_t i = 0; i < l.fnCount; i++ )
+        {
+            /* Hand written assembly often doesn't bother with sizes, so run those up to whatever comes next */
+            if ( ( !l.fn[i].size ) && ( i + 1 < l.fnCount ) )
+            {
+                l.fn[i].size = l.fn[i + 1].addr - l.fn[i].addr;
+            }
+
+            l.fn[i].functionIdx = _getOrAddFunctionEntryIdx( s, ( char * )l.fn[i].name );
+            s->functions[l.fn[i].functionIdx].startAddr    = l.fn[i].addr;
+            s->functions[l.fn[i].functionIdx].endAddr      = l.fn[i].addr + ( l.fn[i].size ? l.fn[i].size - 1 : 0 );
+            s->functions[l.fn[i].functionIdx].fileEntryIdx = nullFileEntry;
+        }
+
+        /* Line sequences from different compilation units can arrive in any order, and can overlap */
+        qsort( l.range, l.rangeCount, sizeof( struct nativeRange ), _compareNativeRanges );
+        kept = 0;
+
+        for ( uint32_t i = 0; i < l.rangeCount; i++ )
+        {
+            if ( kept )
+            {
+                struct nativeRange *p = &l.range[kept - 1];
+
+                if ( l.range[i].endAddr <= p->endAddr )
+                {
+                    continue;
+                }
+
+                if ( l.range[i].startAddr <= p->endAddr )
+                {
+                    l.range[i].startAddr = p->endAddr + 1;
+                }
+            }
+
+            l.range[kept++] = l.range[i];
+        }
+
+        l.rangeCount = kept;
+
+        /* Walk functions and lines together, so code in a function without line info still gets an entry */
+        uint32_t r = 0;
+        uint64_t done = 0;
+
+        for ( uint32_t f = 0; f <= l.fnCount; f++ )
+        {
+            uint64_t fnStart = ( f < l.fnCount ) ? l.fn[f].addr : 0x100000000ULL;
+            uint64_t fnEnd = fnStart + ( ( f < l.fnCount ) && ( l.fn[f].size ) ? l.fn[f].size - 1 : 0 );
+
+            /* First any lines before this function starts */
+            while ( ( r < l.rangeCount ) && ( l.range[r].startAddr < fnStart ) )
+            {
+                _addNativeSource( &l, &l.range[r], nullFileEntry );
+                done = ( uint64_t )l.range[r++].endAddr + 1;
+            }
+
+            if ( ( f == l.fnCount ) || ( !l.fn[f].size ) )
+            {
+                continue;
+            }
+
+            /* ...then the lines inside it, filling any gaps */
+            uint64_t cursor = ( done > fnStart ) ? done : fnStart;
+
+            while ( ( r < l.rangeCount ) && ( l.range[r].startAddr <= fnEnd ) )
+            {
+                if ( l.range[r].startAddr > cursor )
+                {
+                    _fillNativeGap( &l, cursor, l.range[r].startAddr - 1, fnStart, nullFileEntry );
+                }
+
+                _addNativeSource( &l, &l.range[r], nullFileEntry );
+                cursor = done = ( uint64_t )l.range[r++].endAddr + 1;
+            }
+
+            if ( cursor <= fnEnd )
+            {
+                _fillNativeGap( &l, cursor, fnEnd, fnStart, nullFileEntry );
+                done = fnEnd + 1;
+            }
+        }
+
+        _sortLines( s );
+    }
+
+    for ( uint32_t i = 0; i < l.fnCount; i++ )
+    {
+        free( ( char * )l.fn[i].name );
+    }
+
+    free( l.fn );
+    free( l.range );
+    return ok;
+}
+// ====================================================================================================
+// Symbol cache
+// ====================================================================================================
+// The parsed symbol set is written out to a cache file once objdump has been run over an elf, and
+// mapped straight back in on the next start if the elf hasn't changed. The file holds the tables and
+// line index in their in-memory layout, with every pointer made as if the file were mapped at a
+// preferred address picked from its key. Anyone that gets the file mapped there uses it read only
+// and in place, so every tool running against the same elf shares the one copy in the page cache.
+// Anyone that doesn't takes a private copy and relocates it, so loading is never more than an mmap
+// and a relocation pass with no parsing. Tools that start together take a lock on the cache while
+// it's built, so only the first runs objdump and the rest wait to map what it wrote.
+// ====================================================================================================
+static void _getMtime( struct stat *st, int64_t *sec, int64_t *nsec )
+
+{
+#ifdef OSX
+    *sec  = st->st_mtimespec.tv_sec;
+    *nsec = st->st_mtimespec.tv_nsec;
+#else
+    *sec  = st->st_mtim.tv_sec;
+    *nsec = st->st_mtim.tv_nsec;
+#endif
+}
+// ====================================================================================================
+static uint64_t _keyHash( uint64_t h, const void *d, size_t len )
+
+{
+    for ( size_t i = 0; i < len; i++ )
+    {
+        h = ( h ^ ( ( const uint8_t * )d )[i] ) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+// ====================================================================================================
+static uint64_t _objdumpKey( uint64_t h )
+
+/* Add the objdump that would make the tables to the key, so a different one doesn't get the same cache. */
+/* It's found the way popen would find it, and then its mtime and size stand in for its version.         */
+
+{
+    const char *cmd = getenv( OBJENVNAME ) ? getenv( OBJENVNAME ) : OBJDUMP;
+    char prog[MAX_LINE_LEN];
+    char cand[MAX_LINE_LEN];
+    const char *p, *e;
+    char *real = NULL;
+    struct stat st;
+    int64_t sec, nsec;
+    uint64_t size;
+
+    h = _keyHash( h, cmd, strlen( cmd ) );
+
+    /* The command can carry options, so it's only the first word that's the program */
+    snprintf( prog, sizeof( prog ), "%.*s", ( int )strcspn( cmd, " \t" ), cmd );
+
+    if ( strchr( prog, '/' ) )
+    {
+        real = realpath( prog, NULL );
+    }
+    else if ( ( p = getenv( "PATH" ) ) )
+    {
+        for ( ; ( !real ) && ( *p ); p = ( *e ) ? e + 1 : e )
+        {
+            e = p + strcspn( p, ":" );
+            if ( ( snprintf( cand, sizeof( cand ), "%.*s/%s", ( e == p ) ? 1 : ( int )( e - p ), ( e == p ) ? "." : p, prog ) < ( int )sizeof( cand ) ) &&
+                    ( access( cand, X_OK ) == 0 ) )
+            {
+                real = realpath( cand, NULL );
+            }
+        }
+    }
+
+    if ( ( !real ) || ( stat( real, &st ) != 0 ) )
+    {
+        free( real );
+        return h;
+    }
+
+    _getMtime( &st, &sec, &nsec );
+    size = st.st_size;
+    h = _keyHash( h, real, strlen( real ) );
+    h = _keyHash( h, &sec, sizeof( sec ) );
+    h = _keyHash( h, &nsec, sizeof( nsec ) );
+    h = _keyHash( h, &size, sizeof( size ) );
+    free( real );
+    return h;
+}
+// ====================================================================================================
+static bool _cacheFilename( struct SymbolSet *s, char *name, size_t len, char **path, uint64_t *key )
+
+/* Work out where the cache for this symbol set lives, creating the directory if needed */
+
+{
+    char dir[MAX_LINE_LEN];
+    char *e;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint8_t flags = SYMCACHE_FLAGS( s );
+
+    if ( ( e = getenv( CACHEENVNAME ) ) )
+    {
+        /* Explicitly set...an empty setting means don't cache */
+        if ( !*e )
+        {
+            return false;
+        }
+
+        snprintf( dir, MAX_LINE_LEN, "%s", e );
+    }
+    else if ( ( e = getenv( "XDG_CACHE_HOME" ) ) && ( *e ) )
+    {
+        snprintf( dir, MAX_LINE_LEN, "%s/" CACHE_DIRNAME, e );
+    }
+    else if ( ( e = getenv( "HOME" ) ) && ( *e ) )
+    {
+        snprintf( dir, MAX_LINE_LEN, "%s/.cache", e );
+        mkdir( dir, 0755 );
+        snprintf( dir, MAX_LINE_LEN, "%s/.cache/" CACHE_DIRNAME, e );
+    }
+    else
+    {
+        return false;
+    }
+
+    if ( ( mkdir( dir, 0755 ) != 0 ) && ( errno != EEXIST ) )
+    {
+        return false;
+    }
+
+    /* The key is the full path together with anything that changes what ends up in the tables */
+    if ( !( *path = realpath( s->elfFile, NULL ) ) )
+    {
+        *path = strdup( s->elfFile );
+    }
+
+    h = _keyHash( h, *path, strlen( *path ) );
+    h = _keyHash( h, s->deleteMaterial, strlen( s->deleteMaterial ) );
+    h = _keyHash( h, &flags, sizeof( flags ) );
+    h = _objdumpKey( h );
+
+    snprintf( name, len, "%s/%016" PRIx64 ".symcache", dir, h );
+    *key = h;
+    return true;
+}
+// ====================================================================================================
+static void _fillCacheHeader( struct SymbolSet *s, struct symcacheHeader *h )
+
+/* Set up the parts of the header that identify the elf and the layout of the tables */
+
+{
+    memset( h, 0, sizeof( struct symcacheHeader ) );
+    memcpy( h->magic, SYMCACHE_MAGIC, sizeof( h->magic ) );
+    h->version      = SYMCACHE_VERSION;
+    h->flags        = SYMCACHE_FLAGS( s );
+    h->headerSize   = sizeof( struct symcacheHeader );
+    h->fileSize     = sizeof( struct fileEntry );
+    h->functionSize = sizeof( struct functionEntry );
+    h->sourceSize   = sizeof( struct sourceLineEntry );
+    h->assySize     = sizeof( struct assyLineEntry );
+    h->elfSize      = s->st.st_size;
+    _getMtime( &s->st, &h->elfMtimeSec, &h->elfMtimeNsec );
+}
+// ====================================================================================================
+static uint64_t _poolAdd( char **pool, uint64_t *poolLen, uint64_t *poolSize, uint64_t base, const char *str )
+
+/* Add a string to the pool, returning its address from base (zero for no string) */
+
+{
+    uint64_t l;
+    uint64_t ofs;
+
+    if ( !str )
+    {
+        return 0;
+    }
+
+    l = strlen( str ) + 1;
+
+    while ( *poolLen + l > *poolSize )
+    {
+        *poolSize = ( *poolSize ) ? ( *poolSize ) * 2 : MAX_LINE_LEN;
+        *pool = ( char * )realloc( *pool, *poolSize );
+    }
+
+    memcpy( &( *pool )[*poolLen], str, l );
+    ofs = base + *poolLen;
+    *poolLen += l;
+    return ofs;
+}
+// ====================================================================================================
+#define POOL_ADD(x) ((void *)(uintptr_t)_poolAdd( &pool, &poolLen, &poolSize, h.mapBase + h.stringsOfs, (x) ))
+#define CACHE_ALIGN(x) (((x)+7)&~7ULL)
+
+static void _writeCache( struct SymbolSet *s )
+
+/* Serialise the symbol set to the cache, if there is one. Failure just means no cache. */
+
+{
+    char name[CACHE_NAME_LEN];
+    char tmpName[CACHE_NAME_LEN + 16];
+    char *path;
+    struct symcacheHeader h;
+    char *pool = NULL;
+    uint64_t poolLen = 0, poolSize = 0;
+    uint64_t assyOfs;
+    uint64_t key;
+    FILE *f;
+    bool ok;
+
+    if ( !_cacheFilename( s, name, CACHE_NAME_LEN, &path, &key ) )
+    {
+        return;
+    }
+
+    _fillCacheHeader( s, &h );
+    h.mapBase       = SYMCACHE_BASE( key );
+    h.fileCount     = s->fileCount;
+    h.functionCount = s->functionCount;
+    h.sourceCount   = s->sourceCount;
+
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        h.assyCount += s->sources[i].assyLines;
+    }
+
+    h.filesOfs      = CACHE_ALIGN( sizeof( struct symcacheHeader ) );
+    h.functionsOfs  = CACHE_ALIGN( h.filesOfs + h.fileCount * sizeof( struct fileEntry ) );
+    h.sourcesOfs    = CACHE_ALIGN( h.functionsOfs + h.functionCount * sizeof( struct functionEntry ) );
+    h.assyOfs       = CACHE_ALIGN( h.sourcesOfs + h.sourceCount * sizeof( struct sourceLineEntry ) );
+    h.lineKeyOfs    = CACHE_ALIGN( h.assyOfs + h.assyCount * sizeof( struct assyLineEntry ) );
+    h.lineEntryOfs  = CACHE_ALIGN( h.lineKeyOfs + ( h.sourceCount + 1 ) * sizeof( uint32_t ) );
+    h.stringsOfs    = CACHE_ALIGN( h.lineEntryOfs + ( h.sourceCount + 1 ) * sizeof( uint32_t ) );
+
+    /* Copies of the tables with the pointers swizzled into file offsets */
+    struct fileEntry *files = ( struct fileEntry * )calloc( h.fileCount + 1, sizeof( struct fileEntry ) );
+    struct functionEntry *functions = ( struct functionEntry * )calloc( h.functionCount + 1, sizeof( struct functionEntry ) );
+    struct sourceLineEntry *sources = ( struct sourceLineEntry * )calloc( h.sourceCount + 1, sizeof( struct sourceLineEntry ) );
+    struct assyLineEntry *assy = ( struct assyLineEntry * )calloc( h.assyCount + 1, sizeof( struct assyLineEntry ) );
+
+    h.pathOfs = ( uintptr_t )POOL_ADD( path ) - h.mapBase;
+    h.deleteMaterialOfs = ( uintptr_t )POOL_ADD( s->deleteMaterial ) - h.mapBase;
+
+    for ( uint32_t i = 0; i < s->fileCount; i++ )
+    {
+        files[i].name = POOL_ADD( s->files[i].name );
+    }
+
+    for ( uint32_t i = 0; i < s->functionCount; i++ )
+    {
+        functions[i] = s->functions[i];
+        functions[i].name = POOL_ADD( s->functions[i].name );
+    }
+
+    assyOfs = 0;
+
+    for ( uint32_t i = 0; i < s->sourceCount; i++ )
+    {
+        sources[i] = s->sources[i];
+        sources[i].lineText = POOL_ADD( s->sources[i].lineText );
+        sources[i].assy = s->sources[i].assyLines ? ( struct assyLineEntry * )( uintptr_t )( h.mapBase + h.assyOfs + assyOfs * sizeof( struct assyLineEntry ) ) : NULL;
+
+        for ( uint32_t j = 0; j < s->sources[i].assyLines; j++ )
+        {
+            struct assyLineEntry *a = &assy[assyOfs++];
+            *a = s->sources[i].assy[j];
+            a->label = POOL_ADD( s->sources[i].assy[j].label );
+            a->lineText = POOL_ADD( s->sources[i].assy[j].lineText );
+
+            if ( s->sources[i].assy[j].assy )
+            {
+                a->assy = ( char * )a->lineText + ( s->sources[i].assy[j].assy - s->sources[i].assy[j].lineText );
+            }
+        }
+    }
+
+    h.stringsLen = poolLen;
+
+    /* Write to a temporary and rename, so nobody ever maps a partial file */
+    snprintf( tmpName, sizeof( tmpName ), "%s.%d", name, getpid() );
+
+    if ( ( f = fopen( tmpName, "wb" ) ) )
+    {
+        ok = ( fwrite( &h, sizeof( h ), 1, f ) == 1 );
+        ok = ok && !fseek( f, h.filesOfs, SEEK_SET ) && ( fwrite( files, sizeof( struct fileEntry ), h.fileCount, f ) == h.fileCount );
+        ok = ok && !fseek( f, h.functionsOfs, SEEK_SET ) && ( fwrite( functions, sizeof( struct functionEntry ), h.functionCount, f ) == h.functionCount );
+        ok = ok && !fseek( f, h.sourcesOfs, SEEK_SET ) && ( fwrite( sources, sizeof( struct sourceLineEntry ), h.sourceCount, f ) == h.sourceCount );
+        ok = ok && !fseek( f, h.assyOfs, SEEK_SET ) && ( fwrite( assy, sizeof( struct assyLineEntry ), h.assyCount, f ) == h.assyCount );
+        ok = ok && !fseek( f, h.lineKeyOfs, SEEK_SET ) && ( fwrite( s->lineKey, sizeof( uint32_t ), h.sourceCount + 1, f ) == h.sourceCount + 1 );
+        ok = ok && !fseek( f, h.lineEntryOfs, SEEK_SET ) && ( fwrite( s->lineEntry, sizeof( uint32_t ), h.sourceCount + 1, f ) == h.sourceCount + 1 );
+        ok = ok && !fseek( f, h.stringsOfs, SEEK_SET ) && ( fwrite( pool, 1, poolLen, f ) == poolLen );
+        ok = ( fclose( f ) == 0 ) && ok;
+
+        if ( ( !ok ) || ( rename( tmpName, name ) != 0 ) )
+        {
+            genericsReport( V_DEBUG, "Failed to write symbol cache %s" EOL, name );
+            unlink( tmpName );
+        }
+        else
+        {
+            genericsReport( V_DEBUG, "Wrote symbol cache %s" EOL, name );
+        }
+    }
+
+    free( files );
+    free( functions );
+    free( sources );
+    free( assy );
+    free( pool );
+    free( path );
+}
+// ====================================================================================================
+static bool _relocate( void *base, uint64_t len, uint64_t mapBase, uint64_t lo, uint64_t hi, void **p )
+
+/* Check a stored pointer falls within file offsets [lo,hi), and move it to where the file really is. */
+/* When the file is where the pointers expect it, nothing is written, so it can be mapped read only. */
+
+{
+    uint64_t ofs = ( uintptr_t ) * p;
+
+    if ( !ofs )
+    {
+        return true;
+    }
+
+    ofs -= mapBase;
+
+    if ( ( ofs < lo ) || ( ofs >= hi ) || ( ofs >= len ) )
+    {
+        return false;
+    }
+
+    if ( ( uintptr_t )base != mapBase )
+    {
+        *p = ( uint8_t * )base + ofs;
+    }
+
+    return true;
+}
+// ====================================================================================================
+#define RELOC_STR(x) _relocate( m, len, h->mapBase, h->stringsOfs, h->stringsOfs + h->stringsLen, (void **)&(x) )
+#define RELOC_ASSY(x) _relocate( m, len, h->mapBase, h->assyOfs, h->assyOfs + h->assyCount * sizeof( struct assyLineEntry ), (void **)&(x) )
+
+static bool _loadCache( struct SymbolSet *s )
+
+/* Map in a cached symbol set for this elf, returning false if there isn't a valid one */
+
+{
+    char name[CACHE_NAME_LEN];
+    char *path;
+    struct symcacheHeader want;
+    struct symcacheHeader *h;
+    struct stat st;
+    uint8_t *m;
+    uint64_t len;
+    uint64_t key;
+    bool ok = true;
+    int fd;
+
+    if ( stat( s->elfFile, &s->st ) != 0 )
+    {
+        return false;
+    }
+
+    if ( !_cacheFilename( s, name, CACHE_NAME_LEN, &path, &key ) )
+    {
+        return false;
+    }
+
+    if ( ( ( fd = open( name, O_RDONLY ) ) < 0 ) || ( fstat( fd, &st ) != 0 ) || ( st.st_size < sizeof( struct symcacheHeader ) ) )
+    {
+        if ( fd >= 0 )
+        {
+            close( fd );
+        }
+
+        free( path );
+        return false;
+    }
+
+    len = st.st_size;
+
+    /* Try for the address the pointers were made for, where the file can be used as it is and shared... */
+    m = mmap( ( void * )( uintptr_t )SYMCACHE_BASE( key ), len, PROT_READ, MAP_SHARED, fd, 0 );
+
+    if ( ( m != MAP_FAILED ) && ( ( !SYMCACHE_BASE( key ) ) || ( ( uintptr_t )m != ( ( struct symcacheHeader * )m )->mapBase ) ) )
+    {
+        /* ...but if it's landed somewhere else, take a private mapping so relocation only touches our copy of the pages */
+        munmap( m, len );
+        m = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    }
+
+    close( fd );
+
+    if ( m == MAP_FAILED )
+    {
+        free( path );
+        return false;
+    }
+
+    h = ( struct symcacheHeader * )m;
+    _fillCacheHeader( s, &want );
+
+    /* Check this cache matches what we're looking for, and is self-consistent */
+    ok = ( !memcmp( h, &want, offsetof( struct symcacheHeader, fileCount ) ) ) &&
+         ( h->filesOfs + h->fileCount * sizeof( struct fileEntry ) <= len ) &&
+         ( h->functionsOfs + h->functionCount * sizeof( struct functionEntry ) <= len ) &&
+         ( h->sourcesOfs + h->sourceCount * sizeof( struct sourceLineEntry ) <= len ) &&
+         ( h->assyOfs + h->assyCount * sizeof( struct assyLineEntry ) <= len ) &&
+         ( h->lineKeyOfs + ( h->sourceCount + 1 ) * sizeof( uint32_t ) <= len ) && ( !( h->lineKeyOfs & 3 ) ) &&
+         ( h->lineEntryOfs + ( h->sourceCount + 1 ) * sizeof( uint32_t ) <= len ) && ( !( h->lineEntryOfs & 3 ) ) &&
+         ( h->stringsOfs + h->stringsLen <= len ) && ( h->stringsLen ) && ( !m[h->stringsOfs + h->stringsLen - 1] ) &&
+         ( h->pathOfs >= h->stringsOfs ) && ( h->pathOfs < h->stringsOfs + h->stringsLen ) && ( !strcmp( ( char * )&m[h->pathOfs], path ) ) &&
+         ( h->deleteMaterialOfs >= h->stringsOfs ) && ( h->deleteMaterialOfs < h->stringsOfs + h->stringsLen ) &&
+         ( !strcmp( ( char * )&m[h->deleteMaterialOfs], s->deleteMaterial ) );
+
+    free( path );
+
+    s->files     = ( struct fileEntry * )&m[h->filesOfs];
+    s->functions = ( struct functionEntry * )&m[h->functionsOfs];
+    s->sources   = ( struct sourceLineEntry * )&m[h->sourcesOfs];
+
+    for ( uint32_t i = 0; ( ok ) && ( i < h->fileCount ); i++ )
+    {
+        ok = RELOC_STR( s->files[i].name );
+    }
+
+    for ( uint32_t i = 0; ( ok ) && ( i < h->functionCount ); i++ )
+    {
+        ok = RELOC_STR( s->functions[i].name );
+    }
+
+    for ( uint32_t i = 0; ( ok ) && ( i <= h->sourceCount ); i++ )
+    {
+        ok = ( ( i == 0 ) || ( ( ( uint32_t * )&m[h->lineEntryOfs] )[i] < h->sourceCount ) );
+    }
+
+    for ( uint32_t i = 0; ( ok ) && ( i < h->sourceCount ); i++ )
+    {
+        struct sourceLineEntry *src = &s->sources[i];
+        ok = RELOC_STR( src->lineText ) && RELOC_ASSY( src->assy ) &&
+             ( ( !src->assyLines ) || ( ( src->assy ) && ( ( uint8_t * )( src->assy + src->assyLines ) <= &m[h->assyOfs] + h->assyCount * sizeof( struct assyLineEntry ) ) ) );
+    }
+
+    for ( uint32_t i = 0; ( ok ) && ( i < h->assyCount ); i++ )
+    {
+        struct assyLineEntry *a = &( ( struct assyLineEntry * )&m[h->assyOfs] )[i];
+        ok = RELOC_STR( a->label ) && RELOC_STR( a->lineText ) && RELOC_STR( a->assy );
+    }
+
+    if ( !ok )
+    {
+        genericsReport( V_DEBUG, "Symbol cache %s not usable" EOL, name );
+        munmap( m, len );
+        s->files = NULL;
+        s->functions = NULL;
+        s->sources = NULL;
+        return false;
+    }
+
+    s->fileCount     = h->fileCount;
+    s->functionCount = h->functionCount;
+    s->sourceCount   = h->sourceCount;
+    s->lineKey       = ( uint32_t * )&m[h->lineKeyOfs];
+    s->lineEntry     = ( uint32_t * )&m[h->lineEntryOfs];
+    s->cacheMap      = m;
+    s->cacheLen      = len;
+    genericsReport( V_DEBUG, "Using symbol cache %s%s" EOL, name, ( ( uintptr_t )m == h->mapBase ) ? " (shared)" : "" );
+    return true;
+}
+// ====================================================================================================
+static int _lockCache( struct SymbolSet *s )
+
+/* Wait for anyone else building the cache for this set to finish. Returns the lock to hand back, or -1 */
+
+{
+    char name[CACHE_NAME_LEN + 8];
+    char *path;
+    uint64_t key;
+    int fd;
+
+    if ( !_cacheFilename( s, name, CACHE_NAME_LEN, &path, &key ) )
+    {
+        return -1;
+    }
+
+    free( path );
+    strcat( name, ".lock" );
+
+    if ( ( fd = open( name, O_RDWR | O_CREAT, 0644 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( flock( fd, LOCK_EX ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+// ====================================================================================================
+static bool _statChanged( struct stat *a, struct stat *b )
+
+/* We check filesize, modification time and status change time for any differences */
+
+{
+    return ( memcmp( &a->st_size, &b->st_size, sizeof( off_t ) ) ) ||
+#ifdef OSX
+           ( memcmp( &a->st_mtimespec, &b->st_mtimespec, sizeof( struct timespec ) ) ) ||
+           ( memcmp( &a->st_ctimespec, &b->st_ctimespec, sizeof( struct timespec ) ) );
+#else
+           ( memcmp( &a->st_mtim, &b->st_mtim, sizeof( struct timespec ) ) ) ||
+           ( memcmp( &a->st_ctim, &b->st_ctim, sizeof( struct timespec ) ) );
+#endif
+}
+// ====================================================================================================
+static bool _sameLayout( struct SymbolSet *a, struct SymbolSet *b )
+
+/* Check two sets have the same files and functions at the same addresses, so indices into one are good for the other */
+
+{
+    if ( ( a->fileCount != b->fileCount ) || ( a->functionCount != b->functionCount ) )
+    {
+        return false;
+    }
+
+    for ( uint32_t i = 0; i < a->fileCount; i++ )
+    {
+        if ( strcmp( a->files[i].name, b->files[i].name ) )
+        {
+            return false;
+        }
+    }
+
+    for ( uint32_t i = 0; i < a->functionCount; i++ )
+    {
+        if ( ( a->functions[i].startAddr != b->functions[i].startAddr ) || ( a->functions[i].endAddr != b->functions[i].endAddr ) ||
+                ( a->functions[i].fileEntryIdx != b->functions[i].fileEntryIdx ) || ( strcmp( a->functions[i].name, b->functions[i].name ) ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _reclaim( struct SymbolReload *r )
+
+/* Delete any retired sets that no reader can still be using */
+
+{
+    uint64_t oldest = UINT64_MAX;
+    uint64_t e;
+    uint32_t kept = 0;
+
+    for ( uint32_t i = 0; i < SYMBOL_RELOAD_READERS; i++ )
+    {
+        if ( ( ( e = __atomic_load_n( &r->readers[i], __ATOMIC_SEQ_CST ) ) ) && ( e < oldest ) )
+        {
+            oldest = e;
+        }
+    }
+
+    for ( uint32_t i = 0; i < r->retiredCount; i++ )
+    {
+        if ( r->retired[i].epoch <= oldest )
+        {
+            SymbolSetDelete( &r->retired[i].s );
+        }
+        else
+        {
+            r->retired[kept++] = r->retired[i];
+        }
+    }
+
+    r->retiredCount = kept;
+}
+// ====================================================================================================
+static void _reload( struct SymbolReload *r )
+
+/* Load the elf if it's changed, and publish the result in place of the current set */
+
+{
+    struct SymbolSet *c = r->current;
+    struct SymbolSet *n;
+    struct stat st;
+
+    if ( ( stat( r->elfFile, &st ) != 0 ) || ( ( c ) && ( !_statChanged( &st, &c->st ) ) ) )
+    {
+        /* Either there's nothing to load, or nothing new. Whatever is loaded carries on being used */
+        return;
+    }
+
+    if ( ( r->failed ) && ( !_statChanged( &st, &r->failedSt ) ) )
+    {
+        /* It didn't load last time either, and trying it again won't make any odds until it changes */
+        return;
+    }
+
+    if ( !( n = SymbolSetCreate( r->elfFile, r->deleteMaterial, r->demanglecpp, r->recordSource, r->recordAssy ) ) )
+    {
+        if ( !r->failed )
+        {
+            genericsReport( V_ERROR, "Could not read symbols from %s" EOL, r->elfFile );
+            r->failed = true;
+        }
+
+        r->failedSt = st;
+        return;
+    }
+
+    r->failed = false;
+    n->generation = r->generation + 1;
+    n->layout = ( !c ) ? 1 : ( _sameLayout( c, n ) ? c->layout : c->layout + 1 );
+
+    /* Anyone entering from here on gets the new set, so the old one is retired at the next epoch */
+    __atomic_store_n( &r->current, n, __ATOMIC_SEQ_CST );
+    __atomic_store_n( &r->generation, n->generation, __ATOMIC_SEQ_CST );
+
+    if ( c )
+    {
+        if ( r->retiredCount == r->retiredAlloc )
+        {
+            r->retiredAlloc = r->retiredAlloc ? r->retiredAlloc * 2 : 4;
+            r->retired = ( struct retiredSet * )realloc( r->retired, sizeof( struct retiredSet ) * r->retiredAlloc );
+        }
+
+        r->retired[r->retiredCount].s = c;
+        r->retired[r->retiredCount++].epoch = __atomic_add_fetch( &r->epoch, 1, __ATOMIC_SEQ_CST );
+    }
+
+    genericsReport( V_INFO, "Loaded %s (generation %" PRIu32 ")" EOL, r->elfFile, n->generation );
+}
+// ====================================================================================================
+static void *_reloadThread( void *arg )
+
+/* Keep the symbols up to date with the elf, without anyone having to wait for them */
+
+{
+    struct SymbolReload *r = ( struct SymbolReload * )arg;
+    struct timespec until;
+
+    pthread_mutex_lock( &r->lock );
+
+    while ( !r->finish )
+    {
+        pthread_mutex_unlock( &r->lock );
+        _reload( r );
+        _reclaim( r );
+        pthread_mutex_lock( &r->lock );
+
+        /* Wake anyone waiting for the first set, then sleep until the next check */
+        pthread_cond_broadcast( &r->cond );
+        clock_gettime( CLOCK_REALTIME, &until );
+        until.tv_nsec += RELOAD_POLL_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+
+        if ( !r->finish )
+        {
+            pthread_cond_timedwait( &r->cond, &r->lock, &until );
+        }
+    }
+
+    pthread_mutex_unlock( &r->lock );
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+const char *SymbolFilename( struct SymbolSet *s, uint32_t index )
+
+{
+    switch ( index )
+    {
+        default:
+            if ( index < s->fileCount )
+            {
+                return s->files[index].name;
+            }
+
+            return "NONE";
+    }
+}
+// ====================================================================================================
+const char *SymbolFunction( struct SymbolSet *s, uint32_t index )
+
+{
+    switch ( index )
+    {
+        case FN_SLEEPING:
+            return FN_SLEEPING_STR;
+
+        case INTERRUPT:
+            return FN_INTERRUPT_STR;
+
+        default:
+            if ( index < s->functionCount )
+            {
+                return s->functions[index].name;
+            }
+
+            return "NONE";
+    }
+}
+// ====================================================================================================
+bool SymbolLookup( struct SymbolSet *s, uint32_t addr, struct nameEntry *n )
+
+/* Lookup function for address to line, and hence to function */
+
+{
+    const char *source   = NULL;
+    uint32_t fileindex;
+    uint32_t functionindex;
+    const struct assyLineEntry *assy = NULL;
+    uint32_t assyLine;
+    uint16_t linesInBlock;
+    uint32_t line;
+
+    memset( n, 0, sizeof( struct nameEntry ) );
+    assert( s );
+
+    if ( ( addr & SPECIALS_MASK ) == SPECIALS_MASK )
     {
         /* Address is some sort of interrupt */
         n->line = 0;
@@ -753,66 +2501,9 @@ void SymbolSetDelete( struct SymbolSet **s )
     {
         free( ( *s )->elfFile );
 
-        /* Free off any files dynamic memory we allocated */
-        if ( ( *s )->files )
-        {
-            for ( uint32_t i = 0; i < ( *s )->fileCount; i++ )
-            {
-                if ( ( *s )->files[i].name )
-                {
-                    free( ( *s )->files[i].name );
-                }
-            }
-
-            free( ( *s )->files );
-        }
-
-        /* Free off any functions dynamic memory we allocated */
-        if ( ( *s )->functions )
-        {
-            for ( uint32_t i = 0; i < ( *s )->functionCount; i++ )
-            {
-                if ( ( *s )->functions[i].name )
-                {
-                    free( ( *s )->functions[i].name );
-                }
-            }
-
-            free( ( *s )->functions );
-        }
-
-        /* Free off any sources dynamic memory we allocated */
-        if ( ( *s )->sources )
-        {
-            for ( uint32_t i = 0; i < ( *s )->sourceCount; i++ )
-            {
-                if ( ( *s )->sources[i].lineText )
-                {
-                    free( ( *s )->sources[i].lineText );
-                }
-
-                /* For any source line, free off it's assembly if there is some */
-                if ( ( *s )->sources[i].assy )
-                {
-                    if ( ( *s )->sources[i].assy->label )
-                    {
-                        free( ( *s )->sources[i].assy->label );
-                    }
-
-                    for ( uint32_t j = 0; j < ( *s )->sources[i].assyLines; j++ )
-                    {
-                        if ( ( *s )->sources[i].assy[j].lineText )
-                        {
-                            free( ( *s )->sources[i].assy[j].lineText );
-                        }
-                    }
-
-                    free( ( *s )->sources[i].assy );
-                }
-            }
-
-            free( ( *s )->sources );
-        }
+        _deleteTables( *s );
+        free( ( *s )->lineKey );
+        free( ( *s )->lineEntry );
 
         if ( ( *s )->deleteMaterial )
         {
@@ -838,18 +2529,7 @@ bool SymbolSetValid( struct SymbolSet **s, char *filename )
         return false;
     }
 
-    /* We check filesize, modification time and status change time for any differences */
-    if ( ( !( *s ) ) ||
-            ( memcmp( &n.st_size, &( ( *s )->st.st_size ), sizeof( off_t ) ) ) ||
-
-#ifdef OSX
-            ( memcmp( &n.st_mtimespec, &( ( *s )->st.st_mtimespec ), sizeof( struct timespec ) ) ) ||
-            ( memcmp( &n.st_ctimespec, &( ( *s )->st.st_ctimespec ), sizeof( struct timespec ) ) )
-#else
-            ( memcmp( &n.st_mtim, &( ( *s )->st.st_mtim ), sizeof( struct timespec ) ) ) ||
-            ( memcmp( &n.st_ctim, &( ( *s )->st.st_ctim ), sizeof( struct timespec ) ) )
-#endif
-       )
+    if ( ( !( *s ) ) || ( _statChanged( &n, &( *s )->st ) ) )
     {
         SymbolSetDelete( s );
         return false;
@@ -866,6 +2546,8 @@ struct SymbolSet *SymbolSetCreate( const char *filename, const char *deleteMater
 
 {
     struct stat statbuf, newstatbuf;
+    bool loaded;
+    int lock;
     struct SymbolSet *s = ( struct SymbolSet * )calloc( sizeof( struct SymbolSet ), 1 );
     s->elfFile          = strdup( filename );
     s->deleteMaterial   = strdup( deleteMaterial ? deleteMaterial : "" );
@@ -873,6 +2555,19 @@ struct SymbolSet *SymbolSetCreate( const char *filename, const char *deleteMater
     s->demanglecpp      = demanglecpp;
     s->recordAssy       = recordAssy;
 
+    /* If we've seen this exact elf before then there's no need to wait or run objdump */
+    if ( _loadCache( s ) )
+    {
+        return s;
+    }
+
+    /* ...and if someone else was in the middle of loading it, what they've written will do */
+    if ( ( ( lock = _lockCache( s ) ) >= 0 ) && ( _loadCache( s ) ) )
+    {
+        close( lock );
+        return s;
+    }
+
     /* Make sure this file is stable before trying to load it */
     if ( stat( filename, &statbuf ) == 0 )
     {
@@ -886,25 +2581,35 @@ struct SymbolSet *SymbolSetCreate( const char *filename, const char *deleteMater
                 break;
             }
 
-            /* We check filesize, modification time and status change time for any differences */
-            if (
-                        ( memcmp( &statbuf.st_size, &newstatbuf.st_size, sizeof( off_t ) ) ) ||
-#ifdef OSX
-                        ( memcmp( &statbuf.st_mtimespec, &newstatbuf.st_mtimespec, sizeof( struct timespec ) ) ) ||
-                        ( memcmp( &statbuf.st_ctimespec, &newstatbuf.st_ctimespec, sizeof( struct timespec ) ) )
-#else
-                        ( memcmp( &statbuf.st_mtim, &newstatbuf.st_mtim, sizeof( struct timespec ) ) ) ||
-                        ( memcmp( &statbuf.st_ctim, &newstatbuf.st_ctim, sizeof( struct timespec ) ) )
-#endif
-            )
+            if ( _statChanged( &statbuf, &newstatbuf ) )
             {
                 /* Make this the version we check next time around */
                 memcpy( &statbuf, &newstatbuf, sizeof( struct stat ) );
                 continue;
             }
 
-            if ( _getTargetProgramInfo( s ) )
+            memcpy( &s->st, &newstatbuf, sizeof( struct stat ) );
+
+            /* Only objdump can give us source and assembly text, but if those aren't needed we can go direct */
+            loaded = ( !s->recordSource ) && ( !s->recordAssy ) && ( _getNativeProgramInfo( s ) );
+
+            if ( !loaded )
+            {
+                /* Clear out anything a failed native load left behind before objdump has a go */
+                _deleteTables( s );
+                loaded = _getTargetProgramInfo( s );
+            }
+
+            if ( loaded )
             {
+                _indexLines( s );
+                _writeCache( s );
+
+                if ( lock >= 0 )
+                {
+                    close( lock );
+                }
+
                 return s;
             }
             else
@@ -915,7 +2620,129 @@ struct SymbolSet *SymbolSetCreate( const char *filename, const char *deleteMater
     }
 
     /* If we reach here we weren't successful, so delete the allocated memory */
+    if ( lock >= 0 )
+    {
+        close( lock );
+    }
+
     SymbolSetDelete( &s );
     return NULL;
 }
 // ====================================================================================================
+struct SymbolReload *SymbolReloadStart( const char *filename, const char *deleteMaterial, bool demanglecpp, bool recordSource, bool recordAssy )
+
+/* Start keeping a symbol set loaded from the elf in the background. The first set may not be there yet on return */
+
+{
+    struct SymbolReload *r = ( struct SymbolReload * )calloc( 1, sizeof( struct SymbolReload ) );
+
+    r->elfFile = strdup( filename );
+    r->deleteMaterial = deleteMaterial ? strdup( deleteMaterial ) : NULL;
+    r->demanglecpp = demanglecpp;
+    r->recordSource = recordSource;
+    r->recordAssy = recordAssy;
+    r->epoch = 1;
+    pthread_mutex_init( &r->lock, NULL );
+    pthread_cond_init( &r->cond, NULL );
+
+    if ( pthread_create( &r->thread, NULL, &_reloadThread, r ) )
+    {
+        genericsExit( -1, "Failed to create symbol reload thread" EOL );
+    }
+
+    return r;
+}
+// ====================================================================================================
+struct SymbolSet *SymbolReloadEnter( struct SymbolReload *r, uint32_t reader )
+
+/* Get the latest set for a reader, which is kept until it exits. NULL if nothing's loaded yet */
+
+{
+    assert( reader < SYMBOL_RELOAD_READERS );
+
+    /* Say when we came in before looking, so anything retired after this is kept for us */
+    __atomic_store_n( &r->readers[reader], __atomic_load_n( &r->epoch, __ATOMIC_SEQ_CST ), __ATOMIC_SEQ_CST );
+    return __atomic_load_n( &r->current, __ATOMIC_SEQ_CST );
+}
+// ====================================================================================================
+void SymbolReloadExit( struct SymbolReload *r, uint32_t reader )
+
+/* Finish with the set got by SymbolReloadEnter */
+
+{
+    assert( reader < SYMBOL_RELOAD_READERS );
+    __atomic_store_n( &r->readers[reader], 0, __ATOMIC_SEQ_CST );
+}
+// ====================================================================================================
+uint32_t SymbolReloadGeneration( struct SymbolReload *r )
+
+/* Generation of the latest set, to compare with the one a reader has to see if there's a newer one */
+
+{
+    return __atomic_load_n( &r->generation, __ATOMIC_SEQ_CST );
+}
+// ====================================================================================================
+bool SymbolReloadWait( struct SymbolReload *r, int timeoutMs )
+
+/* Wait up to timeoutMs (forever if negative) for there to be a set loaded */
+
+{
+    struct timespec until;
+    bool loaded;
+
+    clock_gettime( CLOCK_REALTIME, &until );
+    until.tv_sec += timeoutMs / 1000;
+    until.tv_nsec += ( timeoutMs % 1000 ) * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock( &r->lock );
+
+    while ( ( !( loaded = SymbolReloadGeneration( r ) ) ) && ( !r->finish ) )
+    {
+        if ( timeoutMs < 0 )
+        {
+            pthread_cond_wait( &r->cond, &r->lock );
+        }
+        else if ( pthread_cond_timedwait( &r->cond, &r->lock, &until ) )
+        {
+            loaded = SymbolReloadGeneration( r );
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &r->lock );
+    return loaded;
+}
+// ====================================================================================================
+void SymbolReloadStop( struct SymbolReload **r )
+
+/* Stop the background reload and delete everything it has loaded. No reader can still be in */
+
+{
+    if ( !*r )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &( *r )->lock );
+    ( *r )->finish = true;
+    pthread_cond_broadcast( &( *r )->cond );
+    pthread_mutex_unlock( &( *r )->lock );
+    pthread_join( ( *r )->thread, NULL );
+
+    for ( uint32_t i = 0; i < ( *r )->retiredCount; i++ )
+    {
+        SymbolSetDelete( &( *r )->retired[i].s );
+    }
+
+    SymbolSetDelete( &( *r )->current );
+    pthread_mutex_destroy( &( *r )->lock );
+    pthread_cond_destroy( &( *r )->cond );
+    free( ( *r )->retired );
+    free( ( *r )->deleteMaterial );
+    free( ( *r )->elfFile );
+    free( *r );
+    *r = NULL;
+}
+// ====================================================================================================
@@ -22,6 +22,38 @@
 #define TIMEOUT (3)
 #define STAT_SYNC_BYTE (0xA6)
 
+/* Lookup tables for unpacking whole frames a word at a time, filled by TPIUDecoderInit */
+static bool _tablesBuilt;
+static uint64_t _lowbitSpread[16];          /* Nibble of aux byte spread into bit 0 of the even bytes of a word */
+static uint64_t _evenLSBs;                  /* Bit 0 of each even byte in a word (the stream change flags) */
+static uint64_t _allOnes;                   /* 0x01 in every byte of a word */
+
+// ====================================================================================================
+static void _buildTables( void )
+
+/* Build the frame unpacking tables. Done via byte arrays so they're correct for any host byte order */
+
+{
+    uint8_t b[sizeof( uint64_t )];
+
+    for ( uint32_t n = 0; n < 16; n++ )
+    {
+        memset( b, 0, sizeof( b ) );
+
+        for ( uint32_t i = 0; i < 4; i++ )
+        {
+            b[i * 2] = ( n >> i ) & 1;
+        }
+
+        memcpy( &_lowbitSpread[n], b, sizeof( uint64_t ) );
+    }
+
+    memcpy( &_evenLSBs, &_lowbitSpread[15], sizeof( uint64_t ) );
+    memset( b, 1, sizeof( b ) );
+    memcpy( &_allOnes, b, sizeof( uint64_t ) );
+    _tablesBuilt = true;
+}
+
 // ====================================================================================================
 void TPIUDecoderInit( struct TPIUDecoder *t )
 
@@ -31,6 +63,11 @@ void TPIUDecoderInit( struct TPIUDecoder *t )
     t->state = TPIU_UNSYNCED;
     t->syncMonitor = 0;
     TPIUDecoderZeroStats( t );
+
+    if ( !_tablesBuilt )
+    {
+        _buildTables();
+    }
 }
 // ====================================================================================================
 void TPIUDecoderZeroStats( struct TPIUDecoder *t )
@@ -253,3 +290,176 @@ enum TPIUPumpEvent TPIUPump( struct TPIUDecoder *t, uint8_t d )
     }
 }
 // ====================================================================================================
+static inline void _emit( struct TPIUDecoder *t, struct TPIUSpan *s, const uint8_t *d, uint32_t len )
+
+/* Put data into an output span, if there is one for this stream */
+
+{
+    if ( !s )
+    {
+        return;
+    }
+
+    if ( s->fill + len > s->len )
+    {
+        t->stats.spanOverflow += len - ( s->len - s->fill );
+        len = s->len - s->fill;
+    }
+
+    memcpy( &s->buffer[s->fill], d, len );
+    s->fill += len;
+}
+// ====================================================================================================
+static void _unpackFrame( struct TPIUDecoder *t, const uint8_t *f, struct TPIUSpan *stream[TPIU_NUM_STREAMS] )
+
+/* Unpack a complete frame into the output spans */
+
+{
+    uint64_t w[2];
+    uint8_t lowbits = f[TPIU_PACKET_LEN - 1];
+    uint8_t delayedStreamChange = NO_CHANNEL_CHANGE;
+    uint8_t d;
+
+    memcpy( w, f, sizeof( w ) );
+
+    if ( !( ( w[0] | w[1] ) & _evenLSBs ) )
+    {
+        /* Commonest case - no stream changes in this frame, so merge in the aux bits and send it all to one place */
+        w[0] |= _lowbitSpread[lowbits & 0x0f];
+        w[1] |= _lowbitSpread[lowbits >> 4];
+        _emit( t, stream[t->currentStream & ( TPIU_NUM_STREAMS - 1 )], ( uint8_t * )w, TPIU_PACKET_LEN - 1 );
+        return;
+    }
+
+    /* There are stream changes, so do it the long way (same algorithm as TPIUGetPacket) */
+    for ( uint32_t i = 0; i < TPIU_PACKET_LEN; i += 2 )
+    {
+        if ( f[i] & 1 )
+        {
+            /* This is a stream change - either before or after the data byte */
+            if ( lowbits & 1 )
+            {
+                delayedStreamChange = f[i] >> 1;
+            }
+            else
+            {
+                t->currentStream = f[i] >> 1;
+            }
+        }
+        else
+        {
+            d = f[i] | ( lowbits & 1 );
+            _emit( t, stream[t->currentStream & ( TPIU_NUM_STREAMS - 1 )], &d, 1 );
+        }
+
+        if ( i < TPIU_PACKET_LEN - 2 )
+        {
+            _emit( t, stream[t->currentStream & ( TPIU_NUM_STREAMS - 1 )], &f[i + 1], 1 );
+        }
+
+        if ( delayedStreamChange != NO_CHANNEL_CHANGE )
+        {
+            t->currentStream = delayedStreamChange;
+            delayedStreamChange = NO_CHANNEL_CHANGE;
+        }
+
+        lowbits >>= 1;
+    }
+}
+// ====================================================================================================
+static inline bool _frameHasSyncByte( const uint8_t *f )
+
+/* Check if a frame contains 0x7F, which ends both a sync and a halfsync. Done a word at a time */
+
+{
+    uint64_t w[2];
+
+    memcpy( w, f, sizeof( w ) );
+    w[0] ^= _allOnes * HALFSYNC_HIGH;
+    w[1] ^= _allOnes * HALFSYNC_HIGH;
+
+    /* Standard test for a zero byte anywhere in a word */
+    return ( ( ( w[0] - _allOnes ) & ~w[0] ) | ( ( w[1] - _allOnes ) & ~w[1] ) ) & ( _allOnes << 7 );
+}
+// ====================================================================================================
+static uint32_t _huntSync( struct TPIUDecoder *t, const uint8_t *buffer, uint32_t len )
+
+/* While unsynced nothing matters until a sync, so skip straight to the next byte that could end one. */
+/* The sync monitor is left as if everything skipped had been pumped. Returns the number skipped.    */
+
+{
+    const uint8_t *c = ( const uint8_t * )memchr( buffer, SYNCPATTERN & 0xff, len );
+    uint32_t n = c ? c - buffer : len;
+
+    for ( uint32_t i = ( n > 4 ) ? n - 4 : 0; i < n; i++ )
+    {
+        t->syncMonitor = ( t->syncMonitor << 8 ) | buffer[i];
+    }
+
+    return n;
+}
+// ====================================================================================================
+uint32_t TPIUDecodeBlock( struct TPIUDecoder *t, const uint8_t *buffer, uint32_t len, struct TPIUSpan *stream[TPIU_NUM_STREAMS] )
+
+/* Decode a whole block of input, with demuxed data put into the spans for each stream (NULL for unwanted streams). */
+/* Once synced, complete frames are processed directly from the input, with the per-byte state machine only used  */
+/* around syncs, halfsyncs and at block boundaries. Unsynced, it hunts for a sync with memchr rather than pumping */
+/* through every byte. Returns the number of frames decoded.                                                     */
+
+{
+    struct timeval nowTime, diffTime;
+    uint32_t frames = 0;
+
+    gettimeofday( &nowTime, NULL );
+
+    while ( len )
+    {
+        if ( ( t->state == TPIU_RXING ) && ( !t->byteCount ) && ( !t->got_lowbits ) &&
+                ( len >= TPIU_PACKET_LEN ) && ( !_frameHasSyncByte( buffer ) ) )
+        {
+            /* Same check as TPIUPump for a sensible interval since the last packet */
+            timersub( &nowTime, &t->lastPacket, &diffTime );
+
+            if ( diffTime.tv_sec >= TIMEOUT )
+            {
+                genericsReport( V_WARN, ">>>>>>>>> PACKET INTERVAL TOO LONG <<<<<<<<<<<<<<" EOL );
+                t->state = TPIU_UNSYNCED;
+                t->stats.lostSync++;
+                continue;
+            }
+
+            t->lastPacket = nowTime;
+            t->syncMonitor = ( buffer[12] << 24 ) | ( buffer[13] << 16 ) | ( buffer[14] << 8 ) | buffer[15];
+            t->stats.packets++;
+            _unpackFrame( t, buffer, stream );
+            buffer += TPIU_PACKET_LEN;
+            len -= TPIU_PACKET_LEN;
+            frames++;
+            continue;
+        }
+
+        if ( t->state == TPIU_UNSYNCED )
+        {
+            uint32_t skipped = _huntSync( t, buffer, len );
+
+            if ( !( len -= skipped ) )
+            {
+                break;
+            }
+
+            buffer += skipped;
+        }
+
+        /* Not a clean frame, so do it the byte at a time way */
+        if ( TPIU_EV_RXEDPACKET == TPIUPump( t, *buffer++ ) )
+        {
+            _unpackFrame( t, t->rxedPacket, stream );
+            frames++;
+        }
+
+        len--;
+    }
+
+    return frames;
+}
+// ====================================================================================================
@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Trace Trigger
+ * =============
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "traceTrigger.h"
+#include "msgDecoder.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _parseRange( const char *s, uint32_t *lo, uint32_t *hi )
+
+/* Get a number, or a range of them as lo-hi */
+
+{
+    char *e;
+
+    *lo = *hi = strtoul( s, &e, 0 );
+
+    if ( ( e == s ) || ( ( *e ) && ( *e != '-' ) ) )
+    {
+        return false;
+    }
+
+    if ( *e == '-' )
+    {
+        s = e + 1;
+        *hi = strtoul( s, &e, 0 );
+
+        if ( ( e == s ) || ( *e ) || ( *hi < *lo ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _fire( struct traceTrigger *t, uint32_t c, uint32_t value )
+
+{
+    t->fired = true;
+    t->firedCond = c;
+    t->firedValue = value;
+}
+// ====================================================================================================
+static void _etmCB( void *d )
+
+/* Decoder callback for the ETM stream. Only the packets matter, so nothing is followed up */
+
+{
+    struct traceTrigger *t = ( struct traceTrigger * )d;
+    struct ETMCPUState *cpu = ETMCPUState( &t->e );
+
+    for ( uint32_t c = 0; ( c < t->numConds ) && ( !t->fired ); c++ )
+    {
+        struct traceTriggerCond *k = &t->cond[c];
+
+        switch ( k->type )
+        {
+            case TT_ETM_TRIGGER:
+                if ( cpu->changeRecord & ( 1 << EV_CH_TRIGGER ) )
+                {
+                    _fire( t, c, cpu->addr );
+                }
+
+                break;
+
+            case TT_EXCEPTION:
+                if ( ( cpu->changeRecord & ( 1 << EV_CH_EX_ENTRY ) ) && ( cpu->exception >= k->lo ) && ( cpu->exception <= k->hi ) )
+                {
+                    _fire( t, c, cpu->exception );
+                }
+
+                break;
+
+            case TT_ADDRESS:
+                if ( ( cpu->changeRecord & ( 1 << EV_CH_ADDRESS ) ) && ( cpu->addr >= k->lo ) && ( cpu->addr <= k->hi ) )
+                {
+                    _fire( t, c, cpu->addr );
+                }
+
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    /* Nobody else looks at this decoder, so everything it reports is done with */
+    cpu->changeRecord = 0;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void TraceTriggerInit( struct traceTrigger *t, bool usingAltAddrEncode )
+
+/* Set up a trigger with no conditions. It doesn't watch for anything until some are added */
+
+{
+    memset( t, 0, sizeof( struct traceTrigger ) );
+    ETMDecoderInit( &t->e, usingAltAddrEncode );
+    ETMDecoderBatchAtoms( &t->e, true );
+    ITMDecoderInit( &t->i, true );
+}
+// ====================================================================================================
+bool TraceTriggerAdd( struct traceTrigger *t, const char *spec )
+
+/* Add a condition, in the form described in traceTrigger.h. Returns false if it can't be understood */
+
+{
+    struct traceTriggerCond k = { 0 };
+    const char *v;
+    char *e;
+
+    if ( t->numConds == TRACETRIGGER_MAX_CONDS )
+    {
+        return false;
+    }
+
+    if ( !strcmp( spec, "trigger" ) )
+    {
+        k.type = TT_ETM_TRIGGER;
+    }
+    else if ( !strncmp( spec, "ex:", 3 ) )
+    {
+        k.type = TT_EXCEPTION;
+
+        if ( !_parseRange( spec + 3, &k.lo, &k.hi ) )
+        {
+            return false;
+        }
+    }
+    else if ( !strncmp( spec, "addr:", 5 ) )
+    {
+        k.type = TT_ADDRESS;
+
+        if ( !_parseRange( spec + 5, &k.lo, &k.hi ) )
+        {
+            return false;
+        }
+    }
+    else if ( !strncmp( spec, "itm:", 4 ) )
+    {
+        k.type = TT_ITM;
+        v = spec + 4;
+        k.lo = strtoul( v, &e, 0 );
+        k.anyValue = ( *e != '=' );
+
+        if ( ( e == v ) || ( k.lo > 31 ) || ( ( *e ) && ( *e != '=' ) ) )
+        {
+            return false;
+        }
+
+        if ( !k.anyValue )
+        {
+            v = e + 1;
+            k.hi = strtoul( v, &e, 0 );
+
+            if ( ( e == v ) || ( *e ) )
+            {
+                return false;
+            }
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    t->wantsITM |= ( k.type == TT_ITM );
+    t->wantsETM |= ( k.type != TT_ITM );
+    t->cond[t->numConds++] = k;
+    return true;
+}
+// ====================================================================================================
+void TraceTriggerArm( struct traceTrigger *t )
+
+/* Get ready to fire again. Whatever came before has gone by, so the ETM watcher waits for a fresh sync */
+
+{
+    t->fired = false;
+    ETMDecoderForceSync( &t->e, false );
+    ITMDecoderForceSync( &t->i, true );
+}
+// ====================================================================================================
+int64_t TraceTriggerETM( struct traceTrigger *t, const uint8_t *buffer, uint32_t len )
+
+/* Watch a block of the ETM stream. Returns -1 if it didn't fire the trigger, otherwise how many */
+/* bytes of it there are up to and including the last byte of the packet that did.              */
+
+{
+    struct ETMDecoder before;
+    uint32_t ofs;
+
+    if ( ( !t->wantsETM ) || ( t->fired ) )
+    {
+        return -1;
+    }
+
+    before = t->e;
+    ETMDecoderPump( &t->e, buffer, len, _etmCB, NULL, t );
+
+    if ( !t->fired )
+    {
+        return -1;
+    }
+
+    /* Triggers are rare, so it's cheap to go back over this block a byte at a time to find exactly where */
+    t->e = before;
+    t->fired = false;
+
+    for ( ofs = 0; ( ofs < len ) && ( !t->fired ); ofs++ )
+    {
+        ETMDecoderPump( &t->e, &buffer[ofs], 1, _etmCB, NULL, t );
+    }
+
+    return ofs;
+}
+// ====================================================================================================
+bool TraceTriggerITM( struct traceTrigger *t, const uint8_t *buffer, uint32_t len )
+
+/* Watch a block of the ITM stream. Returns true if it fired the trigger */
+
+{
+    struct msg m[ITM_DECODE_BATCH];
+    uint32_t used, n;
+
+    if ( ( !t->wantsITM ) || ( t->fired ) )
+    {
+        return false;
+    }
+
+    while ( ( len ) && ( !t->fired ) )
+    {
+        n = ITMDecodeBuffer( &t->i, buffer, len, m, ITM_DECODE_BATCH, &used );
+        buffer += used;
+        len -= used;
+
+        for ( uint32_t g = 0; ( g < n ) && ( !t->fired ); g++ )
+        {
+            if ( m[g].genericMsg.msgtype != MSG_SOFTWARE )
+            {
+                continue;
+            }
+
+            for ( uint32_t c = 0; ( c < t->numConds ) && ( !t->fired ); c++ )
+            {
+                struct traceTriggerCond *k = &t->cond[c];
+
+                if ( ( k->type == TT_ITM ) && ( m[g].swMsg.srcAddr == k->lo ) && ( ( k->anyValue ) || ( m[g].swMsg.value == k->hi ) ) )
+                {
+                    _fire( t, c, m[g].swMsg.value );
+                }
+            }
+        }
+    }
+
+    return t->fired;
+}
+// ====================================================================================================
+const char *TraceTriggerDescribe( struct traceTrigger *t, char *buffer, size_t len )
+
+/* Say what fired the trigger, for the user */
+
+{
+    if ( !t->fired )
+    {
+        snprintf( buffer, len, "Not triggered" );
+        return buffer;
+    }
+
+    switch ( t->cond[t->firedCond].type )
+    {
+        case TT_ETM_TRIGGER:
+            snprintf( buffer, len, "Triggered by ETM trigger" );
+            break;
+
+        case TT_EXCEPTION:
+            snprintf( buffer, len, "Triggered by exception %u", t->firedValue );
+            break;
+
+        case TT_ADDRESS:
+            snprintf( buffer, len, "Triggered by branch to 0x%08x", t->firedValue );
+            break;
+
+        case TT_ITM:
+            snprintf( buffer, len, "Triggered by ITM channel %u value 0x%08x", t->cond[t->firedCond].lo, t->firedValue );
+            break;
+    }
+
+    return buffer;
+}
+// ====================================================================================================